@@ -0,0 +1,56 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "AllocationCounter.h"
+
+namespace
+{
+    std::atomic<uint64_t> allocations{ 0 };
+    std::atomic<uint64_t> allocatedBytes{ 0 };
+}
+
+uint64_t AllocationCounter::Allocations()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+uint64_t AllocationCounter::AllocatedBytes()
+{
+    return allocatedBytes.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t Size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(Size, std::memory_order_relaxed);
+    if (void* memory = std::malloc(Size ? Size : 1))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t Size)
+{
+    return ::operator new(Size);
+}
+
+void operator delete(void* Memory) noexcept
+{
+    std::free(Memory);
+}
+
+void operator delete[](void* Memory) noexcept
+{
+    std::free(Memory);
+}
+
+void operator delete(void* Memory, size_t) noexcept
+{
+    std::free(Memory);
+}
+
+void operator delete[](void* Memory, size_t) noexcept
+{
+    std::free(Memory);
+}
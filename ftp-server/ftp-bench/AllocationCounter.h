@@ -0,0 +1,14 @@
+#pragma once
+#include <cstdint>
+
+// Counts calls into the global allocator of this binary, so benchmarks can report
+// how many heap allocations a code path makes per iteration, and how much they
+// asked for.
+class AllocationCounter
+{
+public:
+    static uint64_t Allocations();
+
+    // Bytes asked for by those calls, not counting the allocator's own overhead.
+    static uint64_t AllocatedBytes();
+};
@@ -0,0 +1,91 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// A small Google Benchmark-style harness: benchmarks are free functions taking a
+// BenchmarkState and looping with `for (auto _ : State)`. The runner grows the
+// iteration count until a run lasts long enough to be stable.
+class BenchmarkState
+{
+public:
+    explicit BenchmarkState(uint64_t Iterations) : iterations(Iterations) {}
+
+    struct [[maybe_unused]] ITERATION
+    {
+    };
+
+    class Iterator
+    {
+    public:
+        explicit Iterator(uint64_t Remaining) : remaining(Remaining) {}
+        bool operator!=(const Iterator&) const { return this->remaining != 0; }
+        void operator++() { --this->remaining; }
+        ITERATION operator*() const { return {}; }
+
+    private:
+        uint64_t remaining;
+    };
+
+    Iterator begin()
+    {
+        this->start = std::chrono::steady_clock::now();
+        return Iterator(this->iterations);
+    }
+
+    Iterator end()
+    {
+        return Iterator(0);
+    }
+
+    uint64_t Iterations() const
+    {
+        return this->iterations;
+    }
+
+    void SetBytesProcessed(uint64_t Bytes)
+    {
+        this->bytesProcessed = Bytes;
+    }
+
+    std::map<std::string, double> Counters;
+
+private:
+    friend class BenchmarkRegistry;
+
+    uint64_t iterations;
+    uint64_t bytesProcessed = 0;
+    std::chrono::steady_clock::time_point start;
+};
+
+template <typename T>
+inline void DoNotOptimize(const T& Value)
+{
+#if defined(_MSC_VER)
+    const volatile char sink = *reinterpret_cast<const volatile char*>(&Value);
+    (void)sink;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "r,m"(Value) : "memory");
+#endif
+}
+
+class BenchmarkRegistry
+{
+public:
+    typedef void (*BENCHMARK_ROUTINE)(BenchmarkState& State);
+
+    static int Register(const char* Name, BENCHMARK_ROUTINE Routine);
+
+    // Runs every benchmark whose name contains Filter; returns the number that ran.
+    static int RunAll(const std::string& Filter, double MinSeconds);
+};
+
+#define BENCHMARK(Routine) \
+    static const int Routine##_registration = BenchmarkRegistry::Register(#Routine, Routine)
@@ -0,0 +1,105 @@
+#include <string>
+#include <string_view>
+#include "AllocationCounter.h"
+#include "Benchmark.h"
+#include "CommandTable.h"
+
+namespace
+{
+    constexpr std::string_view Verbs[] = { "USER", "pass", "PASV", "list", "RETR", "stor", "TYPE", "NOOP" };
+
+    constexpr std::string_view Lines[] = { "USER anonymous", "PASS secret", "TYPE I", "PASV", "RETR some-file-name.bin", "LIST -a" };
+
+    constexpr VERB_ENTRY<int> Entries[] =
+    {
+        { "USER", 1 }, { "PASS", 2 }, { "OPTS", 3 }, { "QUIT", 4 }, { "PASV", 5 }, { "PORT", 6 },
+        { "TYPE", 7 }, { "LIST", 8 }, { "NLST", 9 }, { "RETR", 10 }, { "STOR", 11 },
+    };
+    constexpr CommandTable Table(Entries);
+    static_assert(Table.IsValid(), "no perfect hash found for the benchmark table");
+
+    // The dispatch the server used before the perfect-hash table, kept as a baseline.
+    int CompareChain(const std::string& Command)
+    {
+        if (!Command.compare("USER")) return 1;
+        else if (!Command.compare("PASS")) return 2;
+        else if (!Command.compare("OPTS")) return 3;
+        else if (!Command.compare("PASV")) return 5;
+        else if (!Command.compare("QUIT")) return 4;
+        else if (!Command.compare("LIST")) return 8;
+        else if (!Command.compare("PORT")) return 6;
+        else if (!Command.compare("RETR")) return 10;
+        else if (!Command.compare("TYPE")) return 7;
+        else if (!Command.compare("STOR")) return 11;
+        else if (!Command.compare("NLST")) return 9;
+        return 0;
+    }
+
+    void BM_DispatchCompareChain(BenchmarkState& State)
+    {
+        std::string verbs[std::size(Verbs)];
+        for (size_t i = 0; i < std::size(Verbs); ++i)
+        {
+            verbs[i] = Verbs[i];
+        }
+
+        size_t i = 0;
+        for (auto _ : State)
+        {
+            DoNotOptimize(CompareChain(verbs[i++ % std::size(verbs)]));
+        }
+    }
+    BENCHMARK(BM_DispatchCompareChain);
+
+    void BM_DispatchPerfectHash(BenchmarkState& State)
+    {
+        size_t i = 0;
+        for (auto _ : State)
+        {
+            DoNotOptimize(Table.Find(Verbs[i++ % std::size(Verbs)]));
+        }
+    }
+    BENCHMARK(BM_DispatchPerfectHash);
+
+    // The old ProcessCommand: copy the received bytes, then substr out the line, verb and argument.
+    void BM_ParseSubstr(BenchmarkState& State)
+    {
+        std::string received[std::size(Lines)];
+        for (size_t i = 0; i < std::size(Lines); ++i)
+        {
+            received[i] = std::string(Lines[i]) + "\r\n";
+        }
+
+        size_t i = 0;
+        uint64_t allocations = AllocationCounter::Allocations();
+        for (auto _ : State)
+        {
+            const std::string& line = received[i++ % std::size(received)];
+            std::string command(line.data(), line.size());
+            const std::string& processedCommand = command.substr(0, command.size() - 2);
+            size_t separatorPosition = processedCommand.find_first_of(" ");
+            const std::string& verb = processedCommand.substr(0, separatorPosition);
+            const std::string& argument = processedCommand.substr((separatorPosition != std::string::npos ? separatorPosition + 1 : processedCommand.size()));
+            DoNotOptimize(CompareChain(verb));
+            DoNotOptimize(argument.data());
+        }
+        State.Counters["allocs_per_command"] = static_cast<double>(AllocationCounter::Allocations() - allocations) / static_cast<double>(State.Iterations());
+    }
+    BENCHMARK(BM_ParseSubstr);
+
+    // That this and the rest of ProcessCommand make no allocations is asserted by
+    // ftp-test's Allocation suite, against a real session.
+    void BM_ParseStringView(BenchmarkState& State)
+    {
+        size_t i = 0;
+        for (auto _ : State)
+        {
+            std::string_view verb;
+            std::string_view argument;
+            SplitCommand(Lines[i++ % std::size(Lines)], verb, argument);
+            DoNotOptimize(Table.Find(verb));
+            DoNotOptimize(argument.data());
+        }
+    }
+    BENCHMARK(BM_ParseStringView);
+}
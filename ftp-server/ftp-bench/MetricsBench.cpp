@@ -0,0 +1,49 @@
+#include <memory>
+#include <mutex>
+#include "Benchmark.h"
+#include "Metrics.h"
+
+namespace
+{
+    // Baseline: one histogram shared by every thread behind a mutex.
+    void BM_MetricsRecordLocked(BenchmarkState& State)
+    {
+        static std::mutex lock;
+        static HISTOGRAM_SNAPSHOT shared;
+
+        uint64_t value = 1;
+        for (auto _ : State)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            ++shared.Counts[HistogramBucket(value)];
+            ++shared.Count;
+            shared.Sum += value;
+            value = value * 3 % 100003;
+        }
+        DoNotOptimize(shared.Count);
+    }
+    BENCHMARK(BM_MetricsRecordLocked);
+
+    void BM_MetricsRecordCommand(BenchmarkState& State)
+    {
+        uint64_t value = 1;
+        for (auto _ : State)
+        {
+            Metrics::RecordCommand(COMMAND_ID::Retr, value);
+            value = value * 3 % 100003;
+        }
+    }
+    BENCHMARK(BM_MetricsRecordCommand);
+
+    void BM_MetricsSnapshot(BenchmarkState& State)
+    {
+        std::unique_ptr<METRICS_SNAPSHOT> snapshot = std::make_unique<METRICS_SNAPSHOT>();
+        for (auto _ : State)
+        {
+            *snapshot = {};
+            Metrics::Snapshot(*snapshot);
+            DoNotOptimize(snapshot->BytesOut);
+        }
+    }
+    BENCHMARK(BM_MetricsSnapshot);
+}
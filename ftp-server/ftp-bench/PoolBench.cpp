@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "AllocationCounter.h"
+#include "Benchmark.h"
+#include "BS_thread_pool_light.hpp"
+#include "Metrics.h"
+#include "WorkStealingPool.h"
+
+// Enqueue-to-start latency of BS::thread_pool_light (one queue, one mutex) against
+// WorkStealingPool. Dispatch is the accept loop's pattern: one thread pushes every
+// task. FanOut adds what transfers would do: each task pushes follow-up tasks from
+// inside the pool. Tasks spin for a few hundred nanoseconds so the queue, not the
+// work, dominates, and the producer keeps at most InFlightPerThread tasks per
+// worker outstanding so the waits measure scheduling rather than a growing backlog.
+// The pools get max(32, cores) workers, or FTP_BENCH_POOL_THREADS.
+namespace
+{
+    constexpr uint32_t FanOutChildren = 4;
+    constexpr uint32_t InFlightPerThread = 4;
+
+    BS::concurrency_t PoolThreads()
+    {
+        if (const char* threads = std::getenv("FTP_BENCH_POOL_THREADS"))
+        {
+            return std::max(1U, static_cast<BS::concurrency_t>(std::strtoul(threads, nullptr, 10)));
+        }
+        return std::max(32U, std::thread::hardware_concurrency());
+    }
+
+    void Spin()
+    {
+        uint64_t value = 0x9E3779B97F4A7C15ULL;
+        for (int i = 0; i < 256; ++i)
+        {
+            value ^= value << 13;
+            value ^= value >> 7;
+            value ^= value << 17;
+        }
+        DoNotOptimize(value);
+    }
+
+    uint64_t Nanoseconds(std::chrono::steady_clock::time_point From)
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - From).count());
+    }
+
+    void ReportWaits(BenchmarkState& State, const std::vector<uint64_t>& Waits, BS::concurrency_t Threads)
+    {
+        HISTOGRAM_SNAPSHOT waits;
+        for (uint64_t wait : Waits)
+        {
+            waits.Record(wait);
+        }
+        State.Counters["threads"] = Threads;
+        State.Counters["wait_p50_us"] = static_cast<double>(waits.Percentile(0.5)) / 1000.0;
+        State.Counters["wait_p99_us"] = static_cast<double>(waits.Percentile(0.99)) / 1000.0;
+        State.Counters["wait_p999_us"] = static_cast<double>(waits.Percentile(0.999)) / 1000.0;
+    }
+
+    void Throttle(std::atomic<uint32_t>& InFlight, uint32_t Limit, uint32_t Adding)
+    {
+        while (InFlight.load(std::memory_order_acquire) + Adding > Limit)
+        {
+            std::this_thread::yield();
+        }
+        InFlight.fetch_add(Adding, std::memory_order_relaxed);
+    }
+
+    template <typename Pool>
+    void Dispatch(BenchmarkState& State, Pool& pool)
+    {
+        std::vector<uint64_t> waits(State.Iterations());
+        std::atomic<uint32_t> inFlight{ 0 };
+        uint32_t limit = pool.get_thread_count() * InFlightPerThread;
+        uint64_t index = 0;
+        for (auto _ : State)
+        {
+            Throttle(inFlight, limit, 1);
+            pool.push_task([&waits, &inFlight, index, queued = std::chrono::steady_clock::now()]
+                {
+                    waits[index] = Nanoseconds(queued);
+                    Spin();
+                    inFlight.fetch_sub(1, std::memory_order_release);
+                });
+            ++index;
+        }
+        pool.wait_for_tasks();
+        ReportWaits(State, waits, pool.get_thread_count());
+    }
+
+    template <typename Pool>
+    void FanOut(BenchmarkState& State, Pool& pool)
+    {
+        std::vector<uint64_t> waits(State.Iterations() * (FanOutChildren + 1));
+        std::atomic<uint32_t> inFlight{ 0 };
+        uint32_t limit = pool.get_thread_count() * InFlightPerThread;
+        uint64_t index = 0;
+        for (auto _ : State)
+        {
+            Throttle(inFlight, limit, FanOutChildren + 1);
+            pool.push_task([&pool, &waits, &inFlight, index, queued = std::chrono::steady_clock::now()]
+                {
+                    waits[index] = Nanoseconds(queued);
+                    for (uint32_t child = 1; child <= FanOutChildren; ++child)
+                    {
+                        pool.push_task([&waits, &inFlight, slot = index + child, queued = std::chrono::steady_clock::now()]
+                            {
+                                waits[slot] = Nanoseconds(queued);
+                                Spin();
+                                inFlight.fetch_sub(1, std::memory_order_release);
+                            });
+                    }
+                    Spin();
+                    inFlight.fetch_sub(1, std::memory_order_release);
+                });
+            index += FanOutChildren + 1;
+        }
+        pool.wait_for_tasks();
+        ReportWaits(State, waits, pool.get_thread_count());
+    }
+
+    // A session handed to its pool the way the server does it: one captured pointer,
+    // wrapped with its queue time as InstrumentedPool does. allocs_per_task is what a
+    // push costs the global allocator, including the queue's own growth.
+    template <typename Pool>
+    void SessionTasks(BenchmarkState& State, Pool& pool)
+    {
+        std::atomic<uint32_t> inFlight{ 0 };
+        uint32_t limit = pool.get_thread_count() * InFlightPerThread;
+        uint64_t allocations = AllocationCounter::Allocations();
+        for (auto _ : State)
+        {
+            Throttle(inFlight, limit, 1);
+            auto task = [counter = &inFlight] { counter->fetch_sub(1, std::memory_order_release); };
+            pool.push_task([task, queued = std::chrono::steady_clock::now()]() mutable
+                {
+                    DoNotOptimize(queued);
+                    task();
+                });
+        }
+        pool.wait_for_tasks();
+        State.Counters["allocs_per_task"] = static_cast<double>(AllocationCounter::Allocations() - allocations) / static_cast<double>(State.Iterations());
+    }
+
+    BS::thread_pool_light& SharedQueuePool()
+    {
+        static BS::thread_pool_light pool(PoolThreads());
+        return pool;
+    }
+
+    WorkStealingPool& StealingPool()
+    {
+        static WorkStealingPool pool(PoolThreads());
+        return pool;
+    }
+
+    void BM_PoolDispatchSharedQueue(BenchmarkState& State)
+    {
+        Dispatch(State, SharedQueuePool());
+    }
+    BENCHMARK(BM_PoolDispatchSharedQueue);
+
+    void BM_PoolDispatchWorkStealing(BenchmarkState& State)
+    {
+        Dispatch(State, StealingPool());
+    }
+    BENCHMARK(BM_PoolDispatchWorkStealing);
+
+    void BM_PoolSessionTaskSharedQueue(BenchmarkState& State)
+    {
+        SessionTasks(State, SharedQueuePool());
+    }
+    BENCHMARK(BM_PoolSessionTaskSharedQueue);
+
+    void BM_PoolSessionTaskWorkStealing(BenchmarkState& State)
+    {
+        SessionTasks(State, StealingPool());
+    }
+    BENCHMARK(BM_PoolSessionTaskWorkStealing);
+
+    void BM_PoolFanOutSharedQueue(BenchmarkState& State)
+    {
+        FanOut(State, SharedQueuePool());
+    }
+    BENCHMARK(BM_PoolFanOutSharedQueue);
+
+    void BM_PoolFanOutWorkStealing(BenchmarkState& State)
+    {
+        FanOut(State, StealingPool());
+    }
+    BENCHMARK(BM_PoolFanOutWorkStealing);
+}
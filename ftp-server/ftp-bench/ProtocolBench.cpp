@@ -0,0 +1,112 @@
+#include <string>
+#include <string_view>
+#include "AllocationCounter.h"
+#include "Benchmark.h"
+#include "CommandTable.h"
+#include "ListingFormat.h"
+#include "Protocol.h"
+#include "Replies.h"
+#include "Utils.hpp"
+
+namespace
+{
+    constexpr std::string_view HostPorts[] = { "127,0,0,1,195,80", "10,20,30,40,4,0", "192,168,100,200,255,255", "1,2,3,4,5,6" };
+
+    constexpr std::string_view LongLines[] =
+    {
+        "RETR some/rather/deep/directory/structure/with/a-long-file-name-for-the-split.bin",
+        "STOR uploads/2024/archive-of-the-nightly-build-output-with-symbols.tar.gz",
+        "PORT 192,168,100,200,255,255",
+    };
+
+    // 2024-02-28 17:57:42.123 UTC, a day later, the Unix epoch and a 2022 time, as FILETIME ticks.
+    constexpr uint64_t FileTimes[] = { 133536166621230000ULL, 133536166621230000ULL + 864000000000ULL, 116444736000000000ULL, 133000000000000000ULL };
+
+    void BM_SplitLongCommand(BenchmarkState& State)
+    {
+        size_t i = 0;
+        for (auto _ : State)
+        {
+            std::string_view verb;
+            std::string_view argument;
+            SplitCommand(LongLines[i++ % std::size(LongLines)], verb, argument);
+            DoNotOptimize(verb.data());
+            DoNotOptimize(argument.size());
+        }
+    }
+    BENCHMARK(BM_SplitLongCommand);
+
+    void BM_ParseHostPort(BenchmarkState& State)
+    {
+        size_t i = 0;
+        uint8_t fields[6] = {};
+        for (auto _ : State)
+        {
+            DoNotOptimize(ParseHostPort(HostPorts[i++ % std::size(HostPorts)], fields));
+            DoNotOptimize(fields);
+        }
+    }
+    BENCHMARK(BM_ParseHostPort);
+
+    void BM_FormatPasvReply(BenchmarkState& State)
+    {
+        uint8_t fields[6] = { 192, 168, 100, 200, 0, 0 };
+        uint16_t port = 50000;
+        uint64_t allocations = AllocationCounter::Allocations();
+        for (auto _ : State)
+        {
+            fields[4] = static_cast<uint8_t>(port & 0xFF);
+            fields[5] = static_cast<uint8_t>(port >> 8);
+            ReplyBuilder<512> reply(227);
+            AppendHostPort(reply.Append("Entering Passive Mode ("), fields).Append(").");
+            DoNotOptimize(reply.Wire().size());
+            ++port;
+        }
+        State.Counters["allocs_per_reply"] = static_cast<double>(AllocationCounter::Allocations() - allocations) / static_cast<double>(State.Iterations());
+    }
+    BENCHMARK(BM_FormatPasvReply);
+
+    void BM_FiletimeToTimestamp(BenchmarkState& State)
+    {
+        size_t i = 0;
+        LISTING_TIME time;
+        for (auto _ : State)
+        {
+            FiletimeToTimestamp(FileTimes[i++ % std::size(FileTimes)], time);
+            DoNotOptimize(time);
+        }
+    }
+    BENCHMARK(BM_FiletimeToTimestamp);
+
+    void BM_FormatListingLine(BenchmarkState& State)
+    {
+        LISTING_ENTRY entry;
+        entry.Size = 1234567890ULL;
+        entry.Name = "a-reasonably-long-file-name-for-a-listing.bin";
+        FiletimeToTimestamp(FileTimes[0], entry.LastWriteTime);
+
+        for (auto _ : State)
+        {
+            LISTING_LINE line;
+            FormatListingLine(entry, line);
+            DoNotOptimize(line.View().size());
+        }
+        State.SetBytesProcessed(State.Iterations() * (entry.Name.size() + 60));
+    }
+    BENCHMARK(BM_FormatListingLine);
+
+    void BM_ClientParsePassiveResponse(BenchmarkState& State)
+    {
+        const std::string response = "227 Entering Passive Mode (192,168,100,200,195,80).\r\n";
+        std::string ip;
+        int port = 0;
+        uint64_t allocations = AllocationCounter::Allocations();
+        for (auto _ : State)
+        {
+            DoNotOptimize(Utils::parsePassiveResponse(response, ip, port));
+            DoNotOptimize(port);
+        }
+        State.Counters["allocs_per_reply"] = static_cast<double>(AllocationCounter::Allocations() - allocations) / static_cast<double>(State.Iterations());
+    }
+    BENCHMARK(BM_ClientParsePassiveResponse);
+}
@@ -0,0 +1,122 @@
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "AllocationCounter.h"
+#include "Benchmark.h"
+#include "FtpServer.h"
+
+// What an idle session costs. "Inline" is the layout sessions had before the slab:
+// receive buffer, output buffer, pending transfer and fixed-size name buffers all in
+// one heap block per session. "Slab" is the server's own: a slot holding the
+// context, interned names, and no workspace while the session is parked.
+// bytes_per_idle_session counts what was asked of the heap (allocator overhead not
+// included), divided by the number of sessions.
+namespace
+{
+    constexpr ULONG IdleSessions = 100000;
+
+    typedef struct _INLINE_SESSION
+    {
+        CLIENT_CONTEXT    Context;
+        SESSION_WORKSPACE Work;
+        CHAR              UserName[USERNAME_MAX_LENGTH];
+        CHAR              CurrentDir[MAX_PATH];
+        bool              Parked;
+    } INLINE_SESSION;
+
+    void BM_IdleSessionsInline100k(BenchmarkState& State)
+    {
+        uint64_t bytes = 0;
+        for (auto _ : State)
+        {
+            uint64_t before = AllocationCounter::AllocatedBytes();
+            std::vector<std::unique_ptr<INLINE_SESSION>> sessions;
+            sessions.reserve(IdleSessions);
+            for (ULONG i = 0; i < IdleSessions; ++i)
+            {
+                sessions.push_back(std::make_unique<INLINE_SESSION>());
+            }
+            bytes = AllocationCounter::AllocatedBytes() - before;
+            DoNotOptimize(sessions.data());
+        }
+        State.Counters["bytes_per_idle_session"] = static_cast<double>(bytes) / IdleSessions;
+    }
+    BENCHMARK(BM_IdleSessionsInline100k);
+
+    // Every session logs in as one of a handful of users under one root, so the
+    // names cost a table entry each rather than a buffer per session.
+    void BM_IdleSessionsSlab100k(BenchmarkState& State)
+    {
+        InternedString root = StringTable::Intern("/srv/ftp");
+        InternedString users[] = { StringTable::Intern("anonymous"), StringTable::Intern("alice"), StringTable::Intern("bob") };
+
+        uint64_t bytes = 0;
+        for (auto _ : State)
+        {
+            auto now = SessionSlab<CLIENT_CONTEXT>::Clock::now();
+            uint64_t before = AllocationCounter::AllocatedBytes();
+            SessionSlab<CLIENT_CONTEXT> slots(now);
+            for (ULONG i = 0; i < IdleSessions; ++i)
+            {
+                SESSION_HANDLE handle = INVALID_SESSION_HANDLE;
+                PCLIENT_CONTEXT session = slots.Allocate(static_cast<SOCKET>(i), now, handle);
+                session->Handle = handle;
+                session->CurrentDir = root;
+                session->UserName = users[i % 3];
+                slots.SetState(handle, SESSION_STATE::Parked, now);
+            }
+            bytes = AllocationCounter::AllocatedBytes() - before;
+            DoNotOptimize(slots.Count());
+        }
+        State.Counters["bytes_per_idle_session"] = static_cast<double>(bytes) / IdleSessions;
+        State.Counters["slot_bytes"] = static_cast<double>(SessionSlab<CLIENT_CONTEXT>::SlotBytes());
+        State.Counters["workspace_bytes"] = sizeof(SESSION_WORKSPACE);
+    }
+    BENCHMARK(BM_IdleSessionsSlab100k);
+
+    // A drain or census pass: find the parked sessions among 100k, one in a hundred
+    // of them busy. The inline layout has to touch every session's block.
+    void BM_ParkedScanInline100k(BenchmarkState& State)
+    {
+        std::vector<std::unique_ptr<INLINE_SESSION>> sessions;
+        for (ULONG i = 0; i < IdleSessions; ++i)
+        {
+            sessions.push_back(std::make_unique<INLINE_SESSION>());
+            sessions.back()->Context.Socket = static_cast<SOCKET>(i);
+            sessions.back()->Parked = (i % 100) != 0;
+        }
+        for (auto _ : State)
+        {
+            uint64_t parked = 0;
+            for (const auto& session : sessions)
+            {
+                parked += session->Parked ? 1 : 0;
+            }
+            DoNotOptimize(parked);
+        }
+    }
+    BENCHMARK(BM_ParkedScanInline100k);
+
+    void BM_ParkedScanSlab100k(BenchmarkState& State)
+    {
+        auto now = SessionSlab<CLIENT_CONTEXT>::Clock::now();
+        SessionSlab<CLIENT_CONTEXT> slots(now);
+        for (ULONG i = 0; i < IdleSessions; ++i)
+        {
+            SESSION_HANDLE handle = INVALID_SESSION_HANDLE;
+            slots.Allocate(static_cast<SOCKET>(i), now, handle);
+            if ((i % 100) != 0)
+            {
+                slots.SetState(handle, SESSION_STATE::Parked, now);
+            }
+        }
+        for (auto _ : State)
+        {
+            uint64_t parked = 0;
+            slots.ForEach(SESSION_STATE::Parked, now, [&](SESSION_HANDLE, CLIENT_CONTEXT&, SOCKET, uint32_t) { ++parked; });
+            DoNotOptimize(parked);
+        }
+    }
+    BENCHMARK(BM_ParkedScanSlab100k);
+}
@@ -0,0 +1,44 @@
+#include <chrono>
+#include <cstdint>
+#include "BandwidthShaper.h"
+#include "Benchmark.h"
+
+// What shaping costs a transfer. How exactly it holds its rates is asserted by
+// ftp-test's Shaper suite.
+namespace
+{
+    typedef BandwidthShaper::Clock Clock;
+
+    constexpr uint64_t GBps = 1000ULL * 1000ULL * 1000ULL;
+
+    // What a transfer loop pays per DEFAULT_BUFLEN chunk: Allow and Spend, with the
+    // buckets visited once a quantum. The limited case never runs out of credit.
+    void AllowChunks(BenchmarkState& State, const SHAPING_RATES& Rates)
+    {
+        BandwidthShaper shaper;
+        shaper.SetRates(Rates);
+        SHAPED_FLOW flow;
+        shaper.Attach(flow, "user");
+        Clock::time_point wakeAt;
+        size_t allowed = 0;
+        for (auto _ : State)
+        {
+            allowed = shaper.Allow(flow, 512, wakeAt);
+            BandwidthShaper::Spend(flow, allowed);
+        }
+        DoNotOptimize(allowed);
+        State.SetBytesProcessed(State.Iterations() * 512);
+    }
+
+    void BM_ShaperAllowUnlimited(BenchmarkState& State)
+    {
+        AllowChunks(State, {});
+    }
+    BENCHMARK(BM_ShaperAllowUnlimited);
+
+    void BM_ShaperAllowLimited(BenchmarkState& State)
+    {
+        AllowChunks(State, { .Global = 1000 * GBps, .User = 1000 * GBps, .Session = 1000 * GBps });
+    }
+    BENCHMARK(BM_ShaperAllowLimited);
+}
@@ -0,0 +1,101 @@
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include "Benchmark.h"
+#include "TimerWheel.h"
+
+// The session timers the way the server uses them: every parked session has an idle
+// timer (300 s here, spread so deadlines arrive evenly) and the poller runs the
+// wheel once per 100 ms tick. Time is simulated, so a run covers minutes of server
+// time. ftp-test's TimerWheel suite asserts the share of a core this takes.
+namespace
+{
+    constexpr auto Tick = std::chrono::milliseconds(100);
+    constexpr auto IdleTimeout = std::chrono::seconds(300);
+
+    typedef struct _ARMED_TIMERS
+    {
+        TimerWheel::Clock::time_point Origin;
+        TimerWheel                    Wheel;
+        std::unique_ptr<TIMER[]>      Timers;
+        uint64_t                      Count;
+        uint64_t                      Random = 0x9E3779B97F4A7C15ULL;
+
+        _ARMED_TIMERS(uint64_t Timers, TimerWheel::Clock::time_point Start)
+            : Origin(Start), Wheel(Tick, Start), Timers(std::make_unique<TIMER[]>(Timers)), Count(Timers)
+        {
+            auto spread = std::chrono::duration_cast<std::chrono::milliseconds>(IdleTimeout).count();
+            for (uint64_t i = 0; i < Timers; ++i)
+            {
+                this->Wheel.Schedule(this->Timers[i], Start + std::chrono::milliseconds(static_cast<int64_t>(i * spread / Timers) + 1));
+            }
+        }
+
+        TIMER& Any()
+        {
+            this->Random ^= this->Random << 13;
+            this->Random ^= this->Random >> 7;
+            this->Random ^= this->Random << 17;
+            return this->Timers[this->Random % this->Count];
+        }
+    } ARMED_TIMERS;
+
+    // One command on a parked session: its idle timer moves 300 s out.
+    void Rearm(BenchmarkState& State, uint64_t Timers)
+    {
+        auto now = TimerWheel::Clock::now();
+        ARMED_TIMERS armed(Timers, now);
+        for (auto _ : State)
+        {
+            armed.Wheel.Schedule(armed.Any(), now + IdleTimeout);
+        }
+        State.Counters["timers"] = static_cast<double>(armed.Wheel.Count());
+        State.Counters["bytes_per_timer"] = sizeof(TIMER);
+    }
+
+    // One poller wake-up: expire what is due, re-arm it (the idle session came back)
+    // and work out how long to sleep.
+    void Advance(BenchmarkState& State, uint64_t Timers)
+    {
+        auto start = TimerWheel::Clock::now();
+        ARMED_TIMERS armed(Timers, start);
+        auto now = start;
+        uint64_t fired = 0;
+        ULONG sleep = 0;
+
+        for (auto _ : State)
+        {
+            now += Tick;
+            fired += armed.Wheel.Expire(now, [&](TIMER& Timer) { armed.Wheel.Schedule(Timer, now + IdleTimeout); });
+            sleep = armed.Wheel.MillisecondsUntilNext(now);
+        }
+        DoNotOptimize(sleep);
+
+        State.Counters["timers"] = static_cast<double>(armed.Wheel.Count());
+        State.Counters["fired_per_tick"] = static_cast<double>(fired) / static_cast<double>(State.Iterations());
+    }
+
+    void BM_TimerWheelRearm100k(BenchmarkState& State)
+    {
+        Rearm(State, 100000);
+    }
+    BENCHMARK(BM_TimerWheelRearm100k);
+
+    void BM_TimerWheelRearm1M(BenchmarkState& State)
+    {
+        Rearm(State, 1000000);
+    }
+    BENCHMARK(BM_TimerWheelRearm1M);
+
+    void BM_TimerWheelTick100k(BenchmarkState& State)
+    {
+        Advance(State, 100000);
+    }
+    BENCHMARK(BM_TimerWheelTick100k);
+
+    void BM_TimerWheelTick1M(BenchmarkState& State)
+    {
+        Advance(State, 1000000);
+    }
+    BENCHMARK(BM_TimerWheelTick1M);
+}
@@ -0,0 +1,37 @@
+#include "Benchmark.h"
+#include "Tracing.h"
+
+namespace
+{
+    // The five marks one RETR makes; compare against the cost of the transfer itself
+    // (a loopback RETR of even a small file is tens of microseconds).
+    void TraceOneTransfer()
+    {
+        TransferTrace trace(COMMAND_ID::Retr);
+        trace.Mark(TRACE_PHASE::DataSocketReady);
+        trace.Mark(TRACE_PHASE::FirstByte);
+        trace.Mark(TRACE_PHASE::LastByte, 4096);
+        trace.Mark(TRACE_PHASE::ReplySent, 4096);
+    }
+
+    void BM_TraceTransferDisabled(BenchmarkState& State)
+    {
+        Tracer::Enable(false);
+        for (auto _ : State)
+        {
+            TraceOneTransfer();
+        }
+    }
+    BENCHMARK(BM_TraceTransferDisabled);
+
+    void BM_TraceTransferEnabled(BenchmarkState& State)
+    {
+        Tracer::Enable(true);
+        for (auto _ : State)
+        {
+            TraceOneTransfer();
+        }
+        Tracer::Enable(false);
+    }
+    BENCHMARK(BM_TraceTransferEnabled);
+}
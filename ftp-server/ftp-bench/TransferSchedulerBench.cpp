@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include "Benchmark.h"
+#include "TransferScheduler.h"
+
+// Small files behind large ones, with the transfer pool's eight workers sharing a
+// 100 MB/s pipe. Time is simulated in 1 ms steps: the pipe is split evenly among the
+// workers moving data, and a worker whose transfer finishes or uses up its turn
+// takes the next one in the same step, as a pool thread would. Sixteen 64 MB
+// downloads start at once and a 64 KB file arrives every 20 ms for the first 8 s.
+// Fifo is the server before the scheduler, with every transfer running to the end
+// once a worker has it; Fair is the server's deficit round-robin. latency_ms is from
+// a small file's arrival to its last byte; utilization_percent is the share of the
+// pipe used until the last transfer ends.
+namespace
+{
+    constexpr int64_t StepUs = 1000;
+    constexpr int64_t PipeBytesPerStep = 100LL * 1000LL * 1000LL * StepUs / 1000000LL;
+    constexpr size_t Workers = 8;
+
+    constexpr int64_t LargeBytes = 64LL * 1024LL * 1024LL;
+    constexpr size_t LargeCount = 16;
+    constexpr int64_t SmallBytes = 64LL * 1024LL;
+    constexpr int64_t SmallEveryUs = 20LL * 1000LL;
+    constexpr int64_t SmallUntilUs = 8LL * 1000LL * 1000LL;
+
+    typedef struct _SIMULATED_TRANSFER
+    {
+        std::string    User;
+        int64_t        Remaining = 0LL;
+        int64_t        ArrivedUs = 0LL;
+        int64_t        DoneUs = -1LL;
+        bool           Small = false;
+        SCHEDULED_FLOW Schedule;
+    } SIMULATED_TRANSFER;
+
+    typedef struct _SIMULATION
+    {
+        std::vector<SIMULATED_TRANSFER> Transfers;
+        int64_t                         EndUs = 0LL;
+        uint64_t                        Moved = 0ULL;
+    } SIMULATION;
+
+    // The waiting line either way round, so both runs share the rest of the model.
+    class Line
+    {
+    public:
+        Line(bool Fair, std::vector<SIMULATED_TRANSFER>& Transfers) : fair(Fair), transfers(Transfers)
+        {
+        }
+
+        TransferScheduler<size_t>& Scheduler()
+        {
+            return this->scheduler;
+        }
+
+        void Push(size_t Transfer, bool Returning)
+        {
+            if (this->fair)
+            {
+                this->scheduler.Push(Transfer, this->transfers[Transfer].Schedule, this->transfers[Transfer].User, Returning);
+            }
+            else
+            {
+                this->fifo.push_back(Transfer);
+            }
+        }
+
+        bool Pop(size_t& Transfer)
+        {
+            if (this->fair)
+            {
+                return this->scheduler.Pop(Transfer);
+            }
+            if (this->fifo.empty())
+            {
+                return false;
+            }
+            Transfer = this->fifo.front();
+            this->fifo.pop_front();
+            return true;
+        }
+
+    private:
+        bool                             fair;
+        std::vector<SIMULATED_TRANSFER>& transfers;
+        std::deque<size_t>               fifo;
+        TransferScheduler<size_t>        scheduler;
+    };
+
+    // Runs the transfers, in order of arrival, until all are done or StopUs.
+    VOID Simulate(SIMULATION& Simulation, bool Fair, const std::vector<std::pair<std::string, ULONG>>& Weights, int64_t StopUs)
+    {
+        std::vector<SIMULATED_TRANSFER>& transfers = Simulation.Transfers;
+        Line line(Fair, transfers);
+        for (const auto& [user, weight] : Weights)
+        {
+            line.Scheduler().SetWeight(user, weight);
+        }
+
+        constexpr size_t Idle = static_cast<size_t>(-1);
+        std::vector<size_t> workers(Workers, Idle);
+        size_t arrived = 0;
+        size_t done = 0;
+        int64_t now = 0;
+        for (; done < transfers.size() && now < StopUs; now += StepUs)
+        {
+            for (; arrived < transfers.size() && transfers[arrived].ArrivedUs <= now; ++arrived)
+            {
+                line.Push(arrived, false);
+            }
+            size_t running = 0;
+            for (size_t& worker : workers)
+            {
+                if (worker == Idle && !line.Pop(worker))
+                {
+                    worker = Idle;
+                }
+                running += worker != Idle;
+            }
+            if (!running)
+            {
+                continue;
+            }
+
+            int64_t share = PipeBytesPerStep / static_cast<int64_t>(running);
+            for (size_t& worker : workers)
+            {
+                int64_t budget = worker == Idle ? 0 : share;
+                while (budget > 0 && worker != Idle)
+                {
+                    SIMULATED_TRANSFER& transfer = transfers[worker];
+                    int64_t moved = std::min(budget, transfer.Remaining);
+                    if (Fair)
+                    {
+                        moved = std::min(moved, transfer.Schedule.Deficit);
+                    }
+                    transfer.Remaining -= moved;
+                    transfer.Schedule.Deficit -= moved;
+                    budget -= moved;
+                    Simulation.Moved += static_cast<uint64_t>(moved);
+
+                    if (!transfer.Remaining)
+                    {
+                        transfer.DoneUs = now + StepUs;
+                        transfer.Schedule = SCHEDULED_FLOW();
+                        ++done;
+                    }
+                    else if (Fair && transfer.Schedule.Deficit <= 0)
+                    {
+                        line.Push(worker, true);
+                    }
+                    else
+                    {
+                        continue;
+                    }
+                    if (!line.Pop(worker))
+                    {
+                        worker = Idle;
+                    }
+                }
+            }
+        }
+        Simulation.EndUs = now;
+    }
+
+    SIMULATION MixedWorkload()
+    {
+        SIMULATION simulation;
+        for (size_t i = 0; i < LargeCount; ++i)
+        {
+            simulation.Transfers.push_back({ .User = "bulk", .Remaining = LargeBytes });
+        }
+        for (int64_t at = SmallEveryUs; at < SmallUntilUs; at += SmallEveryUs)
+        {
+            simulation.Transfers.push_back({ .User = "small", .Remaining = SmallBytes, .ArrivedUs = at, .Small = true });
+        }
+        return simulation;
+    }
+
+    double Percentile(std::vector<int64_t>& Values, double Fraction)
+    {
+        std::sort(Values.begin(), Values.end());
+        size_t rank = static_cast<size_t>(Fraction * static_cast<double>(Values.size() - 1));
+        return static_cast<double>(Values[rank]);
+    }
+
+    void Mixed(BenchmarkState& State, bool Fair)
+    {
+        SIMULATION simulation;
+        for (auto _ : State)
+        {
+            simulation = MixedWorkload();
+            Simulate(simulation, Fair, {}, INT64_MAX);
+            DoNotOptimize(simulation.Moved);
+        }
+
+        std::vector<int64_t> small;
+        double largeSeconds = 0.0;
+        for (const SIMULATED_TRANSFER& transfer : simulation.Transfers)
+        {
+            if (transfer.Small)
+            {
+                small.push_back(transfer.DoneUs - transfer.ArrivedUs);
+            }
+            else
+            {
+                largeSeconds += static_cast<double>(transfer.DoneUs) / 1e6 / LargeCount;
+            }
+        }
+        State.Counters["small_latency_p50_ms"] = Percentile(small, 0.50) / 1000.0;
+        State.Counters["small_latency_p99_ms"] = Percentile(small, 0.99) / 1000.0;
+        State.Counters["large_mean_s"] = largeSeconds;
+        State.Counters["utilization_percent"] = static_cast<double>(simulation.Moved) / static_cast<double>(PipeBytesPerStep * (simulation.EndUs / StepUs)) * 100.0;
+    }
+
+    void BM_SchedulerMixedFifo(BenchmarkState& State)
+    {
+        Mixed(State, false);
+    }
+    BENCHMARK(BM_SchedulerMixedFifo);
+
+    void BM_SchedulerMixedFair(BenchmarkState& State)
+    {
+        Mixed(State, true);
+    }
+    BENCHMARK(BM_SchedulerMixedFair);
+
+    // Two users with eight large downloads each, one at weight 3: over the first 2 s,
+    // while both have transfers waiting, byte_ratio should be 3.
+    void BM_SchedulerWeights(BenchmarkState& State)
+    {
+        SIMULATION simulation;
+        for (auto _ : State)
+        {
+            simulation = SIMULATION();
+            for (size_t i = 0; i < 16; ++i)
+            {
+                simulation.Transfers.push_back({ .User = i % 2 ? "heavy" : "light", .Remaining = LargeBytes });
+            }
+            Simulate(simulation, true, { { "heavy", 3 } }, 2LL * 1000LL * 1000LL);
+            DoNotOptimize(simulation.Moved);
+        }
+
+        double heavy = 0.0;
+        double light = 0.0;
+        for (const SIMULATED_TRANSFER& transfer : simulation.Transfers)
+        {
+            (transfer.User == "heavy" ? heavy : light) += static_cast<double>(LargeBytes - transfer.Remaining);
+        }
+        State.Counters["byte_ratio"] = heavy / light;
+    }
+    BENCHMARK(BM_SchedulerWeights);
+
+    // What a transfer pays per turn: a push and a pop under bulkLock, with as many
+    // transfers waiting as the pool has threads.
+    void BM_SchedulerTurn(BenchmarkState& State)
+    {
+        TransferScheduler<size_t> scheduler;
+        std::vector<SCHEDULED_FLOW> flows(Workers);
+        for (size_t i = 0; i < flows.size(); ++i)
+        {
+            scheduler.Push(i, flows[i], "user", false);
+        }
+        size_t transfer = 0;
+        for (auto _ : State)
+        {
+            scheduler.Pop(transfer);
+            flows[transfer].Deficit = 0;
+            scheduler.Push(transfer, flows[transfer], "user", true);
+        }
+        DoNotOptimize(transfer);
+    }
+    BENCHMARK(BM_SchedulerTurn);
+}
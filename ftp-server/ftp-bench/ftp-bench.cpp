@@ -0,0 +1,90 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include "Benchmark.h"
+
+namespace
+{
+    struct REGISTERED_BENCHMARK
+    {
+        const char*                          Name;
+        BenchmarkRegistry::BENCHMARK_ROUTINE Routine;
+    };
+
+    std::vector<REGISTERED_BENCHMARK>& Benchmarks()
+    {
+        static std::vector<REGISTERED_BENCHMARK> benchmarks;
+        return benchmarks;
+    }
+}
+
+int BenchmarkRegistry::Register(const char* Name, BENCHMARK_ROUTINE Routine)
+{
+    Benchmarks().push_back({ Name, Routine });
+    return static_cast<int>(Benchmarks().size());
+}
+
+int BenchmarkRegistry::RunAll(const std::string& Filter, double MinSeconds)
+{
+    std::printf("%-44s %14s %14s  %s\n", "Benchmark", "Time/op", "Iterations", "Counters");
+
+    int ran = 0;
+    for (const REGISTERED_BENCHMARK& benchmark : Benchmarks())
+    {
+        if (!Filter.empty() && std::string(benchmark.Name).find(Filter) == std::string::npos)
+        {
+            continue;
+        }
+
+        uint64_t iterations = 1;
+        double seconds = 0.0;
+        BenchmarkState state(iterations);
+        while (true)
+        {
+            state = BenchmarkState(iterations);
+            benchmark.Routine(state);
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - state.start).count();
+            if (seconds >= MinSeconds || iterations >= (uint64_t{ 1 } << 40))
+            {
+                break;
+            }
+
+            double scale = seconds > 0.0 ? (MinSeconds * 1.4) / seconds : 100.0;
+            scale = scale < 2.0 ? 2.0 : (scale > 100.0 ? 100.0 : scale);
+            iterations = static_cast<uint64_t>(static_cast<double>(iterations) * scale);
+        }
+
+        std::string counters;
+        if (state.bytesProcessed)
+        {
+            counters += "bytes_per_second=" + std::to_string(static_cast<uint64_t>(static_cast<double>(state.bytesProcessed) / seconds)) + " ";
+        }
+        for (const auto& [name, value] : state.Counters)
+        {
+            counters += name + "=" + std::to_string(value) + " ";
+        }
+
+        std::printf("%-44s %11.1f ns %14llu  %s\n",
+            benchmark.Name,
+            seconds * 1e9 / static_cast<double>(state.iterations),
+            static_cast<unsigned long long>(state.iterations),
+            counters.c_str());
+        ++ran;
+    }
+
+    return ran;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string filter = argc > 1 ? argv[1] : "";
+    double minSeconds = argc > 2 ? std::atof(argv[2]) : 0.5;
+
+    if (!BenchmarkRegistry::RunAll(filter, minSeconds))
+    {
+        std::cout << "No benchmark matches '" << filter << "'" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -12,6 +12,7 @@
 #define USER_COMMAND "USER"
 #define PASS_COMMAND "PASS"
 #define PASV_COMMAND "PASV"
+#define EPSV_COMMAND "EPSV"
 #define RETR_COMMAND "RETR"
 #define STOR_COMMAND "STOR"
 #define LIST_COMMAND "LIST"
@@ -19,22 +20,24 @@
 #define TRANSFER_MODE_ASCII "ASCII"
 #define QUIT_COMMAND "QUIT"
 #define PASV_RESPONSE "227"
+#define EPSV_RESPONSE "229"
 #define GET_COMMAND "GET"
 #define PUT_COMMAND "PUT"
 #define EXIT "EXIT"
 #define HELP "HELP"
+#define QUOTE "QUOTE"
 
 FtpClient::FtpClient(std::istream& in, std::ostream& out, std::ostream& err)
-	: controlSocket(INVALID_SOCKET), dataSocket(INVALID_SOCKET), isConnected(false), isBinaryTransfer(false), input(in), output(out), error(err) {}
+	: input(in), output(out), error(err), controlSocket(INVALID_SOCKET), dataSocket(INVALID_SOCKET), isConnected(false), isBinaryTransfer(false), isExtendedPassive(false) {}
 
 FtpClient::~FtpClient()
 {
 	if (controlSocket != INVALID_SOCKET)
 	{
-		closesocket(controlSocket);
+		Platform::CloseSocket(controlSocket);
 	}
 
-	WSACleanup();
+	Platform::StopSockets();
 }
 
 bool FtpClient::Connect(const std::string& serverIP, const std::string& port)
@@ -45,11 +48,9 @@ bool FtpClient::Connect(const std::string& serverIP, const std::string& port)
 		return false;
 	}
 
-	WSADATA wsaData;
-	int status = WSAStartup(MAKEWORD(2, 2), &wsaData);
-	if (status)
+	if (!Platform::StartSockets())
 	{
-		error << "WSAStartup failed with status: " << status << std::endl;
+		error << "Socket startup failed with error: " << Platform::SocketError() << std::endl;
 		return false;
 	}
 
@@ -59,20 +60,20 @@ bool FtpClient::Connect(const std::string& serverIP, const std::string& port)
 	hints.ai_protocol = IPPROTO_TCP;
 
 	ADDRINFOA* result = nullptr;
-	status = getaddrinfo(serverIP.c_str(), port.c_str(), &hints, &result);
+	int status = getaddrinfo(serverIP.c_str(), port.c_str(), &hints, &result);
 	if (status != 0)
 	{
 		error << "getaddrinfo failed with status: " << status << std::endl;
-		WSACleanup();
+		Platform::StopSockets();
 		return false;
 	}
 
 	this->controlSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
 	if (controlSocket == INVALID_SOCKET)
 	{
-		error << "Socket creation failed with error: " << WSAGetLastError() << std::endl;
+		error << "Socket creation failed with error: " << Platform::SocketError() << std::endl;
 		freeaddrinfo(result);
-		WSACleanup();
+		Platform::StopSockets();
 		return false;
 	}
 
@@ -80,12 +81,13 @@ bool FtpClient::Connect(const std::string& serverIP, const std::string& port)
 	freeaddrinfo(result);
 	if (status == SOCKET_ERROR)
 	{
-		error << "Connection to server failed with error: " << WSAGetLastError() << std::endl;
-		closesocket(controlSocket);
-		WSACleanup();
+		error << "Connection to server failed with error: " << Platform::SocketError() << std::endl;
+		Platform::CloseSocket(controlSocket);
+		Platform::StopSockets();
 		return false;
 	}
 
+	pendingResponse.clear();
 	output << ReceiveResponse(controlSocket);
 	this->isConnected = true;
 	this->serverIP = serverIP;
@@ -93,80 +95,81 @@ bool FtpClient::Connect(const std::string& serverIP, const std::string& port)
 	return true;
 }
 
-void FtpClient::SendUser(const std::string& username)
+bool FtpClient::SendUser(const std::string& username)
 {
 	if (!isConnected)
 	{
 		error << "Not connected to any server.\n";
-		return;
+		return false;
 	}
 
 	SendCommand("USER " + username);
-	output << ReceiveResponse(controlSocket);
+	std::string response = ReceiveResponse(controlSocket);
+	output << response;
+	return response[0] == '2' || response[0] == '3';
 }
 
-void FtpClient::SendPassword(const std::string& password)
+bool FtpClient::SendPassword(const std::string& password)
 {
 	if (!isConnected)
 	{
 		error << "Not connected to any server.\n";
-		return;
+		return false;
 	}
 
 	SendCommand("PASS " + password);
-	output << ReceiveResponse(controlSocket);
+	std::string response = ReceiveResponse(controlSocket);
+	output << response;
+	return response[0] == '2';
 }
 
 bool FtpClient::EnterPassiveMode()
 {
-	if (!SendCommand(PASV_COMMAND))
+	const char* command = isExtendedPassive ? EPSV_COMMAND : PASV_COMMAND;
+	if (!SendCommand(command))
 	{
-		error << "Failed to send PASV command.\n";
+		error << "Failed to send " << command << " command.\n";
 		return false;
 	}
 
 	std::string response = ReceiveResponse(controlSocket);
 	output << "Server Response: " << response;
 
-	if (response.find(PASV_RESPONSE) == std::string::npos)
-	{
-		error << "PASV failed. Server response: " << response << std::endl;
-		return false;
-	}
-
-	size_t start = response.find('(');
-	size_t end = response.find(')');
-	if (start == std::string::npos || end == std::string::npos || start >= end)
+	if (response.find(isExtendedPassive ? EPSV_RESPONSE : PASV_RESPONSE) == std::string::npos)
 	{
-		error << "Malformed PASV response: " << response << std::endl;
+		error << command << " failed. Server response: " << response << std::endl;
 		return false;
 	}
 
-	std::string data = response.substr(start + 1, end - start - 1);
-	std::vector<int> numbers;
-	std::stringstream ss(data);
-	std::string token;
-	while (std::getline(ss, token, ','))
+	std::string pasvServerIP;
+	int pasvServerPort = 0;
+	if (isExtendedPassive)
 	{
-		numbers.push_back(std::stoi(token));
+		// EPSV only names a port; the data connection goes to the control connection's peer.
+		sockaddr_in controlAddr = { 0 };
+		socklen_t controlAddrSize = sizeof(controlAddr);
+		char controlIP[INET_ADDRSTRLEN] = { 0 };
+		if (!Utils::parseExtendedPassiveResponse(response, pasvServerPort) ||
+			getpeername(controlSocket, reinterpret_cast<sockaddr*>(&controlAddr), &controlAddrSize) == SOCKET_ERROR ||
+			!inet_ntop(AF_INET, &controlAddr.sin_addr, controlIP, sizeof(controlIP)))
+		{
+			error << "Malformed EPSV response: " << response << std::endl;
+			return false;
+		}
+		pasvServerIP = controlIP;
 	}
-
-	if (numbers.size() != 6)
+	else if (!Utils::parsePassiveResponse(response, pasvServerIP, pasvServerPort))
 	{
-		error << "Invalid PASV response format: " << data << std::endl;
+		error << "Malformed PASV response: " << response << std::endl;
 		return false;
 	}
 
-	std::string pasvServerIP = std::to_string(numbers[0]) + "." + std::to_string(numbers[1]) + "." +
-		std::to_string(numbers[2]) + "." + std::to_string(numbers[3]);
-	int pasvServerPort = (numbers[4] << 8) + numbers[5];
-
 	output << "Passive Mode at: " << pasvServerIP << ":" << pasvServerPort << std::endl;
 
 	this->dataSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 	if (dataSocket == INVALID_SOCKET)
 	{
-		error << "Data socket creation failed with error: " << WSAGetLastError() << std::endl;
+		error << "Data socket creation failed with error: " << Platform::SocketError() << std::endl;
 		return false;
 	}
 
@@ -177,7 +180,7 @@ bool FtpClient::EnterPassiveMode()
 
 	if (connect(dataSocket, reinterpret_cast<sockaddr*>(&dataAddr), sizeof(dataAddr)) == SOCKET_ERROR)
 	{
-		error << "Data socket connection failed with error: " << WSAGetLastError() << std::endl;
+		error << "Data socket connection failed with error: " << Platform::SocketError() << std::endl;
 		CleanupSocket(dataSocket);
 		return false;
 	}
@@ -186,37 +189,57 @@ bool FtpClient::EnterPassiveMode()
 	return true;
 }
 
-void FtpClient::SetTransferMode(bool isBinary)
+void FtpClient::SetExtendedPassive(bool isExtended)
+{
+	this->isExtendedPassive = isExtended;
+}
+
+void FtpClient::ClosePassiveMode()
+{
+	CleanupSocket(dataSocket);
+	dataSocket = INVALID_SOCKET;
+}
+
+bool FtpClient::SetTransferMode(bool isBinary)
 {
 	if (!isConnected)
 	{
 		error << "Not connected to any server.\n";
-		return;
+		return false;
 	}
 
 	std::string modeCommand = isBinary ? "TYPE I" : "TYPE A";
 	if (!SendCommand(modeCommand))
 	{
 		error << "Failed to set transfer mode.\n";
-		return;
+		return false;
+	}
+
+	std::string response = ReceiveResponse(controlSocket);
+	if (response[0] != '2')
+	{
+		error << "Failed to set transfer mode. Server response: " << response << std::endl;
+		return false;
 	}
 
+	this->isBinaryTransfer = isBinary;
 	output << "Transfer mode set to " << (isBinary ? "binary" : "ASCII") << ".\n";
-	output << ReceiveResponse(controlSocket);
+	output << response;
+	return true;
 }
 
-void FtpClient::ListFiles()
+bool FtpClient::ListFiles()
 {
 	if (!isConnected)
 	{
 		error << "Not connected to any server.\n";
-		return;
+		return false;
 	}
 
 	if (!EnterPassiveMode())
 	{
 		error << "Failed to enter passive mode.\n";
-		return;
+		return false;
 	}
 
 	SendCommand(LIST_COMMAND);
@@ -224,7 +247,7 @@ void FtpClient::ListFiles()
 	if (response[0] != '1')
 	{
 		error << "LIST command failed. Server response: " << response << std::endl;
-		return;
+		return false;
 	}
 
 	char buffer[DEFAULT_BUFLEN];
@@ -236,7 +259,7 @@ void FtpClient::ListFiles()
 
 	if (bytesRead == SOCKET_ERROR)
 	{
-		error << "Error reading data socket: " << WSAGetLastError() << std::endl;
+		error << "Error reading data socket: " << Platform::SocketError() << std::endl;
 	}
 
 	CleanupSocket(dataSocket);
@@ -245,24 +268,26 @@ void FtpClient::ListFiles()
 	if (response[0] != '2')
 	{
 		error << "Error completing LIST command. Server response: " << response << std::endl;
+		return false;
 	}
 
 	output << "List command completed.\n";
+	return true;
 }
 
 
-void FtpClient::DownloadFile(const std::string& fileName, const std::string& localFileName)
+bool FtpClient::DownloadFile(const std::string& fileName, const std::string& localFileName)
 {
 	if (!isConnected)
 	{
 		error << "Not connected to any server.\n";
-		return;
+		return false;
 	}
 
 	if (!EnterPassiveMode())
 	{
 		error << "Failed to enter passive mode.\n";
-		return;
+		return false;
 	}
 
 	std::string command = std::string(RETR_COMMAND) + " " + fileName;
@@ -272,14 +297,14 @@ void FtpClient::DownloadFile(const std::string& fileName, const std::string& loc
 	if (response.substr(0, 3) != "150" && response.substr(0, 3) != "125")
 	{
 		error << "Error initiating file download. Server response: " << response << std::endl;
-		return;
+		return false;
 	}
 
 	std::ofstream outFile(localFileName, std::ios::binary | std::ios::trunc);
 	if (!outFile.is_open())
 	{
 		error << "Failed to open local file for writing: " << localFileName << std::endl;
-		return;
+		return false;
 	}
 
 	char buffer[DEFAULT_BUFLEN];
@@ -291,7 +316,7 @@ void FtpClient::DownloadFile(const std::string& fileName, const std::string& loc
 
 	if (bytesRead == SOCKET_ERROR)
 	{
-		error << "Error reading data socket: " << WSAGetLastError() << std::endl;
+		error << "Error reading data socket: " << Platform::SocketError() << std::endl;
 	}
 
 	outFile.close();
@@ -301,32 +326,32 @@ void FtpClient::DownloadFile(const std::string& fileName, const std::string& loc
 	if (response.substr(0, 3) != "226")
 	{
 		error << "Error completing file download. Server response: " << response << std::endl;
+		return false;
 	}
-	else
-	{
-		output << "Download completed successfully.\n";
-	}
+
+	output << "Download completed successfully.\n";
+	return true;
 }
 
-void FtpClient::UploadFile(const std::string& fileName, const std::string& remoteFileName)
+bool FtpClient::UploadFile(const std::string& fileName, const std::string& remoteFileName)
 {
 	if (!isConnected)
 	{
 		error << "Not connected to any server.\n";
-		return;
+		return false;
 	}
 
 	std::ifstream inFile(fileName, this->isBinaryTransfer ? std::ios::binary : std::ios::in);
 	if (!inFile.is_open())
 	{
 		error << "Failed to open local file for reading: " << fileName << std::endl;
-		return;
+		return false;
 	}
 
 	if (!EnterPassiveMode())
 	{
 		error << "Failed to enter passive mode.\n";
-		return;
+		return false;
 	}
 
 	std::string command = std::string(STOR_COMMAND) + " " + remoteFileName;
@@ -337,7 +362,7 @@ void FtpClient::UploadFile(const std::string& fileName, const std::string& remot
 	{
 		error << "Error initiating file upload. Server response: " << response << std::endl;
 		inFile.close();
-		return;
+		return false;
 	}
 
 	char buffer[DEFAULT_BUFLEN];
@@ -346,11 +371,11 @@ void FtpClient::UploadFile(const std::string& fileName, const std::string& remot
 		int bytesSent = send(dataSocket, buffer, static_cast<int>(inFile.gcount()), 0);
 		if (bytesSent == SOCKET_ERROR)
 		{
-			error << "Error sending file data: " << WSAGetLastError() << std::endl;
+			error << "Error sending file data: " << Platform::SocketError() << std::endl;
 			inFile.close();
-			closesocket(dataSocket);
+			Platform::CloseSocket(dataSocket);
 			dataSocket = INVALID_SOCKET;
-			return;
+			return false;
 		}
 	}
 
@@ -361,11 +386,11 @@ void FtpClient::UploadFile(const std::string& fileName, const std::string& remot
 	if (response.substr(0, 3) != "226")
 	{
 		error << "Error completing file upload. Server response: " << response << std::endl;
+		return false;
 	}
-	else
-	{
-		output << "Upload completed successfully.\n";
-	}
+
+	output << "Upload completed successfully.\n";
+	return true;
 }
 
 void FtpClient::Disconnect(bool waitForResponse = true)
@@ -394,23 +419,54 @@ void FtpClient::Disconnect(bool waitForResponse = true)
 	output << "Disconnected from the server.\n";
 }
 
+std::string FtpClient::Quote(const std::string& command)
+{
+	if (!SendCommand(command))
+	{
+		return std::string();
+	}
+
+	std::string response = ReceiveResponse(controlSocket);
+	output << response;
+	return response;
+}
+
 std::string FtpClient::ReceiveResponse(SOCKET socket)
 {
-	std::string response;
+	// Replies can arrive coalesced (150 and 226 in one segment), so return exactly one
+	// reply and keep the rest for the next call. A multi-line reply ("xyz-") ends at the
+	// line starting "xyz ".
 	char buffer[DEFAULT_BUFLEN] = { 0 };
-	int bytesReceived = 0;
+	size_t searchFrom = 0;
+	while (true)
+	{
+		size_t lineEnd = pendingResponse.find("\r\n", searchFrom);
+		while (lineEnd != std::string::npos)
+		{
+			bool multiLine = pendingResponse.size() > 3 && pendingResponse[3] == '-';
+			bool lastLine = !multiLine ||
+				(searchFrom + 3 < lineEnd && pendingResponse.compare(searchFrom, 3, pendingResponse, 0, 3) == 0 && pendingResponse[searchFrom + 3] == ' ');
+			searchFrom = lineEnd + 2;
+			if (lastLine)
+			{
+				std::string response = pendingResponse.substr(0, searchFrom);
+				pendingResponse.erase(0, searchFrom);
+				return response;
+			}
+			lineEnd = pendingResponse.find("\r\n", searchFrom);
+		}
 
-	do {
-		bytesReceived = recv(socket, buffer, DEFAULT_BUFLEN - 1, 0);
-		if (bytesReceived > 0) {
-			response.append(buffer, bytesReceived);
+		int bytesReceived = recv(socket, buffer, DEFAULT_BUFLEN - 1, 0);
+		if (bytesReceived < 0) {
+			return "Receive failed with error: " + std::to_string(Platform::SocketError()) + "\n";
 		}
-		else if (bytesReceived < 0) {
-			return "Receive failed with error: " + std::to_string(WSAGetLastError()) + "\n";
+		if (bytesReceived == 0) {
+			std::string response = std::move(pendingResponse);
+			pendingResponse.clear();
+			return response;
 		}
-	} while (bytesReceived > 0 && response.find("\r\n") == std::string::npos);
-
-	return response;
+		pendingResponse.append(buffer, bytesReceived);
+	}
 }
 
 bool FtpClient::SendCommand(const std::string& command)
@@ -425,18 +481,18 @@ bool FtpClient::SendCommand(const std::string& command)
 	int status = send(controlSocket, formattedCommand.c_str(), static_cast<int>(formattedCommand.size()), 0);
 	if (status == SOCKET_ERROR)
 	{
-		error << "Send failed with error: " << WSAGetLastError() << " " << command << std::endl;
+		error << "Send failed with error: " << Platform::SocketError() << " " << command << std::endl;
 		return false;
 	}
 
 	return true;
 }
 
-void FtpClient::CleanupSocket(SOCKET socket)
+void FtpClient::CleanupSocket(SOCKET& socket)
 {
 	if (socket != INVALID_SOCKET)
 	{
-		closesocket(socket);
+		Platform::CloseSocket(socket);
 		socket = INVALID_SOCKET;
 	}
 }
@@ -528,6 +584,18 @@ void FtpClient::Start()
 		{
 			SetTransferMode(false);
 		}
+		else if (action == QUOTE)
+		{
+			size_t argument = command.find_first_not_of(' ', command.find(' '));
+			if (argument == std::string::npos)
+			{
+				output << "Usage: quote <command>\n";
+			}
+			else
+			{
+				Quote(command.substr(argument));
+			}
+		}
 		else if (action == DISCONNECT_COMMAND)
 		{
 			Disconnect();
@@ -548,6 +616,7 @@ void FtpClient::Start()
 				<< "  put <localFileName> <remoteFileName> - Upload a file\n"
 				<< "  binary             - Switch file transfer mode to binary\n"
 				<< "  ascii              - Switch file transfer mode to ASCII\n"
+				<< "  quote <command>    - Send a command to the server as typed\n"
 				<< "  disconnect         - Disconnects from the FTP server\n"
 				<< "  quit               - Exit the client\n";
 		}
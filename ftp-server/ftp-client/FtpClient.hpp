@@ -2,8 +2,10 @@
 #include <string>
 #include <vector>
 #include <iostream>
-#include <WS2tcpip.h>
+#include "Platform.h"
+#if defined(_MSC_VER)
 #pragma comment(lib, "Ws2_32.lib")
+#endif
 
 #define DEFAULT_FTP_PORT "21"
 
@@ -19,10 +21,12 @@ private:
     SOCKET dataSocket;
     bool isConnected;
     bool isBinaryTransfer;
+    bool isExtendedPassive;
+    std::string pendingResponse;
 
     std::string ReceiveResponse(SOCKET socket);
     bool SendCommand(const std::string& command);
-    void CleanupSocket(SOCKET socket);
+    void CleanupSocket(SOCKET& socket);
 
 public:
     FtpClient(std::istream& input = std::cin, std::ostream& output = std::cout, std::ostream& error = std::cerr);
@@ -30,12 +34,17 @@ public:
 
     void Start();
     bool Connect(const std::string& serverIP, const std::string& port = DEFAULT_FTP_PORT);
-    void SendUser(const std::string& username);
-    void SendPassword(const std::string& password);
-    void ListFiles();
-    void DownloadFile(const std::string& fileName, const std::string& localFileName);
-    void UploadFile(const std::string& fileName, const std::string& remoteFileName);
+    bool SendUser(const std::string& username);
+    bool SendPassword(const std::string& password);
+    bool ListFiles();
+    bool DownloadFile(const std::string& fileName, const std::string& localFileName);
+    bool UploadFile(const std::string& fileName, const std::string& remoteFileName);
     bool EnterPassiveMode();
-    void SetTransferMode(bool isBinary);
+    void SetExtendedPassive(bool isExtended);
+    void ClosePassiveMode();
+    bool SetTransferMode(bool isBinary);
     void Disconnect(bool waitForResponse);
+
+    // Sends a command line as typed and returns the server's reply to it.
+    std::string Quote(const std::string& command);
 };
\ No newline at end of file
@@ -2,6 +2,8 @@
 #include <string>
 #include <algorithm>
 #include <cctype>
+#include <sstream>
+#include <vector>
 
 class Utils {
 public:
@@ -20,4 +22,50 @@ public:
             [](unsigned char c) { return std::toupper(c); });
         return result;
     }
-};
\ No newline at end of file
+
+    // Pulls "h1,h2,h3,h4,p1,p2" out of a 227 reply and turns it into a dotted address and port.
+    static bool parsePassiveResponse(const std::string& response, std::string& ip, int& port) {
+        size_t start = response.find('(');
+        size_t end = response.find(')');
+        if (start == std::string::npos || end == std::string::npos || start >= end)
+            return false;
+
+        std::string data = response.substr(start + 1, end - start - 1);
+        std::vector<int> numbers;
+        std::stringstream ss(data);
+        std::string token;
+        while (std::getline(ss, token, ',')) {
+            try {
+                numbers.push_back(std::stoi(token));
+            }
+            catch (const std::exception&) {
+                return false;
+            }
+        }
+
+        if (numbers.size() != 6)
+            return false;
+
+        ip = std::to_string(numbers[0]) + "." + std::to_string(numbers[1]) + "." +
+            std::to_string(numbers[2]) + "." + std::to_string(numbers[3]);
+        port = (numbers[4] << 8) + numbers[5];
+        return true;
+    }
+
+    // Pulls the port out of a 229 reply, "(|||port|)"; the host is the one the
+    // control connection went to.
+    static bool parseExtendedPassiveResponse(const std::string& response, int& port) {
+        size_t start = response.find("(|||");
+        size_t end = response.find("|)", start == std::string::npos ? 0 : start + 4);
+        if (start == std::string::npos || end == std::string::npos)
+            return false;
+
+        try {
+            port = std::stoi(response.substr(start + 4, end - start - 4));
+        }
+        catch (const std::exception&) {
+            return false;
+        }
+        return port > 0 && port <= 65535;
+    }
+};
@@ -0,0 +1,529 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FtpClient.hpp"
+#include "Metrics.h"
+
+// Closed-loop load generator: N sessions, each logged in on its own FtpClient,
+// issue a weighted mix of LIST/RETR/STOR/PASV with optional think time and record
+// per-command latency. Meant to run against a server on the same machine.
+//
+// --scenario replaces the mix and file size with a built-in workload; "training"
+// is the one the PGO build (pgo-build.sh) profiles the server with.
+//
+// CONN opens a fresh control connection, waits for the 220 greeting and resets it,
+// which measures the accept path alone. "--mix conn:1" is a connection storm; with
+// no other op in the mix the sessions never log in.
+// LOGIN does the same on a fresh connection up to a completed USER/PASS, which is
+// the control-plane latency a new client sees while other sessions are busy.
+namespace
+{
+#if defined(_WIN32)
+    constexpr const char* NullDevice = "NUL";
+#else
+    constexpr const char* NullDevice = "/dev/null";
+#endif
+
+    typedef enum class _LOAD_OP : uint8_t
+    {
+        List = 0,
+        Retr,
+        Stor,
+        Pasv,
+        Connect,
+        Login,
+
+        MaxLoadOp
+    } LOAD_OP;
+
+    constexpr const char* OpNames[] = { "LIST", "RETR", "STOR", "PASV", "CONN", "LOGIN" };
+    constexpr size_t OpCount = static_cast<size_t>(LOAD_OP::MaxLoadOp);
+    static_assert(std::size(OpNames) == OpCount, "OpNames must match LOAD_OP");
+
+    typedef struct _LOAD_PAYLOAD
+    {
+        uint64_t    Size = 0;
+        uint32_t    Weight = 1;
+        std::string Path;
+    } LOAD_PAYLOAD;
+
+    typedef struct _LOAD_SCENARIO
+    {
+        const char* Name;
+        uint32_t    Weights[OpCount];
+        uint64_t    Sizes[4];
+        uint32_t    SizeWeights[4];
+        uint32_t    ListingFiles;       // seeded before the run so LIST walks a large directory
+    } LOAD_SCENARIO;
+
+    // Mostly small transfers with a heavy tail, LIST over a couple of thousand
+    // entries, and PASV set up and torn down on its own.
+    constexpr LOAD_SCENARIO Scenarios[] =
+    {
+        { "training", { 3, 4, 2, 1, 0, 0 }, { 1024, 32 * 1024, 512 * 1024, 4 * 1024 * 1024 }, { 8, 4, 2, 1 }, 2000 },
+    };
+
+    typedef struct _LOAD_OPTIONS
+    {
+        std::string Host = "127.0.0.1";
+        std::string Port = DEFAULT_FTP_PORT;
+        std::string User = "user";
+        std::string Password = "pass";
+        uint32_t    Sessions = 8;
+        double      Seconds = 10.0;
+        uint64_t    FileSize = 64 * 1024;
+        uint32_t    ThinkMs = 0;
+        uint32_t    Weights[OpCount] = { 4, 4, 1, 1, 0, 0 };
+        sockaddr_in Address = {};
+        const char* Scenario = nullptr;
+        uint32_t    ListingFiles = 0;
+        std::vector<LOAD_PAYLOAD> Payloads;
+    } LOAD_OPTIONS;
+
+    typedef struct _SESSION_RESULT
+    {
+        HISTOGRAM_SNAPSHOT Latency[OpCount];
+        uint64_t           Errors[OpCount] = { 0 };
+        uint64_t           Bytes = 0;
+        bool               LoggedIn = false;
+    } SESSION_RESULT;
+
+    void Usage()
+    {
+        std::cout << "Usage: ftp-load [--host 127.0.0.1] [--port 21] [--user user] [--pass pass]\n"
+            << "                [--sessions 8] [--seconds 10] [--size 65536] [--think-ms 0]\n"
+            << "                [--mix list:4,retr:4,stor:1,pasv:1,conn:0,login:0] [--scenario training]\n";
+    }
+
+    bool ParseMix(const std::string& Mix, uint32_t(&Weights)[OpCount])
+    {
+        uint32_t weights[OpCount] = { 0 };
+        size_t start = 0;
+        while (start < Mix.size())
+        {
+            size_t end = Mix.find(',', start);
+            std::string entry = Mix.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            size_t colon = entry.find(':');
+            if (colon == std::string::npos)
+            {
+                return false;
+            }
+
+            std::string name = entry.substr(0, colon);
+            for (char& c : name)
+            {
+                c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            }
+
+            size_t op = 0;
+            while (op < OpCount && name != OpNames[op])
+            {
+                ++op;
+            }
+            if (op == OpCount)
+            {
+                return false;
+            }
+            weights[op] = static_cast<uint32_t>(std::strtoul(entry.c_str() + colon + 1, nullptr, 10));
+
+            start = end == std::string::npos ? Mix.size() : end + 1;
+        }
+
+        std::copy(std::begin(weights), std::end(weights), Weights);
+        return true;
+    }
+
+    bool ParseOptions(int argc, char* argv[], LOAD_OPTIONS& Options)
+    {
+        for (int i = 1; i < argc; i += 2)
+        {
+            std::string key = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+            std::string value = argv[i + 1];
+
+            if (key == "--host") Options.Host = value;
+            else if (key == "--port") Options.Port = value;
+            else if (key == "--user") Options.User = value;
+            else if (key == "--pass") Options.Password = value;
+            else if (key == "--sessions") Options.Sessions = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+            else if (key == "--seconds") Options.Seconds = std::atof(value.c_str());
+            else if (key == "--size") Options.FileSize = std::strtoull(value.c_str(), nullptr, 10);
+            else if (key == "--think-ms") Options.ThinkMs = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+            else if (key == "--scenario")
+            {
+                const LOAD_SCENARIO* scenario = std::find_if(std::begin(Scenarios), std::end(Scenarios),
+                    [&value](const LOAD_SCENARIO& candidate) { return value == candidate.Name; });
+                if (scenario == std::end(Scenarios))
+                {
+                    return false;
+                }
+
+                Options.Scenario = scenario->Name;
+                Options.ListingFiles = scenario->ListingFiles;
+                std::copy(std::begin(scenario->Weights), std::end(scenario->Weights), Options.Weights);
+                Options.Payloads.clear();
+                for (size_t i = 0; i < std::size(scenario->Sizes); ++i)
+                {
+                    Options.Payloads.push_back({ scenario->Sizes[i], scenario->SizeWeights[i], {} });
+                }
+            }
+            else if (key == "--mix")
+            {
+                if (!ParseMix(value, Options.Weights))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        if (Options.Payloads.empty())
+        {
+            Options.Payloads.push_back({ Options.FileSize, 1, {} });
+        }
+
+        uint32_t totalWeight = 0;
+        for (uint32_t weight : Options.Weights)
+        {
+            totalWeight += weight;
+        }
+        return Options.Sessions > 0 && Options.Seconds > 0.0 && totalWeight > 0;
+    }
+
+    bool Login(const LOAD_OPTIONS& Options, FtpClient& Client)
+    {
+        return Client.Connect(Options.Host, Options.Port) &&
+            Client.SendUser(Options.User) &&
+            Client.SendPassword(Options.Password) &&
+            Client.SetTransferMode(true);
+    }
+
+    std::string RemoteName(uint32_t Index, size_t Payload)
+    {
+        return "ftp-load-" + std::to_string(Index) + "-" + std::to_string(Payload) + ".bin";
+    }
+
+    // Uploads files [First, ListingFiles) in steps of Stride, so several seeders split the work.
+    uint32_t SeedListing(const LOAD_OPTIONS& Options, const std::string& Payload, uint32_t First, uint32_t Stride)
+    {
+        std::istream nullInput(nullptr);
+        std::ostream nullOutput(nullptr);
+        FtpClient client(nullInput, nullOutput, nullOutput);
+        if (!Login(Options, client))
+        {
+            return 0;
+        }
+
+        uint32_t seeded = 0;
+        char name[32] = { 0 };
+        for (uint32_t i = First; i < Options.ListingFiles; i += Stride)
+        {
+            std::snprintf(name, sizeof(name), "ftp-load-list-%05u.txt", i);
+            seeded += client.UploadFile(Payload, name) ? 1 : 0;
+        }
+        client.Disconnect(true);
+        return seeded;
+    }
+
+    bool WritePayload(const std::string& Path, uint64_t Size)
+    {
+        std::ofstream file(Path, std::ios::binary | std::ios::trunc);
+        std::vector<char> block(64 * 1024);
+        for (size_t i = 0; i < block.size(); ++i)
+        {
+            block[i] = static_cast<char>('A' + i % 26);
+        }
+        for (uint64_t remaining = Size; remaining;)
+        {
+            size_t chunk = static_cast<size_t>(remaining < block.size() ? remaining : block.size());
+            file.write(block.data(), static_cast<std::streamsize>(chunk));
+            remaining -= chunk;
+        }
+        return static_cast<bool>(file);
+    }
+
+    // Aborts with a reset rather than a FIN, so a storm does not leave the client's
+    // ephemeral ports in TIME_WAIT.
+    bool ConnectOnce(const sockaddr_in& Address)
+    {
+        SOCKET probe = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (probe == INVALID_SOCKET)
+        {
+            return false;
+        }
+
+        bool greeted = false;
+        if (connect(probe, reinterpret_cast<const sockaddr*>(&Address), sizeof(Address)) != SOCKET_ERROR)
+        {
+            char greeting[128] = { 0 };
+            greeted = recv(probe, greeting, sizeof(greeting), 0) >= 3 && !std::strncmp(greeting, "220", 3);
+        }
+
+        linger abort = { 1, 0 };
+        setsockopt(probe, SOL_SOCKET, SO_LINGER, reinterpret_cast<const char*>(&abort), sizeof(abort));
+        Platform::CloseSocket(probe);
+        return greeted;
+    }
+
+    void RunSession(const LOAD_OPTIONS& Options, uint32_t Index, std::chrono::steady_clock::time_point Deadline, SESSION_RESULT& Result)
+    {
+        std::istream nullInput(nullptr);
+        std::ostream nullOutput(nullptr);
+        FtpClient client(nullInput, nullOutput, nullOutput);
+
+        std::vector<uint32_t> weights(std::begin(Options.Weights), std::end(Options.Weights));
+        bool needsSession = std::any_of(weights.begin(), weights.begin() + static_cast<size_t>(LOAD_OP::Connect), [](uint32_t weight) { return weight != 0; });
+        bool needsFiles = weights[static_cast<size_t>(LOAD_OP::Retr)] || weights[static_cast<size_t>(LOAD_OP::Stor)];
+
+        if (needsSession && !Login(Options, client))
+        {
+            return;
+        }
+        Result.LoggedIn = true;
+
+        // Every session downloads the files it uploaded, so RETR always has a target.
+        std::vector<uint32_t> sizeWeights;
+        for (size_t payload = 0; needsFiles && payload < Options.Payloads.size(); ++payload)
+        {
+            bool uploaded = client.UploadFile(Options.Payloads[payload].Path, RemoteName(Index, payload));
+            Result.Errors[static_cast<size_t>(LOAD_OP::Stor)] += uploaded ? 0 : 1;
+            sizeWeights.push_back(uploaded ? Options.Payloads[payload].Weight : 0);
+        }
+        if (std::all_of(sizeWeights.begin(), sizeWeights.end(), [](uint32_t weight) { return weight == 0; }))
+        {
+            sizeWeights.assign(Options.Payloads.size(), 0);
+            weights[static_cast<size_t>(LOAD_OP::Retr)] = 0;
+            weights[static_cast<size_t>(LOAD_OP::Stor)] = 0;
+            if (std::all_of(weights.begin(), weights.end(), [](uint32_t weight) { return weight == 0; }))
+            {
+                return;
+            }
+            std::fill(sizeWeights.begin(), sizeWeights.end(), 1);
+        }
+
+        std::mt19937 random(Index * 7919U + 1U);
+        std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+        std::discrete_distribution<size_t> pickSize(sizeWeights.begin(), sizeWeights.end());
+        while (std::chrono::steady_clock::now() < Deadline)
+        {
+            size_t op = pick(random);
+            size_t payload = pickSize(random);
+            bool succeeded = false;
+
+            auto start = std::chrono::steady_clock::now();
+            switch (static_cast<LOAD_OP>(op))
+            {
+            case LOAD_OP::List:
+                succeeded = client.ListFiles();
+                break;
+            case LOAD_OP::Retr:
+                succeeded = client.DownloadFile(RemoteName(Index, payload), NullDevice);
+                Result.Bytes += succeeded ? Options.Payloads[payload].Size : 0;
+                break;
+            case LOAD_OP::Stor:
+                succeeded = client.UploadFile(Options.Payloads[payload].Path, RemoteName(Index, payload));
+                Result.Bytes += succeeded ? Options.Payloads[payload].Size : 0;
+                break;
+            case LOAD_OP::Pasv:
+                succeeded = client.EnterPassiveMode();
+                client.ClosePassiveMode();
+                break;
+            case LOAD_OP::Connect:
+                succeeded = ConnectOnce(Options.Address);
+                break;
+            default:
+                {
+                    FtpClient probe(nullInput, nullOutput, nullOutput);
+                    succeeded = Login(Options, probe);
+                    probe.Disconnect(true);
+                }
+                break;
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+            if (succeeded)
+            {
+                Result.Latency[op].Record(static_cast<uint64_t>(elapsed.count()));
+            }
+            else
+            {
+                ++Result.Errors[op];
+            }
+
+            if (Options.ThinkMs)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(Options.ThinkMs));
+            }
+        }
+
+        if (needsSession)
+        {
+            client.Disconnect(true);
+        }
+    }
+
+    bool ResolveServer(LOAD_OPTIONS& Options)
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* result = nullptr;
+        if (getaddrinfo(Options.Host.c_str(), Options.Port.c_str(), &hints, &result) != 0)
+        {
+            return false;
+        }
+        std::memcpy(&Options.Address, result->ai_addr, sizeof(Options.Address));
+        freeaddrinfo(result);
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    LOAD_OPTIONS options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        Usage();
+        return 1;
+    }
+
+    if (!Platform::StartSockets() || !ResolveServer(options))
+    {
+        std::cerr << "Cannot resolve " << options.Host << ":" << options.Port << std::endl;
+        return 1;
+    }
+
+    for (size_t i = 0; i < options.Payloads.size(); ++i)
+    {
+        LOAD_PAYLOAD& payload = options.Payloads[i];
+        payload.Path = (std::filesystem::temp_directory_path() / ("ftp-load-payload-" + std::to_string(i) + ".bin")).string();
+        if (!WritePayload(payload.Path, payload.Size))
+        {
+            std::cerr << "Cannot create payload file " << payload.Path << std::endl;
+            return 1;
+        }
+    }
+
+    if (options.ListingFiles)
+    {
+        auto seedStarted = std::chrono::steady_clock::now();
+        uint32_t seeders = std::min<uint32_t>(options.Sessions, 8);
+        std::vector<uint32_t> seeded(seeders, 0);
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < seeders; ++i)
+        {
+            threads.emplace_back([&options, &seeded, i, seeders]
+                {
+                    seeded[i] = SeedListing(options, options.Payloads.front().Path, i, seeders);
+                });
+        }
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+        uint32_t total = 0;
+        for (uint32_t count : seeded)
+        {
+            total += count;
+        }
+        std::printf("seeded_files=%u seed_seconds=%.2f\n", total,
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - seedStarted).count());
+    }
+
+    std::vector<std::unique_ptr<SESSION_RESULT>> results;
+    std::vector<std::thread> sessions;
+    auto started = std::chrono::steady_clock::now();
+    auto deadline = started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(options.Seconds));
+    for (uint32_t i = 0; i < options.Sessions; ++i)
+    {
+        results.push_back(std::make_unique<SESSION_RESULT>());
+        sessions.emplace_back(RunSession, std::cref(options), i, deadline, std::ref(*results.back()));
+    }
+    for (std::thread& session : sessions)
+    {
+        session.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    std::unique_ptr<SESSION_RESULT> total = std::make_unique<SESSION_RESULT>();
+    uint32_t loggedIn = 0;
+    for (const std::unique_ptr<SESSION_RESULT>& result : results)
+    {
+        for (size_t op = 0; op < OpCount; ++op)
+        {
+            total->Latency[op].Merge(result->Latency[op]);
+            total->Errors[op] += result->Errors[op];
+        }
+        total->Bytes += result->Bytes;
+        loggedIn += result->LoggedIn ? 1 : 0;
+    }
+
+    uint64_t commands = 0;
+    for (size_t op = 0; op < OpCount; ++op)
+    {
+        commands += total->Latency[op].Count;
+    }
+
+    if (options.Scenario)
+    {
+        std::printf("sessions=%u logged_in=%u seconds=%.2f scenario=%s think_ms=%u\n",
+            options.Sessions, loggedIn, seconds, options.Scenario, options.ThinkMs);
+    }
+    else
+    {
+        std::printf("sessions=%u logged_in=%u seconds=%.2f file_size=%llu think_ms=%u\n",
+            options.Sessions, loggedIn, seconds, static_cast<unsigned long long>(options.FileSize), options.ThinkMs);
+    }
+    std::printf("commands=%llu commands_per_second=%.1f throughput_mib_per_second=%.2f\n",
+        static_cast<unsigned long long>(commands),
+        static_cast<double>(commands) / seconds,
+        static_cast<double>(total->Bytes) / seconds / (1024.0 * 1024.0));
+    if (uint64_t connects = total->Latency[static_cast<size_t>(LOAD_OP::Connect)].Count)
+    {
+        std::printf("connects_per_second=%.1f\n", static_cast<double>(connects) / seconds);
+    }
+    std::printf("\n");
+    std::printf("%-6s %10s %8s %12s %12s %12s %12s\n", "op", "count", "errors", "p50_ms", "p99_ms", "p999_ms", "max_ms");
+    for (size_t op = 0; op < OpCount; ++op)
+    {
+        const HISTOGRAM_SNAPSHOT& latency = total->Latency[op];
+        if (!latency.Count && !total->Errors[op])
+        {
+            continue;
+        }
+
+        std::printf("%-6s %10llu %8llu %12.3f %12.3f %12.3f %12.3f\n",
+            OpNames[op],
+            static_cast<unsigned long long>(latency.Count),
+            static_cast<unsigned long long>(total->Errors[op]),
+            static_cast<double>(latency.Percentile(0.5)) / 1000.0,
+            static_cast<double>(latency.Percentile(0.99)) / 1000.0,
+            static_cast<double>(latency.Percentile(0.999)) / 1000.0,
+            static_cast<double>(latency.Max) / 1000.0);
+    }
+
+    for (const LOAD_PAYLOAD& payload : options.Payloads)
+    {
+        std::filesystem::remove(payload.Path);
+    }
+    Platform::StopSockets();
+    return loggedIn == options.Sessions ? 0 : 2;
+}
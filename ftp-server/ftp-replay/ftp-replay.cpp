@@ -0,0 +1,401 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FtpClient.hpp"
+#include "Metrics.h"
+#include "SessionCapture.h"
+
+// Replays a capture written by SITE CAPTURE against a (candidate) server. Every
+// captured session gets its own FtpClient and thread, and each command is issued
+// at its captured offset divided by --speed. The report compares the server-side
+// latency captured in production with the latency observed during the replay.
+namespace
+{
+#if defined(_WIN32)
+    constexpr const char* NullDevice = "NUL";
+#else
+    constexpr const char* NullDevice = "/dev/null";
+#endif
+
+    constexpr size_t CommandCount = static_cast<size_t>(COMMAND_ID::MaxCommandId);
+
+    typedef struct _REPLAY_OPTIONS
+    {
+        std::string Capture = CAPTURE_DEFAULT_FILE;
+        std::string Host = "127.0.0.1";
+        std::string Port = DEFAULT_FTP_PORT;
+        std::string User;                   // empty: the captured user name
+        std::string Password = "pass";
+        double      Speed = 1.0;            // 0: no pacing, as fast as the server answers
+    } REPLAY_OPTIONS;
+
+    typedef struct _CAPTURED_COMMAND
+    {
+        CAPTURE_RECORD Record;
+        std::string    Line;
+        uint64_t       RecordedUs = 0;
+        bool           Folded = false;
+    } CAPTURED_COMMAND;
+
+    typedef struct _CAPTURED_SESSION
+    {
+        uint32_t                      Id = 0;
+        std::vector<CAPTURED_COMMAND> Commands;
+    } CAPTURED_SESSION;
+
+    typedef struct _SESSION_RESULT
+    {
+        HISTOGRAM_SNAPSHOT Recorded[CommandCount];
+        HISTOGRAM_SNAPSHOT Replayed[CommandCount];
+        uint64_t           Errors[CommandCount] = { 0 };
+        HISTOGRAM_SNAPSHOT Lag;
+        uint64_t           Skipped = 0;
+        bool               Connected = false;
+    } SESSION_RESULT;
+
+    void Usage()
+    {
+        std::cout << "Usage: ftp-replay [--capture " CAPTURE_DEFAULT_FILE "] [--host 127.0.0.1] [--port 21]\n"
+            << "                  [--user <captured>] [--pass pass] [--speed 1]\n"
+            << "--speed 10 replays ten times faster than captured; --speed 0 does not pace at all.\n";
+    }
+
+    bool ParseOptions(int argc, char* argv[], REPLAY_OPTIONS& Options)
+    {
+        for (int i = 1; i < argc; i += 2)
+        {
+            std::string key = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+            std::string value = argv[i + 1];
+
+            if (key == "--capture") Options.Capture = value;
+            else if (key == "--host") Options.Host = value;
+            else if (key == "--port") Options.Port = value;
+            else if (key == "--user") Options.User = value;
+            else if (key == "--pass") Options.Password = value;
+            else if (key == "--speed") Options.Speed = std::atof(value.c_str());
+            else
+            {
+                return false;
+            }
+        }
+        return Options.Speed >= 0.0;
+    }
+
+    std::string Argument(const std::string& Line)
+    {
+        size_t separator = Line.find(' ');
+        return separator == std::string::npos ? std::string() : Line.substr(separator + 1);
+    }
+
+    bool IsTransfer(COMMAND_ID Id)
+    {
+        return Id == COMMAND_ID::List || Id == COMMAND_ID::Nlst || Id == COMMAND_ID::Retr || Id == COMMAND_ID::Stor;
+    }
+
+    bool LoadCapture(const std::string& Path, std::vector<CAPTURED_SESSION>& Sessions)
+    {
+        std::ifstream file(Path, std::ios::binary);
+        CAPTURE_FILE_HEADER header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            memcmp(header.Magic, CAPTURE_FILE_MAGIC, sizeof(header.Magic)) ||
+            header.Version != CAPTURE_FILE_VERSION ||
+            header.RecordSize != sizeof(CAPTURE_RECORD))
+        {
+            return false;
+        }
+
+        std::map<uint32_t, size_t> index;
+        CAPTURED_COMMAND command;
+        while (file.read(reinterpret_cast<char*>(&command.Record), sizeof(command.Record)))
+        {
+            command.Line.resize(command.Record.LineLength);
+            if (!file.read(command.Line.data(), command.Record.LineLength))
+            {
+                break;
+            }
+            command.RecordedUs = command.Record.LatencyUs;
+
+            auto [position, inserted] = index.try_emplace(command.Record.SessionId, Sessions.size());
+            if (inserted)
+            {
+                Sessions.push_back({ command.Record.SessionId, {} });
+            }
+            Sessions[position->second].Commands.push_back(command);
+        }
+
+        for (CAPTURED_SESSION& session : Sessions)
+        {
+            std::stable_sort(session.Commands.begin(), session.Commands.end(),
+                [](const CAPTURED_COMMAND& a, const CAPTURED_COMMAND& b) { return a.Record.Offset < b.Record.Offset; });
+
+            // FtpClient opens its own passive connection for every transfer, so a PASV,
+            // EPSV or PORT right before one is folded into it, latency included.
+            for (size_t i = 0; i + 1 < session.Commands.size(); ++i)
+            {
+                CAPTURED_COMMAND& current = session.Commands[i];
+                CAPTURED_COMMAND& next = session.Commands[i + 1];
+                if ((current.Record.Command == COMMAND_ID::Pasv || current.Record.Command == COMMAND_ID::Epsv || current.Record.Command == COMMAND_ID::Port) &&
+                    IsTransfer(next.Record.Command))
+                {
+                    current.Folded = true;
+                    next.RecordedUs += current.RecordedUs;
+                }
+            }
+        }
+        return true;
+    }
+
+    void RunSession(const REPLAY_OPTIONS& Options, const CAPTURED_SESSION& Session, const std::map<uint64_t, std::string>& Payloads,
+        std::chrono::steady_clock::time_point Epoch, uint64_t FirstOffset, SESSION_RESULT& Result)
+    {
+        auto scheduled = [&](const CAPTURED_COMMAND& Command)
+            {
+                if (Options.Speed == 0.0)
+                {
+                    return std::chrono::steady_clock::now();
+                }
+                double offset = static_cast<double>(Command.Record.Offset - FirstOffset) / Options.Speed;
+                return Epoch + std::chrono::microseconds(static_cast<int64_t>(offset));
+            };
+
+        std::istream nullInput(nullptr);
+        std::ostream nullOutput(nullptr);
+        FtpClient client(nullInput, nullOutput, nullOutput);
+
+        std::this_thread::sleep_until(scheduled(Session.Commands.front()));
+        if (!client.Connect(Options.Host, Options.Port))
+        {
+            return;
+        }
+        Result.Connected = true;
+
+        bool open = true;
+        for (const CAPTURED_COMMAND& command : Session.Commands)
+        {
+            if (!open)
+            {
+                break;
+            }
+            if (command.Folded)
+            {
+                continue;
+            }
+
+            if (command.Record.Event == CAPTURE_EVENT::SessionClosed)
+            {
+                std::this_thread::sleep_until(scheduled(command));
+                client.Disconnect(false);
+                open = false;
+                continue;
+            }
+
+            COMMAND_ID id = command.Record.Command;
+            if (id != COMMAND_ID::User && id != COMMAND_ID::Pass && id != COMMAND_ID::Type && id != COMMAND_ID::Pasv &&
+                id != COMMAND_ID::Epsv && id != COMMAND_ID::Port && !IsTransfer(id) && id != COMMAND_ID::Quit)
+            {
+                ++Result.Skipped;
+                continue;
+            }
+
+            auto due = scheduled(command);
+            std::this_thread::sleep_until(due);
+
+            std::string argument = Argument(command.Line);
+            bool succeeded = false;
+            auto start = std::chrono::steady_clock::now();
+            switch (id)
+            {
+            case COMMAND_ID::User:
+                succeeded = client.SendUser(Options.User.empty() ? argument : Options.User);
+                break;
+            case COMMAND_ID::Pass:
+                succeeded = client.SendPassword(Options.Password);
+                break;
+            case COMMAND_ID::Type:
+                succeeded = client.SetTransferMode(!argument.empty() && (argument[0] == 'I' || argument[0] == 'i'));
+                break;
+            case COMMAND_ID::List:
+            case COMMAND_ID::Nlst:
+                succeeded = client.ListFiles();
+                break;
+            case COMMAND_ID::Retr:
+                succeeded = client.DownloadFile(argument, NullDevice);
+                break;
+            case COMMAND_ID::Stor:
+                succeeded = client.UploadFile(Payloads.at(command.Record.TransferBytes), argument);
+                break;
+            case COMMAND_ID::Quit:
+                client.Disconnect(true);
+                succeeded = true;
+                open = false;
+                break;
+            default:
+                succeeded = client.EnterPassiveMode();
+                client.ClosePassiveMode();
+                break;
+            }
+            auto finished = std::chrono::steady_clock::now();
+
+            size_t op = static_cast<size_t>(id);
+            Result.Lag.Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(start - due).count()));
+            Result.Recorded[op].Record(command.RecordedUs);
+            if (succeeded)
+            {
+                Result.Replayed[op].Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(finished - start).count()));
+            }
+            else
+            {
+                ++Result.Errors[op];
+            }
+        }
+
+        if (open)
+        {
+            client.Disconnect(false);
+        }
+    }
+
+    bool WritePayload(const std::string& Path, uint64_t Size)
+    {
+        std::ofstream file(Path, std::ios::binary | std::ios::trunc);
+        std::vector<char> block(64 * 1024);
+        for (size_t i = 0; i < block.size(); ++i)
+        {
+            block[i] = static_cast<char>('A' + i % 26);
+        }
+        for (uint64_t remaining = Size; remaining;)
+        {
+            size_t chunk = static_cast<size_t>(remaining < block.size() ? remaining : block.size());
+            file.write(block.data(), static_cast<std::streamsize>(chunk));
+            remaining -= chunk;
+        }
+        return static_cast<bool>(file);
+    }
+
+    double Milliseconds(uint64_t Microseconds)
+    {
+        return static_cast<double>(Microseconds) / 1000.0;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    REPLAY_OPTIONS options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        Usage();
+        return 1;
+    }
+
+    std::vector<CAPTURED_SESSION> sessions;
+    if (!LoadCapture(options.Capture, sessions))
+    {
+        std::cerr << "Cannot read capture " << options.Capture << std::endl;
+        return 1;
+    }
+    if (sessions.empty())
+    {
+        std::cerr << "Capture " << options.Capture << " holds no sessions" << std::endl;
+        return 1;
+    }
+
+    // One local file per distinct STOR size, shared by every session.
+    std::map<uint64_t, std::string> payloads;
+    uint64_t firstOffset = UINT64_MAX;
+    uint64_t lastOffset = 0;
+    for (const CAPTURED_SESSION& session : sessions)
+    {
+        firstOffset = std::min(firstOffset, session.Commands.front().Record.Offset);
+        lastOffset = std::max(lastOffset, session.Commands.back().Record.Offset);
+        for (const CAPTURED_COMMAND& command : session.Commands)
+        {
+            if (command.Record.Command == COMMAND_ID::Stor && !payloads.contains(command.Record.TransferBytes))
+            {
+                std::string path = (std::filesystem::temp_directory_path() / ("ftp-replay-" + std::to_string(command.Record.TransferBytes) + ".bin")).string();
+                if (!WritePayload(path, command.Record.TransferBytes))
+                {
+                    std::cerr << "Cannot create payload file " << path << std::endl;
+                    return 1;
+                }
+                payloads.emplace(command.Record.TransferBytes, path);
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<SESSION_RESULT>> results;
+    std::vector<std::thread> threads;
+    auto epoch = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+    for (const CAPTURED_SESSION& session : sessions)
+    {
+        results.push_back(std::make_unique<SESSION_RESULT>());
+        threads.emplace_back(RunSession, std::cref(options), std::cref(session), std::cref(payloads), epoch, firstOffset, std::ref(*results.back()));
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+
+    std::unique_ptr<SESSION_RESULT> total = std::make_unique<SESSION_RESULT>();
+    uint32_t connected = 0;
+    for (const std::unique_ptr<SESSION_RESULT>& result : results)
+    {
+        for (size_t op = 0; op < CommandCount; ++op)
+        {
+            total->Recorded[op].Merge(result->Recorded[op]);
+            total->Replayed[op].Merge(result->Replayed[op]);
+            total->Errors[op] += result->Errors[op];
+        }
+        total->Lag.Merge(result->Lag);
+        total->Skipped += result->Skipped;
+        connected += result->Connected ? 1 : 0;
+    }
+
+    std::printf("sessions=%zu connected=%u captured_seconds=%.2f replay_seconds=%.2f speed=%.2f skipped_commands=%llu\n",
+        sessions.size(), connected, static_cast<double>(lastOffset - firstOffset) / 1e6, seconds, options.Speed,
+        static_cast<unsigned long long>(total->Skipped));
+    std::printf("schedule_lag_ms p50=%.3f p99=%.3f max=%.3f\n\n",
+        Milliseconds(total->Lag.Percentile(0.5)), Milliseconds(total->Lag.Percentile(0.99)), Milliseconds(total->Lag.Max));
+    std::printf("%-6s %8s %7s %12s %12s %12s %12s %12s %12s\n",
+        "op", "count", "errors", "rec_p50_ms", "p50_ms", "delta_p50", "rec_p99_ms", "p99_ms", "delta_p99");
+    for (size_t op = 0; op < CommandCount; ++op)
+    {
+        const HISTOGRAM_SNAPSHOT& recorded = total->Recorded[op];
+        const HISTOGRAM_SNAPSHOT& replayed = total->Replayed[op];
+        if (!recorded.Count)
+        {
+            continue;
+        }
+
+        double recordedP50 = Milliseconds(recorded.Percentile(0.5));
+        double recordedP99 = Milliseconds(recorded.Percentile(0.99));
+        double replayedP50 = Milliseconds(replayed.Percentile(0.5));
+        double replayedP99 = Milliseconds(replayed.Percentile(0.99));
+        std::printf("%-6s %8llu %7llu %12.3f %12.3f %+12.3f %12.3f %12.3f %+12.3f\n",
+            std::string(CommandName(static_cast<COMMAND_ID>(op))).c_str(),
+            static_cast<unsigned long long>(recorded.Count),
+            static_cast<unsigned long long>(total->Errors[op]),
+            recordedP50, replayedP50, replayedP50 - recordedP50,
+            recordedP99, replayedP99, replayedP99 - recordedP99);
+    }
+
+    for (const auto& [size, path] : payloads)
+    {
+        std::filesystem::remove(path);
+    }
+    return connected == sessions.size() ? 0 : 2;
+}
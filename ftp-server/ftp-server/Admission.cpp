@@ -0,0 +1,56 @@
+#include "Admission.h"
+
+VOID AdmissionControl::SetLimits(const ADMISSION_LIMITS& Limits)
+{
+    this->limits = Limits;
+}
+
+const ADMISSION_LIMITS& AdmissionControl::Limits() const
+{
+    return this->limits;
+}
+
+bool AdmissionControl::Admit(const IN_ADDR& Address, SHED_REASON& Reason)
+{
+    ULONG sessions = this->sessions.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (this->limits.MaxSessions && sessions > this->limits.MaxSessions)
+    {
+        this->sessions.fetch_sub(1, std::memory_order_relaxed);
+        Reason = SHED_REASON::MaxSessions;
+        return false;
+    }
+
+    if (this->limits.MaxSessionsPerAddress)
+    {
+        std::lock_guard<std::mutex> guard(this->addressLock);
+        ULONG& addressSessions = this->addressSessions[Address.s_addr];
+        if (addressSessions >= this->limits.MaxSessionsPerAddress)
+        {
+            this->sessions.fetch_sub(1, std::memory_order_relaxed);
+            Reason = SHED_REASON::PerAddress;
+            return false;
+        }
+        ++addressSessions;
+    }
+    return true;
+}
+
+VOID AdmissionControl::Release(const IN_ADDR& Address)
+{
+    this->sessions.fetch_sub(1, std::memory_order_relaxed);
+
+    if (this->limits.MaxSessionsPerAddress)
+    {
+        std::lock_guard<std::mutex> guard(this->addressLock);
+        auto entry = this->addressSessions.find(Address.s_addr);
+        if (entry != this->addressSessions.end() && --entry->second == 0)
+        {
+            this->addressSessions.erase(entry);
+        }
+    }
+}
+
+ULONG AdmissionControl::Sessions() const
+{
+    return this->sessions.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include "Metrics.h"
+#include "Platform.h"
+
+#define DEFAULT_MAX_SESSIONS                1024
+#define DEFAULT_MAX_SESSIONS_PER_ADDRESS    128
+#define DEFAULT_QUEUE_DEADLINE_MS           1000
+
+// 0 turns a limit off.
+typedef struct _ADMISSION_LIMITS
+{
+    ULONG MaxSessions = DEFAULT_MAX_SESSIONS;
+    ULONG MaxSessionsPerAddress = DEFAULT_MAX_SESSIONS_PER_ADDRESS;
+    ULONG QueueDeadlineMs = DEFAULT_QUEUE_DEADLINE_MS;
+} ADMISSION_LIMITS, * PADMISSION_LIMITS;
+
+// Decides at accept time whether a connection becomes a session. Every admitted
+// connection holds one slot against the server-wide limit and one against its
+// source address until Release(); a client over either limit is told 421 and
+// closed before it costs a task or a session context.
+class AdmissionControl
+{
+public:
+    AdmissionControl() = default;
+
+    AdmissionControl(_In_ const AdmissionControl& Other) = delete;
+    AdmissionControl& operator=(_In_ const AdmissionControl& Other) = delete;
+
+    // Not synchronized: call before the first Admit().
+    VOID SetLimits(const ADMISSION_LIMITS& Limits);
+    const ADMISSION_LIMITS& Limits() const;
+
+    bool Admit(const IN_ADDR& Address, SHED_REASON& Reason);
+    VOID Release(const IN_ADDR& Address);
+
+    // Sessions admitted and not yet released.
+    ULONG Sessions() const;
+
+private:
+    ADMISSION_LIMITS                    limits;
+    std::atomic<ULONG>                  sessions{ 0 };
+    std::mutex                          addressLock;
+    std::unordered_map<uint32_t, ULONG> addressSessions;
+};
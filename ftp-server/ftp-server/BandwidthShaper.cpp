@@ -0,0 +1,122 @@
+#include "BandwidthShaper.h"
+
+VOID BandwidthShaper::SetRates(const SHAPING_RATES& Rates)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->rates = Rates;
+    this->limited.store(Rates.Global || Rates.User || Rates.Session, std::memory_order_relaxed);
+}
+
+VOID BandwidthShaper::SetRate(SHAPING_LEVEL Level, uint64_t BytesPerSecond)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+    switch (Level)
+    {
+    case SHAPING_LEVEL::Global:
+        this->rates.Global = BytesPerSecond;
+        break;
+
+    case SHAPING_LEVEL::User:
+        this->rates.User = BytesPerSecond;
+        break;
+
+    default:
+        this->rates.Session = BytesPerSecond;
+        break;
+    }
+    this->limited.store(this->rates.Global || this->rates.User || this->rates.Session, std::memory_order_relaxed);
+}
+
+SHAPING_RATES BandwidthShaper::Rates()
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->rates;
+}
+
+VOID BandwidthShaper::Attach(SHAPED_FLOW& Flow, std::string_view User)
+{
+    Flow.Session = TOKEN_BUCKET();
+    Flow.Grant = 0;
+
+    std::lock_guard<std::mutex> guard(this->lock);
+    auto user = this->users.find(User);
+    if (user == this->users.end())
+    {
+        user = this->users.emplace(std::string(User), TOKEN_BUCKET()).first;
+    }
+    Flow.User = &user->second;
+}
+
+VOID BandwidthShaper::Detach(SHAPED_FLOW& Flow)
+{
+    if (Flow.Grant && this->limited.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (this->rates.Global)
+        {
+            this->global.Tokens += static_cast<double>(Flow.Grant);
+        }
+        if (this->rates.User && Flow.User)
+        {
+            Flow.User->Tokens += static_cast<double>(Flow.Grant);
+        }
+    }
+    Flow.Grant = 0;
+}
+
+bool BandwidthShaper::Replenish(SHAPED_FLOW& Flow, Clock::time_point Now, Clock::time_point& WakeAt)
+{
+    if (!this->limited.load(std::memory_order_relaxed))
+    {
+        Flow.Grant = SHAPER_QUANTUM;
+        return true;
+    }
+
+    std::lock_guard<std::mutex> guard(this->lock);
+    PTOKEN_BUCKET buckets[] = { &this->global, Flow.User, &Flow.Session };
+    uint64_t rates[] = { this->rates.Global, this->rates.User, this->rates.Session };
+
+    double wait = 0.0;
+    for (size_t level = 0; level < std::size(buckets); ++level)
+    {
+        if (!rates[level] || !buckets[level])
+        {
+            continue;
+        }
+        Refill(*buckets[level], rates[level], Now);
+        if (buckets[level]->Tokens < 0.0)
+        {
+            wait = std::max(wait, -buckets[level]->Tokens / static_cast<double>(rates[level]));
+        }
+    }
+    if (wait > 0.0)
+    {
+        WakeAt = Now + std::chrono::ceil<Clock::duration>(std::chrono::duration<double>(wait));
+        return false;
+    }
+
+    for (size_t level = 0; level < std::size(buckets); ++level)
+    {
+        if (rates[level] && buckets[level])
+        {
+            buckets[level]->Tokens -= SHAPER_QUANTUM;
+        }
+    }
+    Flow.Grant += SHAPER_QUANTUM;
+    return true;
+}
+
+// A bucket banks SHAPER_BURST_MS of its rate, and at least a quantum, so a flow
+// that wakes a timer tick late has lost nothing. A clock reading older than the
+// bucket's last update (another thread got the lock first) adds nothing.
+VOID BandwidthShaper::Refill(TOKEN_BUCKET& Bucket, uint64_t Rate, Clock::time_point Now)
+{
+    if (Now <= Bucket.Updated)
+    {
+        return;
+    }
+    double burst = std::max(static_cast<double>(SHAPER_QUANTUM), static_cast<double>(Rate) * SHAPER_BURST_MS / 1000.0);
+    double seconds = std::chrono::duration<double>(Now - Bucket.Updated).count();
+    Bucket.Tokens = std::min(burst, Bucket.Tokens + seconds * static_cast<double>(Rate));
+    Bucket.Updated = Now;
+}
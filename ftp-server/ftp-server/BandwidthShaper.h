@@ -0,0 +1,112 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include "Platform.h"
+
+#define SHAPER_QUANTUM      (16 * 1024)     // bytes a transfer takes from its buckets at a time
+#define SHAPER_BURST_MS     200             // unused rate a bucket banks, in milliseconds of it
+
+typedef enum class _SHAPING_LEVEL : BYTE
+{
+    Global = 0,
+    User = 1,
+    Session = 2,
+
+    MaxShapingLevel
+} SHAPING_LEVEL, * PSHAPING_LEVEL;
+
+// Bytes per second; 0 leaves a level unlimited.
+typedef struct _SHAPING_RATES
+{
+    uint64_t Global = 0ULL;     // every transfer on the server together
+    uint64_t User = 0ULL;       // each user's transfers together
+    uint64_t Session = 0ULL;    // each transfer on its own
+} SHAPING_RATES, * PSHAPING_RATES;
+
+// Tokens are bytes. A bucket can go into debt by up to one quantum, which is what
+// lets a transfer take a whole quantum the moment it has any credit at all: the
+// long-run rate stays exact and nobody waits for a bucket to fill to a threshold.
+typedef struct _TOKEN_BUCKET
+{
+    double                                Tokens = 0.0;
+    std::chrono::steady_clock::time_point Updated;     // the epoch, so a new bucket starts full
+} TOKEN_BUCKET, * PTOKEN_BUCKET;
+
+// One transfer's place in the hierarchy. Only the slice of the transfer that is
+// running touches Grant, and Session only under the shaper's lock.
+typedef struct _SHAPED_FLOW
+{
+    PTOKEN_BUCKET User = nullptr;
+    TOKEN_BUCKET  Session;
+    int64_t       Grant = 0LL;      // taken from the buckets and not yet moved; negative when overdrawn
+} SHAPED_FLOW, * PSHAPED_FLOW;
+
+// Hierarchical token buckets: a byte moves only when the global bucket, the user's
+// bucket and the session's bucket all have credit, so a user can be held to a share
+// of the uplink without a cap on what all users together get. Transfers take credit
+// a quantum at a time, so the lock is taken once per SHAPER_QUANTUM bytes and not
+// at all while every level is unlimited. A flow told to wait is expected to give
+// its thread back until WakeAt rather than sleep on it.
+//
+// Thread-safe. Rates can be changed at any time; flows pick them up at their next
+// quantum.
+class BandwidthShaper
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    BandwidthShaper() = default;
+
+    BandwidthShaper(_In_ const BandwidthShaper& Other) = delete;
+    BandwidthShaper& operator=(_In_ const BandwidthShaper& Other) = delete;
+
+    VOID SetRates(const SHAPING_RATES& Rates);
+    VOID SetRate(SHAPING_LEVEL Level, uint64_t BytesPerSecond);
+    SHAPING_RATES Rates();
+
+    // Starts Flow for a transfer by User. A user's bucket is kept for the life of
+    // the shaper, so only a user's first transfer allocates.
+    VOID Attach(SHAPED_FLOW& Flow, std::string_view User);
+
+    // Returns credit Flow took and did not use, or charges what it overdrew.
+    VOID Detach(SHAPED_FLOW& Flow);
+
+    // How many of Want bytes Flow may move now, at least one while it has credit.
+    // 0 means it has none and cannot get any before WakeAt.
+    size_t Allow(SHAPED_FLOW& Flow, size_t Want, Clock::time_point& WakeAt)
+    {
+        if (Flow.Grant <= 0 && !this->Replenish(Flow, Clock::now(), WakeAt))
+        {
+            return 0;
+        }
+        return static_cast<size_t>(std::min<int64_t>(Flow.Grant, static_cast<int64_t>(Want)));
+    }
+
+    // Bytes moved. May exceed what Allow() returned by less than a quantum, for
+    // callers that can only move whole records; the overdraft comes out of the
+    // next quantum.
+    static VOID Spend(SHAPED_FLOW& Flow, size_t Bytes)
+    {
+        Flow.Grant -= static_cast<int64_t>(Bytes);
+    }
+
+    // Takes a quantum for Flow from every limited level, or works out when each of
+    // them will be out of debt.
+    bool Replenish(SHAPED_FLOW& Flow, Clock::time_point Now, Clock::time_point& WakeAt);
+
+private:
+    static VOID Refill(TOKEN_BUCKET& Bucket, uint64_t Rate, Clock::time_point Now);
+
+    std::atomic<bool>                                   limited{ false };
+    std::mutex                                          lock;
+    SHAPING_RATES                                       rates;
+    TOKEN_BUCKET                                        global;
+    std::map<std::string, TOKEN_BUCKET, std::less<>>    users;
+};
@@ -0,0 +1,139 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Packs a 3-4 letter verb into a uint32_t, folding it to upper case on the way.
+// Returns 0 for anything that cannot be a verb, which never matches a table slot.
+constexpr uint32_t PackVerb(std::string_view Verb)
+{
+    if (Verb.size() < 3 || Verb.size() > 4)
+    {
+        return 0;
+    }
+
+    uint32_t packed = 0;
+    for (size_t i = 0; i < Verb.size(); ++i)
+    {
+        char c = Verb[i];
+        if (c >= 'a' && c <= 'z')
+        {
+            c = static_cast<char>(c - ('a' - 'A'));
+        }
+        else if (c < 'A' || c > 'Z')
+        {
+            return 0;
+        }
+        packed |= static_cast<uint32_t>(static_cast<unsigned char>(c)) << (i * 8);
+    }
+    return packed;
+}
+
+// Splits a command line (CRLF already stripped) into verb and argument. Both views
+// point into Line, so nothing is copied.
+constexpr void SplitCommand(std::string_view Line, std::string_view& Verb, std::string_view& Argument)
+{
+    size_t separatorPosition = Line.find(' ');
+    Verb = Line.substr(0, separatorPosition);
+    Argument = separatorPosition != std::string_view::npos ? Line.substr(separatorPosition + 1) : std::string_view();
+}
+
+template <typename Target>
+struct VERB_ENTRY
+{
+    std::string_view Verb;
+    Target           Value;
+};
+
+// Perfect-hash table from packed verbs to handlers. The multiplier is searched for at
+// compile time, so adding a verb only means adding an entry; IsValid() turns a failed
+// search (or a duplicate/invalid verb) into a static_assert at the definition site.
+template <typename Target, size_t Count>
+class CommandTable
+{
+    static constexpr size_t ComputeBits()
+    {
+        size_t bits = 1;
+        while ((size_t{ 1 } << bits) < Count * 2)
+        {
+            ++bits;
+        }
+        return bits;
+    }
+
+public:
+    static constexpr size_t Bits = ComputeBits();
+    static constexpr size_t Size = size_t{ 1 } << Bits;
+
+    constexpr CommandTable(const VERB_ENTRY<Target>(&Entries)[Count])
+    {
+        uint32_t keys[Count] = {};
+        for (size_t i = 0; i < Count; ++i)
+        {
+            keys[i] = PackVerb(Entries[i].Verb);
+            if (!keys[i])
+            {
+                return;
+            }
+        }
+
+        uint32_t candidate = 0x9E3779B1U;
+        for (int attempt = 0; attempt < (1 << 16); ++attempt)
+        {
+            candidate = candidate * 1664525U + 1013904223U;
+            uint32_t multiplier = candidate | 1U;
+
+            bool used[Size] = {};
+            bool collision = false;
+            for (size_t i = 0; i < Count && !collision; ++i)
+            {
+                size_t index = IndexOf(keys[i], multiplier);
+                collision = used[index];
+                used[index] = true;
+            }
+
+            if (!collision)
+            {
+                this->seed = multiplier;
+                for (size_t i = 0; i < Count; ++i)
+                {
+                    SLOT& slot = this->slots[IndexOf(keys[i], multiplier)];
+                    slot.Key = keys[i];
+                    slot.Value = Entries[i].Value;
+                }
+                return;
+            }
+        }
+    }
+
+    constexpr bool IsValid() const
+    {
+        return this->seed != 0;
+    }
+
+    constexpr const Target* Find(std::string_view Verb) const
+    {
+        return this->Find(PackVerb(Verb));
+    }
+
+    constexpr const Target* Find(uint32_t Key) const
+    {
+        const SLOT& slot = this->slots[IndexOf(Key, this->seed)];
+        return (Key && slot.Key == Key) ? &slot.Value : nullptr;
+    }
+
+private:
+    struct SLOT
+    {
+        uint32_t Key = 0;
+        Target   Value = {};
+    };
+
+    static constexpr size_t IndexOf(uint32_t Key, uint32_t Multiplier)
+    {
+        return static_cast<size_t>(static_cast<uint32_t>(Key * Multiplier) >> (32 - Bits));
+    }
+
+    uint32_t seed = 0;
+    SLOT     slots[Size] = {};
+};
@@ -1,40 +1,251 @@
 #include "FtpServer.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <stdexcept>
 
 
-FtpServer::FtpServer()
+// Every path a session builds starts with the root, and the xferlog records
+// absolute ones, so the root is resolved once, against the working directory the
+// server starts in.
+InternedString ResolveRoot()
+{
+    CHAR root[MAX_PATH];
+    return StringTable::Intern(Platform::FullPath(FTP_ROOT_DIRECTORY, root) ? root : FTP_ROOT_DIRECTORY);
+}
+
+FtpServer::FtpServer() : rootDirectory(ResolveRoot()), transfers(TRANSFER_THREADS)
 {
     //srand(static_cast<ULONG>(time(nullptr)));
 
-    this->threadPool = std::make_unique<BS::thread_pool_light>(16);
+    Logger::Start();
+    TransferLog::Start();
 
-    WSADATA wsaData = { 0 };
-    int status = WSAStartup(MAKEWORD(2, 2), &wsaData);
-    if (status)
+    if (!Platform::StartSockets())
     {
-        const std::string& message = "WSAStartup failed with status " + std::to_string(status);
-        throw std::exception(message.c_str());
+        const std::string& message = "socket startup failed with error " + std::to_string(Platform::SocketError());
+        throw std::runtime_error(message);
     }
 }
 
 FtpServer::~FtpServer()
 {
-    int status = closesocket(this->listenSocket);
-    if (status == SOCKET_ERROR)
+    this->metricsPoller.Stop();
+    if (this->metricsThread.joinable())
+    {
+        this->metricsThread.join();
+    }
+    if (this->metricsSocket != INVALID_SOCKET)
     {
-        const std::string& message = "closesocket failed with status " + std::to_string(WSAGetLastError());
-        std::cout << message.c_str() << std::endl;
+        Platform::CloseSocket(this->metricsSocket);
+    }
+
+    // The handoff sockets belong to this process alone, so shutting them down is
+    // safe and wakes the threads blocked on them.
+    if (this->handoffListener != INVALID_SOCKET)
+    {
+        shutdown(this->handoffListener, SD_BOTH);
+    }
+    if (this->takeoverChannel != INVALID_SOCKET)
+    {
+        shutdown(this->takeoverChannel, SD_BOTH);
+    }
+    if (this->handoffThread.joinable())
+    {
+        this->handoffThread.join();
+    }
+    if (this->takeoverThread.joinable())
+    {
+        this->takeoverThread.join();
+    }
+    if (this->handoffListener != INVALID_SOCKET)
+    {
+        Platform::CloseSocket(this->handoffListener);
+    }
+    if (this->takeoverChannel != INVALID_SOCKET)
+    {
+        Platform::CloseSocket(this->takeoverChannel);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(this->handBackLock);
+        this->stopping.store(true, std::memory_order_relaxed);
+    }
+    for (const std::unique_ptr<ACCEPTOR_SHARD>& shard : this->shards)
+    {
+        shard->Acceptor.Stop();
+        shard->Poller.Stop();
+    }
+    for (const std::unique_ptr<ACCEPTOR_SHARD>& shard : this->shards)
+    {
+        if (shard->Thread.joinable())
+        {
+            shard->Thread.join();
+        }
+        if (shard->PollerThread.joinable())
+        {
+            shard->PollerThread.join();
+        }
+        if (shard->OwnsSocket && shard->ListenSocket != INVALID_SOCKET && Platform::CloseSocket(shard->ListenSocket) == SOCKET_ERROR)
+        {
+            LogEvent(LOG_LEVEL::Error, "closesocket_failed").Field("error", Platform::SocketError());
+        }
+    }
+
+    // Session tasks still running use their shard's slots and spare workspaces and may
+    // queue a transfer, so the session pools go first. Transfers finishing since
+    // stopping was set close their session instead of handing it back to a shard.
+    for (const std::unique_ptr<ACCEPTOR_SHARD>& shard : this->shards)
+    {
+        shard->Sessions.reset();
+    }
+    this->transfers.wait();
+    this->shards.clear();
+
+    Platform::StopSockets();
+
+    SessionCapture::Stop();
+    TransferLog::Stop();
+    Logger::Stop();
+}
+
+VOID
+FtpServer::Start(const LISTENER_OPTIONS& Options)
+{
+    this->admission.SetLimits(Options.Admission);
+    this->timeouts = Options.Timeouts;
+    this->drainSeconds = Options.DrainSeconds;
+    this->shaper.SetRates(Options.Rates);
+    {
+        std::lock_guard<std::mutex> guard(this->bulkLock);
+        for (const auto& [user, weight] : Options.Weights)
+        {
+            this->bulkTransfers.SetWeight(user, weight);
+        }
+    }
+
+    // A process taking over serves the listeners it is handed, one shard per
+    // listener at least, so none of the old process's SO_REUSEPORT group is left
+    // without an acceptor.
+    std::vector<SOCKET> inherited;
+    SOCKET inheritedMetrics = INVALID_SOCKET;
+    if (Options.TakeoverPath)
+    {
+        this->takeoverChannel = this->TakeOver(Options.TakeoverPath, inherited, inheritedMetrics);
+        if (this->takeoverChannel == INVALID_SOCKET)
+        {
+            return;
+        }
+    }
+
+    ULONG shardCount = Options.Shards ? Options.Shards : std::max(1U, std::thread::hardware_concurrency());
+    shardCount = std::max(shardCount, static_cast<ULONG>(inherited.size()));
+    bool portSharing = inherited.empty() ? shardCount > 1 : inherited.size() > 1;
+    ULONG sessionThreads = (SESSION_THREADS + shardCount - 1) / shardCount;
+
+    for (ULONG index = 0; index < shardCount; ++index)
+    {
+        std::unique_ptr<ACCEPTOR_SHARD> shard = std::make_unique<ACCEPTOR_SHARD>();
+        shard->Server = this;
+        shard->Index = index;
+        if (!inherited.empty())
+        {
+            shard->ListenSocket = inherited[index % inherited.size()];
+            shard->OwnsSocket = index < inherited.size();
+        }
+        else if (index == 0 || portSharing)
+        {
+            shard->ListenSocket = OpenListener(Options.Port, portSharing);
+            if (shard->ListenSocket == INVALID_SOCKET)
+            {
+                return;
+            }
+            shard->OwnsSocket = true;
+        }
+        else
+        {
+            shard->ListenSocket = this->shards.front()->ListenSocket;
+        }
+        if (shard->OwnsSocket)
+        {
+            Platform::SetBlocking(shard->ListenSocket, false);
+        }
+        shard->Sessions = std::make_unique<InstrumentedPool>(sessionThreads);
+        this->shards.push_back(std::move(shard));
+    }
+
+    LogEvent(LOG_LEVEL::Info, "server_listening")
+        .Field("port", Options.Port)
+        .Field("shards", shardCount)
+        .Field("port_sharing", static_cast<uint64_t>(portSharing))
+        .Field("session_threads", sessionThreads)
+        .Field("transfer_threads", static_cast<ULONG>(TRANSFER_THREADS))
+        .Field("max_sessions", Options.Admission.MaxSessions)
+        .Field("max_sessions_per_address", Options.Admission.MaxSessionsPerAddress)
+        .Field("queue_deadline_ms", Options.Admission.QueueDeadlineMs)
+        .Field("idle_timeout_s", Options.Timeouts.IdleSeconds)
+        .Field("login_timeout_s", Options.Timeouts.LoginSeconds)
+        .Field("stall_timeout_s", Options.Timeouts.DataStallSeconds)
+        .Field("drain_s", Options.DrainSeconds)
+        .Field("taken_over", static_cast<uint64_t>(!inherited.empty()));
+    // Its own line, as server_listening already fills LOG_MESSAGE_LENGTH.
+    LogEvent(LOG_LEVEL::Info, "transfer_policy")
+        .Field("rate_global", Options.Rates.Global)
+        .Field("rate_user", Options.Rates.User)
+        .Field("rate_session", Options.Rates.Session)
+        .Field("weighted_users", static_cast<uint64_t>(Options.Weights.size()));
+
+    this->StartMetricsEndpoint(inheritedMetrics);
+    for (const std::unique_ptr<ACCEPTOR_SHARD>& shard : this->shards)
+    {
+        shard->PollerThread = std::thread(&FtpServer::PollSessions, this, std::ref(*shard));
+        shard->Thread = std::thread(&FtpServer::HandleConnections, this, std::ref(*shard), Options.PinShards);
+    }
+    if (this->takeoverChannel != INVALID_SOCKET)
+    {
+        this->takeoverThread = std::thread(&FtpServer::ReceiveSessions, this);
+    }
+    if (Options.HandoffPath)
+    {
+        this->handoffPath = Options.HandoffPath;
+        this->handoffListener = Platform::OpenLocalListener(Options.HandoffPath);
+        if (this->handoffListener == INVALID_SOCKET)
+        {
+            LogEvent(LOG_LEVEL::Error, "handoff_unsupported").Field("path", Options.HandoffPath).Field("error", Platform::SocketError());
+        }
+        else
+        {
+            this->handoffThread = std::thread(&FtpServer::WaitForTakeover, this);
+        }
     }
 
-    status = WSACleanup();
-    if (status)
     {
-        const std::string& message = "WSACleanup failed with status " + std::to_string(WSAGetLastError());
-        std::cout << message.c_str() << std::endl;
+        std::unique_lock<std::mutex> lock(this->stopLock);
+        this->stopRequested.wait(lock, [this] { return this->drainMode != DRAIN_MODE::None; });
     }
+    this->Drain();
 }
 
 VOID
-FtpServer::Start()
+FtpServer::RequestStop()
+{
+    std::lock_guard<std::mutex> guard(this->stopLock);
+    if (this->drainMode == DRAIN_MODE::None)
+    {
+        this->drainMode = DRAIN_MODE::Close;
+    }
+    else
+    {
+        this->drainAborted = true;
+    }
+    this->stopRequested.notify_all();
+}
+
+// PortSharing asks for SO_REUSEPORT and comes back false if the platform does not
+// balance connections across sockets sharing a port.
+SOCKET
+FtpServer::OpenListener(PCSTR Port, bool& PortSharing)
 {
     ADDRINFOA hints = { 0 };
     hints.ai_family = AF_INET;
@@ -43,726 +254,2200 @@ FtpServer::Start()
     hints.ai_flags = AI_PASSIVE;
 
     PADDRINFOA result = nullptr;
-    int status = getaddrinfo(NULL, DEFAULT_PORT, &hints, &result);
+    int status = getaddrinfo(NULL, Port, &hints, &result);
     if (status)
     {
-        std::cout << "getaddrinfo failed with status " << status << std::endl;
-        return;
+        LogEvent(LOG_LEVEL::Error, "getaddrinfo_failed").Field("error", status);
+        return INVALID_SOCKET;
     }
 
-    this->listenSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-    if (this->listenSocket == INVALID_SOCKET)
+    SOCKET listenSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (listenSocket == INVALID_SOCKET)
     {
-        std::cout << "socket failed with status " << WSAGetLastError() << std::endl;
+        LogEvent(LOG_LEVEL::Error, "socket_failed").Field("error", Platform::SocketError());
         freeaddrinfo(result);
-        return;
+        return INVALID_SOCKET;
     }
 
-    status = bind(this->listenSocket, result->ai_addr, (int)result->ai_addrlen);
+    PortSharing = PortSharing && Platform::EnablePortSharing(listenSocket);
+
+    status = bind(listenSocket, result->ai_addr, (int)result->ai_addrlen);
     if (status == SOCKET_ERROR)
     {
-        std::cout << "bind failed with status " << WSAGetLastError() << std::endl;
+        LogEvent(LOG_LEVEL::Error, "bind_failed").Field("error", Platform::SocketError());
         freeaddrinfo(result);
-        return;
+        Platform::CloseSocket(listenSocket);
+        return INVALID_SOCKET;
     }
 
     freeaddrinfo(result);
 
-    status = listen(this->listenSocket, SOMAXCONN);
+    status = listen(listenSocket, SOMAXCONN);
     if (status == SOCKET_ERROR)
     {
-        std::cout << "listen failed with status " << WSAGetLastError() << std::endl;
+        LogEvent(LOG_LEVEL::Error, "listen_failed").Field("error", Platform::SocketError());
+        Platform::CloseSocket(listenSocket);
+        return INVALID_SOCKET;
+    }
+
+    return listenSocket;
+}
+
+VOID
+FtpServer::HandleConnections(ACCEPTOR_SHARD& Shard, bool Pin)
+{
+    // Shard N and its session workers share CPU N, so a connection is accepted and
+    // served on the same core.
+    if (Pin)
+    {
+        ULONG cpu = Shard.Index % std::max(1U, std::thread::hardware_concurrency());
+        bool pinned = Platform::PinCurrentThread(cpu);
+        Shard.Sessions->RunOnEachWorker([cpu] { Platform::PinCurrentThread(cpu); });
+        LogEvent(LOG_LEVEL::Info, "acceptor_pinned").Field("shard", Shard.Index).Field("cpu", cpu).Field("pinned", static_cast<uint64_t>(pinned));
+    }
+
+    while (!this->stopping.load(std::memory_order_relaxed) && !this->draining.load(std::memory_order_relaxed))
+    {
+        SOCKADDR_IN clientInfo = { 0 };
+        SOCKET clientSocket = AcceptNext(Shard.Acceptor, Shard.ListenSocket, &clientInfo);
+        if (clientSocket == INVALID_SOCKET)
+        {
+            break;
+        }
+
+        Metrics::ConnectionAccepted();
+        SHED_REASON reason = SHED_REASON::MaxSessions;
+        if (!this->admission.Admit(clientInfo.sin_addr, reason))
+        {
+            ShedConnection(clientSocket, clientInfo.sin_addr, reason);
+            continue;
+        }
+
+        Platform::DisableNagle(clientSocket);
+        Shard.Sessions->PushTask([this, &Shard, clientSocket, clientInfo, accepted = std::chrono::steady_clock::now()]
+            {
+                // By the time a worker gets to a connection that has queued this
+                // long, the client has probably given up; refusing it drains the
+                // backlog faster than serving it would.
+                ULONG deadline = this->admission.Limits().QueueDeadlineMs;
+                if (deadline && std::chrono::steady_clock::now() - accepted > std::chrono::milliseconds(deadline))
+                {
+                    ShedConnection(clientSocket, clientInfo.sin_addr, SHED_REASON::QueueDeadline);
+                    this->admission.Release(clientInfo.sin_addr);
+                    return;
+                }
+
+                CHAR clientIP[INET_ADDRSTRLEN] = { 0 };
+                inet_ntop(AF_INET, &clientInfo.sin_addr, clientIP, INET_ADDRSTRLEN);
+                LogEvent(LOG_LEVEL::Info, "client_connected").Field("ip", clientIP).Field("socket", static_cast<uint64_t>(clientSocket));
+
+                PCLIENT_CONTEXT clientContext = this->NewSession(Shard, clientSocket, clientInfo.sin_addr, accepted);
+
+                this->SendReply(*clientContext, Replies::ServiceReady);
+                if (!this->FlushReplies(*clientContext) || !this->ParkSession(*clientContext))
+                {
+                    this->EndSession(clientContext);
+                }
+            });
+    }
+}
+
+// Listening sockets are non-blocking. The poller only comes into it when the backlog
+// is empty, and stopping the poller is how an accept loop is told to return; the
+// socket it hands back is blocking, like every session socket.
+SOCKET
+FtpServer::AcceptNext(SocketPoller& Poller, SOCKET Listener, SOCKADDR_IN* Address)
+{
+    while (true)
+    {
+        socklen_t addressSize = sizeof(*Address);
+        SOCKET socket = accept(Listener, reinterpret_cast<PSOCKADDR>(Address), &addressSize);
+        if (socket != INVALID_SOCKET)
+        {
+            Platform::SetBlocking(socket, true);
+            return socket;
+        }
+
+        int error = Platform::SocketError();
+        if (error != WSAEWOULDBLOCK)
+        {
+            LogEvent(LOG_LEVEL::Error, "accept_failed").Field("error", error);
+        }
+
+        POLL_KEY ready = 1;
+        ULONG count = 0;
+        if (!Poller.Arm(Listener, ready) || !Poller.Wait(&ready, 1, INFINITE, count))
+        {
+            return INVALID_SOCKET;
+        }
+    }
+}
+
+// A new session is Busy, with a workspace to greet the client from.
+PCLIENT_CONTEXT
+FtpServer::NewSession(ACCEPTOR_SHARD& Shard, SOCKET Socket, const IN_ADDR& Address, std::chrono::steady_clock::time_point Connected)
+{
+    PCLIENT_CONTEXT clientContext = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(Shard.SessionLock);
+        SESSION_HANDLE handle = INVALID_SESSION_HANDLE;
+        clientContext = Shard.Slots.Allocate(Socket, std::chrono::steady_clock::now(), handle);
+        clientContext->Handle = handle;
+        AttachWorkspace(Shard, *clientContext);
+    }
+
+    clientContext->Socket = Socket;
+    clientContext->Shard = &Shard;
+    clientContext->CurrentDir = this->rootDirectory;
+    clientContext->IPv4 = Address;
+    clientContext->Connected = Connected;
+    clientContext->ControlTimer.Context = clientContext;
+    clientContext->DataTimer.Context = clientContext;
+    Metrics::SessionStarted();
+    return clientContext;
+}
+
+// The caller holds Shard.SessionLock.
+VOID
+FtpServer::AttachWorkspace(ACCEPTOR_SHARD& Shard, CLIENT_CONTEXT& ClientContext)
+{
+    if (ClientContext.Work)
+    {
+        return;
+    }
+    if (Shard.SpareWorkspaces.empty())
+    {
+        ClientContext.Work = std::make_unique<SESSION_WORKSPACE>();
+        return;
+    }
+    ClientContext.Work = std::move(Shard.SpareWorkspaces.back());
+    Shard.SpareWorkspaces.pop_back();
+}
+
+// The caller holds Shard.SessionLock. A session holding part of a command line
+// keeps its workspace, and one that ended in the middle of a transfer takes it
+// along to be freed.
+VOID
+FtpServer::DetachWorkspace(ACCEPTOR_SHARD& Shard, CLIENT_CONTEXT& ClientContext)
+{
+    SESSION_WORKSPACE* work = ClientContext.Work.get();
+    if (!work || work->ReceiveLength || work->Transfer.Kind != TRANSFER_KIND::None)
+    {
+        return;
+    }
+    work->Output.SegmentCount = 0;
+    work->Output.StorageLength = 0;
+    if (Shard.SpareWorkspaces.size() < WORKSPACE_SPARES)
+    {
+        Shard.SpareWorkspaces.push_back(std::move(ClientContext.Work));
+    }
+    ClientContext.Work.reset();
+}
+
+// Sessions only occupy a worker while there is something to do: the poller hands a
+// session to the shard's pool when its control connection becomes readable, and the
+// task re-arms it when it has handled every complete command. Between batches the
+// poller also runs the shard's timers, sleeping until the next one is due.
+VOID
+FtpServer::PollSessions(ACCEPTOR_SHARD& Shard)
+{
+    POLL_KEY ready[POLL_BATCH];
+    PCLIENT_CONTEXT readySessions[POLL_BATCH];
+    ULONG count = 0;
+    ULONG timeout = INFINITE;
+    std::vector<std::pair<PCLIENT_CONTEXT, SESSION_TIMEOUT>> closing;
+    std::vector<PCLIENT_CONTEXT> resuming;
+    while (Shard.Poller.Wait(ready, POLL_BATCH, timeout, count))
+    {
+        auto now = std::chrono::steady_clock::now();
+        {
+            // A session a drain has already taken out of the poller may still be
+            // reported once; it is no longer Parked and belongs to the drain.
+            std::lock_guard<std::mutex> guard(Shard.SessionLock);
+            for (ULONG i = 0; i < count; ++i)
+            {
+                PCLIENT_CONTEXT clientContext = Shard.Slots.Resolve(ready[i]);
+                if (!clientContext || Shard.Slots.State(ready[i]) != SESSION_STATE::Parked)
+                {
+                    readySessions[i] = nullptr;
+                    continue;
+                }
+                Shard.Slots.SetState(ready[i], SESSION_STATE::Busy, now);
+                Shard.Timers.Cancel(clientContext->ControlTimer);
+                AttachWorkspace(Shard, *clientContext);
+                readySessions[i] = clientContext;
+            }
+            Shard.Timers.Expire(now, [&](TIMER& Timer) { this->ExpireTimer(Shard, Timer, now, closing, resuming); });
+            timeout = Shard.Timers.MillisecondsUntilNext(now);
+            Shard.PollerWakeAt = timeout == INFINITE ? std::chrono::steady_clock::time_point::max() : now + std::chrono::milliseconds(timeout);
+        }
+
+        // One captured pointer, so with the pool's queue timestamp the task still fits
+        // std::function's inline storage and WorkStealingPool queues it without
+        // allocating. BS::thread_pool_light wraps it in std::bind, which does not fit.
+        for (ULONG i = 0; i < count; ++i)
+        {
+            PCLIENT_CONTEXT clientContext = readySessions[i];
+            if (clientContext)
+            {
+                Shard.Sessions->PushTask([clientContext] { clientContext->Shard->Server->ServeSession(*clientContext); });
+            }
+        }
+        for (const auto& [clientContext, kind] : closing)
+        {
+            Shard.Sessions->PushTask([this, clientContext, kind] { this->TimeOutSession(*clientContext, kind); });
+        }
+        closing.clear();
+        for (PCLIENT_CONTEXT clientContext : resuming)
+        {
+            this->QueueTransfer(*clientContext);
+        }
+        resuming.clear();
+    }
+}
+
+// Hands an idle session to the poller with its control timer running. The timer is
+// set first and both happen under the session lock, so the poller never sees the
+// session readable without a timer to cancel, or expires a timer whose socket it
+// cannot disarm. Once the server is draining an idle session is retired instead.
+bool
+FtpServer::ParkSession(CLIENT_CONTEXT& ClientContext)
+{
+    ACCEPTOR_SHARD& shard = *ClientContext.Shard;
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    if (this->timeouts.IdleSeconds)
+    {
+        deadline = std::chrono::steady_clock::now() + std::chrono::seconds(this->timeouts.IdleSeconds);
+    }
+    if (this->timeouts.LoginSeconds && ClientContext.Access == CLIENT_ACCESS::NotLoggedIn)
+    {
+        deadline = std::min(deadline, ClientContext.Connected + std::chrono::seconds(this->timeouts.LoginSeconds));
+    }
+
+    std::unique_lock<std::mutex> lock(shard.SessionLock);
+    if (this->draining.load(std::memory_order_relaxed))
+    {
+        lock.unlock();
+        this->RetireSession(ClientContext);
+        return true;
+    }
+    if (deadline != std::chrono::steady_clock::time_point::max())
+    {
+        ArmTimer(shard, ClientContext.ControlTimer, deadline);
+    }
+    DetachWorkspace(shard, ClientContext);
+    shard.Slots.SetState(ClientContext.Handle, SESSION_STATE::Parked, std::chrono::steady_clock::now());
+    if (shard.Poller.Arm(ClientContext.Socket, ClientContext.Handle))
+    {
+        return true;
+    }
+    shard.Slots.SetState(ClientContext.Handle, SESSION_STATE::Busy, std::chrono::steady_clock::now());
+    shard.Timers.Cancel(ClientContext.ControlTimer);
+    AttachWorkspace(shard, ClientContext);
+    return false;
+}
+
+// The caller holds Shard.SessionLock.
+VOID
+FtpServer::ArmTimer(ACCEPTOR_SHARD& Shard, TIMER& Timer, std::chrono::steady_clock::time_point Deadline)
+{
+    Shard.Timers.Schedule(Timer, Deadline);
+    if (Deadline < Shard.PollerWakeAt)
+    {
+        Shard.PollerWakeAt = Deadline;
+        Shard.Poller.Wake();
+    }
+}
+
+// Runs on the poller thread under the session lock. A stall timer re-arms itself
+// while the transfer is still moving bytes, so a transfer that stops is caught
+// between one and two stall timeouts later; a stalled one has its data socket shut
+// down, which fails the blocked accept, send or recv on the transfer pool. A resume
+// timer means a shaped transfer has credit again and goes back to the transfer pool.
+// An expired control timer means the session is parked: it leaves the poller here
+// and is closed by a task on the shard's pool.
+VOID
+FtpServer::ExpireTimer(ACCEPTOR_SHARD& Shard, TIMER& Timer, std::chrono::steady_clock::time_point Now, std::vector<std::pair<PCLIENT_CONTEXT, SESSION_TIMEOUT>>& Closing, std::vector<PCLIENT_CONTEXT>& Resuming)
+{
+    PCLIENT_CONTEXT clientContext = static_cast<PCLIENT_CONTEXT>(Timer.Context);
+    if (clientContext->Work && &Timer == &clientContext->Work->Transfer.ResumeTimer)
+    {
+        Resuming.push_back(clientContext);
+        return;
+    }
+    if (&Timer == &clientContext->DataTimer)
+    {
+        PENDING_TRANSFER& transfer = clientContext->Work->Transfer;
+        uint64_t progress = transfer.Progress.load(std::memory_order_relaxed);
+        if (progress != transfer.CheckedProgress)
+        {
+            transfer.CheckedProgress = progress;
+            Shard.Timers.Schedule(Timer, Now + std::chrono::seconds(this->timeouts.DataStallSeconds));
+            return;
+        }
+
+        transfer.Stalled.store(true, std::memory_order_relaxed);
+        if (transfer.DataSocket != INVALID_SOCKET)
+        {
+            shutdown(transfer.DataSocket, SD_BOTH);
+        }
+        Metrics::SessionTimedOut(SESSION_TIMEOUT::DataStall);
+        LogEvent(LOG_LEVEL::Warning, "transfer_stalled").Field("socket", static_cast<uint64_t>(clientContext->Socket)).Field("bytes", progress);
         return;
     }
 
-    std::cout << "Server is ready and listening on port " << DEFAULT_PORT << std::endl;
+    Shard.Slots.SetState(clientContext->Handle, SESSION_STATE::Busy, Now);
+    Shard.Poller.Disarm(clientContext->Socket);
+    AttachWorkspace(Shard, *clientContext);
+    bool login = this->timeouts.LoginSeconds && clientContext->Access == CLIENT_ACCESS::NotLoggedIn &&
+        Now >= clientContext->Connected + std::chrono::seconds(this->timeouts.LoginSeconds);
+    Closing.emplace_back(clientContext, login ? SESSION_TIMEOUT::Login : SESSION_TIMEOUT::Idle);
+}
+
+VOID
+FtpServer::TimeOutSession(CLIENT_CONTEXT& ClientContext, SESSION_TIMEOUT Timeout)
+{
+    Metrics::SessionTimedOut(Timeout);
+    LogEvent(LOG_LEVEL::Info, "session_timeout").Field("socket", static_cast<uint64_t>(ClientContext.Socket)).Field("kind", SessionTimeoutName(Timeout));
+
+    this->SendReply(ClientContext, Timeout == SESSION_TIMEOUT::Login ? Replies::LoginTimeout : Replies::IdleTimeout);
+    this->FlushReplies(ClientContext);
+    this->EndSession(&ClientContext);
+}
+
+// 421 goes out with a plain send: a freshly accepted socket has an empty send
+// buffer, so it cannot block the accept loop.
+VOID
+FtpServer::ShedConnection(SOCKET Socket, const IN_ADDR& Address, SHED_REASON Reason)
+{
+    Metrics::ConnectionShed(Reason);
+
+    CHAR clientIP[INET_ADDRSTRLEN] = { 0 };
+    inet_ntop(AF_INET, &Address, clientIP, INET_ADDRSTRLEN);
+    LogEvent(LOG_LEVEL::Warning, "connection_shed").Field("ip", clientIP).Field("reason", ShedReasonName(Reason));
+
+    SendBuffer(Socket, Replies::TooManyConnections.Wire.data(), Replies::TooManyConnections.Wire.size());
+    Platform::CloseSocket(Socket);
+}
+
+VOID
+FtpServer::EndSession(PCLIENT_CONTEXT ClientContext)
+{
+    Metrics::SessionEnded();
+    this->admission.Release(ClientContext->IPv4);
+
+    if (ClientContext->CaptureSession && SessionCapture::IsEnabled())
+    {
+        SessionCapture::Record(ClientContext->CaptureSession, CAPTURE_EVENT::SessionClosed, COMMAND_ID::Unknown, {}, 0, 0);
+    }
+
+    if (ClientContext->DataSocket != INVALID_SOCKET)
+    {
+        Platform::CloseSocket(ClientContext->DataSocket);
+    }
+
+    Platform::CloseSocket(ClientContext->Socket);
+
+    ACCEPTOR_SHARD& shard = *ClientContext->Shard;
+    std::lock_guard<std::mutex> guard(shard.SessionLock);
+    if (ClientContext->Work)
+    {
+        ClientContext->Work->ReceiveLength = 0;
+        ClientContext->Work->ReceiveOffset = 0;
+        DetachWorkspace(shard, *ClientContext);
+    }
+    shard.Slots.Release(ClientContext->Handle);
+}
+
+// Prometheus scrape endpoint on the loopback interface. Each connection gets the
+// current metrics as a plain HTTP/1.0 response, whatever it asked for. A process
+// that took over reuses the old process's listener rather than racing it for the
+// port.
+VOID
+FtpServer::StartMetricsEndpoint(SOCKET Inherited)
+{
+    this->metricsSocket = Inherited;
+    if (this->metricsSocket == INVALID_SOCKET)
+    {
+        this->metricsSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (this->metricsSocket == INVALID_SOCKET)
+        {
+            LogEvent(LOG_LEVEL::Error, "metrics_socket_failed").Field("error", Platform::SocketError());
+            return;
+        }
+
+        SOCKADDR_IN address = { .sin_family = AF_INET, .sin_port = htons(METRICS_PORT) };
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(this->metricsSocket, reinterpret_cast<PSOCKADDR>(&address), sizeof(address)) == SOCKET_ERROR ||
+            listen(this->metricsSocket, SOMAXCONN) == SOCKET_ERROR)
+        {
+            LogEvent(LOG_LEVEL::Error, "metrics_listen_failed").Field("error", Platform::SocketError());
+            Platform::CloseSocket(this->metricsSocket);
+            this->metricsSocket = INVALID_SOCKET;
+            return;
+        }
+    }
+    Platform::SetBlocking(this->metricsSocket, false);
 
-    this->HandleConnections();
+    LogEvent(LOG_LEVEL::Info, "metrics_listening").Field("port", METRICS_PORT);
+    this->metricsThread = std::thread(&FtpServer::ServeMetrics, this);
 }
 
 VOID
-FtpServer::HandleConnections()
+FtpServer::ServeMetrics()
 {
     while (true)
     {
-        SOCKADDR_IN clientInfo = { 0 };
-        int clientInfoSize = sizeof(clientInfo);
-        SOCKET* clientSocket = new SOCKET(accept(this->listenSocket, reinterpret_cast<PSOCKADDR>(&clientInfo), &clientInfoSize));
-        if (*clientSocket == INVALID_SOCKET)
+        SOCKADDR_IN scraper = { 0 };
+        SOCKET scrapeSocket = AcceptNext(this->metricsPoller, this->metricsSocket, &scraper);
+        if (scrapeSocket == INVALID_SOCKET)
         {
-            std::cout << "accept failed with status " << WSAGetLastError() << std::endl;
-            closesocket(*clientSocket);
-            delete clientSocket;
+            return;
         }
-        else
+
+        CHAR request[DEFAULT_BUFLEN];
+        recv(scrapeSocket, request, sizeof(request), 0);
+
+        std::string body;
+        Metrics::RenderPrometheus(body);
+
+        TextBuffer<MESSAGE_MAX_LENGTH> header;
+        header.Append("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ")
+            .Append(body.size())
+            .Append("\r\nConnection: close\r\n\r\n");
+        SendBuffer(scrapeSocket, header.View().data(), header.View().size());
+        SendBuffer(scrapeSocket, body.data(), body.size());
+        Platform::CloseSocket(scrapeSocket);
+    }
+}
+
+// Stops accepting, lets every session finish what it is doing and then closes it,
+// or hands it to the process that took over. Sessions still open when the drain
+// deadline passes are listed and have their sockets shut down.
+VOID
+FtpServer::Drain()
+{
+    DRAIN_MODE mode = DRAIN_MODE::Close;
+    {
+        std::lock_guard<std::mutex> guard(this->stopLock);
+        mode = this->drainMode;
+    }
+    if (mode == DRAIN_MODE::Handoff && !this->SendListeners(this->handoffChannel))
+    {
+        mode = DRAIN_MODE::Close;
+    }
+    this->handingOff.store(mode == DRAIN_MODE::Handoff, std::memory_order_relaxed);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(this->drainSeconds);
+    LogEvent(LOG_LEVEL::Info, "drain_started")
+        .Field("mode", mode == DRAIN_MODE::Handoff ? "handoff" : "close")
+        .Field("sessions", this->admission.Sessions())
+        .Field("deadline_s", this->drainSeconds);
+
+    this->draining.store(true, std::memory_order_relaxed);
+    for (const std::unique_ptr<ACCEPTOR_SHARD>& shard : this->shards)
+    {
+        shard->Acceptor.Stop();
+    }
+    for (const std::unique_ptr<ACCEPTOR_SHARD>& shard : this->shards)
+    {
+        if (shard->Thread.joinable())
+        {
+            shard->Thread.join();
+        }
+        if (shard->OwnsSocket)
+        {
+            Platform::CloseSocket(shard->ListenSocket);
+        }
+        shard->ListenSocket = INVALID_SOCKET;
+    }
+
+    // The path now belongs to the process that took over, if there is one.
+    if (this->handoffListener != INVALID_SOCKET)
+    {
+        shutdown(this->handoffListener, SD_BOTH);
+        if (this->handoffThread.joinable())
+        {
+            this->handoffThread.join();
+        }
+        Platform::CloseSocket(this->handoffListener);
+        this->handoffListener = INVALID_SOCKET;
+        if (mode != DRAIN_MODE::Handoff)
+        {
+            std::remove(this->handoffPath.c_str());
+        }
+    }
+
+    this->RetireParkedSessions();
+    {
+        std::unique_lock<std::mutex> lock(this->stopLock);
+        while (this->admission.Sessions() && !this->drainAborted && std::chrono::steady_clock::now() < deadline)
+        {
+            this->stopRequested.wait_for(lock, std::chrono::milliseconds(DRAIN_POLL_MS));
+        }
+    }
+
+    ULONG remaining = this->admission.Sessions();
+    if (remaining)
+    {
+        LogEvent(LOG_LEVEL::Warning, "drain_deadline").Field("sessions", remaining);
+        this->ReportRemainingSessions();
+        auto grace = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (this->admission.Sessions() && std::chrono::steady_clock::now() < grace)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_POLL_MS));
+        }
+    }
+
+    if (mode == DRAIN_MODE::Handoff)
+    {
+        std::lock_guard<std::mutex> guard(this->handoffLock);
+        HANDOFF_MESSAGE message = { .Kind = HANDOFF_KIND::End };
+        Platform::SendWithSockets(this->handoffChannel, &message, sizeof(message), nullptr, 0);
+        Platform::CloseSocket(this->handoffChannel);
+        this->handoffChannel = INVALID_SOCKET;
+    }
+
+    LogEvent(LOG_LEVEL::Info, "drain_finished")
+        .Field("handed_off", this->sessionsHandedOff.load(std::memory_order_relaxed))
+        .Field("closed", this->sessionsClosed.load(std::memory_order_relaxed))
+        .Field("cut_off", remaining);
+}
+
+// Sessions waiting in a poller are taken out of it here; the rest are retired by
+// ParkSession when their current batch or transfer is done.
+VOID
+FtpServer::RetireParkedSessions()
+{
+    std::vector<PCLIENT_CONTEXT> parked;
+    for (const std::unique_ptr<ACCEPTOR_SHARD>& shard : this->shards)
+    {
+        {
+            std::lock_guard<std::mutex> guard(shard->SessionLock);
+            auto now = std::chrono::steady_clock::now();
+            shard->Slots.ForEach(SESSION_STATE::Parked, now, [&](SESSION_HANDLE Handle, CLIENT_CONTEXT& ClientContext, SOCKET Socket, uint32_t)
+                {
+                    shard->Poller.Disarm(Socket);
+                    shard->Timers.Cancel(ClientContext.ControlTimer);
+                    AttachWorkspace(*shard, ClientContext);
+                    parked.push_back(&ClientContext);
+                    shard->Slots.SetState(Handle, SESSION_STATE::Busy, now);
+                });
+        }
+        for (PCLIENT_CONTEXT clientContext : parked)
+        {
+            shard->Sessions->PushTask([this, clientContext] { this->RetireSession(*clientContext); });
+        }
+        parked.clear();
+    }
+}
+
+VOID
+FtpServer::RetireSession(CLIENT_CONTEXT& ClientContext)
+{
+    if (this->handingOff.load(std::memory_order_relaxed) && this->HandOffSession(ClientContext))
+    {
+        this->sessionsHandedOff.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    this->SendReply(ClientContext, Replies::ShuttingDown);
+    this->FlushReplies(ClientContext);
+    this->sessionsClosed.fetch_add(1, std::memory_order_relaxed);
+    this->EndSession(&ClientContext);
+}
+
+// Shutting the sockets down under the session lock keeps the descriptors from being
+// closed and reused underneath; the tasks blocked on them fail and end the session.
+VOID
+FtpServer::ReportRemainingSessions()
+{
+    static constexpr PCSTR transferKinds[] = { "none", "listing", "download", "upload" };
+    static_assert(std::size(transferKinds) == static_cast<size_t>(TRANSFER_KIND::MaxTransferKind));
+
+    for (const std::unique_ptr<ACCEPTOR_SHARD>& shard : this->shards)
+    {
+        std::lock_guard<std::mutex> guard(shard->SessionLock);
+        shard->Slots.ForEach(std::chrono::steady_clock::now(), [&](SESSION_HANDLE, CLIENT_CONTEXT& ClientContext, SOCKET Socket, uint32_t Seconds)
+            {
+                CHAR clientIP[INET_ADDRSTRLEN] = { 0 };
+                inet_ntop(AF_INET, &ClientContext.IPv4, clientIP, INET_ADDRSTRLEN);
+                LogEvent event(LOG_LEVEL::Warning, "session_remaining");
+                event.Field("socket", static_cast<uint64_t>(Socket))
+                    .Field("ip", clientIP)
+                    .Field("user", ClientContext.UserName.View())
+                    .Field("busy_s", Seconds);
+
+                if (ClientContext.Work)
+                {
+                    PENDING_TRANSFER& transfer = ClientContext.Work->Transfer;
+                    event.Field("transfer", transferKinds[static_cast<size_t>(transfer.Kind)])
+                        .Field("bytes", transfer.Progress.load(std::memory_order_relaxed));
+                    if (transfer.DataSocket != INVALID_SOCKET)
+                    {
+                        shutdown(transfer.DataSocket, SD_BOTH);
+                    }
+                }
+                shutdown(Socket, SD_BOTH);
+            });
+    }
+}
+
+// A newer process connecting to the handoff path starts the drain in handoff mode.
+VOID
+FtpServer::WaitForTakeover()
+{
+    SOCKET channel = accept(this->handoffListener, NULL, NULL);
+    if (channel == INVALID_SOCKET)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(this->stopLock);
+    if (this->drainMode != DRAIN_MODE::None)
+    {
+        Platform::CloseSocket(channel);
+        return;
+    }
+    LogEvent(LOG_LEVEL::Info, "takeover_requested").Field("path", this->handoffPath);
+    this->handoffChannel = channel;
+    this->drainMode = DRAIN_MODE::Handoff;
+    this->stopRequested.notify_all();
+}
+
+// The listeners stay open in both processes, so connections queued in the backlog
+// are accepted by one or the other and none is refused.
+bool
+FtpServer::SendListeners(SOCKET Channel)
+{
+    SOCKET listeners[HANDOFF_MAX_LISTENERS + 1];
+    ULONG count = 0;
+    for (const std::unique_ptr<ACCEPTOR_SHARD>& shard : this->shards)
+    {
+        if (shard->OwnsSocket && count < HANDOFF_MAX_LISTENERS)
+        {
+            listeners[count++] = shard->ListenSocket;
+        }
+    }
+
+    HANDOFF_MESSAGE message = { .Kind = HANDOFF_KIND::Listeners, .MetricsListener = this->metricsSocket != INVALID_SOCKET };
+    if (message.MetricsListener)
+    {
+        listeners[count++] = this->metricsSocket;
+    }
+    if (!Platform::SendWithSockets(Channel, &message, sizeof(message), listeners, count))
+    {
+        LogEvent(LOG_LEVEL::Error, "handoff_failed").Field("error", Platform::SocketError());
+        Platform::CloseSocket(Channel);
+        this->handoffChannel = INVALID_SOCKET;
+        return false;
+    }
+
+    // The new process serves metrics from here on.
+    if (message.MetricsListener)
+    {
+        this->metricsPoller.Stop();
+        if (this->metricsThread.joinable())
+        {
+            this->metricsThread.join();
+        }
+        Platform::CloseSocket(this->metricsSocket);
+        this->metricsSocket = INVALID_SOCKET;
+    }
+    return true;
+}
+
+// Called with the session idle: no transfer, no complete command waiting. Once a
+// send fails the rest of the drain closes sessions instead.
+bool
+FtpServer::HandOffSession(CLIENT_CONTEXT& ClientContext)
+{
+    HANDOFF_MESSAGE message = {
+        .Kind = HANDOFF_KIND::Session,
+        .Access = ClientContext.Access,
+        .TransferType = ClientContext.TransferType,
+        .AgeMs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - ClientContext.Connected).count()),
+        .ReceiveLength = ClientContext.Work->ReceiveLength };
+    std::string_view userName = ClientContext.UserName.View();
+    std::string_view currentDir = ClientContext.CurrentDir.View();
+    memcpy(message.UserName, userName.data(), std::min(userName.size(), sizeof(message.UserName) - 1));
+    memcpy(message.CurrentDir, currentDir.data(), std::min(currentDir.size(), sizeof(message.CurrentDir) - 1));
+    memcpy(message.Address, &ClientContext.IPv4, sizeof(message.Address));
+    memcpy(message.ReceiveBuffer, ClientContext.Work->ReceiveBuffer, ClientContext.Work->ReceiveLength);
+
+    {
+        std::lock_guard<std::mutex> guard(this->handoffLock);
+        if (this->handoffChannel == INVALID_SOCKET ||
+            !Platform::SendWithSockets(this->handoffChannel, &message, sizeof(message), &ClientContext.Socket, 1))
+        {
+            if (this->handingOff.exchange(false, std::memory_order_relaxed))
+            {
+                LogEvent(LOG_LEVEL::Error, "handoff_failed").Field("error", Platform::SocketError());
+            }
+            return false;
+        }
+    }
+
+    LogEvent(LOG_LEVEL::Info, "session_handed_off").Field("socket", static_cast<uint64_t>(ClientContext.Socket)).Field("user", ClientContext.UserName.View());
+    this->EndSession(&ClientContext);
+    return true;
+}
+
+// Connects to a running server's handoff path and takes its listeners. The
+// channel stays open for the sessions that follow.
+SOCKET
+FtpServer::TakeOver(PCSTR Path, std::vector<SOCKET>& Listeners, SOCKET& MetricsListener)
+{
+    SOCKET channel = Platform::ConnectLocal(Path);
+    if (channel == INVALID_SOCKET)
+    {
+        LogEvent(LOG_LEVEL::Error, "takeover_failed").Field("path", Path).Field("error", Platform::SocketError());
+        return INVALID_SOCKET;
+    }
+
+    HANDOFF_MESSAGE message;
+    SOCKET sockets[HANDOFF_MAX_LISTENERS + 1];
+    ULONG count = 0;
+    if (!Platform::ReceiveWithSockets(channel, &message, sizeof(message), sockets, static_cast<ULONG>(std::size(sockets)), count) ||
+        message.Magic != HANDOFF_MAGIC || message.Version != HANDOFF_VERSION || message.Kind != HANDOFF_KIND::Listeners ||
+        count < (message.MetricsListener ? 2UL : 1UL))
+    {
+        for (ULONG i = 0; i < count; ++i)
+        {
+            Platform::CloseSocket(sockets[i]);
+        }
+        LogEvent(LOG_LEVEL::Error, "takeover_failed").Field("path", Path).Field("error", "bad listeners message");
+        Platform::CloseSocket(channel);
+        return INVALID_SOCKET;
+    }
+
+    if (message.MetricsListener)
+    {
+        MetricsListener = sockets[--count];
+    }
+    Listeners.assign(sockets, sockets + count);
+    LogEvent(LOG_LEVEL::Info, "takeover_listeners").Field("path", Path).Field("listeners", count);
+    return channel;
+}
+
+// Adopts the sessions the old process sends until it is done. Each one is admitted
+// like a new connection, picks up where it left off without a new greeting and
+// keeps its login deadline.
+VOID
+FtpServer::ReceiveSessions()
+{
+    HANDOFF_MESSAGE message;
+    SOCKET socket = INVALID_SOCKET;
+    ULONG count = 0;
+    ULONG adopted = 0;
+    size_t next = 0;
+    while (Platform::ReceiveWithSockets(this->takeoverChannel, &message, sizeof(message), &socket, 1, count))
+    {
+        if (message.Kind == HANDOFF_KIND::End)
+        {
+            break;
+        }
+        if (message.Kind != HANDOFF_KIND::Session || count != 1 || message.ReceiveLength > sizeof(message.ReceiveBuffer))
+        {
+            if (count)
+            {
+                Platform::CloseSocket(socket);
+            }
+            continue;
+        }
+
+        IN_ADDR address = { 0 };
+        memcpy(&address, message.Address, sizeof(address));
+        SHED_REASON reason = SHED_REASON::MaxSessions;
+        if (!this->admission.Admit(address, reason))
+        {
+            ShedConnection(socket, address, reason);
+            continue;
+        }
+
+        ACCEPTOR_SHARD& shard = *this->shards[next++ % this->shards.size()];
+        PCLIENT_CONTEXT clientContext = this->NewSession(shard, socket, address, std::chrono::steady_clock::now() - std::chrono::milliseconds(message.AgeMs));
+        message.UserName[sizeof(message.UserName) - 1] = '\0';
+        message.CurrentDir[sizeof(message.CurrentDir) - 1] = '\0';
+        clientContext->Access = message.Access;
+        clientContext->TransferType = message.TransferType;
+        clientContext->UserName = StringTable::Intern(message.UserName);
+        if (clientContext->CurrentDir.View() != message.CurrentDir)
+        {
+            clientContext->CurrentDir = StringTable::Intern(message.CurrentDir);
+        }
+        memcpy(clientContext->Work->ReceiveBuffer, message.ReceiveBuffer, message.ReceiveLength);
+        clientContext->Work->ReceiveLength = message.ReceiveLength;
+        ++adopted;
+
+        shard.Sessions->PushTask([this, clientContext] { this->ProcessPending(*clientContext); });
+    }
+
+    LogEvent(LOG_LEVEL::Info, "takeover_finished").Field("sessions", adopted);
+}
+
+VOID
+FtpServer::ServeSession(CLIENT_CONTEXT& ClientContext)
+{
+    SESSION_WORKSPACE& work = *ClientContext.Work;
+    int status = recv(ClientContext.Socket,
+        work.ReceiveBuffer + work.ReceiveLength,
+        static_cast<int>(sizeof(work.ReceiveBuffer) - work.ReceiveLength),
+        0);
+    if (!status)
+    {
+        LogEvent(LOG_LEVEL::Info, "client_disconnected").Field("socket", static_cast<uint64_t>(ClientContext.Socket));
+        this->EndSession(&ClientContext);
+        return;
+    }
+    else if (status < 0)
+    {
+        LogEvent(LOG_LEVEL::Warning, "recv_failed").Field("socket", static_cast<uint64_t>(ClientContext.Socket)).Field("error", Platform::SocketError());
+        this->EndSession(&ClientContext);
+        return;
+    }
+    work.ReceiveLength += static_cast<ULONG>(status);
+    Metrics::AddBytesIn(static_cast<uint64_t>(status));
+
+    this->ProcessPending(ClientContext);
+}
+
+// Handles the complete commands in the receive buffer. A command that starts a data
+// transfer ends the batch: the transfer goes to the transfer pool, which hands the
+// session back here when it is done, and the commands behind it wait in the buffer.
+VOID
+FtpServer::ProcessPending(CLIENT_CONTEXT& ClientContext)
+{
+    SESSION_WORKSPACE& work = *ClientContext.Work;
+    std::string_view pending(work.ReceiveBuffer + work.ReceiveOffset, work.ReceiveLength - work.ReceiveOffset);
+    size_t lineEnd = 0;
+    while (work.Transfer.Kind == TRANSFER_KIND::None && (lineEnd = pending.find("\r\n")) != std::string_view::npos)
+    {
+        this->ProcessCommand(pending.substr(0, lineEnd), ClientContext);
+        pending.remove_prefix(lineEnd + 2);
+    }
+
+    bool stopping = this->stopping.load(std::memory_order_relaxed);
+    if (work.Transfer.Kind != TRANSFER_KIND::None)
+    {
+        if (!stopping)
+        {
+            work.ReceiveOffset = work.ReceiveLength - static_cast<ULONG>(pending.size());
+            this->QueueTransfer(ClientContext);
+            return;
+        }
+
+        // Set up just as the server stopped: the transfer pool is going away, so the
+        // transfer never runs and its 150 gets a 426 here.
+        work.Transfer.Reset();
+        work.Arena.release();
+        Metrics::TransferError();
+        this->SendReply(ClientContext, Replies::TransferAborted);
+    }
+
+    if (pending.size() == sizeof(work.ReceiveBuffer))
+    {
+        this->SendReply(ClientContext, Replies::LineTooLong);
+        pending = {};
+    }
+
+    memmove(work.ReceiveBuffer, pending.data(), pending.size());
+    work.ReceiveLength = static_cast<ULONG>(pending.size());
+    work.ReceiveOffset = 0;
+
+    if (!this->FlushReplies(ClientContext) || stopping || !this->ParkSession(ClientContext))
+    {
+        this->EndSession(&ClientContext);
+    }
+}
+
+// Listings are short and someone is usually waiting on them, so they go ahead of
+// bulk file transfers and run to the end. File transfers take turns through the
+// deficit round-robin scheduler instead, a quantum per unit of their user's weight
+// at a time, so a small file queued behind large ones starts within a round rather
+// than after them. std::priority_queue keeps no order among equal priorities, so
+// every normal-priority task runs whichever transfer the scheduler says is next.
+// Returning is for a transfer that used up its turn and has more to move.
+VOID
+FtpServer::QueueTransfer(CLIENT_CONTEXT& ClientContext, bool Returning)
+{
+    if (ClientContext.Work->Transfer.Kind == TRANSFER_KIND::Listing)
+    {
+        this->transfers.detach_task([this, &ClientContext] { this->RunTransfer(ClientContext); }, BS::pr::high);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(this->bulkLock);
+        this->bulkTransfers.Push(&ClientContext, ClientContext.Work->Transfer.Schedule, ClientContext.UserName.View(), Returning);
+    }
+    this->transfers.detach_task([this] { this->RunNextBulkTransfer(); }, BS::pr::normal);
+}
+
+// Every push detaches exactly one of these, so the line is never empty here.
+VOID
+FtpServer::RunNextBulkTransfer()
+{
+    PCLIENT_CONTEXT clientContext = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(this->bulkLock);
+        this->bulkTransfers.Pop(clientContext);
+    }
+    this->RunTransfer(*clientContext);
+}
+
+// Runs on the transfer pool, one slice at a time when the shaper holds the transfer
+// back or its turn with the scheduler is up. The command's latency and capture
+// record cover the whole transfer, pauses included, as they did when it ran inline.
+VOID
+FtpServer::RunTransfer(CLIENT_CONTEXT& ClientContext)
+{
+    PENDING_TRANSFER& transfer = ClientContext.Work->Transfer;
+    if (transfer.Connection == INVALID_SOCKET)
+    {
+        this->StartStallTimer(ClientContext);
+        this->shaper.Attach(transfer.Flow, ClientContext.UserName.View());
+        transfer.Transferred = 0;
+    }
+
+    TRANSFER_STEP step = TRANSFER_STEP::Finished;
+    switch (transfer.Kind)
+    {
+    case TRANSFER_KIND::Download:
+        step = this->SendFile(ClientContext);
+        break;
+
+    case TRANSFER_KIND::Upload:
+        step = this->ReceiveFile(ClientContext);
+        break;
+
+    default:
+        step = this->SendListing(ClientContext);
+        break;
+    }
+    if (step == TRANSFER_STEP::Yielded)
+    {
+        this->QueueTransfer(ClientContext, true);
+        return;
+    }
+    if (step == TRANSFER_STEP::Paused)
+    {
+        this->PauseTransfer(ClientContext);
+        return;
+    }
+    this->shaper.Detach(transfer.Flow);
+    transfer.Schedule = SCHEDULED_FLOW();
+    this->StopStallTimer(ClientContext);
+
+    uint64_t latency = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - transfer.Received).count());
+    Metrics::RecordCommand(transfer.Command, latency);
+    CaptureCommand(ClientContext, transfer.Line, transfer.Verb, transfer.Command, latency);
+
+    transfer.File = INVALID_FILE_HANDLE;     // the finished slice closed it
+    transfer.Reset();
+    ClientContext.Work->Arena.release();
+
+    // Under the lock, so the session pools are still there when this hands back.
+    {
+        std::lock_guard<std::mutex> guard(this->handBackLock);
+        if (!this->stopping.load(std::memory_order_relaxed))
+        {
+            PCLIENT_CONTEXT clientContext = &ClientContext;
+            ClientContext.Shard->Sessions->PushTask([clientContext] { clientContext->Shard->Server->ProcessPending(*clientContext); });
+            return;
+        }
+    }
+    this->FlushReplies(ClientContext);
+    this->EndSession(&ClientContext);
+}
+
+// The transfer gives its worker back and waits in the shard's timer wheel, which
+// queues it again once the shaper's buckets have the credit. The stall timer keeps
+// running, so a transfer held back for longer than the stall timeout is aborted. The
+// poller can take the transfer as soon as the lock is dropped, so nothing after it
+// may touch the session.
+VOID
+FtpServer::PauseTransfer(CLIENT_CONTEXT& ClientContext)
+{
+    Metrics::TransferThrottled();
+    PENDING_TRANSFER& transfer = ClientContext.Work->Transfer;
+    transfer.ResumeTimer.Context = &ClientContext;
+    std::lock_guard<std::mutex> guard(ClientContext.Shard->SessionLock);
+    ArmTimer(*ClientContext.Shard, transfer.ResumeTimer, transfer.ResumeAt);
+}
+
+// Replies are queued in the session's output buffer and written with a single
+// gathered send per command batch. Dynamic text is copied into the buffer's storage,
+// while catalogue replies and the CRLF terminator are segments pointing at
+// static storage.
+bool FtpServer::SendString(CLIENT_CONTEXT& ClientContext, std::string_view Message)
+{
+    static CHAR crlf[] = "\r\n";
+
+    OUTPUT_BUFFER& output = ClientContext.Work->Output;
+    bool terminated = Message.ends_with("\r\n");
+    ULONG segmentsNeeded = terminated ? 1UL : 2UL;
+
+    if (output.SegmentCount + segmentsNeeded > OUTPUT_MAX_SEGMENTS || output.StorageLength + Message.size() > OUTPUT_STORAGE_LENGTH)
+    {
+        if (!this->FlushReplies(ClientContext))
+        {
+            return false;
+        }
+    }
+
+    if (Message.size() > OUTPUT_STORAGE_LENGTH)
+    {
+        output.Segments[output.SegmentCount++] = MakeSegment(Message.data(), Message.size());
+        if (!terminated)
+        {
+            output.Segments[output.SegmentCount++] = MakeSegment(crlf, 2);
+        }
+        return this->FlushReplies(ClientContext);
+    }
+
+    PCHAR storage = output.Storage + output.StorageLength;
+    memcpy(storage, Message.data(), Message.size());
+    output.StorageLength += static_cast<ULONG>(Message.size());
+    output.Segments[output.SegmentCount++] = MakeSegment(storage, Message.size());
+    if (!terminated)
+    {
+        output.Segments[output.SegmentCount++] = MakeSegment(crlf, 2);
+    }
+    return true;
+}
+
+bool FtpServer::SendReply(CLIENT_CONTEXT& ClientContext, const REPLY& Reply)
+{
+    OUTPUT_BUFFER& output = ClientContext.Work->Output;
+    if (output.SegmentCount == OUTPUT_MAX_SEGMENTS && !this->FlushReplies(ClientContext))
+    {
+        return false;
+    }
+
+    output.Segments[output.SegmentCount++] = MakeSegment(Reply.Wire.data(), Reply.Wire.size());
+    return true;
+}
+
+bool FtpServer::FlushReplies(CLIENT_CONTEXT& ClientContext)
+{
+    OUTPUT_BUFFER& output = ClientContext.Work->Output;
+    bool status = true;
+
+    ULONG first = 0;
+    while (first < output.SegmentCount)
+    {
+        size_t bytesSent = 0;
+        if (!Platform::SendSegments(ClientContext.Socket, output.Segments + first, output.SegmentCount - first, bytesSent) || !bytesSent)
+        {
+            LogEvent(LOG_LEVEL::Warning, "send_failed").Field("socket", static_cast<uint64_t>(ClientContext.Socket)).Field("error", Platform::SocketError());
+            status = false;
+            break;
+        }
+        Metrics::AddBytesOut(bytesSent);
+
+        while (first < output.SegmentCount && bytesSent >= SegmentLength(output.Segments[first]))
+        {
+            bytesSent -= SegmentLength(output.Segments[first]);
+            ++first;
+        }
+        if (bytesSent)
+        {
+            AdvanceSegment(output.Segments[first], bytesSent);
+        }
+    }
+
+    output.SegmentCount = 0;
+    output.StorageLength = 0;
+    return status;
+}
+
+bool FtpServer::SendBuffer(const SOCKET& Socket, const CHAR* Buffer, size_t Length)
+{
+    while (Length)
+    {
+        int chunk = Length > INT_MAX ? INT_MAX : static_cast<int>(Length);
+        int bytesSent = send(Socket, Buffer, chunk, 0);
+        if (bytesSent == SOCKET_ERROR)
+        {
+            return false;
+        }
+        Metrics::AddBytesOut(static_cast<uint64_t>(bytesSent));
+        Buffer += bytesSent;
+        Length -= static_cast<size_t>(bytesSent);
+    }
+    return true;
+}
+
+void FtpServer::ProcessCommand(std::string_view Command, CLIENT_CONTEXT& ClientContext)
+{
+    std::string_view command;
+    std::string_view argument;
+    SplitCommand(Command, command, argument);
+
+    LogEvent(LOG_LEVEL::Info, "command")
+        .Field("socket", static_cast<uint64_t>(ClientContext.Socket))
+        .Field("verb", command)
+        .Field("argument", PackVerb(command) == PackVerb("PASS") ? std::string_view("***") : argument);
+
+    const COMMAND_HANDLER* handler = FindCommand(command);
+    if (!handler)
+    {
+        LogEvent(LOG_LEVEL::Info, "unsupported_command").Field("socket", static_cast<uint64_t>(ClientContext.Socket)).Field("verb", command);
+        this->SendReply(ClientContext, Replies::NotImplemented);
+        Metrics::RecordCommand(COMMAND_ID::Unknown, 0);
+        CaptureCommand(ClientContext, Command, command, COMMAND_ID::Unknown, 0);
+        return;
+    }
+
+    if (ClientContext.Access < handler->RequiredAccess)
+    {
+        this->SendReply(ClientContext, ClientContext.Access == CLIENT_ACCESS::NotLoggedIn
+            ? Replies::NotLoggedIn
+            : Replies::PermissionDenied);
+        Metrics::RecordCommand(handler->Id, 0);
+        CaptureCommand(ClientContext, Command, command, handler->Id, 0);
+        return;
+    }
+
+    ClientContext.TransferBytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    (this->*handler->Routine)(ClientContext, argument);
+    PENDING_TRANSFER& transfer = ClientContext.Work->Transfer;
+    if (transfer.Kind != TRANSFER_KIND::None)
+    {
+        transfer.Command = handler->Id;
+        transfer.Line = Command;
+        transfer.Verb = command;
+        transfer.Received = start;
+        return;
+    }
+    ClientContext.Work->Arena.release();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    Metrics::RecordCommand(handler->Id, static_cast<uint64_t>(elapsed.count()));
+    CaptureCommand(ClientContext, Command, command, handler->Id, static_cast<uint64_t>(elapsed.count()));
+}
+
+// Sessions already open when capture starts are picked up at their next command.
+// The password never reaches the capture file; the replayer supplies its own.
+VOID FtpServer::CaptureCommand(CLIENT_CONTEXT& ClientContext, std::string_view Line, std::string_view Verb, COMMAND_ID Id, uint64_t LatencyUs)
+{
+    if (!SessionCapture::IsEnabled())
+    {
+        return;
+    }
+
+    if (!ClientContext.CaptureSession)
+    {
+        ClientContext.CaptureSession = SessionCapture::NextSessionId();
+    }
+    SessionCapture::Record(ClientContext.CaptureSession, CAPTURE_EVENT::Command, Id, Id == COMMAND_ID::Pass ? Verb : Line, LatencyUs, ClientContext.TransferBytes);
+}
+
+const FtpServer::COMMAND_HANDLER* FtpServer::FindCommand(std::string_view Verb)
+{
+    static constexpr VERB_ENTRY<COMMAND_HANDLER> entries[] =
+    {
+        { "USER", { &FtpServer::HandleUser, CLIENT_ACCESS::NotLoggedIn, COMMAND_ID::User } },
+        { "PASS", { &FtpServer::HandlePass, CLIENT_ACCESS::NotLoggedIn, COMMAND_ID::Pass } },
+        { "OPTS", { &FtpServer::HandleOpts, CLIENT_ACCESS::NotLoggedIn, COMMAND_ID::Opts } },
+        { "QUIT", { &FtpServer::HandleQuit, CLIENT_ACCESS::NotLoggedIn, COMMAND_ID::Quit } },
+        { "PASV", { &FtpServer::HandlePasv, CLIENT_ACCESS::ReadOnly, COMMAND_ID::Pasv } },
+        { "PORT", { &FtpServer::HandlePort, CLIENT_ACCESS::ReadOnly, COMMAND_ID::Port } },
+        { "TYPE", { &FtpServer::HandleType, CLIENT_ACCESS::ReadOnly, COMMAND_ID::Type } },
+        { "LIST", { &FtpServer::HandleList, CLIENT_ACCESS::ReadOnly, COMMAND_ID::List } },
+        { "NLST", { &FtpServer::HandleNlst, CLIENT_ACCESS::ReadOnly, COMMAND_ID::Nlst } },
+        { "RETR", { &FtpServer::HandleRetr, CLIENT_ACCESS::ReadOnly, COMMAND_ID::Retr } },
+        { "STAT", { &FtpServer::HandleStat, CLIENT_ACCESS::ReadOnly, COMMAND_ID::Stat } },
+        { "STOR", { &FtpServer::HandleStor, CLIENT_ACCESS::CreateNew, COMMAND_ID::Stor } },
+        { "SITE", { &FtpServer::HandleSite, CLIENT_ACCESS::ReadOnly, COMMAND_ID::Site } },
+        { "EPSV", { &FtpServer::HandleEpsv, CLIENT_ACCESS::ReadOnly, COMMAND_ID::Epsv } },
+    };
+    static constexpr CommandTable commandTable(entries);
+    static_assert(commandTable.IsValid(), "no perfect hash found for the command table");
+
+    return commandTable.Find(Verb);
+}
+
+bool FtpServer::HandleUser(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
+{
+    if (Argument.size() == 0)
+    {
+        return this->SendReply(ClientContext, Replies::SyntaxError);
+    }
+
+    ClientContext.Access = CLIENT_ACCESS::NotLoggedIn;
+
+    if (Argument.size() >= USERNAME_MAX_LENGTH)
+    {
+        return this->SendReply(ClientContext, Replies::SyntaxError);
+    }
+
+    ClientContext.UserName = StringTable::Intern(Argument);
+
+    ReplyBuilder<MESSAGE_MAX_LENGTH> reply(331);
+    reply.Append("User ").Append(Argument).Append(" OK. Password required");
+    return this->SendString(ClientContext, reply.Wire());
+
+}
+
+bool FtpServer::HandlePass(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
+{
+    if (Argument.size() == 0)
+    {
+        return this->SendReply(ClientContext, Replies::PassSyntaxError);
+    }
+    std::string_view username = ClientContext.UserName.View();
+    if (username.size() == 0 || username != HARDCODED_USER || Argument != HARDCODED_PASSWORD)
+    {
+        return this->SendReply(ClientContext, Replies::LoginIncorrect);
+    }
+
+    ClientContext.Access = CLIENT_ACCESS::Full;
+
+    return this->SendReply(ClientContext, Replies::LoggedIn);
+}
+
+bool FtpServer::HandleOpts(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
+{
+    if (Argument == "UTF8 ON")
+    {
+        return this->SendReply(ClientContext, Replies::Utf8Enabled);
+    }
+    else
+    {
+        return this->SendReply(ClientContext, Replies::OptsSyntaxError);
+    }
+}
+
+// Listens on a fresh ephemeral port for the data connection of PASV or EPSV.
+bool FtpServer::OpenPassiveSocket(CLIENT_CONTEXT& ClientContext)
+{
+    if (ClientContext.DataSocket != INVALID_SOCKET)
+    {
+        Platform::CloseSocket(ClientContext.DataSocket);
+        ClientContext.DataSocket = INVALID_SOCKET;
+    }
+
+    SOCKET passiveSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (passiveSocket == INVALID_SOCKET)
+    {
+        LogEvent(LOG_LEVEL::Error, "pasv_socket_failed").Field("error", Platform::SocketError());
+        Platform::CloseSocket(passiveSocket);
+        return false;
+    }
+
+    // Port 0 lets the stack pick a free ephemeral port; a fixed range runs out
+    // under load as closed data connections sit in TIME_WAIT.
+    SOCKADDR_IN serverAddr = { .sin_family = AF_INET, .sin_port = 0, .sin_addr = {} };
+    socklen_t serverAddrSize = sizeof(serverAddr);
+    int status = bind(passiveSocket, reinterpret_cast<PSOCKADDR>(&serverAddr), sizeof(serverAddr));
+    if (status != SOCKET_ERROR)
+    {
+        status = getsockname(passiveSocket, reinterpret_cast<PSOCKADDR>(&serverAddr), &serverAddrSize);
+    }
+    if (status == SOCKET_ERROR)
+    {
+        LogEvent(LOG_LEVEL::Error, "pasv_bind_failed").Field("error", Platform::SocketError());
+        Platform::CloseSocket(passiveSocket);
+        return false;
+    }
+
+    status = listen(passiveSocket, SOMAXCONN);
+    if (status == SOCKET_ERROR)
+    {
+        LogEvent(LOG_LEVEL::Error, "pasv_listen_failed").Field("error", Platform::SocketError());
+        Platform::CloseSocket(passiveSocket);
+        return false;
+    }
+
+    ClientContext.DataIPv4 = serverAddr.sin_addr;
+    ClientContext.DataPort = serverAddr.sin_port;
+    ClientContext.DataSocket = passiveSocket;
+    ClientContext.DataSocketType = DATASOCKET_TYPE::Passive;
+    return true;
+}
+
+bool FtpServer::HandlePasv(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
+{
+    UNREFERENCED_PARAMETER(Argument);
+
+    if (!this->OpenPassiveSocket(ClientContext))
+    {
+        return this->SendReply(ClientContext, Replies::LocalError);
+    }
+
+    // Advertise the address the client reached us on, which is the one it can
+    // open the data connection to.
+    SOCKADDR_IN controlAddr = { 0 };
+    socklen_t controlAddrSize = sizeof(controlAddr);
+    getsockname(ClientContext.Socket, reinterpret_cast<PSOCKADDR>(&controlAddr), &controlAddrSize);
+
+    ReplyBuilder<MESSAGE_MAX_LENGTH> reply(227);
+    uint8_t address[4] = { 0 };
+    AddressToBytes(controlAddr.sin_addr, address);
+    const uint8_t fields[6] = { address[0], address[1], address[2], address[3],
+        static_cast<uint8_t>(ClientContext.DataPort & 0xFF), static_cast<uint8_t>((ClientContext.DataPort >> 8) & 0xFF) };
+    AppendHostPort(reply.Append("Entering Passive Mode ("), fields).Append(").");
+    return this->SendString(ClientContext, reply.Wire());
+}
+
+// RFC 2428. The reply carries only the port, so the client connects back to the
+// address it already reached us on. The server is IPv4 only: an argument naming
+// another network protocol gets 522, and "EPSV ALL" (no more PORT or PASV from
+// this client) needs no state because EPSV is all such a client will send.
+bool FtpServer::HandleEpsv(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
+{
+    if (Argument.size() == 3 && PackVerb(Argument) == PackVerb("ALL"))
+    {
+        return this->SendReply(ClientContext, Replies::EpsvAllOk);
+    }
+    if (!Argument.empty() && Argument != "1")
+    {
+        return this->SendReply(ClientContext, Replies::ProtocolNotSupported);
+    }
+
+    if (!this->OpenPassiveSocket(ClientContext))
+    {
+        return this->SendReply(ClientContext, Replies::LocalError);
+    }
+
+    ReplyBuilder<MESSAGE_MAX_LENGTH> reply(229);
+    reply.Append("Entering Extended Passive Mode (|||").Append(ntohs(ClientContext.DataPort)).Append("|).");
+    return this->SendString(ClientContext, reply.Wire());
+}
+
+bool FtpServer::HandleQuit(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
+{
+    UNREFERENCED_PARAMETER(Argument);
+
+    return this->SendReply(ClientContext, Replies::ClosingControl);
+}
+
+bool BuildPath(CHAR(&Path)[MAX_PATH], std::string_view Directory, std::string_view Name, std::string_view Suffix = {})
+{
+    size_t length = Directory.size() + (Name.empty() ? 0 : Name.size() + 1) + Suffix.size();
+    if (length >= MAX_PATH)
+    {
+        return false;
+    }
+
+    PCHAR p = Path;
+    memcpy(p, Directory.data(), Directory.size());
+    p += Directory.size();
+    if (!Name.empty())
+    {
+        *p++ = PATH_SEPARATOR;
+        memcpy(p, Name.data(), Name.size());
+        p += Name.size();
+    }
+    memcpy(p, Suffix.data(), Suffix.size());
+    p += Suffix.size();
+    *p = ANSI_NULL;
+    return true;
+}
+
+VOID FtpServer::LogTransfer(const CLIENT_CONTEXT& ClientContext, PCSTR FilePath, TRANSFER_DIRECTION Direction, uint64_t Bytes, std::chrono::steady_clock::time_point Started, bool Completed)
+{
+    TRANSFER_RECORD record;
+    record.Timestamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    record.DurationMs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - Started).count());
+    record.Bytes = Bytes;
+    AddressToBytes(ClientContext.IPv4, record.RemoteAddress);
+    record.Direction = Direction;
+    record.TransferType = ClientContext.TransferType;
+    record.Completed = Completed;
+    record.SetFileName(FilePath);
+    record.SetUserName(ClientContext.UserName.View());
+    TransferLog::Write(record);
+}
+
+bool FtpServer::OpenListing(CLIENT_CONTEXT& ClientContext, std::string_view Argument, DirectoryListing& Listing)
+{
+    std::string_view listDir;
+    if (Argument.size() > 0 && !Argument.starts_with("-a") && !Argument.starts_with("-1"))
+    {
+        if (Argument.contains(".."))
+        {
+            this->SendReply(ClientContext, Replies::SyntaxError);
+            return false;
+        }
+        listDir = Argument;
+    }
+
+    CHAR directoryPath[MAX_PATH] = { 0 };
+    if (!BuildPath(directoryPath, ClientContext.CurrentDir.View(), listDir))
+    {
+        this->SendReply(ClientContext, Replies::SyntaxError);
+        return false;
+    }
+
+    if (!Listing.Open(directoryPath))
+    {
+        this->SendReply(ClientContext, Replies::FileUnavailable);
+        return false;
+    }
+
+    return true;
+}
+
+// The data connection of a transfer, made on the transfer pool. On failure the
+// reply is queued and INVALID_SOCKET returned.
+SOCKET FtpServer::OpenDataConnection(CLIENT_CONTEXT& ClientContext)
+{
+    SOCKET dataSocket = INVALID_SOCKET;
+    if (ClientContext.DataSocketType == DATASOCKET_TYPE::Passive)
+    {
+        dataSocket = accept(ClientContext.DataSocket, NULL, NULL);
+        this->WatchDataSocket(ClientContext, dataSocket);
+        Platform::CloseSocket(ClientContext.DataSocket);
+        ClientContext.DataSocket = INVALID_SOCKET;
+        if (dataSocket == INVALID_SOCKET)
+        {
+            Metrics::TransferError();
+            this->SendReply(ClientContext, Replies::LocalError);
+        }
+    }
+    else if (ClientContext.DataSocketType == DATASOCKET_TYPE::Normal)
+    {
+        dataSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        this->WatchDataSocket(ClientContext, dataSocket);
+        SOCKADDR_IN clientAddr = { .sin_family = AF_INET, .sin_port = ClientContext.DataPort, .sin_addr = ClientContext.DataIPv4 };
+        int status = connect(dataSocket, reinterpret_cast<PSOCKADDR>(&clientAddr), sizeof(clientAddr));
+        if (status == SOCKET_ERROR)
         {
-            this->threadPool->push_task([&, clientInfo]
-                {
-                    CHAR clientIP[INET_ADDRSTRLEN] = { 0 };
-                    inet_ntop(AF_INET, &clientInfo.sin_addr, clientIP, INET_ADDRSTRLEN);
-                    std::cout << "Client connected from IP: " << clientIP << std::endl;
-
-                    CLIENT_CONTEXT clientContext = { .Socket = *clientSocket, .CurrentDir = R"(C:\Users\Alex)", .IPv4 = clientInfo.sin_addr };
-                    this->HandleConnection(clientContext);
-
-                    closesocket(*clientSocket);
-                    delete clientSocket;
-                });
+            this->CloseDataSocket(ClientContext, dataSocket);
+            dataSocket = INVALID_SOCKET;
+            Metrics::TransferError();
+            this->SendReply(ClientContext, Replies::FileUnavailable);
         }
     }
+    else
+    {
+        Metrics::TransferError();
+        this->SendReply(ClientContext, Replies::LocalError);
+    }
+    return dataSocket;
 }
 
-VOID
-FtpServer::HandleConnection(CLIENT_CONTEXT& ClientContext)
+// The stall timer runs from the moment the transfer pool picks the transfer up, so
+// it also covers a client that never opens the data connection.
+VOID FtpServer::StartStallTimer(CLIENT_CONTEXT& ClientContext)
 {
-    this->SendString(ClientContext, "220 FTP Server Ready");
-
-    int status = 0;
-    do
+    PENDING_TRANSFER& transfer = ClientContext.Work->Transfer;
+    ACCEPTOR_SHARD& shard = *ClientContext.Shard;
+    transfer.Progress.store(0, std::memory_order_relaxed);
+    transfer.Stalled.store(false, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> guard(shard.SessionLock);
+    transfer.CheckedProgress = 0;
+    transfer.DataSocket = ClientContext.DataSocketType == DATASOCKET_TYPE::Passive ? ClientContext.DataSocket : INVALID_SOCKET;
+    if (this->timeouts.DataStallSeconds)
     {
-        char buffer[DEFAULT_BUFLEN] = { 0 };
-        int bufferSize = sizeof(buffer);
+        ArmTimer(shard, ClientContext.DataTimer, std::chrono::steady_clock::now() + std::chrono::seconds(this->timeouts.DataStallSeconds));
+    }
+}
 
-        status = recv(ClientContext.Socket, buffer, bufferSize, 0);;
-        std::cout << "Command received: " << buffer;
-        if (status > 0)
-        {
-            std::string command(buffer, status);
-            this->ProcessCommand(command, ClientContext);
-        }
-        else if (!status)
-        {
-            std::cout << "Connection closing..." << std::endl;
-        }
-        else
-        {
-            std::cout << "recv failed " << WSAGetLastError() << std::endl;
-            return;
-        }
-    } while (status > 0);
+VOID FtpServer::StopStallTimer(CLIENT_CONTEXT& ClientContext)
+{
+    std::lock_guard<std::mutex> guard(ClientContext.Shard->SessionLock);
+    ClientContext.Shard->Timers.Cancel(ClientContext.DataTimer);
+    ClientContext.Work->Transfer.DataSocket = INVALID_SOCKET;
 }
 
-bool FtpServer::SendString(const CLIENT_CONTEXT& ClientContext, const std::string& Message)
+// A data socket is only closed once the poller can no longer shut it down, so an
+// expiring stall timer never touches a descriptor that has been reused.
+VOID FtpServer::WatchDataSocket(CLIENT_CONTEXT& ClientContext, SOCKET DataSocket)
 {
-    return this->SendString(ClientContext.Socket, Message);
+    std::lock_guard<std::mutex> guard(ClientContext.Shard->SessionLock);
+    ClientContext.Work->Transfer.DataSocket = DataSocket;
 }
 
-bool FtpServer::SendString(const SOCKET& Socket, const std::string& Message)
+VOID FtpServer::CloseDataSocket(CLIENT_CONTEXT& ClientContext, SOCKET DataSocket)
 {
-    std::string message = Message;
-    if (!message.ends_with("\r\n"))
-    {
-        message += "\r\n";
-    }
-    return send(Socket, message.c_str(), static_cast<int>(message.size()), 0) != SOCKET_ERROR;
+    this->WatchDataSocket(ClientContext, INVALID_SOCKET);
+    Platform::CloseSocket(DataSocket);
 }
 
-void FtpServer::ProcessCommand(const std::string& Command, CLIENT_CONTEXT& ClientContext)
+bool FtpServer::HandleList(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
 {
-    if (!Command.ends_with("\r\n"))
+    PENDING_TRANSFER& transfer = ClientContext.Work->Transfer;
+    transfer.Trace = TransferTrace(COMMAND_ID::List);
+    transfer.Listing = MakeInArena<DirectoryListing>(ClientContext.Work->Arena);
+    if (!this->OpenListing(ClientContext, Argument, *transfer.Listing))
     {
-        return;
+        transfer.Listing.reset();
+        return false;
     }
 
-    const std::string& processedCommand = Command.substr(0, Command.size() - 2);
-    size_t separatorPosition = processedCommand.find_first_of(" ");
-    const std::string& command = processedCommand.substr(0, separatorPosition);
-    const std::string& argument = processedCommand.substr((separatorPosition != std::string::npos ? separatorPosition + 1 : processedCommand.size()));
+    this->SendReply(ClientContext, Replies::OpeningDataConnection);
+    this->FlushReplies(ClientContext);
+    transfer.Kind = TRANSFER_KIND::Listing;
+    return true;
+}
 
-    if (!command.compare("USER"))
+// SendListing, SendFile and ReceiveFile each run one slice of a transfer, which
+// RunTransfer picks up where it left off if it is not Finished. Listings are short
+// and take no turns with the scheduler.
+TRANSFER_STEP FtpServer::SendListing(CLIENT_CONTEXT& ClientContext)
+{
+    PENDING_TRANSFER& transfer = ClientContext.Work->Transfer;
+    if (transfer.Connection == INVALID_SOCKET)
     {
-        this->HandleUser(ClientContext, argument);
+        transfer.Connection = this->OpenDataConnection(ClientContext);
+        if (transfer.Connection == INVALID_SOCKET)
+        {
+            return TRANSFER_STEP::Finished;
+        }
+        transfer.Trace.Mark(TRACE_PHASE::DataSocketReady);
     }
-    else if (!command.compare("PASS"))
+
+    // Lines only go out whole, so a chunk may overdraw the flow's credit a little.
+    CHAR chunk[DEFAULT_BUFLEN * 8];
+    size_t chunkLength = 0;
+    bool sent = true;
+    while (sent)
     {
-        this->HandlePass(ClientContext, argument);
+        if (!this->shaper.Allow(transfer.Flow, sizeof(chunk), transfer.ResumeAt))
+        {
+            return TRANSFER_STEP::Paused;
+        }
+        if (!(chunkLength = transfer.Listing->Read(chunk, sizeof(chunk))))
+        {
+            break;
+        }
+        BandwidthShaper::Spend(transfer.Flow, chunkLength);
+        sent = SendBuffer(transfer.Connection, chunk, chunkLength);
+        if (!transfer.Transferred)
+        {
+            transfer.Trace.Mark(TRACE_PHASE::FirstByte);
+        }
+        transfer.Transferred += chunkLength;
+        transfer.Progress.store(transfer.Transferred, std::memory_order_relaxed);
     }
-    else if (!command.compare("OPTS"))
+    this->CloseDataSocket(ClientContext, transfer.Connection);
+    transfer.Connection = INVALID_SOCKET;
+    transfer.Trace.Mark(TRACE_PHASE::LastByte, transfer.Transferred);
+    ClientContext.TransferBytes = transfer.Transferred;
+
+    if (!sent)
     {
-        this->HandleOpts(ClientContext, argument);
+        Metrics::TransferError();
+        this->SendReply(ClientContext, Replies::TransferAborted);
+        return TRANSFER_STEP::Finished;
     }
-    else if (!command.compare("PASV"))
+
+    if (this->SendReply(ClientContext, Replies::TransferComplete))
     {
-        this->HandlePasv(ClientContext);
+        this->FlushReplies(ClientContext);
     }
-    else if (!command.compare("QUIT"))
+    transfer.Trace.Mark(TRACE_PHASE::ReplySent, transfer.Transferred);
+    return TRANSFER_STEP::Finished;
+}
+
+// STAT <path> returns the same listing as LIST, but inline as a multi-line 213
+// reply, which saves the PASV round trip and data connection for small directories.
+bool FtpServer::HandleStat(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
+{
+    if (Argument.size() == 0)
     {
-        this->HandleQuit(ClientContext);
+        ReplyBuilder<MESSAGE_MAX_LENGTH> reply(211, '-');
+        reply.Append("FTP server status:\r\n Logged in as ").Append(ClientContext.UserName.View());
+        this->SendString(ClientContext, reply.Wire());
+        return this->SendReply(ClientContext, Replies::SystemStatusEnd);
     }
-    else if (!command.compare("LIST"))
+
+    DirectoryListing listing;
+    if (!this->OpenListing(ClientContext, Argument, listing))
     {
-        this->HandleList(ClientContext, argument);
+        return false;
     }
-    else if (!command.compare("PORT"))
+
+    ReplyBuilder<MESSAGE_MAX_LENGTH> reply(213, '-');
+    reply.Append("Status of ").Append(Argument).Append(':');
+    this->SendString(ClientContext, reply.Wire());
+
+    CHAR chunk[OUTPUT_STORAGE_LENGTH];
+    size_t chunkLength = 0;
+    while ((chunkLength = listing.Read(chunk, sizeof(chunk))))
     {
-        this->HandlePort(ClientContext, argument);
+        if (!this->SendString(ClientContext, std::string_view(chunk, chunkLength)))
+        {
+            return false;
+        }
     }
-    else if (!command.compare("RETR"))
+
+    return this->SendReply(ClientContext, Replies::FileStatusEnd);
+}
+
+bool EqualsIgnoreCase(std::string_view Text, std::string_view UpperCase)
+{
+    return std::ranges::equal(Text, UpperCase, [](char a, char b) { return (a >= 'a' && a <= 'z' ? a - ('a' - 'A') : a) == b; });
+}
+
+bool FtpServer::HandleSite(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
+{
+    std::string_view command;
+    std::string_view argument;
+    SplitCommand(Argument, command, argument);
+
+    if (EqualsIgnoreCase(command, "STATS") && argument.empty())
     {
-        this->HandleRetr(ClientContext, argument);
+        return this->SiteStats(ClientContext);
     }
-    else if (!command.compare("TYPE"))
+    else if (EqualsIgnoreCase(command, "TRACE"))
     {
-        this->HandleType(ClientContext, argument);
+        return this->SiteTrace(ClientContext, argument);
     }
-    else if (!command.compare("STOR"))
+    else if (EqualsIgnoreCase(command, "CAPTURE"))
     {
-        this->HandleStor(ClientContext, argument);
+        return this->SiteCapture(ClientContext, argument);
     }
-    else if (!command.compare("NLST"))
+    else if (EqualsIgnoreCase(command, "RATE"))
     {
-        this->HandleNlst(ClientContext, argument);
+        return this->SiteRate(ClientContext, argument);
     }
-    else
+    else if (EqualsIgnoreCase(command, "WEIGHT"))
     {
-        std::cout << "Unsupported command: " << command << std::endl;
+        return this->SiteWeight(ClientContext, argument);
     }
+
+    return this->SendReply(ClientContext, Replies::ParameterNotImplemented);
 }
 
-bool FtpServer::HandleUser(CLIENT_CONTEXT& ClientContext, const std::string& Argument)
+// SITE STATS: the same counters and latency percentiles as the metrics endpoint,
+// as a multi-line 211 reply for operators who only have an FTP client at hand.
+bool FtpServer::SiteStats(CLIENT_CONTEXT& ClientContext)
 {
-    if (Argument.size() == 0)
+    // The snapshot is far larger than a session's arena, so there is one for the
+    // server, held until the reply is queued.
+    std::lock_guard<std::mutex> guard(this->statsLock);
+    METRICS_SNAPSHOT& snapshot = this->statsSnapshot;
+    snapshot = METRICS_SNAPSHOT();
+    Metrics::Snapshot(snapshot);
+
+    ReplyBuilder<MESSAGE_MAX_LENGTH> reply(211, '-');
+    reply.Append("Server statistics:");
+    this->SendString(ClientContext, reply.Wire());
+
+    TextBuffer<MESSAGE_MAX_LENGTH> line;
+    line.Append(" sessions=").Append(snapshot.ActiveSessions)
+        .Append(" bytes_in=").Append(snapshot.BytesIn)
+        .Append(" bytes_out=").Append(snapshot.BytesOut)
+        .Append(" transfer_errors=").Append(snapshot.TransferErrors)
+        .Append(" transfers_throttled=").Append(snapshot.TransfersThrottled);
+    this->SendString(ClientContext, line.View());
+
+    line.Clear();
+    line.Append(" records_dropped log=").Append(snapshot.LogRecordsDropped)
+        .Append(" xferlog=").Append(snapshot.TransferRecordsDropped);
+    this->SendString(ClientContext, line.View());
+
+    line.Clear();
+    line.Append(" connections accepted=").Append(snapshot.ConnectionsAccepted);
+    for (size_t reason = 0; reason < static_cast<size_t>(SHED_REASON::MaxShedReason); ++reason)
     {
-        return this->SendString(ClientContext, "501 Syntax error in parameters or arguments.");
+        line.Append(" shed_").Append(ShedReasonName(static_cast<SHED_REASON>(reason))).Append('=').Append(snapshot.ConnectionsShed[reason]);
     }
+    for (size_t timeout = 0; timeout < static_cast<size_t>(SESSION_TIMEOUT::MaxSessionTimeout); ++timeout)
+    {
+        line.Append(" timeout_").Append(SessionTimeoutName(static_cast<SESSION_TIMEOUT>(timeout))).Append('=').Append(snapshot.SessionTimeouts[timeout]);
+    }
+    this->SendString(ClientContext, line.View());
 
-    ClientContext.Access = CLIENT_ACCESS::NotLoggedIn;
-
-    CHAR message[MESSAGE_MAX_LENGTH] = { 0 };
-    _snprintf_s(message, sizeof(message), _TRUNCATE, "331 User %s OK. Password required", Argument.c_str());
-    strcpy_s(ClientContext.UserName, sizeof(ClientContext.UserName), Argument.c_str());
-    return this->SendString(ClientContext, message);
-
-}
+    line.Clear();
+    line.Append(" pool queue_depth=").Append(snapshot.QueueDepth)
+        .Append(" high_water=").Append(snapshot.QueueHighWater)
+        .Append(" wait_p50_us=").Append(snapshot.TaskWait.Percentile(0.5))
+        .Append(" wait_p99_us=").Append(snapshot.TaskWait.Percentile(0.99))
+        .Append(" runtime_p99_us=").Append(snapshot.TaskRuntime.Percentile(0.99));
+    this->SendString(ClientContext, line.View());
 
-bool FtpServer::HandlePass(CLIENT_CONTEXT& ClientContext, const std::string& Argument)
-{
-    if (Argument.size() == 0)
+    for (uint32_t worker = 0; worker < snapshot.Workers; ++worker)
     {
-        return this->SendString(ClientContext, "501 Pass command with syntax error.");
+        line.Clear();
+        line.Append(" worker ").Append(worker)
+            .Append(" busy_permille=").Append(static_cast<uint32_t>(snapshot.WorkerBusy[worker] * 1000.0));
+        this->SendString(ClientContext, line.View());
     }
-    const std::string& username = ClientContext.UserName;
-    if (username.size() == 0 || username.compare(HARDCODED_USER) || Argument.compare(HARDCODED_PASSWORD))
+
+    for (size_t id = 0; id < static_cast<size_t>(COMMAND_ID::MaxCommandId); ++id)
     {
-        return this->SendString(ClientContext, "530 Invalid username or password");
-    }
+        const HISTOGRAM_SNAPSHOT& latency = snapshot.CommandLatency[id];
+        if (!snapshot.Commands[id])
+        {
+            continue;
+        }
 
-    ClientContext.Access = CLIENT_ACCESS::Full;
+        line.Clear();
+        line.Append(' ').Append(CommandName(static_cast<COMMAND_ID>(id)))
+            .Append(" count=").Append(snapshot.Commands[id])
+            .Append(" p50_us=").Append(latency.Percentile(0.5))
+            .Append(" p99_us=").Append(latency.Percentile(0.99))
+            .Append(" p999_us=").Append(latency.Percentile(0.999))
+            .Append(" max_us=").Append(latency.Max);
+        if (!this->SendString(ClientContext, line.View()))
+        {
+            return false;
+        }
+    }
 
-    return this->SendString(ClientContext, "230 User logged in.");
+    return this->SendReply(ClientContext, Replies::SystemStatusEnd);
 }
 
-bool FtpServer::HandleOpts(CLIENT_CONTEXT& ClientContext, const std::string& Argument)
+// SITE TRACE ON|OFF|DUMP switches transfer tracing and writes the rings to
+// TRACE_DEFAULT_FILE for the ftp-trace exporter. The tracer is the whole process's,
+// so like SITE RATE this takes Full access.
+bool FtpServer::SiteTrace(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
 {
-    if (Argument == "UTF8 ON")
+    if (ClientContext.Access < CLIENT_ACCESS::Full)
     {
-        return this->SendString(ClientContext, "200 UTF8 mode enabled");
+        return this->SendReply(ClientContext, Replies::PermissionDenied);
     }
-    else
-    {
-        return this->SendString(ClientContext, "501 Opts command with syntax error.");
-    }
-}
-//std::string GetLocalIPv4()
-//{
-//    char buffer[INET_ADDRSTRLEN] = { 0 };
-//    PIP_ADAPTER_ADDRESSES adapterAddresses = nullptr, adapter = nullptr;
-//    ULONG outBufLen = 0;
-//
-//    // Initial call to determine required buffer size
-//    if (GetAdaptersAddresses(AF_INET, 0, nullptr, adapterAddresses, &outBufLen) == ERROR_BUFFER_OVERFLOW)
-//    {
-//        adapterAddresses = (PIP_ADAPTER_ADDRESSES)malloc(outBufLen);
-//    }
-//    else
-//    {
-//        return "0.0.0.0"; // Default on failure
-//    }
-//
-//    if (GetAdaptersAddresses(AF_INET, 0, nullptr, adapterAddresses, &outBufLen) == NO_ERROR)
-//    {
-//        for (adapter = adapterAddresses; adapter != nullptr; adapter = adapter->Next)
-//        {
-//            if (adapter->OperStatus == IfOperStatusUp && adapter->FirstUnicastAddress != nullptr)
-//            {
-//                sockaddr_in* ipv4Addr = reinterpret_cast<sockaddr_in*>(adapter->FirstUnicastAddress->Address.lpSockaddr);
-//                if (inet_ntop(AF_INET, &ipv4Addr->sin_addr, buffer, INET_ADDRSTRLEN))
-//                {
-//                    free(adapterAddresses);
-//                    return std::string(buffer);
-//                }
-//            }
-//        }
-//    }
-//
-//    free(adapterAddresses);
-//    return "0.0.0.0"; // Default on failure
-
-struct IPv4 {
-    unsigned char b1, b2, b3, b4;
-};
-
-bool getMyIP(IPv4& myIP)
-{
-    char szBuffer[1024];
-
-#ifdef WIN32
-    WSADATA wsaData;
-    WORD wVersionRequested = MAKEWORD(2, 0);
-    if (::WSAStartup(wVersionRequested, &wsaData) != 0)
-        return false;
-#endif
 
-    // Get the hostname
-    if (gethostname(szBuffer, sizeof(szBuffer)) != 0)
+    if (EqualsIgnoreCase(Argument, "ON"))
     {
-#ifdef WIN32
-        WSACleanup();
-#endif
-        return false;
+        Tracer::Enable(true);
+        return this->SendReply(ClientContext, Replies::TraceEnabled);
     }
-
-    // Use getaddrinfo to retrieve the IP address
-    struct addrinfo hints = {};
-    struct addrinfo* result = nullptr;
-
-    hints.ai_family = AF_INET; // IPv4
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-
-    if (getaddrinfo(szBuffer, nullptr, &hints, &result) != 0)
+    else if (EqualsIgnoreCase(Argument, "OFF"))
     {
-#ifdef WIN32
-        WSACleanup();
-#endif
-        return false;
+        Tracer::Enable(false);
+        return this->SendReply(ClientContext, Replies::TraceDisabled);
     }
-
-    // Extract the first IPv4 address
-    for (struct addrinfo* ptr = result; ptr != nullptr; ptr = ptr->ai_next)
+    else if (EqualsIgnoreCase(Argument, "DUMP"))
     {
-        if (ptr->ai_family == AF_INET) // Ensure it's IPv4
+        FILE* file = Platform::OpenStream(TRACE_DEFAULT_FILE, "wb");
+        if (!file)
         {
-            struct sockaddr_in* sockaddr_ipv4 = (struct sockaddr_in*)ptr->ai_addr;
-            myIP.b1 = sockaddr_ipv4->sin_addr.S_un.S_un_b.s_b1;
-            myIP.b2 = sockaddr_ipv4->sin_addr.S_un.S_un_b.s_b2;
-            myIP.b3 = sockaddr_ipv4->sin_addr.S_un.S_un_b.s_b3;
-            myIP.b4 = sockaddr_ipv4->sin_addr.S_un.S_un_b.s_b4;
-
-            freeaddrinfo(result);
-#ifdef WIN32
-            WSACleanup();
-#endif
-            return true;
+            return this->SendReply(ClientContext, Replies::LocalError);
         }
+
+        size_t records = Tracer::Dump(file);
+        fclose(file);
+        LogEvent(LOG_LEVEL::Info, "trace_dumped").Field("file", TRACE_DEFAULT_FILE).Field("records", records);
+
+        ReplyBuilder<MESSAGE_MAX_LENGTH> reply(200);
+        reply.Append(records).Append(" trace records written to " TRACE_DEFAULT_FILE ".");
+        return this->SendString(ClientContext, reply.Wire());
     }
 
-    freeaddrinfo(result);
-#ifdef WIN32
-    WSACleanup();
-#endif
-    return false;
+    return this->SendReply(ClientContext, Replies::SyntaxError);
 }
 
-bool FtpServer::HandlePasv(CLIENT_CONTEXT& ClientContext)
+// SITE CAPTURE ON|OFF: record control-channel traffic for ftp-replay. Capture is
+// server-wide, so like SITE RATE this takes Full access.
+bool FtpServer::SiteCapture(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
 {
-    if (ClientContext.Access == CLIENT_ACCESS::NotLoggedIn)
+    if (ClientContext.Access < CLIENT_ACCESS::Full)
     {
-        return this->SendString(ClientContext, "530 Please login with USER and PASS.");
+        return this->SendReply(ClientContext, Replies::PermissionDenied);
     }
 
-    SOCKET passiveSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (passiveSocket == INVALID_SOCKET)
+    if (EqualsIgnoreCase(Argument, "ON"))
     {
-        std::cout << "Passive socket == invalid socket" << std::endl;
-        closesocket(passiveSocket);
-        return this->SendString(ClientContext, "451 Requested action aborted. Local error in processing.");
+        if (!SessionCapture::Start())
+        {
+            return this->SendReply(ClientContext, Replies::LocalError);
+        }
+        LogEvent(LOG_LEVEL::Info, "capture_started").Field("file", CAPTURE_DEFAULT_FILE);
+        return this->SendReply(ClientContext, Replies::CaptureStarted);
     }
-
-    SOCKADDR_IN serverAddr = { .sin_family = AF_INET, .sin_port = htons((rand() % 5000) + 60001), .sin_addr = 0UL };
-    int status = bind(passiveSocket, reinterpret_cast<PSOCKADDR>(&serverAddr), sizeof(serverAddr));
-    if (status == SOCKET_ERROR)
+    else if (EqualsIgnoreCase(Argument, "OFF"))
     {
-        std::cout << "Binding error == sockket erorr" << std::endl;
-        closesocket(passiveSocket);
-        return this->SendString(ClientContext, "451 Requested action aborted. Local error in processing.");
-    }
+        uint64_t records = SessionCapture::Stop();
+        LogEvent(LOG_LEVEL::Info, "capture_stopped").Field("file", CAPTURE_DEFAULT_FILE).Field("records", records);
 
-    status = listen(passiveSocket, SOMAXCONN);
-    if (status == SOCKET_ERROR)
-    {
-        std::cout << "Listen status == socket errorr" << std::endl;
-        closesocket(passiveSocket);
-        return this->SendString(ClientContext, "451 Requested action aborted. Local error in processing.");
+        ReplyBuilder<MESSAGE_MAX_LENGTH> reply(200);
+        reply.Append(records).Append(" capture records written to " CAPTURE_DEFAULT_FILE ".");
+        return this->SendString(ClientContext, reply.Wire());
     }
 
-    IPv4 ipv4 = { 0 };
-    getMyIP(ipv4);
-    ClientContext.DataIPv4 = serverAddr.sin_addr;
-    ClientContext.DataPort = serverAddr.sin_port;
-    ClientContext.DataSocket = passiveSocket;
-    ClientContext.DataSocketType = DATASOCKET_TYPE::Passive;
-
-    CHAR message[MESSAGE_MAX_LENGTH] = { 0 };
-        _snprintf_s(message, sizeof(message), _TRUNCATE,
-        "227 Entering Passive Mode (%u,%u,%u,%u,%u,%u).",
-        ipv4.b1 & 0xFF,
-        ipv4.b2 & 0xFF,
-        ipv4.b3 & 0xFF,
-        ipv4.b4 & 0xFF,
-        (ClientContext.DataPort) & 0xFF,
-        (ClientContext.DataPort >> 8) & 0xFF);
-    return this->SendString(ClientContext, message);
-}
-
-bool FtpServer::HandleQuit(CLIENT_CONTEXT& ClientContext)
-{
-    return this->SendString(ClientContext, "221 Quit.");
-}
-
-std::string FiletimeToTimestamp(FILETIME& Filetime)
-{
-    SYSTEMTIME systemTime = { 0 };
-    FileTimeToSystemTime(&Filetime, &systemTime);
-    CHAR buffer[24] = { 0 };
-    _snprintf_s(buffer, 24, _TRUNCATE, "%04d-%02d-%02d %02d:%02d:%02d.%03d", systemTime.wYear, systemTime.wMonth, systemTime.wDay, systemTime.wHour, systemTime.wMinute, systemTime.wSecond, systemTime.wMilliseconds);
-    buffer[24 - 1] = ANSI_NULL;
-    return buffer;
+    return this->SendReply(ClientContext, Replies::SyntaxError);
 }
 
-bool FtpServer::HandleList(CLIENT_CONTEXT& ClientContext, const std::string& Argument)
+// SITE RATE [GLOBAL|USER|SESSION <bytes/s>] shows the shaping rates, after changing
+// one if asked to. Transfers already running pick the change up at their next
+// quantum; 0 lifts a limit. SITE is dispatched at ReadOnly, but the rates are the
+// whole server's, so this takes Full access.
+bool FtpServer::SiteRate(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
 {
-    if (ClientContext.Access == CLIENT_ACCESS::NotLoggedIn)
+    if (ClientContext.Access < CLIENT_ACCESS::Full)
     {
-        return this->SendString(ClientContext, "530 Please login with user and pass.");
+        return this->SendReply(ClientContext, Replies::PermissionDenied);
     }
 
-    std::string listDir = std::string(ClientContext.CurrentDir);
-    if (Argument.size() > 0 && !Argument.starts_with("-a") && !Argument.starts_with("-1"))
+    if (!Argument.empty())
     {
-        if (Argument.contains(".."))
+        std::string_view level;
+        std::string_view value;
+        SplitCommand(Argument, level, value);
+
+        uint64_t rate = 0;
+        auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), rate);
+        if (value.empty() || error != std::errc() || end != value.data() + value.size())
         {
-            return this->SendString(ClientContext, "501 Syntax error in parmeters or arguments");
+            return this->SendReply(ClientContext, Replies::SyntaxError);
         }
-        listDir += "\\" + Argument;
-    }
 
-    WIN32_FIND_DATAA fileData = { 0 };
-    HANDLE fileHandle = FindFirstFileA((listDir + "\\*").c_str(), &fileData);
-    std::stringstream listStream;
-    do
-    {
-        if (strcmp(fileData.cFileName, ".") && strcmp(fileData.cFileName, ".."))
+        if (EqualsIgnoreCase(level, "GLOBAL"))
         {
-            listStream << ((fileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? "d" : "-")
-                << "rw-r--r-- 1 owner group "
-                << fileData.nFileSizeLow << " "
-                << FiletimeToTimestamp(fileData.ftLastWriteTime) << " "
-                << fileData.cFileName << "\r\n";
+            this->shaper.SetRate(SHAPING_LEVEL::Global, rate);
         }
-    } while (FindNextFileA(fileHandle, &fileData));
-    FindClose(fileHandle);
-
-    this->SendString(ClientContext, "150 Opening data connection.");
-
-    SOCKET dataSocket = { 0 };
-    if (ClientContext.DataSocketType == DATASOCKET_TYPE::Passive)
-    {
-        dataSocket = accept(ClientContext.DataSocket, NULL, NULL);
-        closesocket(ClientContext.DataSocket);
-        ClientContext.DataSocket = dataSocket;
-        if (dataSocket == INVALID_SOCKET)
+        else if (EqualsIgnoreCase(level, "USER"))
         {
-            closesocket(dataSocket);
-            return this->SendString(ClientContext, "451 Requested action aborted. Local error in processing.");
+            this->shaper.SetRate(SHAPING_LEVEL::User, rate);
         }
-    }
-    else if (ClientContext.DataSocketType == DATASOCKET_TYPE::Normal)
-    {
-        dataSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-        SOCKADDR_IN clientAddr = { .sin_family = AF_INET, .sin_port = ClientContext.DataPort, .sin_addr = ClientContext.DataIPv4 };
-        int status = connect(dataSocket, reinterpret_cast<PSOCKADDR>(&clientAddr), sizeof(clientAddr));
-        if (status == SOCKET_ERROR)
+        else if (EqualsIgnoreCase(level, "SESSION"))
+        {
+            this->shaper.SetRate(SHAPING_LEVEL::Session, rate);
+        }
+        else
         {
-            closesocket(dataSocket);
-            return this->SendString(ClientContext, "550 File or directory unavailable.");
+            return this->SendReply(ClientContext, Replies::SyntaxError);
         }
+        LogEvent(LOG_LEVEL::Info, "rate_changed").Field("limit", level).Field("bytes_per_second", rate).Field("user", ClientContext.UserName.View());
     }
 
-    this->SendString(dataSocket, listStream.str());
-    closesocket(dataSocket);
-    return this->SendString(ClientContext, "226 Transfer complete.");
+    SHAPING_RATES rates = this->shaper.Rates();
+    ReplyBuilder<MESSAGE_MAX_LENGTH> reply(200);
+    reply.Append("Rates in bytes/s, 0 unlimited: global=").Append(rates.Global)
+        .Append(" user=").Append(rates.User)
+        .Append(" session=").Append(rates.Session);
+    return this->SendString(ClientContext, reply.Wire());
 }
 
-bool FtpServer::HandlePort(CLIENT_CONTEXT& ClientContext, const std::string& Argument)
+// SITE WEIGHT <user> [<weight>] shows a user's share of the transfer scheduler's
+// turns, after changing it if asked to. A user with weight 2 gets twice the turns
+// of one with the default 1 when both have transfers waiting; 0 sets it back to 1.
+// Like SITE RATE, this takes Full access.
+bool FtpServer::SiteWeight(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
 {
-    if (ClientContext.Access == CLIENT_ACCESS::NotLoggedIn)
+    if (ClientContext.Access < CLIENT_ACCESS::Full)
     {
-        return this->SendString(ClientContext, "530 Please login with USER and PASS.");
+        return this->SendReply(ClientContext, Replies::PermissionDenied);
     }
 
-    if (Argument.size() == 0)
+    std::string_view user;
+    std::string_view value;
+    SplitCommand(Argument, user, value);
+    if (user.empty())
     {
-        return this->SendString(ClientContext, "501 Syntax error in parameters or arguments.");
+        return this->SendReply(ClientContext, Replies::SyntaxError);
     }
 
-    int c;
-    PCHAR p = const_cast<PCHAR>(Argument.c_str());
-    ULONG dataAddr[4] = { 0UL };
-    ULONG dataPort[2] = { 0UL };
-    for (c = 0; c < 4; ++c)
+    ULONG weight = 0;
+    if (!value.empty())
     {
-        dataAddr[c] = strtoul(p, &p, 10);
-        if (*p != ',' && *p != 0)
-        {
-            break;
-        }
-        if (*p == 0)
+        auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), weight);
+        if (error != std::errc() || end != value.data() + value.size() || weight > SCHEDULER_MAX_WEIGHT)
         {
-            return this->SendString(ClientContext, "501 Syntax error in parameters or arguments.");
+            return this->SendReply(ClientContext, Replies::SyntaxError);
         }
-        ++p;
     }
 
-    for (c = 0; c < 2; ++c)
     {
-        dataPort[c] = strtoul(p, &p, 10);
-        if (*p != ',' && *p != 0)
+        std::lock_guard<std::mutex> guard(this->bulkLock);
+        if (!value.empty())
         {
-            break;
-        }
-        if (*p == 0)
-        {
-            break;
+            this->bulkTransfers.SetWeight(user, weight);
         }
-        ++p;
+        weight = this->bulkTransfers.Weight(user);
     }
-
-    IN_ADDR dataIPv4 = { 0 };
-    dataIPv4.S_un.S_un_b.s_b1 = static_cast<BYTE>(dataAddr[0]);
-    dataIPv4.S_un.S_un_b.s_b2 = static_cast<BYTE>(dataAddr[1]);
-    dataIPv4.S_un.S_un_b.s_b3 = static_cast<BYTE>(dataAddr[2]);
-    dataIPv4.S_un.S_un_b.s_b4 = static_cast<BYTE>(dataAddr[3]);
-    if (dataIPv4.S_un.S_addr != ClientContext.IPv4.S_un.S_addr)
+    if (!value.empty())
     {
-        return this->SendString(ClientContext, "501 Syntax error in parameters or arguments.");
+        LogEvent(LOG_LEVEL::Info, "weight_changed").Field("target", user).Field("weight", weight).Field("user", ClientContext.UserName.View());
     }
 
-    ClientContext.DataIPv4.S_un.S_addr = dataIPv4.S_un.S_addr;
-    ClientContext.DataPort = static_cast<USHORT>((dataPort[1] << 8) + dataPort[0]);
-    ClientContext.DataSocketType = DATASOCKET_TYPE::Normal;
-
-    return this->SendString(ClientContext, "200 Transfer complete.");
+    ReplyBuilder<MESSAGE_MAX_LENGTH> reply(200);
+    reply.Append("Weight of ").Append(user).Append(" is ").Append(weight).Append(".");
+    return this->SendString(ClientContext, reply.Wire());
 }
 
-bool FtpServer::HandleRetr(CLIENT_CONTEXT& ClientContext, const std::string& Argument)
+bool FtpServer::HandlePort(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
 {
-    if (ClientContext.Access == CLIENT_ACCESS::NotLoggedIn)
+    if (Argument.size() == 0)
     {
-        return this->SendString(ClientContext, "530 Please login with USER and PASS.");
+        return this->SendReply(ClientContext, Replies::SyntaxError);
     }
 
-    if (Argument.size() == 0)
+    uint8_t fields[6] = {};
+    if (!ParseHostPort(Argument, fields))
     {
-        return this->SendString(ClientContext, "501 Syntax error in parameters or arguments.");
+        return this->SendReply(ClientContext, Replies::SyntaxError);
     }
 
-    bool status = false;
-    bool fileFound = false;
-    WIN32_FIND_DATAA fileData = { 0 };
-    HANDLE fileHandle = FindFirstFileA((std::string(ClientContext.CurrentDir) + "\\*").c_str(), &fileData);
-    do
+    IN_ADDR dataIPv4 = AddressFromBytes(fields);
+    if (dataIPv4.s_addr != ClientContext.IPv4.s_addr)
     {
-        if (!strcmp(Argument.c_str(), fileData.cFileName))
-        {
-            this->SendString(ClientContext, "150 Opening data connection.");
-
-            SOCKET dataSocket = { 0 };
-            if (ClientContext.DataSocketType == DATASOCKET_TYPE::Passive)
-            {
-                dataSocket = accept(ClientContext.DataSocket, NULL, NULL);
-                closesocket(ClientContext.DataSocket);
-                ClientContext.DataSocket = dataSocket;
-                if (dataSocket == INVALID_SOCKET)
-                {
-                    closesocket(dataSocket);
-                    return this->SendString(ClientContext, "451 Requested action aborted. Local error in processing.");
-                }
-            }
-            else if (ClientContext.DataSocketType == DATASOCKET_TYPE::Normal)
-            {
-                dataSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-                SOCKADDR_IN clientAddr = { .sin_family = AF_INET, .sin_port = ClientContext.DataPort, .sin_addr = ClientContext.DataIPv4 };
-                int socketStatus = connect(dataSocket, reinterpret_cast<PSOCKADDR>(&clientAddr), sizeof(clientAddr));
-                if (socketStatus == SOCKET_ERROR)
-                {
-                    closesocket(dataSocket);
-                    return this->SendString(ClientContext, "550 File or directory unavailable.");
-                }
-            }
+        return this->SendReply(ClientContext, Replies::SyntaxError);
+    }
 
-            std::ifstream file(std::string(ClientContext.CurrentDir) + "\\" + fileData.cFileName, std::ios::binary);
-            if (!file.is_open())
-            {
-                closesocket(dataSocket);
-                return this->SendString(ClientContext, "550 File not found or access denied.");
-            }
+    ClientContext.DataIPv4 = dataIPv4;
+    ClientContext.DataPort = static_cast<USHORT>((fields[5] << 8) | fields[4]);
+    ClientContext.DataSocketType = DATASOCKET_TYPE::Normal;
 
-            CHAR buffer[DEFAULT_BUFLEN] = { 0 };
-            while (file.read(buffer, sizeof(buffer)) || file.gcount())
-            {
-                if (send(dataSocket, buffer, static_cast<int>(file.gcount()), 0) == SOCKET_ERROR)
-                {
-                    file.close();
-                    closesocket(dataSocket);
-                    return this->SendString(ClientContext, "426 Connection closed; transfer aborted.");
-                }
-            }
+    return this->SendReply(ClientContext, Replies::PortOk);
+}
 
-            file.close();
-            closesocket(dataSocket);
-            status = this->SendString(ClientContext, "226 Transfer complete.");
-            fileFound = true;
+bool FtpServer::HandleRetr(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
+{
+    PENDING_TRANSFER& transfer = ClientContext.Work->Transfer;
+    transfer.Trace = TransferTrace(COMMAND_ID::Retr);
+    if (Argument.size() == 0)
+    {
+        return this->SendReply(ClientContext, Replies::SyntaxError);
+    }
 
-            break;
+    // Only names that are actually in the current directory can be retrieved.
+    bool fileFound = false;
+    {
+        DirectoryEnumerator directory;
+        if (!directory.Open(ClientContext.CurrentDir.CStr()))
+        {
+            return this->SendReply(ClientContext, Replies::FileUnavailable);
         }
-    } while (FindNextFileA(fileHandle, &fileData));
-    FindClose(fileHandle);
 
+        DIRECTORY_ENTRY entry;
+        while (!fileFound && directory.Next(entry))
+        {
+            fileFound = Argument == entry.Name;
+        }
+    }
     if (!fileFound)
     {
-        status = this->SendString(ClientContext, "550 File or directory unavailable.");
+        return this->SendReply(ClientContext, Replies::FileUnavailable);
     }
 
-    return status;
+    FILE_HANDLE file = INVALID_FILE_HANDLE;
+    if (BuildPath(transfer.FilePath, ClientContext.CurrentDir.View(), Argument))
+    {
+        file = Platform::OpenFile(transfer.FilePath, FILE_ACCESS::Read);
+    }
+    if (file == INVALID_FILE_HANDLE)
+    {
+        return this->SendReply(ClientContext, Replies::FileNotFound);
+    }
+
+    this->SendReply(ClientContext, Replies::OpeningDataConnection);
+    this->FlushReplies(ClientContext);
+    transfer.File = file;
+    transfer.Kind = TRANSFER_KIND::Download;
+    return true;
 }
 
-bool FtpServer::HandleType(CLIENT_CONTEXT& ClientContext, const std::string& Argument)
+TRANSFER_STEP FtpServer::SendFile(CLIENT_CONTEXT& ClientContext)
 {
-    if (ClientContext.Access == CLIENT_ACCESS::NotLoggedIn)
+    PENDING_TRANSFER& transfer = ClientContext.Work->Transfer;
+    if (transfer.Connection == INVALID_SOCKET)
+    {
+        transfer.Connection = this->OpenDataConnection(ClientContext);
+        if (transfer.Connection == INVALID_SOCKET)
+        {
+            Platform::CloseFile(transfer.File);
+            return TRANSFER_STEP::Finished;
+        }
+        transfer.Trace.Mark(TRACE_PHASE::DataSocketReady);
+        transfer.Started = std::chrono::steady_clock::now();
+    }
+
+    CHAR buffer[DEFAULT_BUFLEN] = { 0 };
+    size_t allowed = 0;
+    size_t bytesRead = 0;
+    bool readFailed = false;
+    while (true)
+    {
+        if (transfer.Schedule.Deficit <= 0)
+        {
+            return TRANSFER_STEP::Yielded;
+        }
+        if (!(allowed = this->shaper.Allow(transfer.Flow, sizeof(buffer), transfer.ResumeAt)))
+        {
+            return TRANSFER_STEP::Paused;
+        }
+        allowed = std::min<size_t>(allowed, static_cast<size_t>(transfer.Schedule.Deficit));
+        if ((readFailed = !Platform::ReadFile(transfer.File, buffer, allowed, bytesRead)) || !bytesRead)
+        {
+            break;
+        }
+        BandwidthShaper::Spend(transfer.Flow, bytesRead);
+        transfer.Schedule.Deficit -= static_cast<int64_t>(bytesRead);
+        if (!SendBuffer(transfer.Connection, buffer, bytesRead))
+        {
+            Metrics::TransferError();
+            Platform::CloseFile(transfer.File);
+            this->CloseDataSocket(ClientContext, transfer.Connection);
+            transfer.Connection = INVALID_SOCKET;
+            transfer.Trace.Mark(TRACE_PHASE::LastByte, transfer.Transferred);
+            ClientContext.TransferBytes = transfer.Transferred;
+            LogTransfer(ClientContext, transfer.FilePath, TRANSFER_DIRECTION::Outgoing, transfer.Transferred, transfer.Started, false);
+            this->SendReply(ClientContext, Replies::TransferAborted);
+            return TRANSFER_STEP::Finished;
+        }
+        if (!transfer.Transferred)
+        {
+            transfer.Trace.Mark(TRACE_PHASE::FirstByte);
+        }
+        transfer.Transferred += bytesRead;
+        transfer.Progress.store(transfer.Transferred, std::memory_order_relaxed);
+    }
+
+    // The client sees the data connection close either way; only the reply tells it
+    // that a failed read left it with part of the file.
+    Platform::CloseFile(transfer.File);
+    this->CloseDataSocket(ClientContext, transfer.Connection);
+    transfer.Connection = INVALID_SOCKET;
+    transfer.Trace.Mark(TRACE_PHASE::LastByte, transfer.Transferred);
+    ClientContext.TransferBytes = transfer.Transferred;
+    LogTransfer(ClientContext, transfer.FilePath, TRANSFER_DIRECTION::Outgoing, transfer.Transferred, transfer.Started, !readFailed);
+    if (readFailed)
+    {
+        Metrics::TransferError();
+        this->SendReply(ClientContext, Replies::LocalError);
+        return TRANSFER_STEP::Finished;
+    }
+    if (this->SendReply(ClientContext, Replies::TransferComplete))
     {
-        return this->SendString(ClientContext, "530 Please login with USER and PASS.");
+        this->FlushReplies(ClientContext);
     }
+    transfer.Trace.Mark(TRACE_PHASE::ReplySent, transfer.Transferred);
+    return TRANSFER_STEP::Finished;
+}
 
+bool FtpServer::HandleType(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
+{
     if (Argument.size() == 0)
     {
-        return this->SendString(ClientContext, "501 Syntax error in parameters or arguments.");
+        return this->SendReply(ClientContext, Replies::SyntaxError);
     }
 
-    switch (Argument.c_str()[0])
+    switch (Argument[0])
     {
     case 'A':
     case 'a':
-        return this->SendString(ClientContext, "200 Type set to A.");
+        ClientContext.TransferType = 'a';
+        return this->SendReply(ClientContext, Replies::TypeAscii);
 
     case 'I':
     case 'i':
-        return this->SendString(ClientContext, "200 Type set to I.");
+        ClientContext.TransferType = 'b';
+        return this->SendReply(ClientContext, Replies::TypeImage);
 
     default:
-        return this->SendString(ClientContext, "501 Syntax error in parameters or argument.");
+        return this->SendReply(ClientContext, Replies::SyntaxError);
     }
 }
 
-bool FtpServer::HandleStor(CLIENT_CONTEXT& ClientContext, const std::string& Argument)
+bool FtpServer::HandleStor(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
 {
-    if (ClientContext.Access == CLIENT_ACCESS::NotLoggedIn)
-    {
-        return this->SendString(ClientContext, "530 Please login with USER and PASS.");
-    }
-
-    if (ClientContext.Access == CLIENT_ACCESS::ReadOnly)
+    PENDING_TRANSFER& transfer = ClientContext.Work->Transfer;
+    transfer.Trace = TransferTrace(COMMAND_ID::Stor);
+    if (Argument.size() == 0)
     {
-        return this->SendString(ClientContext, "550 Permission denied.");
+        return this->SendReply(ClientContext, Replies::SyntaxError);
     }
 
-    if (Argument.size() == 0)
+    FILE_HANDLE file = INVALID_FILE_HANDLE;
+    if (BuildPath(transfer.FilePath, ClientContext.CurrentDir.View(), Argument))
     {
-        return this->SendString(ClientContext, "501 Syntax error in parameters or arguments.");
+        file = Platform::OpenFile(transfer.FilePath, FILE_ACCESS::Write);
     }
-
-    std::ofstream file(std::string(ClientContext.CurrentDir) + "\\" + Argument, std::ios::binary);
-    if (!file.is_open())
+    if (file == INVALID_FILE_HANDLE)
     {
-        return this->SendString(ClientContext, "550 Cannot open file for writing.");
+        return this->SendReply(ClientContext, Replies::CannotOpenForWriting);
     }
 
-    this->SendString(ClientContext, "150 Opening data connection.");
+    this->SendReply(ClientContext, Replies::OpeningDataConnection);
+    this->FlushReplies(ClientContext);
+    transfer.File = file;
+    transfer.Kind = TRANSFER_KIND::Upload;
+    return true;
+}
 
-    SOCKET dataSocket = { 0 };
-    if (ClientContext.DataSocketType == DATASOCKET_TYPE::Passive)
+TRANSFER_STEP FtpServer::ReceiveFile(CLIENT_CONTEXT& ClientContext)
+{
+    PENDING_TRANSFER& transfer = ClientContext.Work->Transfer;
+    if (transfer.Connection == INVALID_SOCKET)
     {
-        dataSocket = accept(ClientContext.DataSocket, NULL, NULL);
-        closesocket(ClientContext.DataSocket);
-        ClientContext.DataSocket = dataSocket;
-        if (dataSocket == INVALID_SOCKET)
+        transfer.Connection = this->OpenDataConnection(ClientContext);
+        if (transfer.Connection == INVALID_SOCKET)
         {
-            file.close();
-            closesocket(dataSocket);
-            return this->SendString(ClientContext, "451 Requested action aborted. Local error in processing.");
+            Platform::CloseFile(transfer.File);
+            return TRANSFER_STEP::Finished;
         }
+        transfer.Trace.Mark(TRACE_PHASE::DataSocketReady);
+        transfer.Started = std::chrono::steady_clock::now();
+        transfer.WriteFailed = false;
     }
-    else if (ClientContext.DataSocketType == DATASOCKET_TYPE::Normal)
+
+    // A paused upload leaves the client's bytes in the socket buffer, and TCP slows
+    // the client down.
+    int bytesRead;
+    size_t allowed = 0;
+    CHAR buffer[DEFAULT_BUFLEN] = { 0 };
+    while (true)
     {
-        dataSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-        SOCKADDR_IN clientAddr = { .sin_family = AF_INET, .sin_port = ClientContext.DataPort, .sin_addr = ClientContext.DataIPv4 };
-        int status = connect(dataSocket, reinterpret_cast<PSOCKADDR>(&clientAddr), sizeof(clientAddr));
-        if (status == SOCKET_ERROR)
+        if (transfer.Schedule.Deficit <= 0)
+        {
+            return TRANSFER_STEP::Yielded;
+        }
+        if (!(allowed = this->shaper.Allow(transfer.Flow, sizeof(buffer), transfer.ResumeAt)))
+        {
+            return TRANSFER_STEP::Paused;
+        }
+        allowed = std::min<size_t>(allowed, static_cast<size_t>(transfer.Schedule.Deficit));
+        if ((bytesRead = recv(transfer.Connection, buffer, static_cast<int>(allowed), 0)) <= 0)
+        {
+            break;
+        }
+        BandwidthShaper::Spend(transfer.Flow, static_cast<size_t>(bytesRead));
+        transfer.Schedule.Deficit -= bytesRead;
+        if (!transfer.Transferred)
         {
-            file.close();
-            closesocket(dataSocket);
-            return this->SendString(ClientContext, "550 File or directory unavailable.");
+            transfer.Trace.Mark(TRACE_PHASE::FirstByte);
         }
+        transfer.Transferred += static_cast<uint64_t>(bytesRead);
+        transfer.Progress.store(transfer.Transferred, std::memory_order_relaxed);
+        Metrics::AddBytesIn(static_cast<uint64_t>(bytesRead));
+        transfer.WriteFailed = transfer.WriteFailed || !Platform::WriteFile(transfer.File, buffer, static_cast<size_t>(bytesRead));
     }
 
-    int bytesRead;
-    CHAR buffer[DEFAULT_BUFLEN] = { 0 };
-    while ((bytesRead = recv(dataSocket, buffer, sizeof(buffer), 0)) > 0)
+    // A stalled upload was shut down under recv, which then reports end of file.
+    bool written = !transfer.WriteFailed;
+    bool stalled = transfer.Stalled.load(std::memory_order_relaxed);
+    uint64_t transferred = transfer.Transferred;
+    Platform::CloseFile(transfer.File);
+    this->CloseDataSocket(ClientContext, transfer.Connection);
+    transfer.Connection = INVALID_SOCKET;
+    transfer.Trace.Mark(TRACE_PHASE::LastByte, transferred);
+    ClientContext.TransferBytes = transferred;
+    LogTransfer(ClientContext, transfer.FilePath, TRANSFER_DIRECTION::Incoming, transferred, transfer.Started, written && bytesRead == 0 && !stalled);
+
+    if (!written)
     {
-        file.write(buffer, bytesRead);
+        Metrics::TransferError();
+        this->SendReply(ClientContext, Replies::InsufficientStorage);
+        return TRANSFER_STEP::Finished;
     }
 
-    file.close();
-    closesocket(dataSocket);
-
-    if (bytesRead < 0)
+    if (bytesRead < 0 || stalled)
     {
-        return this->SendString(ClientContext, "426 Connection closed; transfer aborted.");
+        Metrics::TransferError();
+        this->SendReply(ClientContext, Replies::TransferAborted);
+        return TRANSFER_STEP::Finished;
     }
 
-    return this->SendString(ClientContext, "226 Transfer complete.");
+    if (this->SendReply(ClientContext, Replies::TransferComplete))
+    {
+        this->FlushReplies(ClientContext);
+    }
+    transfer.Trace.Mark(TRACE_PHASE::ReplySent, transferred);
+    return TRANSFER_STEP::Finished;
 }
 
-bool FtpServer::HandleNlst(CLIENT_CONTEXT& ClientContext, const std::string& Argument)
+bool FtpServer::HandleNlst(CLIENT_CONTEXT& ClientContext, std::string_view Argument)
 {
     return this->HandleList(ClientContext, Argument);
-
-    /*
-    if (ClientContext.Access == CLIENT_ACCESS::NotLoggedIn) {
-        return this->SendString(ClientContext, "530 Please login with USER and PASS.");
-    }
-
-    std::string dirPath = ClientContext.CurrentDir;
-    if (!Argument.empty() && !Argument.starts_with("-")) {
-        dirPath += "\\" + Argument;
-    }
-
-    WIN32_FIND_DATAA fileData;
-    HANDLE hFind = FindFirstFileA((dirPath + "\\*").c_str(), &fileData);
-    if (hFind == INVALID_HANDLE_VALUE) {
-        return this->SendString(ClientContext, "450 Requested file action not taken. Directory unavailable.");
-    }
-
-    std::stringstream fileList;
-    do {
-        if (!(fileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
-            fileList << fileData.cFileName << "\r\n";
-        }
-    } while (FindNextFileA(hFind, &fileData));
-    FindClose(hFind);
-
-    return this->SendString(ClientContext.DataSocket, fileList.str()) &&
-        this->SendString(ClientContext, "226 Transfer complete."); */
 }
 
 
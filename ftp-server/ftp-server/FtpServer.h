@@ -1,19 +1,68 @@
 #pragma once
-#include <WinSock2.h>
-#include <WS2tcpip.h>
+#include <atomic>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <fstream>
-#include "BS_thread_pool_light.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory_resource>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#define BS_THREAD_POOL_ENABLE_PRIORITY
+#include "BS_thread_pool.hpp"
+#include "Admission.h"
+#include "BandwidthShaper.h"
+#include "CommandTable.h"
+#include "InstrumentedPool.h"
+#include "Listing.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Platform.h"
+#include "Protocol.h"
+#include "Replies.h"
+#include "SessionCapture.h"
+#include "SessionSlab.h"
+#include "StringTable.h"
+#include "TimerWheel.h"
+#include "Tracing.h"
+#include "TransferLog.h"
+#include "TransferScheduler.h"
 
 #define DEFAULT_BUFLEN  512
 #define DEFAULT_PORT    "21"
+#define METRICS_PORT    9121
+#define SESSION_THREADS 16
+#define TRANSFER_THREADS 8
+#define POLL_BATCH      64
+#define WORKSPACE_SPARES 64
+#define SESSION_ARENA_LENGTH 1024
+#define TIMER_TICK_MS   100
+#define DEFAULT_IDLE_TIMEOUT_SECONDS    300
+#define DEFAULT_LOGIN_TIMEOUT_SECONDS   30
+#define DEFAULT_STALL_TIMEOUT_SECONDS   60
+#define DEFAULT_DRAIN_SECONDS           30
+#define DRAIN_POLL_MS                   50
+#define HANDOFF_MAGIC                   0x48505446UL    // "FTPH"
+#define HANDOFF_VERSION                 1
+#define HANDOFF_MAX_LISTENERS           64
 #define USERNAME_MAX_LENGTH         25
 #define PASSWORD_MAX_LENGTH         32
 #define MESSAGE_MAX_LENGTH          256
+#define OUTPUT_MAX_SEGMENTS         32
+#define OUTPUT_STORAGE_LENGTH       2048
 #define HARDCODED_USER              "user"
 #define HARDCODED_PASSWORD          "pass"
+#if defined(_WIN32)
+#define FTP_ROOT_DIRECTORY          R"(C:\Users\Alex)"
+#else
+#define FTP_ROOT_DIRECTORY          "."
+#endif
 
 typedef enum class _CLIENT_ACCESS : BYTE
 {
@@ -35,23 +84,272 @@ typedef enum class _DATASOCKET_TYPE : BYTE
     MaxDataSockektType
 } DATASOCKET_TYPE, * PDATASOCKET_TYPE;
 
+typedef enum class _TRANSFER_KIND : BYTE
+{
+    None = 0,
+    Listing = 1,
+    Download = 2,
+    Upload = 3,
+
+    MaxTransferKind
+} TRANSFER_KIND, * PTRANSFER_KIND;
+
+// How far one slice of a data transfer got.
+typedef enum class _TRANSFER_STEP : BYTE
+{
+    Finished = 0,   // over, whether it succeeded or not
+    Paused = 1,     // out of shaper credit, asleep on its resume timer
+    Yielded = 2,    // its scheduler turn is used up and it has more to move
+
+    MaxTransferStep
+} TRANSFER_STEP, * PTRANSFER_STEP;
+
+// Objects built in a session's arena are only destroyed in place; their memory
+// comes back when the arena is reset after the command.
+typedef struct _ARENA_DELETE
+{
+    template <typename T>
+    VOID operator()(T* Object) const
+    {
+        Object->~T();
+    }
+} ARENA_DELETE;
+
+template <typename T>
+using ArenaPtr = std::unique_ptr<T, ARENA_DELETE>;
+
+template <typename T>
+ArenaPtr<T> MakeInArena(std::pmr::memory_resource& Arena)
+{
+    return ArenaPtr<T>(std::pmr::polymorphic_allocator<>(&Arena).new_object<T>());
+}
+
+// A data transfer that a command handler has set up (150 sent, file or listing
+// open) and that runs on the transfer pool once the control task lets go of the
+// session. Line and Verb point into the session's receive buffer, which is left
+// alone until the transfer is done.
+typedef struct _PENDING_TRANSFER
+{
+    TRANSFER_KIND                         Kind = TRANSFER_KIND::None;
+    COMMAND_ID                            Command = COMMAND_ID::Unknown;
+    FILE_HANDLE                           File = INVALID_FILE_HANDLE;
+    CHAR                                  FilePath[MAX_PATH] = { 0 };
+    ArenaPtr<DirectoryListing>            Listing;
+    TransferTrace                         Trace;
+    std::string_view                      Line;
+    std::string_view                      Verb;
+    std::chrono::steady_clock::time_point Received;
+
+    // Stall detection: the transfer publishes its byte count, and the shard's
+    // poller compares it with the count it saw at the previous stall check.
+    // DataSocket is what the poller shuts down to unblock a stalled transfer.
+    std::atomic<uint64_t>                 Progress{ 0 };
+    uint64_t                              CheckedProgress = 0ULL;
+    std::atomic<bool>                     Stalled{ false };
+    SOCKET                                DataSocket = INVALID_SOCKET;     // under the shard's SessionLock
+
+    // Shaping: a transfer that runs out of credit keeps its data connection open,
+    // leaves the transfer pool and sleeps on ResumeTimer in its shard's timer wheel
+    // until ResumeAt; the next slice carries on from Transferred. Schedule is a
+    // file transfer's place in the transfer scheduler, which also ends a slice.
+    SHAPED_FLOW                           Flow;
+    SCHEDULED_FLOW                        Schedule;
+    SOCKET                                Connection = INVALID_SOCKET;
+    uint64_t                              Transferred = 0ULL;
+    bool                                  WriteFailed = false;
+    std::chrono::steady_clock::time_point Started;
+    std::chrono::steady_clock::time_point ResumeAt;
+    TIMER                                 ResumeTimer;
+
+    // Gives up a transfer that will not run, or not again: closes its file and
+    // destroys its listing. The reply to its 150 is the caller's to send.
+    VOID Reset()
+    {
+        if (this->File != INVALID_FILE_HANDLE)
+        {
+            Platform::CloseFile(this->File);
+            this->File = INVALID_FILE_HANDLE;
+        }
+        this->Kind = TRANSFER_KIND::None;
+        this->Listing.reset();
+    }
+
+    ~_PENDING_TRANSFER()
+    {
+        this->Reset();
+    }
+} PENDING_TRANSFER, * PPENDING_TRANSFER;
+
+typedef struct _OUTPUT_BUFFER
+{
+    IO_SEGMENT      Segments[OUTPUT_MAX_SEGMENTS] = {};
+    ULONG           SegmentCount = 0UL;
+    ULONG           StorageLength = 0UL;
+    CHAR            Storage[OUTPUT_STORAGE_LENGTH] = { 0 };
+} OUTPUT_BUFFER, * POUTPUT_BUFFER;
+
+// The buffers a session only needs while it is doing something. A session borrows
+// one from its shard when it wakes up and gives it back when it parks, unless it
+// is holding part of a command line, so an idle session costs a CLIENT_CONTEXT
+// and nothing more. What a command needs beyond the fixed buffers comes from Arena,
+// which is reset once the command, and any transfer it started, is done; only
+// something larger than ArenaBuffer reaches the global allocator.
+typedef struct _SESSION_WORKSPACE
+{
+    ULONG            ReceiveLength = 0UL;
+    ULONG            ReceiveOffset = 0UL;    // commands before this one have been handled
+    CHAR             ReceiveBuffer[DEFAULT_BUFLEN] = { 0 };
+    OUTPUT_BUFFER    Output;
+    alignas(std::max_align_t) BYTE ArenaBuffer[SESSION_ARENA_LENGTH];
+    std::pmr::monotonic_buffer_resource Arena{ ArenaBuffer, sizeof(ArenaBuffer), std::pmr::new_delete_resource() };
+    PENDING_TRANSFER Transfer;              // after Arena, so its Listing goes first
+} SESSION_WORKSPACE, * PSESSION_WORKSPACE;
+
+// Lives in its shard's SessionSlab. Strings that most sessions share are interned.
 typedef struct _CLIENT_CONTEXT
 {
-    SOCKET          Socket = { 0 };
-    CHAR            UserName[USERNAME_MAX_LENGTH] = { 0 };
-    CHAR            CurrentDir[MAX_PATH] = { 0 };
-    CLIENT_ACCESS   Access = CLIENT_ACCESS::NotLoggedIn;
+    SOCKET          Socket = INVALID_SOCKET;
+    SOCKET          DataSocket = INVALID_SOCKET;
+    struct _ACCEPTOR_SHARD* Shard = nullptr;
+    SESSION_HANDLE  Handle = INVALID_SESSION_HANDLE;
+    std::unique_ptr<SESSION_WORKSPACE> Work;    // attached and detached under the SessionLock
+    InternedString  UserName;
+    InternedString  CurrentDir;
     IN_ADDR         IPv4 = { 0 };
     IN_ADDR         DataIPv4 = { 0 };
     USHORT          DataPort = 0UL;
-    SOCKET          DataSocket = { 0 };
+    CLIENT_ACCESS   Access = CLIENT_ACCESS::NotLoggedIn;
     DATASOCKET_TYPE DataSocketType = DATASOCKET_TYPE::Unknown;
+    CHAR            TransferType = 'a';
+    uint32_t        CaptureSession = 0UL;
+    uint64_t        TransferBytes = 0ULL;
+    std::chrono::steady_clock::time_point Connected;
+    TIMER           ControlTimer;   // idle or login timeout, while parked in the poller
+    TIMER           DataTimer;      // stall timeout, while a transfer runs
 } CLIENT_CONTEXT, * PCLIENT_CONTEXT;
 
+// In seconds; 0 turns a timeout off.
+typedef struct _SESSION_TIMEOUTS
+{
+    ULONG IdleSeconds = DEFAULT_IDLE_TIMEOUT_SECONDS;          // no command on the control connection
+    ULONG LoginSeconds = DEFAULT_LOGIN_TIMEOUT_SECONDS;        // from connect until PASS succeeds
+    ULONG DataStallSeconds = DEFAULT_STALL_TIMEOUT_SECONDS;    // no data connection or no bytes moved
+} SESSION_TIMEOUTS, * PSESSION_TIMEOUTS;
+
+typedef struct _LISTENER_OPTIONS
+{
+    PCSTR Port = DEFAULT_PORT;
+    ULONG Shards = 1UL;             // 0: one per CPU
+    bool  PinShards = false;
+    ADMISSION_LIMITS Admission;
+    SESSION_TIMEOUTS Timeouts;
+    ULONG DrainSeconds = DEFAULT_DRAIN_SECONDS;
+    SHAPING_RATES Rates;
+    std::vector<std::pair<std::string_view, ULONG>> Weights;    // transfer scheduler weight by user
+    PCSTR HandoffPath = nullptr;    // accept a takeover from a newer process here
+    PCSTR TakeoverPath = nullptr;   // take the listeners and sessions of the process there
+} LISTENER_OPTIONS, * PLISTENER_OPTIONS;
+
+// One accept loop, the poller that watches its sessions' control connections and
+// the pool that runs their commands. With port sharing each shard owns a listening
+// socket and the kernel spreads connections across them; without it the shards
+// all accept() on the first shard's socket. Listening sockets are non-blocking and
+// the accept loop waits on its own poller, so it can be stopped without shutting
+// down a socket that another process may share after a handoff. The session poller
+// thread also runs the shard's session timers: it sleeps until the next one is due
+// and wakes early if a timer is set that is due before then. SessionLock guards the
+// timers, the shard's sessions and its spare workspaces.
+typedef struct _ACCEPTOR_SHARD
+{
+    class FtpServer*                  Server = nullptr;
+    ULONG                             Index = 0UL;
+    SOCKET                            ListenSocket = INVALID_SOCKET;
+    bool                              OwnsSocket = false;
+    std::unique_ptr<InstrumentedPool> Sessions;
+    SocketPoller                      Acceptor;
+    SocketPoller                      Poller;
+    std::mutex                        SessionLock;
+    SessionSlab<CLIENT_CONTEXT>       Slots;
+    std::vector<std::unique_ptr<SESSION_WORKSPACE>> SpareWorkspaces;
+    TimerWheel                        Timers{ std::chrono::milliseconds(TIMER_TICK_MS) };
+    std::chrono::steady_clock::time_point PollerWakeAt = std::chrono::steady_clock::time_point::max();
+    std::thread                       Thread;
+    std::thread                       PollerThread;
+} ACCEPTOR_SHARD, * PACCEPTOR_SHARD;
+
+typedef enum class _DRAIN_MODE : BYTE
+{
+    None = 0,
+    Close = 1,      // idle sessions are told 421 and closed
+    Handoff = 2,    // listeners and idle sessions go to the process that took over
+
+    MaxDrainMode
+} DRAIN_MODE, * PDRAIN_MODE;
+
+typedef enum class _HANDOFF_KIND : BYTE
+{
+    Listeners = 1,  // FTP listeners, then the metrics listener if MetricsListener
+    Session = 2,    // one control connection and the state below
+    End = 3,
+
+    MaxHandoffKind
+} HANDOFF_KIND, * PHANDOFF_KIND;
+
+// One message on the handoff channel, with the sockets it describes attached. Both
+// ends are the same build of the server or a compatible one, so the layout is the
+// protocol; Magic and Version catch anything else.
+typedef struct _HANDOFF_MESSAGE
+{
+    uint32_t      Magic = HANDOFF_MAGIC;
+    uint16_t      Version = HANDOFF_VERSION;
+    HANDOFF_KIND  Kind = HANDOFF_KIND::End;
+    bool          MetricsListener = false;
+    CHAR          UserName[USERNAME_MAX_LENGTH] = { 0 };
+    CHAR          CurrentDir[MAX_PATH] = { 0 };
+    CLIENT_ACCESS Access = CLIENT_ACCESS::NotLoggedIn;
+    CHAR          TransferType = 'a';
+    uint8_t       Address[4] = { 0 };
+    uint64_t      AgeMs = 0ULL;             // since the client connected, for the login timeout
+    ULONG         ReceiveLength = 0UL;      // a partial command line
+    CHAR          ReceiveBuffer[DEFAULT_BUFLEN] = { 0 };
+} HANDOFF_MESSAGE, * PHANDOFF_MESSAGE;
+
 class FtpServer
 {
-    std::unique_ptr<BS::thread_pool_light> threadPool;
-    SOCKET listenSocket = { 0 };
+    std::vector<std::unique_ptr<ACCEPTOR_SHARD>> shards;
+    std::atomic<bool> stopping{ false };        // set under handBackLock
+    std::mutex handBackLock;
+    std::atomic<bool> draining{ false };
+    AdmissionControl admission;
+    SESSION_TIMEOUTS timeouts;
+    InternedString rootDirectory;
+
+    std::mutex stopLock;
+    std::condition_variable stopRequested;
+    DRAIN_MODE drainMode = DRAIN_MODE::None;
+    bool drainAborted = false;
+    ULONG drainSeconds = DEFAULT_DRAIN_SECONDS;
+    std::atomic<uint64_t> sessionsClosed{ 0 };
+    std::atomic<uint64_t> sessionsHandedOff{ 0 };
+
+    std::string handoffPath;
+    SOCKET handoffListener = INVALID_SOCKET;
+    std::thread handoffThread;
+    std::mutex handoffLock;
+    SOCKET handoffChannel = INVALID_SOCKET;     // under handoffLock once draining
+    std::atomic<bool> handingOff{ false };
+    SOCKET takeoverChannel = INVALID_SOCKET;
+    std::thread takeoverThread;
+
+    BS::thread_pool transfers;
+    BandwidthShaper shaper;
+    std::mutex bulkLock;
+    TransferScheduler<PCLIENT_CONTEXT> bulkTransfers;      // under bulkLock
+    std::mutex statsLock;
+    METRICS_SNAPSHOT statsSnapshot;     // SITE STATS, under statsLock
+    SOCKET metricsSocket = INVALID_SOCKET;
+    SocketPoller metricsPoller;
+    std::thread metricsThread;
 
 public:
     FtpServer();
@@ -63,28 +361,100 @@ public:
     FtpServer(_Inout_ FtpServer&& Other) = delete;
     FtpServer& operator=(_In_ FtpServer&& Other) = delete;
 
-    VOID Start();
+    // Serves until a stop is requested or another process takes over, then drains
+    // and returns.
+    VOID Start(const LISTENER_OPTIONS& Options = LISTENER_OPTIONS());
+
+    // Asks Start() to drain; a second request cuts the drain short.
+    VOID RequestStop();
 
 private:
-    VOID HandleConnections();
-
-    VOID HandleConnection(CLIENT_CONTEXT& ClientContext);
-
-    bool SendString(const CLIENT_CONTEXT& ClientSocket, const std::string& Message);
-    bool SendString(const SOCKET& Socket, const std::string& Message);
-
-    void ProcessCommand(const std::string& Command, CLIENT_CONTEXT& ClientContext);
-
-    bool HandleUser(CLIENT_CONTEXT& ClientContext, const std::string& Argument);
-    bool HandleOpts(CLIENT_CONTEXT& ClientContext, const std::string& Argument);
-    bool HandlePass(CLIENT_CONTEXT& ClientContext, const std::string& Argument);
-    bool HandlePasv(CLIENT_CONTEXT& ClientContext);
-    bool HandleQuit(CLIENT_CONTEXT& ClientContext);
-    bool HandleList(CLIENT_CONTEXT& ClientContext, const std::string& Argument);
-    bool HandlePort(CLIENT_CONTEXT& ClientContext, const std::string& Argument);
-    bool HandleRetr(CLIENT_CONTEXT& ClientContext, const std::string& Argument);
-    bool HandleType(CLIENT_CONTEXT& ClientContext, const std::string& Argument);
-    bool HandleStor(CLIENT_CONTEXT& ClientContext, const std::string& Argument);
-    bool HandleNlst(CLIENT_CONTEXT& ClientContext, const std::string& Argument);
+    static SOCKET OpenListener(PCSTR Port, bool& PortSharing);
+    static SOCKET AcceptNext(SocketPoller& Poller, SOCKET Listener, SOCKADDR_IN* Address);
+    VOID HandleConnections(ACCEPTOR_SHARD& Shard, bool Pin);
+    static VOID ShedConnection(SOCKET Socket, const IN_ADDR& Address, SHED_REASON Reason);
+    PCLIENT_CONTEXT NewSession(ACCEPTOR_SHARD& Shard, SOCKET Socket, const IN_ADDR& Address, std::chrono::steady_clock::time_point Connected);
+    static VOID AttachWorkspace(ACCEPTOR_SHARD& Shard, CLIENT_CONTEXT& ClientContext);
+    static VOID DetachWorkspace(ACCEPTOR_SHARD& Shard, CLIENT_CONTEXT& ClientContext);
+
+    VOID StartMetricsEndpoint(SOCKET Inherited);
+    VOID ServeMetrics();
+
+    VOID Drain();
+    VOID RetireParkedSessions();
+    VOID RetireSession(CLIENT_CONTEXT& ClientContext);
+    VOID ReportRemainingSessions();
+    VOID WaitForTakeover();
+    bool SendListeners(SOCKET Channel);
+    bool HandOffSession(CLIENT_CONTEXT& ClientContext);
+    SOCKET TakeOver(PCSTR Path, std::vector<SOCKET>& Listeners, SOCKET& MetricsListener);
+    VOID ReceiveSessions();
+
+    VOID PollSessions(ACCEPTOR_SHARD& Shard);
+    bool ParkSession(CLIENT_CONTEXT& ClientContext);
+    static VOID ArmTimer(ACCEPTOR_SHARD& Shard, TIMER& Timer, std::chrono::steady_clock::time_point Deadline);
+    VOID ExpireTimer(ACCEPTOR_SHARD& Shard, TIMER& Timer, std::chrono::steady_clock::time_point Now, std::vector<std::pair<PCLIENT_CONTEXT, SESSION_TIMEOUT>>& Closing, std::vector<PCLIENT_CONTEXT>& Resuming);
+    VOID TimeOutSession(CLIENT_CONTEXT& ClientContext, SESSION_TIMEOUT Timeout);
+    VOID ServeSession(CLIENT_CONTEXT& ClientContext);
+    VOID ProcessPending(CLIENT_CONTEXT& ClientContext);
+    VOID QueueTransfer(CLIENT_CONTEXT& ClientContext, bool Returning = false);
+    VOID RunNextBulkTransfer();
+    VOID RunTransfer(CLIENT_CONTEXT& ClientContext);
+    VOID PauseTransfer(CLIENT_CONTEXT& ClientContext);
+    VOID EndSession(PCLIENT_CONTEXT ClientContext);
+
+    bool SendString(CLIENT_CONTEXT& ClientContext, std::string_view Message);
+    bool SendReply(CLIENT_CONTEXT& ClientContext, const REPLY& Reply);
+    bool FlushReplies(CLIENT_CONTEXT& ClientContext);
+    static bool SendBuffer(const SOCKET& Socket, const CHAR* Buffer, size_t Length);
+
+    void ProcessCommand(std::string_view Command, CLIENT_CONTEXT& ClientContext);
+
+    typedef bool (FtpServer::* COMMAND_ROUTINE)(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+
+    typedef struct _COMMAND_HANDLER
+    {
+        COMMAND_ROUTINE Routine = nullptr;
+        CLIENT_ACCESS   RequiredAccess = CLIENT_ACCESS::Unknown;
+        COMMAND_ID      Id = COMMAND_ID::Unknown;
+    } COMMAND_HANDLER, * PCOMMAND_HANDLER;
+
+    static const COMMAND_HANDLER* FindCommand(std::string_view Verb);
+
+    bool HandleUser(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool HandleOpts(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool HandlePass(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool HandlePasv(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool HandleEpsv(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool HandleQuit(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool HandleList(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool HandlePort(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool HandleRetr(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool HandleType(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool HandleStor(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool HandleNlst(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool HandleStat(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool HandleSite(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+
+    bool SiteStats(CLIENT_CONTEXT& ClientContext);
+    bool SiteTrace(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool SiteCapture(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool SiteRate(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+    bool SiteWeight(CLIENT_CONTEXT& ClientContext, std::string_view Argument);
+
+    static VOID CaptureCommand(CLIENT_CONTEXT& ClientContext, std::string_view Line, std::string_view Verb, COMMAND_ID Id, uint64_t LatencyUs);
+    static VOID LogTransfer(const CLIENT_CONTEXT& ClientContext, PCSTR FilePath, TRANSFER_DIRECTION Direction, uint64_t Bytes, std::chrono::steady_clock::time_point Started, bool Completed);
+
+    bool OpenPassiveSocket(CLIENT_CONTEXT& ClientContext);
+    bool OpenListing(CLIENT_CONTEXT& ClientContext, std::string_view Argument, DirectoryListing& Listing);
+    SOCKET OpenDataConnection(CLIENT_CONTEXT& ClientContext);
+    VOID StartStallTimer(CLIENT_CONTEXT& ClientContext);
+    VOID StopStallTimer(CLIENT_CONTEXT& ClientContext);
+    VOID WatchDataSocket(CLIENT_CONTEXT& ClientContext, SOCKET DataSocket);
+    VOID CloseDataSocket(CLIENT_CONTEXT& ClientContext, SOCKET DataSocket);
+
+    TRANSFER_STEP SendListing(CLIENT_CONTEXT& ClientContext);
+    TRANSFER_STEP SendFile(CLIENT_CONTEXT& ClientContext);
+    TRANSFER_STEP ReceiveFile(CLIENT_CONTEXT& ClientContext);
 };
 
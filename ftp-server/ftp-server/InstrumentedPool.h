@@ -0,0 +1,72 @@
+#pragma once
+#include <chrono>
+#include <latch>
+#include <utility>
+#include "BS_thread_pool_light.hpp"
+#include "Metrics.h"
+#include "WorkStealingPool.h"
+
+#ifndef INSTRUMENT_THREAD_POOL
+#define INSTRUMENT_THREAD_POOL 1
+#endif
+
+#ifndef WORK_STEALING_POOL
+#define WORK_STEALING_POOL 1
+#endif
+
+// WorkStealingPool (per-worker deques) or, with WORK_STEALING_POOL=0,
+// BS::thread_pool_light (one shared queue). Only the former queues a session task
+// without allocating: BS::thread_pool_light wraps every task in std::bind.
+#if WORK_STEALING_POOL
+typedef WorkStealingPool POOL_BACKEND;
+#else
+typedef BS::thread_pool_light POOL_BACKEND;
+#endif
+
+// The pool backend with optional accounting: queue depth and its high-water mark,
+// enqueue-to-start wait, task runtime and per-worker busy time, all reported
+// through Metrics. Build with INSTRUMENT_THREAD_POOL=0 to push tasks unwrapped.
+class InstrumentedPool
+{
+public:
+    explicit InstrumentedPool(BS::concurrency_t ThreadCount) : pool(ThreadCount) {}
+
+    template <typename F>
+    void PushTask(F&& Task)
+    {
+#if INSTRUMENT_THREAD_POOL
+        Metrics::TaskQueued();
+        this->pool.push_task([task = std::forward<F>(Task), queued = std::chrono::steady_clock::now()]() mutable
+            {
+                auto started = std::chrono::steady_clock::now();
+                Metrics::TaskStarted(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(started - queued).count()));
+                task();
+                Metrics::TaskFinished(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count()));
+            });
+#else
+        this->pool.push_task(std::forward<F>(Task));
+#endif
+    }
+
+    // Runs Routine once on every worker, e.g. to set its affinity. Each worker holds
+    // on to its task until all have started, so none can take a second one. Only
+    // meaningful while the pool is otherwise idle.
+    template <typename F>
+    void RunOnEachWorker(F&& Routine)
+    {
+        BS::concurrency_t workers = this->pool.get_thread_count();
+        std::latch started(static_cast<std::ptrdiff_t>(workers));
+        for (BS::concurrency_t i = 0; i < workers; ++i)
+        {
+            this->pool.push_task([&Routine, &started]
+                {
+                    Routine();
+                    started.arrive_and_wait();
+                });
+        }
+        this->pool.wait_for_tasks();
+    }
+
+private:
+    POOL_BACKEND pool;
+};
@@ -0,0 +1,34 @@
+#include "Listing.h"
+
+bool DirectoryListing::Open(PCSTR Directory)
+{
+    if (!this->directory.Open(Directory))
+    {
+        return false;
+    }
+    this->hasEntry = this->directory.Next(this->entry);
+    return true;
+}
+
+size_t DirectoryListing::Read(PCHAR Buffer, size_t Capacity)
+{
+    size_t length = 0;
+    for (; this->hasEntry; this->hasEntry = this->directory.Next(this->entry))
+    {
+        LISTING_ENTRY listingEntry;
+        listingEntry.IsDirectory = this->entry.IsDirectory;
+        listingEntry.Size = this->entry.Size;
+        FiletimeToTimestamp(this->entry.LastWriteTime, listingEntry.LastWriteTime);
+        listingEntry.Name = this->entry.Name;
+
+        LISTING_LINE line;
+        FormatListingLine(listingEntry, line);
+        if (length + line.View().size() > Capacity)
+        {
+            break;
+        }
+        memcpy(Buffer + length, line.View().data(), line.View().size());
+        length += line.View().size();
+    }
+    return length;
+}
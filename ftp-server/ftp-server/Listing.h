@@ -0,0 +1,23 @@
+#pragma once
+#include "ListingFormat.h"
+#include "Platform.h"
+
+// Enumerates a directory and renders it as CRLF-terminated listing lines. Used by
+// LIST (over the data connection) and STAT (inline on the control connection).
+class DirectoryListing
+{
+    DirectoryEnumerator directory;
+    DIRECTORY_ENTRY     entry;
+    bool                hasEntry = false;
+
+public:
+    DirectoryListing() = default;
+
+    DirectoryListing(_In_ const DirectoryListing& Other) = delete;
+    DirectoryListing& operator=(_In_ const DirectoryListing& Other) = delete;
+
+    bool Open(PCSTR Directory);
+
+    // Fills Buffer with as many whole lines as fit; returns 0 once the listing is done.
+    size_t Read(PCHAR Buffer, size_t Capacity);
+};
@@ -0,0 +1,39 @@
+#include <chrono>
+#include "ListingFormat.h"
+
+void FiletimeToTimestamp(uint64_t FileTime, LISTING_TIME& Time)
+{
+    using namespace std::chrono;
+    constexpr sys_days epoch = year(1601) / January / 1;
+
+    uint64_t milliseconds = FileTime / 10000;
+    uint64_t dayCount = milliseconds / 86400000;
+    uint64_t dayMilliseconds = milliseconds % 86400000;
+
+    year_month_day date(epoch + days(static_cast<int64_t>(dayCount)));
+    Time.Year = static_cast<uint16_t>(static_cast<int>(date.year()));
+    Time.Month = static_cast<uint16_t>(static_cast<unsigned>(date.month()));
+    Time.Day = static_cast<uint16_t>(static_cast<unsigned>(date.day()));
+    Time.Hour = static_cast<uint16_t>(dayMilliseconds / 3600000);
+    Time.Minute = static_cast<uint16_t>(dayMilliseconds / 60000 % 60);
+    Time.Second = static_cast<uint16_t>(dayMilliseconds / 1000 % 60);
+    Time.Milliseconds = static_cast<uint16_t>(dayMilliseconds % 1000);
+}
+
+void FormatTimestamp(const LISTING_TIME& Time, LISTING_LINE& Line)
+{
+    Line.Append(Time.Year, 4).Append('-')
+        .Append(Time.Month, 2).Append('-')
+        .Append(Time.Day, 2).Append(' ')
+        .Append(Time.Hour, 2).Append(':')
+        .Append(Time.Minute, 2).Append(':')
+        .Append(Time.Second, 2).Append('.')
+        .Append(Time.Milliseconds, 3);
+}
+
+void FormatListingLine(const LISTING_ENTRY& Entry, LISTING_LINE& Line)
+{
+    Line.Append(Entry.IsDirectory ? 'd' : '-').Append("rw-r--r-- 1 owner group ").Append(Entry.Size).Append(' ');
+    FormatTimestamp(Entry.LastWriteTime, Line);
+    Line.Append(' ').Append(Entry.Name).Append("\r\n");
+}
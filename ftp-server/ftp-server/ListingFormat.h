@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include "TextBuffer.h"
+
+#define LISTING_NAME_LENGTH         260
+#define LISTING_LINE_LENGTH         (LISTING_NAME_LENGTH + 64)
+
+typedef struct _LISTING_TIME
+{
+    uint16_t Year = 0;
+    uint16_t Month = 0;
+    uint16_t Day = 0;
+    uint16_t Hour = 0;
+    uint16_t Minute = 0;
+    uint16_t Second = 0;
+    uint16_t Milliseconds = 0;
+} LISTING_TIME, * PLISTING_TIME;
+
+typedef struct _LISTING_ENTRY
+{
+    bool             IsDirectory = false;
+    uint64_t         Size = 0ULL;
+    LISTING_TIME     LastWriteTime;
+    std::string_view Name;
+} LISTING_ENTRY, * PLISTING_ENTRY;
+
+typedef TextBuffer<LISTING_LINE_LENGTH> LISTING_LINE;
+
+// FILETIME ticks (100 ns since 1601-01-01 UTC) to calendar time, without a system call.
+void FiletimeToTimestamp(uint64_t FileTime, LISTING_TIME& Time);
+
+void FormatTimestamp(const LISTING_TIME& Time, LISTING_LINE& Line);
+void FormatListingLine(const LISTING_ENTRY& Entry, LISTING_LINE& Line);
@@ -0,0 +1,217 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Logger.h"
+#include "PerThreadRing.h"
+
+namespace
+{
+    typedef struct _LOG_RECORD
+    {
+        int64_t   Timestamp;
+        LOG_LEVEL Level;
+        uint16_t  Length;
+        char      Text[LOG_MESSAGE_LENGTH];
+    } LOG_RECORD;
+
+    typedef PerThreadRing<LOG_RECORD, LOG_RING_CAPACITY> LOG_RING;
+
+    struct LOGGER_STATE
+    {
+        std::mutex             lock;       // Start and Stop
+        RingRegistry<LOG_RING> rings;
+        RingFlusher            flusher;
+        bool                   running = false;
+        FILE*                  output = stdout;
+        std::atomic<LOG_LEVEL> level{ LOG_LEVEL::Info };
+    };
+
+    LOGGER_STATE& State()
+    {
+        static LOGGER_STATE state;
+        return state;
+    }
+
+    const char* LevelName(LOG_LEVEL Level)
+    {
+        switch (Level)
+        {
+        case LOG_LEVEL::Debug:
+            return "debug";
+        case LOG_LEVEL::Info:
+            return "info";
+        case LOG_LEVEL::Warning:
+            return "warn";
+        default:
+            return "error";
+        }
+    }
+
+    void AppendTimestamp(std::string& Out, int64_t Timestamp)
+    {
+        using namespace std::chrono;
+        sys_time<microseconds> time{ microseconds(Timestamp) };
+        sys_days day = floor<days>(time);
+        year_month_day date(day);
+        hh_mm_ss<microseconds> clock(time - day);
+
+        TextBuffer<32> text;
+        text.Append(static_cast<int>(date.year()), 4).Append('-')
+            .Append(static_cast<unsigned>(date.month()), 2).Append('-')
+            .Append(static_cast<unsigned>(date.day()), 2).Append('T')
+            .Append(clock.hours().count(), 2).Append(':')
+            .Append(clock.minutes().count(), 2).Append(':')
+            .Append(clock.seconds().count(), 2).Append('.')
+            .Append(clock.subseconds().count(), 6).Append('Z');
+        Out.append(text.View());
+    }
+
+    // Drains every ring into one buffer and writes it with a single fwrite. Batch
+    // and Rings are the flusher's own and keep their capacity between drains.
+    void Drain(LOGGER_STATE& State, std::string& Batch, std::vector<LOG_RING*>& Rings)
+    {
+        State.rings.Collect(Rings);
+
+        Batch.clear();
+        uint64_t dropped = 0;
+        for (LOG_RING* ring : Rings)
+        {
+            ring->Drain([&Batch, ring](const LOG_RECORD& Record)
+                {
+                    Batch.append("ts=");
+                    AppendTimestamp(Batch, Record.Timestamp);
+                    Batch.append(" level=").append(LevelName(Record.Level));
+                    Batch.append(" thread=").append(std::to_string(ring->ThreadIndex()));
+                    Batch.append(Record.Text, Record.Length).append("\n");
+                });
+            dropped += ring->NewlyDropped();
+        }
+
+        if (dropped)
+        {
+            Batch.append("ts=");
+            AppendTimestamp(Batch, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+            Batch.append(" level=warn thread=0 event=log_dropped count=").append(std::to_string(dropped)).append("\n");
+        }
+
+        if (!Batch.empty())
+        {
+            fwrite(Batch.data(), 1, Batch.size(), State.output);
+            fflush(State.output);
+        }
+    }
+}
+
+void Logger::Start(FILE* Output, LOG_LEVEL Level)
+{
+    LOGGER_STATE& state = State();
+    std::lock_guard<std::mutex> guard(state.lock);
+    if (state.running)
+    {
+        return;
+    }
+
+    state.output = Output;
+    state.level.store(Level, std::memory_order_relaxed);
+    state.running = true;
+    state.flusher.Start(std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS),
+        [&state, batch = std::string(), rings = std::vector<LOG_RING*>()]() mutable { Drain(state, batch, rings); });
+}
+
+void Logger::Stop()
+{
+    LOGGER_STATE& state = State();
+    std::lock_guard<std::mutex> guard(state.lock);
+    if (!state.running)
+    {
+        return;
+    }
+    state.running = false;
+    state.flusher.Stop();
+}
+
+void Logger::SetLevel(LOG_LEVEL Level)
+{
+    State().level.store(Level, std::memory_order_relaxed);
+}
+
+bool Logger::IsEnabled(LOG_LEVEL Level)
+{
+    return Level >= State().level.load(std::memory_order_relaxed);
+}
+
+uint64_t Logger::Dropped()
+{
+    return State().rings.Dropped();
+}
+
+void Logger::Write(LOG_LEVEL Level, std::string_view Text)
+{
+    LOG_RING& ring = State().rings.ThreadRing();
+    LOG_RECORD* record = ring.Reserve();
+    if (!record)
+    {
+        return;
+    }
+
+    record->Timestamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    record->Level = Level;
+    record->Length = static_cast<uint16_t>(Text.size() < LOG_MESSAGE_LENGTH ? Text.size() : LOG_MESSAGE_LENGTH);
+    memcpy(record->Text, Text.data(), record->Length);
+    ring.Commit();
+}
+
+LogEvent::LogEvent(LOG_LEVEL Level, std::string_view Event)
+    : enabled(Logger::IsEnabled(Level)), level(Level)
+{
+    if (this->enabled)
+    {
+        this->text.Append(" event=").Append(Event);
+    }
+}
+
+LogEvent::~LogEvent()
+{
+    if (this->enabled)
+    {
+        Logger::Write(this->level, this->text.View());
+    }
+}
+
+LogEvent& LogEvent::Field(std::string_view Key, std::string_view Value)
+{
+    if (!this->enabled)
+    {
+        return *this;
+    }
+
+    this->text.Append(' ').Append(Key).Append('=');
+    bool quote = Value.empty() || Value.find_first_of(" \"=") != std::string_view::npos;
+    if (quote)
+    {
+        this->text.Append('"');
+    }
+    for (char c : Value)
+    {
+        if (c == '"' || c == '\\')
+        {
+            this->text.Append('\\').Append(c);
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            this->text.Append('?');
+        }
+        else
+        {
+            this->text.Append(c);
+        }
+    }
+    if (quote)
+    {
+        this->text.Append('"');
+    }
+    return *this;
+}
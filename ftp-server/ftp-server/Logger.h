@@ -0,0 +1,70 @@
+#pragma once
+#include <concepts>
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+#include "TextBuffer.h"
+
+#define LOG_RING_CAPACITY           512
+#define LOG_MESSAGE_LENGTH          232
+#define LOG_FLUSH_INTERVAL_MS       50
+
+enum class LOG_LEVEL : uint8_t
+{
+    Debug = 0,
+    Info = 1,
+    Warning = 2,
+    Error = 3,
+
+    MaxLogLevel
+};
+
+// Asynchronous key=value logger. Each thread appends to its own single-producer
+// ring without taking locks; a background thread drains the rings and writes them
+// out in batches. When a ring is full the record is dropped and counted, and the
+// flusher reports the drop count instead of blocking the producer.
+class Logger
+{
+public:
+    Logger() = delete;
+
+    static void Start(FILE* Output = stdout, LOG_LEVEL Level = LOG_LEVEL::Info);
+    static void Stop();
+
+    static void SetLevel(LOG_LEVEL Level);
+    static bool IsEnabled(LOG_LEVEL Level);
+    static uint64_t Dropped();
+
+    static void Write(LOG_LEVEL Level, std::string_view Text);
+};
+
+// One log line under construction. Fields are formatted on the stack and the line
+// is handed to the logger when the temporary goes out of scope:
+//     LogEvent(LOG_LEVEL::Info, "client_connected").Field("ip", clientIP);
+class LogEvent
+{
+public:
+    LogEvent(LOG_LEVEL Level, std::string_view Event);
+    ~LogEvent();
+
+    LogEvent(const LogEvent& Other) = delete;
+    LogEvent& operator=(const LogEvent& Other) = delete;
+
+    LogEvent& Field(std::string_view Key, std::string_view Value);
+
+    template <std::integral Integer>
+        requires (!std::same_as<Integer, char> && !std::same_as<Integer, bool>)
+    LogEvent& Field(std::string_view Key, Integer Value)
+    {
+        if (this->enabled)
+        {
+            this->text.Append(' ').Append(Key).Append('=').Append(Value);
+        }
+        return *this;
+    }
+
+private:
+    bool                           enabled;
+    LOG_LEVEL                      level;
+    TextBuffer<LOG_MESSAGE_LENGTH> text;
+};
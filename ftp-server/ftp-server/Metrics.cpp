@@ -0,0 +1,391 @@
+#include <bit>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Logger.h"
+#include "Metrics.h"
+#include "TextBuffer.h"
+
+namespace
+{
+    constexpr std::string_view CommandNames[] =
+    {
+        "UNKNOWN", "USER", "PASS", "OPTS", "QUIT", "PASV", "PORT", "TYPE", "LIST", "NLST", "RETR", "STAT", "STOR", "SITE", "EPSV",
+    };
+    static_assert(std::size(CommandNames) == static_cast<size_t>(COMMAND_ID::MaxCommandId), "CommandNames must match COMMAND_ID");
+
+    constexpr std::string_view ShedReasonNames[] = { "max_sessions", "per_address", "queue_deadline" };
+    static_assert(std::size(ShedReasonNames) == static_cast<size_t>(SHED_REASON::MaxShedReason), "ShedReasonNames must match SHED_REASON");
+
+    constexpr std::string_view SessionTimeoutNames[] = { "idle", "login", "data_stall" };
+    static_assert(std::size(SessionTimeoutNames) == static_cast<size_t>(SESSION_TIMEOUT::MaxSessionTimeout), "SessionTimeoutNames must match SESSION_TIMEOUT");
+
+    typedef struct _METRICS_SHARD
+    {
+        Histogram             CommandLatency[static_cast<size_t>(COMMAND_ID::MaxCommandId)];
+        std::atomic<uint64_t> Commands[static_cast<size_t>(COMMAND_ID::MaxCommandId)] = {};
+        std::atomic<uint64_t> BytesIn{ 0 };
+        std::atomic<uint64_t> BytesOut{ 0 };
+        std::atomic<uint64_t> TransferErrors{ 0 };
+        std::atomic<uint64_t> TransfersThrottled{ 0 };
+        std::atomic<int64_t>  ActiveSessions{ 0 };
+        std::atomic<uint64_t> ConnectionsAccepted{ 0 };
+        std::atomic<uint64_t> ConnectionsShed[static_cast<size_t>(SHED_REASON::MaxShedReason)] = {};
+        std::atomic<uint64_t> SessionTimeouts[static_cast<size_t>(SESSION_TIMEOUT::MaxSessionTimeout)] = {};
+        std::atomic<uint64_t> TransferRecordsDropped{ 0 };
+
+        Histogram             TaskWait;
+        Histogram             TaskRuntime;
+        std::atomic<uint64_t> BusyMicroseconds{ 0 };
+        std::chrono::steady_clock::time_point Registered = std::chrono::steady_clock::now();
+    } METRICS_SHARD;
+
+    struct METRICS_STATE
+    {
+        std::mutex                                  lock;
+        std::vector<std::unique_ptr<METRICS_SHARD>> shards;
+        std::atomic<int64_t>                        queueDepth{ 0 };
+        std::atomic<int64_t>                        queueHighWater{ 0 };
+    };
+
+    METRICS_STATE& State()
+    {
+        static METRICS_STATE state;
+        return state;
+    }
+
+    METRICS_SHARD& ThreadShard()
+    {
+        thread_local METRICS_SHARD* shard = nullptr;
+        if (!shard)
+        {
+            METRICS_STATE& state = State();
+            std::lock_guard<std::mutex> guard(state.lock);
+            state.shards.push_back(std::make_unique<METRICS_SHARD>());
+            shard = state.shards.back().get();
+        }
+        return *shard;
+    }
+
+    void AppendSeconds(std::string& Out, uint64_t Microseconds)
+    {
+        TextBuffer<32> text;
+        text.Append(Microseconds / 1000000).Append('.').Append(Microseconds % 1000000, 6);
+        Out.append(text.View());
+    }
+
+    // One Prometheus summary series (quantiles, _sum, _count) for a microsecond histogram.
+    void AppendSummary(std::string& Out, std::string_view Name, std::string_view Labels, const HISTOGRAM_SNAPSHOT& Histogram)
+    {
+        static constexpr double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+        static constexpr std::string_view quantileLabels[] = { "0.5", "0.9", "0.99", "0.999" };
+
+        for (size_t q = 0; q < std::size(quantiles); ++q)
+        {
+            Out.append(Name).append("{").append(Labels).append(Labels.empty() ? "" : ",")
+                .append("quantile=\"").append(quantileLabels[q]).append("\"} ");
+            AppendSeconds(Out, Histogram.Percentile(quantiles[q]));
+            Out.append("\n");
+        }
+
+        std::string labels = Labels.empty() ? std::string() : "{" + std::string(Labels) + "}";
+        Out.append(Name).append("_sum").append(labels).append(" ");
+        AppendSeconds(Out, Histogram.Sum);
+        Out.append("\n").append(Name).append("_count").append(labels).append(" ")
+            .append(std::to_string(Histogram.Count)).append("\n");
+    }
+}
+
+std::string_view CommandName(COMMAND_ID Id)
+{
+    size_t index = static_cast<size_t>(Id);
+    return index < std::size(CommandNames) ? CommandNames[index] : CommandNames[0];
+}
+
+std::string_view ShedReasonName(SHED_REASON Reason)
+{
+    return ShedReasonNames[static_cast<size_t>(Reason)];
+}
+
+std::string_view SessionTimeoutName(SESSION_TIMEOUT Timeout)
+{
+    return SessionTimeoutNames[static_cast<size_t>(Timeout)];
+}
+
+size_t HistogramBucket(uint64_t Value)
+{
+    if (Value < HISTOGRAM_SUB_BUCKETS)
+    {
+        return static_cast<size_t>(Value);
+    }
+
+    int exponent = std::bit_width(Value) - 1;
+    if (exponent > HISTOGRAM_MAX_EXPONENT)
+    {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+
+    size_t mantissa = static_cast<size_t>(Value >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return static_cast<size_t>(exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS + mantissa;
+}
+
+uint64_t HistogramBucketUpperBound(size_t Bucket)
+{
+    if (Bucket < HISTOGRAM_SUB_BUCKETS)
+    {
+        return Bucket;
+    }
+
+    int shift = static_cast<int>(Bucket / HISTOGRAM_SUB_BUCKETS) - 1;
+    uint64_t mantissa = HISTOGRAM_SUB_BUCKETS + Bucket % HISTOGRAM_SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void HISTOGRAM_SNAPSHOT::Record(uint64_t Value)
+{
+    ++this->Counts[HistogramBucket(Value)];
+    ++this->Count;
+    this->Sum += Value;
+    this->Max = Value > this->Max ? Value : this->Max;
+}
+
+uint64_t HISTOGRAM_SNAPSHOT::Percentile(double Quantile) const
+{
+    if (!this->Count)
+    {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(Quantile * static_cast<double>(this->Count));
+    rank = rank < 1 ? 1 : (rank > this->Count ? this->Count : rank);
+
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+    {
+        seen += this->Counts[bucket];
+        if (seen >= rank)
+        {
+            uint64_t bound = HistogramBucketUpperBound(bucket);
+            return bound < this->Max ? bound : this->Max;
+        }
+    }
+    return this->Max;
+}
+
+void HISTOGRAM_SNAPSHOT::Merge(const HISTOGRAM_SNAPSHOT& Other)
+{
+    for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+    {
+        this->Counts[bucket] += Other.Counts[bucket];
+    }
+    this->Count += Other.Count;
+    this->Sum += Other.Sum;
+    this->Max = Other.Max > this->Max ? Other.Max : this->Max;
+}
+
+void Histogram::AddTo(HISTOGRAM_SNAPSHOT& Snapshot) const
+{
+    for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+    {
+        Snapshot.Counts[bucket] += this->counts[bucket].load(std::memory_order_relaxed);
+    }
+    Snapshot.Count += this->count.load(std::memory_order_relaxed);
+    Snapshot.Sum += this->sum.load(std::memory_order_relaxed);
+    uint64_t max = this->max.load(std::memory_order_relaxed);
+    Snapshot.Max = max > Snapshot.Max ? max : Snapshot.Max;
+}
+
+void Metrics::RecordCommand(COMMAND_ID Id, uint64_t Microseconds)
+{
+    METRICS_SHARD& shard = ThreadShard();
+    shard.CommandLatency[static_cast<size_t>(Id)].Record(Microseconds);
+    Histogram::Bump(shard.Commands[static_cast<size_t>(Id)], 1);
+}
+
+void Metrics::AddBytesIn(uint64_t Bytes)
+{
+    Histogram::Bump(ThreadShard().BytesIn, Bytes);
+}
+
+void Metrics::AddBytesOut(uint64_t Bytes)
+{
+    Histogram::Bump(ThreadShard().BytesOut, Bytes);
+}
+
+void Metrics::TransferError()
+{
+    Histogram::Bump(ThreadShard().TransferErrors, 1);
+}
+
+void Metrics::TransferThrottled()
+{
+    Histogram::Bump(ThreadShard().TransfersThrottled, 1);
+}
+
+// Sessions can end on a different thread than they started on, so the gauge lives
+// in shards as signed deltas; only the sum is meaningful.
+void Metrics::SessionStarted()
+{
+    std::atomic<int64_t>& sessions = ThreadShard().ActiveSessions;
+    sessions.store(sessions.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void Metrics::SessionEnded()
+{
+    std::atomic<int64_t>& sessions = ThreadShard().ActiveSessions;
+    sessions.store(sessions.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+}
+
+void Metrics::ConnectionAccepted()
+{
+    Histogram::Bump(ThreadShard().ConnectionsAccepted, 1);
+}
+
+void Metrics::ConnectionShed(SHED_REASON Reason)
+{
+    Histogram::Bump(ThreadShard().ConnectionsShed[static_cast<size_t>(Reason)], 1);
+}
+
+void Metrics::SessionTimedOut(SESSION_TIMEOUT Timeout)
+{
+    Histogram::Bump(ThreadShard().SessionTimeouts[static_cast<size_t>(Timeout)], 1);
+}
+
+void Metrics::TransferRecordDropped()
+{
+    Histogram::Bump(ThreadShard().TransferRecordsDropped, 1);
+}
+
+void Metrics::TaskQueued()
+{
+    METRICS_STATE& state = State();
+    int64_t depth = state.queueDepth.fetch_add(1, std::memory_order_relaxed) + 1;
+    int64_t highWater = state.queueHighWater.load(std::memory_order_relaxed);
+    while (depth > highWater && !state.queueHighWater.compare_exchange_weak(highWater, depth, std::memory_order_relaxed))
+    {
+    }
+}
+
+void Metrics::TaskStarted(uint64_t WaitMicroseconds)
+{
+    State().queueDepth.fetch_sub(1, std::memory_order_relaxed);
+    ThreadShard().TaskWait.Record(WaitMicroseconds);
+}
+
+void Metrics::TaskFinished(uint64_t RuntimeMicroseconds)
+{
+    METRICS_SHARD& shard = ThreadShard();
+    shard.TaskRuntime.Record(RuntimeMicroseconds);
+    Histogram::Bump(shard.BusyMicroseconds, RuntimeMicroseconds);
+}
+
+void Metrics::Snapshot(METRICS_SNAPSHOT& Snapshot)
+{
+    METRICS_STATE& state = State();
+    std::lock_guard<std::mutex> guard(state.lock);
+    auto now = std::chrono::steady_clock::now();
+    for (const std::unique_ptr<METRICS_SHARD>& shard : state.shards)
+    {
+        for (size_t id = 0; id < static_cast<size_t>(COMMAND_ID::MaxCommandId); ++id)
+        {
+            shard->CommandLatency[id].AddTo(Snapshot.CommandLatency[id]);
+            Snapshot.Commands[id] += shard->Commands[id].load(std::memory_order_relaxed);
+        }
+        Snapshot.BytesIn += shard->BytesIn.load(std::memory_order_relaxed);
+        Snapshot.BytesOut += shard->BytesOut.load(std::memory_order_relaxed);
+        Snapshot.TransferErrors += shard->TransferErrors.load(std::memory_order_relaxed);
+        Snapshot.TransfersThrottled += shard->TransfersThrottled.load(std::memory_order_relaxed);
+        Snapshot.ActiveSessions += shard->ActiveSessions.load(std::memory_order_relaxed);
+        Snapshot.ConnectionsAccepted += shard->ConnectionsAccepted.load(std::memory_order_relaxed);
+        for (size_t reason = 0; reason < static_cast<size_t>(SHED_REASON::MaxShedReason); ++reason)
+        {
+            Snapshot.ConnectionsShed[reason] += shard->ConnectionsShed[reason].load(std::memory_order_relaxed);
+        }
+        for (size_t timeout = 0; timeout < static_cast<size_t>(SESSION_TIMEOUT::MaxSessionTimeout); ++timeout)
+        {
+            Snapshot.SessionTimeouts[timeout] += shard->SessionTimeouts[timeout].load(std::memory_order_relaxed);
+        }
+        Snapshot.TransferRecordsDropped += shard->TransferRecordsDropped.load(std::memory_order_relaxed);
+
+        // Only threads that ran pool tasks are workers.
+        shard->TaskWait.AddTo(Snapshot.TaskWait);
+        shard->TaskRuntime.AddTo(Snapshot.TaskRuntime);
+        uint64_t busy = shard->BusyMicroseconds.load(std::memory_order_relaxed);
+        if (busy && Snapshot.Workers < METRICS_MAX_WORKERS)
+        {
+            auto lifetime = std::chrono::duration_cast<std::chrono::microseconds>(now - shard->Registered).count();
+            Snapshot.WorkerBusy[Snapshot.Workers++] = lifetime > 0 ? static_cast<double>(busy) / static_cast<double>(lifetime) : 0.0;
+        }
+    }
+
+    Snapshot.QueueDepth = state.queueDepth.load(std::memory_order_relaxed);
+    Snapshot.QueueHighWater = state.queueHighWater.load(std::memory_order_relaxed);
+    Snapshot.LogRecordsDropped = Logger::Dropped();
+}
+
+void Metrics::RenderPrometheus(std::string& Out)
+{
+    std::unique_ptr<METRICS_SNAPSHOT> snapshot = std::make_unique<METRICS_SNAPSHOT>();
+    Metrics::Snapshot(*snapshot);
+
+    Out.append("# HELP ftp_commands_total Commands processed, by verb.\n# TYPE ftp_commands_total counter\n");
+    for (size_t id = 0; id < static_cast<size_t>(COMMAND_ID::MaxCommandId); ++id)
+    {
+        Out.append("ftp_commands_total{command=\"").append(CommandNames[id]).append("\"} ")
+            .append(std::to_string(snapshot->Commands[id])).append("\n");
+    }
+
+    Out.append("# HELP ftp_command_latency_seconds Time spent handling a command, by verb.\n# TYPE ftp_command_latency_seconds summary\n");
+    for (size_t id = 0; id < static_cast<size_t>(COMMAND_ID::MaxCommandId); ++id)
+    {
+        if (snapshot->CommandLatency[id].Count)
+        {
+            AppendSummary(Out, "ftp_command_latency_seconds", "command=\"" + std::string(CommandNames[id]) + "\"", snapshot->CommandLatency[id]);
+        }
+    }
+
+    Out.append("# HELP ftp_bytes_received_total Bytes received on control and data connections.\n# TYPE ftp_bytes_received_total counter\n")
+        .append("ftp_bytes_received_total ").append(std::to_string(snapshot->BytesIn)).append("\n");
+    Out.append("# HELP ftp_bytes_sent_total Bytes sent on control and data connections.\n# TYPE ftp_bytes_sent_total counter\n")
+        .append("ftp_bytes_sent_total ").append(std::to_string(snapshot->BytesOut)).append("\n");
+    Out.append("# HELP ftp_transfer_errors_total Data transfers that were aborted.\n# TYPE ftp_transfer_errors_total counter\n")
+        .append("ftp_transfer_errors_total ").append(std::to_string(snapshot->TransferErrors)).append("\n");
+    Out.append("# HELP ftp_transfers_throttled_total Times a data transfer paused for the bandwidth shaper.\n# TYPE ftp_transfers_throttled_total counter\n")
+        .append("ftp_transfers_throttled_total ").append(std::to_string(snapshot->TransfersThrottled)).append("\n");
+    Out.append("# HELP ftp_active_sessions Control connections currently open.\n# TYPE ftp_active_sessions gauge\n")
+        .append("ftp_active_sessions ").append(std::to_string(snapshot->ActiveSessions)).append("\n");
+    Out.append("# HELP ftp_connections_accepted_total Control connections accepted, across all acceptor shards.\n# TYPE ftp_connections_accepted_total counter\n")
+        .append("ftp_connections_accepted_total ").append(std::to_string(snapshot->ConnectionsAccepted)).append("\n");
+    Out.append("# HELP ftp_connections_shed_total Control connections refused with 421 at accept time, by reason.\n# TYPE ftp_connections_shed_total counter\n");
+    for (size_t reason = 0; reason < static_cast<size_t>(SHED_REASON::MaxShedReason); ++reason)
+    {
+        Out.append("ftp_connections_shed_total{reason=\"").append(ShedReasonNames[reason]).append("\"} ")
+            .append(std::to_string(snapshot->ConnectionsShed[reason])).append("\n");
+    }
+    Out.append("# HELP ftp_session_timeouts_total Sessions closed and transfers aborted by a session timer, by kind.\n# TYPE ftp_session_timeouts_total counter\n");
+    for (size_t timeout = 0; timeout < static_cast<size_t>(SESSION_TIMEOUT::MaxSessionTimeout); ++timeout)
+    {
+        Out.append("ftp_session_timeouts_total{kind=\"").append(SessionTimeoutNames[timeout]).append("\"} ")
+            .append(std::to_string(snapshot->SessionTimeouts[timeout])).append("\n");
+    }
+    Out.append("# HELP ftp_log_dropped_total Log records dropped because a ring was full.\n# TYPE ftp_log_dropped_total counter\n")
+        .append("ftp_log_dropped_total ").append(std::to_string(snapshot->LogRecordsDropped)).append("\n");
+    Out.append("# HELP ftp_xferlog_dropped_total Transfer log records dropped because a ring was full.\n# TYPE ftp_xferlog_dropped_total counter\n")
+        .append("ftp_xferlog_dropped_total ").append(std::to_string(snapshot->TransferRecordsDropped)).append("\n");
+
+    Out.append("# HELP ftp_pool_queue_depth Tasks waiting for a worker.\n# TYPE ftp_pool_queue_depth gauge\n")
+        .append("ftp_pool_queue_depth ").append(std::to_string(snapshot->QueueDepth)).append("\n");
+    Out.append("# HELP ftp_pool_queue_depth_high_water Deepest the task queue has been.\n# TYPE ftp_pool_queue_depth_high_water gauge\n")
+        .append("ftp_pool_queue_depth_high_water ").append(std::to_string(snapshot->QueueHighWater)).append("\n");
+    Out.append("# HELP ftp_pool_task_wait_seconds Time from enqueue until a worker starts the task.\n# TYPE ftp_pool_task_wait_seconds summary\n");
+    AppendSummary(Out, "ftp_pool_task_wait_seconds", {}, snapshot->TaskWait);
+    Out.append("# HELP ftp_pool_task_runtime_seconds Time a worker spends running a task.\n# TYPE ftp_pool_task_runtime_seconds summary\n");
+    AppendSummary(Out, "ftp_pool_task_runtime_seconds", {}, snapshot->TaskRuntime);
+    Out.append("# HELP ftp_pool_worker_busy_ratio Fraction of its lifetime a worker spent running tasks.\n# TYPE ftp_pool_worker_busy_ratio gauge\n");
+    for (uint32_t worker = 0; worker < snapshot->Workers; ++worker)
+    {
+        Out.append("ftp_pool_worker_busy_ratio{worker=\"").append(std::to_string(worker)).append("\"} ")
+            .append(std::to_string(snapshot->WorkerBusy[worker])).append("\n");
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+typedef enum class _COMMAND_ID : uint8_t
+{
+    Unknown = 0,
+    User,
+    Pass,
+    Opts,
+    Quit,
+    Pasv,
+    Port,
+    Type,
+    List,
+    Nlst,
+    Retr,
+    Stat,
+    Stor,
+    Site,
+    Epsv,
+
+    MaxCommandId
+} COMMAND_ID, * PCOMMAND_ID;
+
+std::string_view CommandName(COMMAND_ID Id);
+
+// Why a connection was turned away at accept time, see AdmissionControl.
+typedef enum class _SHED_REASON : uint8_t
+{
+    MaxSessions = 0,
+    PerAddress,
+    QueueDeadline,
+
+    MaxShedReason
+} SHED_REASON, * PSHED_REASON;
+
+std::string_view ShedReasonName(SHED_REASON Reason);
+
+// Which session timer closed a connection or aborted a transfer.
+typedef enum class _SESSION_TIMEOUT : uint8_t
+{
+    Idle = 0,
+    Login,
+    DataStall,
+
+    MaxSessionTimeout
+} SESSION_TIMEOUT, * PSESSION_TIMEOUT;
+
+std::string_view SessionTimeoutName(SESSION_TIMEOUT Timeout);
+
+// Log-linear buckets in the style of HdrHistogram: values below 8 are exact, above
+// that every power of two is split into 8 sub-buckets (about 12% precision).
+#define HISTOGRAM_SUB_BUCKET_BITS   3
+#define HISTOGRAM_SUB_BUCKETS       (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAX_EXPONENT      40
+#define HISTOGRAM_BUCKETS           ((HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BUCKET_BITS + 2) * HISTOGRAM_SUB_BUCKETS)
+
+size_t HistogramBucket(uint64_t Value);
+uint64_t HistogramBucketUpperBound(size_t Bucket);
+
+typedef struct _HISTOGRAM_SNAPSHOT
+{
+    uint64_t Counts[HISTOGRAM_BUCKETS] = { 0 };
+    uint64_t Count = 0;
+    uint64_t Sum = 0;
+    uint64_t Max = 0;
+
+    void Record(uint64_t Value);
+    uint64_t Percentile(double Quantile) const;
+    void Merge(const _HISTOGRAM_SNAPSHOT& Other);
+} HISTOGRAM_SNAPSHOT, * PHISTOGRAM_SNAPSHOT;
+
+// A histogram written by exactly one thread. Updates are relaxed load/store pairs
+// (no locked instructions); readers on other threads only ever see whole values.
+class Histogram
+{
+public:
+    void Record(uint64_t Value)
+    {
+        Bump(this->counts[HistogramBucket(Value)], 1);
+        Bump(this->count, 1);
+        Bump(this->sum, Value);
+        if (Value > this->max.load(std::memory_order_relaxed))
+        {
+            this->max.store(Value, std::memory_order_relaxed);
+        }
+    }
+
+    void AddTo(HISTOGRAM_SNAPSHOT& Snapshot) const;
+
+    static void Bump(std::atomic<uint64_t>& Counter, uint64_t Amount)
+    {
+        Counter.store(Counter.load(std::memory_order_relaxed) + Amount, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> counts[HISTOGRAM_BUCKETS] = {};
+    std::atomic<uint64_t> count{ 0 };
+    std::atomic<uint64_t> sum{ 0 };
+    std::atomic<uint64_t> max{ 0 };
+};
+
+#define METRICS_MAX_WORKERS         64
+
+typedef struct _METRICS_SNAPSHOT
+{
+    HISTOGRAM_SNAPSHOT CommandLatency[static_cast<size_t>(COMMAND_ID::MaxCommandId)];
+    uint64_t           Commands[static_cast<size_t>(COMMAND_ID::MaxCommandId)] = { 0 };
+    uint64_t           BytesIn = 0;
+    uint64_t           BytesOut = 0;
+    uint64_t           TransferErrors = 0;
+    uint64_t           TransfersThrottled = 0;
+    int64_t            ActiveSessions = 0;
+    uint64_t           ConnectionsAccepted = 0;
+    uint64_t           ConnectionsShed[static_cast<size_t>(SHED_REASON::MaxShedReason)] = { 0 };
+    uint64_t           SessionTimeouts[static_cast<size_t>(SESSION_TIMEOUT::MaxSessionTimeout)] = { 0 };
+    uint64_t           LogRecordsDropped = 0;
+    uint64_t           TransferRecordsDropped = 0;
+
+    HISTOGRAM_SNAPSHOT TaskWait;
+    HISTOGRAM_SNAPSHOT TaskRuntime;
+    int64_t            QueueDepth = 0;
+    int64_t            QueueHighWater = 0;
+    uint32_t           Workers = 0;
+    double             WorkerBusy[METRICS_MAX_WORKERS] = { 0 };
+} METRICS_SNAPSHOT, * PMETRICS_SNAPSHOT;
+
+// Server-wide counters and per-command latency histograms. Every thread records into
+// its own shard, so the hot path never shares a cache line or takes a lock; readers
+// (the Prometheus endpoint and SITE STATS) merge the shards on demand.
+class Metrics
+{
+public:
+    Metrics() = delete;
+
+    static void RecordCommand(COMMAND_ID Id, uint64_t Microseconds);
+    static void AddBytesIn(uint64_t Bytes);
+    static void AddBytesOut(uint64_t Bytes);
+    static void TransferError();
+    static void TransferThrottled();
+    static void SessionStarted();
+    static void SessionEnded();
+    static void ConnectionAccepted();
+    static void ConnectionShed(SHED_REASON Reason);
+    static void SessionTimedOut(SESSION_TIMEOUT Timeout);
+    // An xferlog record dropped because its ring was full, see TransferLog.
+    static void TransferRecordDropped();
+
+    // Thread pool instrumentation, see InstrumentedPool.
+    static void TaskQueued();
+    static void TaskStarted(uint64_t WaitMicroseconds);
+    static void TaskFinished(uint64_t RuntimeMicroseconds);
+
+    static void Snapshot(METRICS_SNAPSHOT& Snapshot);
+
+    // Prometheus text exposition format (version 0.0.4).
+    static void RenderPrometheus(std::string& Out);
+};
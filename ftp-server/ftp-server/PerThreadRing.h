@@ -0,0 +1,201 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A single-producer, single-consumer ring of fixed-size records: the thread that
+// owns it writes, a background thread drains. A write into a full ring is dropped
+// and counted rather than waiting for the reader.
+template <typename Record, size_t Capacity>
+class PerThreadRing
+{
+public:
+    static_assert((Capacity & (Capacity - 1)) == 0, "PerThreadRing capacity must be a power of two");
+
+    explicit PerThreadRing(uint32_t ThreadIndex) : threadIndex(ThreadIndex)
+    {
+    }
+
+    // 1-based, in order of registration.
+    uint32_t ThreadIndex() const
+    {
+        return this->threadIndex;
+    }
+
+    // Writer: the slot for the next record, or nullptr if the ring is full. A
+    // record filled in through it is not seen by the reader until Commit.
+    Record* Reserve()
+    {
+        uint64_t head = this->head.load(std::memory_order_relaxed);
+        if (head - this->tail.load(std::memory_order_acquire) >= Capacity)
+        {
+            this->dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &this->records[head & (Capacity - 1)];
+    }
+
+    void Commit()
+    {
+        this->head.store(this->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Reader: passes every committed record to Visit, oldest first, then frees
+    // their slots.
+    template <typename Visitor>
+    void Drain(Visitor&& Visit)
+    {
+        uint64_t tail = this->tail.load(std::memory_order_relaxed);
+        uint64_t head = this->head.load(std::memory_order_acquire);
+        for (; tail != head; ++tail)
+        {
+            Visit(static_cast<const Record&>(this->records[tail & (Capacity - 1)]));
+        }
+        this->tail.store(tail, std::memory_order_release);
+    }
+
+    // Reader: frees every committed record unread.
+    void Discard()
+    {
+        this->tail.store(this->head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    uint64_t Dropped() const
+    {
+        return this->dropped.load(std::memory_order_relaxed);
+    }
+
+    // Reader: drops since the last call.
+    uint64_t NewlyDropped()
+    {
+        uint64_t dropped = this->Dropped();
+        uint64_t newly = dropped - this->reportedDropped;
+        this->reportedDropped = dropped;
+        return newly;
+    }
+
+private:
+    alignas(64) std::atomic<uint64_t> head{ 0 };
+    alignas(64) std::atomic<uint64_t> tail{ 0 };
+    std::atomic<uint64_t>             dropped{ 0 };
+    uint64_t                          reportedDropped = 0;     // reader only
+    uint32_t                          threadIndex;
+    Record                            records[Capacity];
+};
+
+// Every thread's ring of one type. A thread registers on its first write, which
+// takes the lock once; rings live until the process exits, so a reader may hold
+// on to one after the lock is dropped. The thread's ring is found through a
+// thread_local of the ring type's own, so there is one registry per ring type.
+template <typename Ring>
+class RingRegistry
+{
+public:
+    Ring& ThreadRing()
+    {
+        thread_local Ring* ring = nullptr;
+        if (!ring)
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->rings.push_back(std::make_unique<Ring>(static_cast<uint32_t>(this->rings.size() + 1)));
+            ring = this->rings.back().get();
+        }
+        return *ring;
+    }
+
+    // The rings registered so far, into Rings (cleared first, so a reader can keep
+    // one vector and its capacity between drains).
+    void Collect(std::vector<Ring*>& Rings)
+    {
+        Rings.clear();
+        std::lock_guard<std::mutex> guard(this->lock);
+        for (const std::unique_ptr<Ring>& ring : this->rings)
+        {
+            Rings.push_back(ring.get());
+        }
+    }
+
+    // Visit(Ring&) for every ring, under the lock, so no thread registers meanwhile.
+    template <typename Visitor>
+    void ForEach(Visitor&& Visit)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        for (const std::unique_ptr<Ring>& ring : this->rings)
+        {
+            Visit(*ring);
+        }
+    }
+
+    uint64_t Dropped()
+    {
+        uint64_t dropped = 0;
+        this->ForEach([&dropped](Ring& ring) { dropped += ring.Dropped(); });
+        return dropped;
+    }
+
+private:
+    std::mutex                         lock;
+    std::vector<std::unique_ptr<Ring>> rings;
+};
+
+// The background thread that drains a registry: Drain runs every Interval, and
+// once more on Stop so nothing committed before it is lost. Start and Stop are
+// serialized by the caller.
+class RingFlusher
+{
+public:
+    // False if the flusher is already running.
+    bool Start(std::chrono::milliseconds Interval, std::function<void()> Drain)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (this->running)
+        {
+            return false;
+        }
+
+        this->running = true;
+        this->thread = std::thread([this, Interval, Drain = std::move(Drain)]
+            {
+                std::unique_lock<std::mutex> lock(this->lock);
+                while (this->running)
+                {
+                    this->wake.wait_for(lock, Interval);
+                    lock.unlock();
+                    Drain();
+                    lock.lock();
+                }
+                lock.unlock();
+                Drain();
+            });
+        return true;
+    }
+
+    // False if the flusher was not running.
+    bool Stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            if (!this->running)
+            {
+                return false;
+            }
+            this->running = false;
+        }
+        this->wake.notify_one();
+        this->thread.join();
+        return true;
+    }
+
+private:
+    std::mutex              lock;
+    std::condition_variable wake;
+    std::thread             thread;
+    bool                    running = false;
+};
@@ -0,0 +1,780 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include "Platform.h"
+#if !defined(_WIN32)
+#include <csignal>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+#include <vector>
+
+#if !defined(_WIN32)
+namespace
+{
+    constexpr uint64_t UnixEpochTicks = 116444736000000000ULL;
+}
+#endif
+
+bool Platform::StartSockets()
+{
+#if defined(_WIN32)
+    WSADATA wsaData = { 0 };
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+#else
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+#endif
+}
+
+VOID Platform::StopSockets()
+{
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+}
+
+int Platform::CloseSocket(SOCKET Socket)
+{
+#if defined(_WIN32)
+    return closesocket(Socket);
+#else
+    return close(Socket);
+#endif
+}
+
+int Platform::SocketError()
+{
+#if defined(_WIN32)
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+bool Platform::DisableNagle(SOCKET Socket)
+{
+    int enable = 1;
+    return setsockopt(Socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable)) == 0;
+}
+
+bool Platform::EnablePortSharing(SOCKET Socket)
+{
+#if defined(__linux__) && defined(SO_REUSEPORT)
+    int enable = 1;
+    return setsockopt(Socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == 0;
+#else
+    UNREFERENCED_PARAMETER(Socket);
+    return false;
+#endif
+}
+
+bool Platform::PinCurrentThread(ULONG Cpu)
+{
+#if defined(_WIN32)
+    return Cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << Cpu) != 0;
+#elif defined(__linux__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(Cpu, &cpus);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+    UNREFERENCED_PARAMETER(Cpu);
+    return false;
+#endif
+}
+
+bool Platform::SetBlocking(SOCKET Socket, bool Blocking)
+{
+#if defined(_WIN32)
+    u_long nonBlocking = Blocking ? 0 : 1;
+    return ioctlsocket(Socket, FIONBIO, &nonBlocking) == 0;
+#else
+    int flags = fcntl(Socket, F_GETFL);
+    return flags >= 0 && fcntl(Socket, F_SETFL, Blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK) == 0;
+#endif
+}
+
+bool Platform::SendSegments(SOCKET Socket, IO_SEGMENT* Segments, ULONG Count, size_t& BytesSent)
+{
+#if defined(_WIN32)
+    DWORD bytesSent = 0;
+    if (WSASend(Socket, Segments, Count, &bytesSent, 0, NULL, NULL) == SOCKET_ERROR)
+    {
+        return false;
+    }
+    BytesSent = bytesSent;
+    return true;
+#else
+    msghdr message = {};
+    message.msg_iov = Segments;
+    message.msg_iovlen = Count;
+    ssize_t bytesSent;
+    do
+    {
+        bytesSent = sendmsg(Socket, &message, MSG_NOSIGNAL);
+    } while (bytesSent < 0 && errno == EINTR);
+    if (bytesSent < 0)
+    {
+        return false;
+    }
+    BytesSent = static_cast<size_t>(bytesSent);
+    return true;
+#endif
+}
+
+#if defined(_WIN32)
+namespace
+{
+    HANDLE stopEvent = NULL;
+
+    BOOL WINAPI OnConsoleControl(DWORD Event)
+    {
+        UNREFERENCED_PARAMETER(Event);
+        SetEvent(stopEvent);
+        return TRUE;
+    }
+}
+
+VOID Platform::BlockStopSignals()
+{
+    stopEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+    SetConsoleCtrlHandler(OnConsoleControl, TRUE);
+}
+
+VOID Platform::WaitForStopSignal()
+{
+    WaitForSingleObject(stopEvent, INFINITE);
+}
+
+SOCKET Platform::OpenLocalListener(PCSTR Path)
+{
+    UNREFERENCED_PARAMETER(Path);
+    return INVALID_SOCKET;
+}
+
+SOCKET Platform::ConnectLocal(PCSTR Path)
+{
+    UNREFERENCED_PARAMETER(Path);
+    return INVALID_SOCKET;
+}
+
+bool Platform::SendWithSockets(SOCKET Channel, const VOID* Data, size_t Length, const SOCKET* Sockets, ULONG Count)
+{
+    UNREFERENCED_PARAMETER(Channel);
+    UNREFERENCED_PARAMETER(Data);
+    UNREFERENCED_PARAMETER(Length);
+    UNREFERENCED_PARAMETER(Sockets);
+    UNREFERENCED_PARAMETER(Count);
+    return false;
+}
+
+bool Platform::ReceiveWithSockets(SOCKET Channel, PVOID Data, size_t Length, SOCKET* Sockets, ULONG Capacity, ULONG& Count)
+{
+    UNREFERENCED_PARAMETER(Channel);
+    UNREFERENCED_PARAMETER(Data);
+    UNREFERENCED_PARAMETER(Length);
+    UNREFERENCED_PARAMETER(Sockets);
+    UNREFERENCED_PARAMETER(Capacity);
+    Count = 0;
+    return false;
+}
+#else
+namespace
+{
+    bool LocalAddress(PCSTR Path, sockaddr_un& Address)
+    {
+        Address = {};
+        Address.sun_family = AF_UNIX;
+        size_t length = strlen(Path);
+        if (length >= sizeof(Address.sun_path))
+        {
+            return false;
+        }
+        memcpy(Address.sun_path, Path, length + 1);
+        return true;
+    }
+
+    sigset_t StopSignals()
+    {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        return signals;
+    }
+}
+
+VOID Platform::BlockStopSignals()
+{
+    sigset_t signals = StopSignals();
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+}
+
+VOID Platform::WaitForStopSignal()
+{
+    sigset_t signals = StopSignals();
+    int signal = 0;
+    while (sigwait(&signals, &signal) != 0)
+    {
+    }
+}
+
+SOCKET Platform::OpenLocalListener(PCSTR Path)
+{
+    sockaddr_un address;
+    if (!LocalAddress(Path, address))
+    {
+        errno = ENAMETOOLONG;
+        return INVALID_SOCKET;
+    }
+
+    SOCKET listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET)
+    {
+        return INVALID_SOCKET;
+    }
+    unlink(Path);
+    if (bind(listener, reinterpret_cast<PSOCKADDR>(&address), sizeof(address)) == SOCKET_ERROR ||
+        listen(listener, 1) == SOCKET_ERROR)
+    {
+        int error = errno;
+        close(listener);
+        errno = error;
+        return INVALID_SOCKET;
+    }
+    return listener;
+}
+
+SOCKET Platform::ConnectLocal(PCSTR Path)
+{
+    sockaddr_un address;
+    if (!LocalAddress(Path, address))
+    {
+        errno = ENAMETOOLONG;
+        return INVALID_SOCKET;
+    }
+
+    SOCKET channel = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (channel != INVALID_SOCKET && connect(channel, reinterpret_cast<PSOCKADDR>(&address), sizeof(address)) == SOCKET_ERROR)
+    {
+        int error = errno;
+        close(channel);
+        errno = error;
+        return INVALID_SOCKET;
+    }
+    return channel;
+}
+
+// Each message goes out in one sendmsg() with its sockets attached to its first
+// byte. The receiver reads exactly one message's length, so attachments never
+// end up on the wrong message.
+bool Platform::SendWithSockets(SOCKET Channel, const VOID* Data, size_t Length, const SOCKET* Sockets, ULONG Count)
+{
+    std::vector<CHAR> control(CMSG_SPACE(sizeof(int) * Count));
+    iovec segment = { const_cast<PVOID>(Data), Length };
+    msghdr message = {};
+    message.msg_iov = &segment;
+    message.msg_iovlen = 1;
+    if (Count)
+    {
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * Count);
+        memcpy(CMSG_DATA(header), Sockets, sizeof(int) * Count);
+    }
+
+    ssize_t sent = sendmsg(Channel, &message, MSG_NOSIGNAL);
+    if (sent < 0)
+    {
+        return false;
+    }
+    const CHAR* rest = static_cast<const CHAR*>(Data) + sent;
+    size_t remaining = Length - static_cast<size_t>(sent);
+    while (remaining)
+    {
+        ssize_t chunk = send(Channel, rest, remaining, MSG_NOSIGNAL);
+        if (chunk <= 0)
+        {
+            return false;
+        }
+        rest += chunk;
+        remaining -= static_cast<size_t>(chunk);
+    }
+    return true;
+}
+
+bool Platform::ReceiveWithSockets(SOCKET Channel, PVOID Data, size_t Length, SOCKET* Sockets, ULONG Capacity, ULONG& Count)
+{
+    std::vector<CHAR> control(CMSG_SPACE(sizeof(int) * std::max(Capacity, 1U)));
+    iovec segment = { Data, Length };
+    msghdr message = {};
+    message.msg_iov = &segment;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+
+    Count = 0;
+#if defined(MSG_CMSG_CLOEXEC)
+    ssize_t received = recvmsg(Channel, &message, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+#else
+    ssize_t received = recvmsg(Channel, &message, MSG_WAITALL);
+#endif
+    if (received <= 0)
+    {
+        return false;
+    }
+    for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+    {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+        {
+            continue;
+        }
+        ULONG attached = static_cast<ULONG>((header->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        const int* sockets = reinterpret_cast<const int*>(CMSG_DATA(header));
+        for (ULONG i = 0; i < attached; ++i)
+        {
+            if (Count < Capacity)
+            {
+                Sockets[Count++] = sockets[i];
+            }
+            else
+            {
+                close(sockets[i]);
+            }
+        }
+    }
+
+    // A message cut short or with its attachments truncated is no use to the
+    // caller, so the sockets that did arrive are closed.
+    bool complete = (message.msg_flags & MSG_CTRUNC) == 0;
+    CHAR* rest = static_cast<CHAR*>(Data) + received;
+    size_t remaining = Length - static_cast<size_t>(received);
+    while (complete && remaining)
+    {
+        ssize_t chunk = recv(Channel, rest, remaining, MSG_WAITALL);
+        complete = chunk > 0;
+        if (complete)
+        {
+            rest += chunk;
+            remaining -= static_cast<size_t>(chunk);
+        }
+    }
+    if (!complete)
+    {
+        for (ULONG i = 0; i < Count; ++i)
+        {
+            close(Sockets[i]);
+        }
+        Count = 0;
+    }
+    return complete;
+}
+#endif
+
+FILE_HANDLE Platform::OpenFile(PCSTR Path, FILE_ACCESS Access)
+{
+#if defined(_WIN32)
+    return Access == FILE_ACCESS::Read
+        ? CreateFileA(Path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL)
+        : CreateFileA(Path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+#else
+    if (Access == FILE_ACCESS::Read)
+    {
+        int file = open(Path, O_RDONLY | O_CLOEXEC);
+        if (file >= 0)
+        {
+            posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+        return file;
+    }
+    return open(Path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+}
+
+bool Platform::ReadFile(FILE_HANDLE File, PCHAR Buffer, size_t Capacity, size_t& BytesRead)
+{
+#if defined(_WIN32)
+    DWORD bytesRead = 0;
+    BOOL status = ::ReadFile(File, Buffer, static_cast<DWORD>(Capacity > ULONG_MAX ? ULONG_MAX : Capacity), &bytesRead, NULL);
+    BytesRead = bytesRead;
+    return status != FALSE;
+#else
+    ssize_t bytesRead;
+    do
+    {
+        bytesRead = read(File, Buffer, Capacity);
+    } while (bytesRead < 0 && errno == EINTR);
+    BytesRead = bytesRead > 0 ? static_cast<size_t>(bytesRead) : 0;
+    return bytesRead >= 0;
+#endif
+}
+
+bool Platform::WriteFile(FILE_HANDLE File, const CHAR* Buffer, size_t Length)
+{
+#if defined(_WIN32)
+    DWORD bytesWritten = 0;
+    return ::WriteFile(File, Buffer, static_cast<DWORD>(Length), &bytesWritten, NULL) && bytesWritten == Length;
+#else
+    while (Length)
+    {
+        ssize_t bytesWritten = write(File, Buffer, Length);
+        if (bytesWritten < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        Buffer += bytesWritten;
+        Length -= static_cast<size_t>(bytesWritten);
+    }
+    return true;
+#endif
+}
+
+VOID Platform::CloseFile(FILE_HANDLE File)
+{
+#if defined(_WIN32)
+    CloseHandle(File);
+#else
+    close(File);
+#endif
+}
+
+FILE* Platform::OpenStream(PCSTR Path, PCSTR Mode)
+{
+#if defined(_WIN32)
+    FILE* file = nullptr;
+    return fopen_s(&file, Path, Mode) ? nullptr : file;
+#else
+    return fopen(Path, Mode);
+#endif
+}
+
+bool Platform::FullPath(PCSTR Path, CHAR(&FullPath)[MAX_PATH])
+{
+#if defined(_WIN32)
+    DWORD length = GetFullPathNameA(Path, MAX_PATH, FullPath, NULL);
+    return length && length < MAX_PATH;
+#else
+    PCHAR resolved = realpath(Path, nullptr);
+    if (!resolved)
+    {
+        return false;
+    }
+    size_t length = strlen(resolved);
+    bool fits = length < MAX_PATH;
+    if (fits)
+    {
+        memcpy(FullPath, resolved, length + 1);
+    }
+    free(resolved);
+    return fits;
+#endif
+}
+
+DirectoryEnumerator::~DirectoryEnumerator()
+{
+#if defined(_WIN32)
+    if (this->findHandle != INVALID_HANDLE_VALUE)
+    {
+        FindClose(this->findHandle);
+    }
+#else
+    if (this->directory)
+    {
+        closedir(this->directory);
+    }
+#endif
+}
+
+bool DirectoryEnumerator::Open(PCSTR Directory)
+{
+#if defined(_WIN32)
+    CHAR searchPath[MAX_PATH] = { 0 };
+    size_t length = strlen(Directory);
+    if (length + 2 >= MAX_PATH)
+    {
+        return false;
+    }
+    memcpy(searchPath, Directory, length);
+    memcpy(searchPath + length, "\\*", 3);
+
+    this->findHandle = FindFirstFileA(searchPath, &this->fileData);
+    this->pending = this->findHandle != INVALID_HANDLE_VALUE;
+    return this->pending;
+#else
+    this->directory = opendir(Directory);
+    return this->directory != nullptr;
+#endif
+}
+
+bool DirectoryEnumerator::Next(DIRECTORY_ENTRY& Entry)
+{
+#if defined(_WIN32)
+    // fileData is only advanced here, so the previous entry's Name stays valid
+    // until the caller asks for the next one.
+    if (this->consumed)
+    {
+        this->pending = FindNextFileA(this->findHandle, &this->fileData) != FALSE;
+        this->consumed = false;
+    }
+
+    for (; this->pending; this->pending = FindNextFileA(this->findHandle, &this->fileData) != FALSE)
+    {
+        if (!strcmp(this->fileData.cFileName, ".") || !strcmp(this->fileData.cFileName, ".."))
+        {
+            continue;
+        }
+
+        Entry.IsDirectory = (this->fileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        Entry.Size = (static_cast<uint64_t>(this->fileData.nFileSizeHigh) << 32) | this->fileData.nFileSizeLow;
+        Entry.LastWriteTime = (static_cast<uint64_t>(this->fileData.ftLastWriteTime.dwHighDateTime) << 32) | this->fileData.ftLastWriteTime.dwLowDateTime;
+        Entry.Name = this->fileData.cFileName;
+        this->consumed = true;
+        return true;
+    }
+    return false;
+#else
+    if (!this->directory)
+    {
+        return false;
+    }
+
+    while (dirent* entry = readdir(this->directory))
+    {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+        {
+            continue;
+        }
+
+        struct stat status = {};
+        if (fstatat(dirfd(this->directory), entry->d_name, &status, 0))
+        {
+            continue;
+        }
+
+        Entry.IsDirectory = S_ISDIR(status.st_mode);
+        Entry.Size = static_cast<uint64_t>(status.st_size);
+        Entry.LastWriteTime = UnixEpochTicks +
+            static_cast<uint64_t>(status.st_mtim.tv_sec) * 10000000ULL +
+            static_cast<uint64_t>(status.st_mtim.tv_nsec) / 100ULL;
+        Entry.Name = entry->d_name;
+        return true;
+    }
+    return false;
+#endif
+}
+
+#if defined(__linux__)
+SocketPoller::SocketPoller()
+{
+    this->pollHandle = epoll_create1(EPOLL_CLOEXEC);
+    this->stopHandle = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    // Level-triggered and never drained: once stopped, every Wait() returns at once.
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = 0;
+    epoll_ctl(this->pollHandle, EPOLL_CTL_ADD, this->stopHandle, &event);
+
+    // Drained by the Wait() that sees it.
+    this->wakeHandle = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    event.data.u64 = POLL_KEY_RESERVED;
+    epoll_ctl(this->pollHandle, EPOLL_CTL_ADD, this->wakeHandle, &event);
+}
+
+SocketPoller::~SocketPoller()
+{
+    close(this->wakeHandle);
+    close(this->stopHandle);
+    close(this->pollHandle);
+}
+
+bool SocketPoller::Arm(SOCKET Socket, POLL_KEY Key)
+{
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.u64 = Key;
+    if (epoll_ctl(this->pollHandle, EPOLL_CTL_MOD, Socket, &event) == 0)
+    {
+        return true;
+    }
+    return errno == ENOENT && epoll_ctl(this->pollHandle, EPOLL_CTL_ADD, Socket, &event) == 0;
+}
+
+VOID SocketPoller::Disarm(SOCKET Socket)
+{
+    epoll_ctl(this->pollHandle, EPOLL_CTL_DEL, Socket, nullptr);
+}
+
+bool SocketPoller::Wait(POLL_KEY* Keys, ULONG Capacity, ULONG TimeoutMs, ULONG& Count)
+{
+    epoll_event events[64];
+    Count = 0;
+    int ready = epoll_wait(this->pollHandle, events, static_cast<int>(std::min<ULONG>(Capacity, 64)),
+        TimeoutMs == INFINITE ? -1 : static_cast<int>(std::min<ULONG>(TimeoutMs, INT_MAX)));
+    if (ready < 0)
+    {
+        return errno == EINTR;
+    }
+
+    for (int i = 0; i < ready; ++i)
+    {
+        if (!events[i].data.u64)
+        {
+            return false;
+        }
+        if (events[i].data.u64 == POLL_KEY_RESERVED)
+        {
+            uint64_t value = 0;
+            ssize_t drained = read(this->wakeHandle, &value, sizeof(value));
+            UNREFERENCED_PARAMETER(drained);
+            continue;
+        }
+        Keys[Count++] = events[i].data.u64;
+    }
+    return true;
+}
+
+VOID SocketPoller::Wake()
+{
+    uint64_t value = 1;
+    ssize_t written = write(this->wakeHandle, &value, sizeof(value));
+    UNREFERENCED_PARAMETER(written);
+}
+
+VOID SocketPoller::Stop()
+{
+    uint64_t value = 1;
+    ssize_t written = write(this->stopHandle, &value, sizeof(value));
+    UNREFERENCED_PARAMETER(written);
+}
+#else
+SocketPoller::SocketPoller()
+{
+    // A UDP socket connected to itself: Wake() sends it a byte, which makes it
+    // readable and ends the current poll.
+    this->wakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    SOCKADDR_IN address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addressSize = sizeof(address);
+    bind(this->wakeSocket, reinterpret_cast<PSOCKADDR>(&address), sizeof(address));
+    getsockname(this->wakeSocket, reinterpret_cast<PSOCKADDR>(&address), &addressSize);
+    connect(this->wakeSocket, reinterpret_cast<PSOCKADDR>(&address), sizeof(address));
+#if defined(_WIN32)
+    u_long nonBlocking = 1;
+    ioctlsocket(this->wakeSocket, FIONBIO, &nonBlocking);
+#else
+    fcntl(this->wakeSocket, F_SETFL, fcntl(this->wakeSocket, F_GETFL) | O_NONBLOCK);
+#endif
+}
+
+SocketPoller::~SocketPoller()
+{
+    Platform::CloseSocket(this->wakeSocket);
+}
+
+VOID SocketPoller::Wake()
+{
+    CHAR signal = 0;
+    send(this->wakeSocket, &signal, 1, 0);
+}
+
+bool SocketPoller::Arm(SOCKET Socket, POLL_KEY Key)
+{
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->armed[Socket] = Key;
+    }
+    this->Wake();
+    return true;
+}
+
+VOID SocketPoller::Disarm(SOCKET Socket)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->armed.erase(Socket);
+}
+
+bool SocketPoller::Wait(POLL_KEY* Keys, ULONG Capacity, ULONG TimeoutMs, ULONG& Count)
+{
+#if defined(_WIN32)
+    typedef WSAPOLLFD POLL_ENTRY;
+#else
+    typedef pollfd POLL_ENTRY;
+#endif
+    std::vector<POLL_ENTRY> entries;
+    entries.push_back({ this->wakeSocket, POLLIN, 0 });
+    Count = 0;
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (this->stopped)
+        {
+            return false;
+        }
+        for (const auto& [socket, key] : this->armed)
+        {
+            entries.push_back({ socket, POLLIN, 0 });
+        }
+    }
+
+    // Every Arm() wakes the poll, so the caller's loop rebuilds the set each time.
+    int timeout = TimeoutMs == INFINITE ? -1 : static_cast<int>(std::min<ULONG>(TimeoutMs, INT_MAX));
+#if defined(_WIN32)
+    int ready = WSAPoll(entries.data(), static_cast<ULONG>(entries.size()), timeout);
+#else
+    int ready = poll(entries.data(), static_cast<nfds_t>(entries.size()), timeout);
+#endif
+    if (ready <= 0)
+    {
+        return true;
+    }
+
+    if (entries[0].revents)
+    {
+        CHAR drain[64];
+        while (recv(this->wakeSocket, drain, sizeof(drain), 0) > 0)
+        {
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(this->lock);
+    for (size_t i = 1; i < entries.size() && Count < Capacity; ++i)
+    {
+        auto entry = this->armed.find(entries[i].fd);
+        if (entries[i].revents && entry != this->armed.end())
+        {
+            Keys[Count++] = entry->second;
+            this->armed.erase(entry);
+        }
+    }
+    return !this->stopped;
+}
+
+VOID SocketPoller::Stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopped = true;
+    }
+    this->Wake();
+}
+#endif
@@ -0,0 +1,258 @@
+#pragma once
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#if !defined(__linux__)
+#include <mutex>
+#include <unordered_map>
+#endif
+#if defined(_WIN32)
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <Windows.h>
+#else
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+typedef WSABUF              IO_SEGMENT;
+typedef HANDLE              FILE_HANDLE;
+#define INVALID_FILE_HANDLE INVALID_HANDLE_VALUE
+#define PATH_SEPARATOR      '\\'
+#else
+// The Win32 names the server is written against, mapped onto their POSIX equivalents.
+typedef int                 SOCKET;
+#define INVALID_SOCKET      (-1)
+#define SOCKET_ERROR        (-1)
+#define SD_BOTH             SHUT_RDWR
+#define MAX_PATH            260
+#define ANSI_NULL           ('\0')
+#define INFINITE            0xFFFFFFFF
+#define WSAEWOULDBLOCK      EWOULDBLOCK
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+#define _In_
+#define _Inout_
+#define VOID                void
+
+typedef void*               PVOID;
+typedef char                CHAR, * PCHAR;
+typedef const char*         PCSTR;
+typedef uint8_t             BYTE;
+typedef uint16_t            USHORT;
+typedef uint32_t            ULONG, * PULONG;
+typedef uint32_t            DWORD;
+typedef struct sockaddr_in  SOCKADDR_IN;
+typedef struct sockaddr*    PSOCKADDR;
+typedef struct in_addr      IN_ADDR;
+typedef struct addrinfo     ADDRINFOA, * PADDRINFOA;
+
+typedef struct iovec        IO_SEGMENT;
+typedef int                 FILE_HANDLE;
+#define INVALID_FILE_HANDLE (-1)
+#define PATH_SEPARATOR      '/'
+#endif
+
+typedef enum class _FILE_ACCESS : BYTE
+{
+    Read = 0,
+    Write = 1,      // created or truncated
+
+    MaxFileAccess
+} FILE_ACCESS, * PFILE_ACCESS;
+
+inline IO_SEGMENT MakeSegment(const CHAR* Data, size_t Length)
+{
+    IO_SEGMENT segment = {};
+#if defined(_WIN32)
+    segment.buf = const_cast<PCHAR>(Data);
+    segment.len = static_cast<ULONG>(Length);
+#else
+    segment.iov_base = const_cast<PCHAR>(Data);
+    segment.iov_len = Length;
+#endif
+    return segment;
+}
+
+inline size_t SegmentLength(const IO_SEGMENT& Segment)
+{
+#if defined(_WIN32)
+    return Segment.len;
+#else
+    return Segment.iov_len;
+#endif
+}
+
+inline VOID AdvanceSegment(IO_SEGMENT& Segment, size_t Bytes)
+{
+#if defined(_WIN32)
+    Segment.buf += Bytes;
+    Segment.len -= static_cast<ULONG>(Bytes);
+#else
+    Segment.iov_base = static_cast<PCHAR>(Segment.iov_base) + Bytes;
+    Segment.iov_len -= Bytes;
+#endif
+}
+
+// IPv4 addresses as the four bytes of their dotted form, in network order.
+inline VOID AddressToBytes(const IN_ADDR& Address, uint8_t(&Bytes)[4])
+{
+    memcpy(Bytes, &Address.s_addr, sizeof(Bytes));
+}
+
+inline IN_ADDR AddressFromBytes(const uint8_t* Bytes)
+{
+    IN_ADDR address = {};
+    memcpy(&address.s_addr, Bytes, sizeof(address.s_addr));
+    return address;
+}
+
+// The few socket and file calls whose spelling differs between WinSock/Win32 and
+// POSIX. Everything else (socket, bind, accept, recv, send, getaddrinfo) is the
+// same BSD call on both.
+class Platform
+{
+public:
+    Platform() = delete;
+
+    // WSAStartup/WSACleanup on Windows; on POSIX, ignores SIGPIPE so a peer that
+    // goes away surfaces as a failed send instead of killing the process.
+    static bool StartSockets();
+    static VOID StopSockets();
+
+    static int CloseSocket(SOCKET Socket);
+    static int SocketError();
+
+    // Control replies go out in pairs (150 then 226) with no request in between;
+    // with Nagle on, the second waits out the peer's delayed ACK.
+    static bool DisableNagle(SOCKET Socket);
+
+    // SO_REUSEPORT where the kernel balances incoming connections across every
+    // socket bound to the port (Linux). Elsewhere it fails and callers share one
+    // listening socket instead.
+    static bool EnablePortSharing(SOCKET Socket);
+
+    // Restricts the calling thread to one CPU; false where affinity is unsupported.
+    static bool PinCurrentThread(ULONG Cpu);
+
+    static bool SetBlocking(SOCKET Socket, bool Blocking);
+
+    // Gathered send of Count segments; BytesSent may be short of the total.
+    static bool SendSegments(SOCKET Socket, IO_SEGMENT* Segments, ULONG Count, size_t& BytesSent);
+
+    // SIGINT and SIGTERM (console control events on Windows) become stop requests
+    // instead of killing the process. Block them before starting any thread, so
+    // every thread inherits the mask, then wait for them on one thread.
+    static VOID BlockStopSignals();
+    static VOID WaitForStopSignal();
+
+    // Unix domain stream sockets, over which open sockets can be passed to another
+    // process (SCM_RIGHTS). Not supported on Windows: the calls fail there.
+    static SOCKET OpenLocalListener(PCSTR Path);
+    static SOCKET ConnectLocal(PCSTR Path);
+
+    // Length bytes with Count sockets attached. The receiver gets its own
+    // descriptors for the same sockets; the sender's copies stay open.
+    static bool SendWithSockets(SOCKET Channel, const VOID* Data, size_t Length, const SOCKET* Sockets, ULONG Count);
+    static bool ReceiveWithSockets(SOCKET Channel, PVOID Data, size_t Length, SOCKET* Sockets, ULONG Capacity, ULONG& Count);
+
+    static FILE_HANDLE OpenFile(PCSTR Path, FILE_ACCESS Access);
+    static bool ReadFile(FILE_HANDLE File, PCHAR Buffer, size_t Capacity, size_t& BytesRead);
+    static bool WriteFile(FILE_HANDLE File, const CHAR* Buffer, size_t Length);
+    static VOID CloseFile(FILE_HANDLE File);
+
+    static FILE* OpenStream(PCSTR Path, PCSTR Mode);
+
+    // The absolute form of Path, which must exist. False if it does not, or if the
+    // result does not fit.
+    static bool FullPath(PCSTR Path, CHAR(&FullPath)[MAX_PATH]);
+};
+
+typedef struct _DIRECTORY_ENTRY
+{
+    bool     IsDirectory = false;
+    uint64_t Size = 0ULL;
+    uint64_t LastWriteTime = 0ULL;      // FILETIME ticks: 100 ns since 1601-01-01 UTC
+    PCSTR    Name = nullptr;            // valid until the next call to Next()
+} DIRECTORY_ENTRY, * PDIRECTORY_ENTRY;
+
+// FindFirstFileA/FindNextFileA or opendir/readdir, without "." and "..".
+class DirectoryEnumerator
+{
+#if defined(_WIN32)
+    HANDLE           findHandle = INVALID_HANDLE_VALUE;
+    WIN32_FIND_DATAA fileData = { 0 };
+    bool             pending = false;
+    bool             consumed = false;
+#else
+    DIR*             directory = nullptr;
+#endif
+
+public:
+    DirectoryEnumerator() = default;
+    ~DirectoryEnumerator();
+
+    DirectoryEnumerator(_In_ const DirectoryEnumerator& Other) = delete;
+    DirectoryEnumerator& operator=(_In_ const DirectoryEnumerator& Other) = delete;
+
+    bool Open(PCSTR Directory);
+    bool Next(DIRECTORY_ENTRY& Entry);
+};
+
+// Readiness notification for control connections. Arm() asks for one readable
+// event: once Wait() has reported a socket it stays quiet until it is armed again,
+// so only one task at a time ever handles a given session. epoll with EPOLLONESHOT
+// on Linux; elsewhere poll()/WSAPoll over the armed set, with a loopback datagram
+// socket that interrupts Wait() whenever the set changes. Keys are opaque to the
+// poller; 0 and POLL_KEY_RESERVED are its own.
+typedef uint64_t POLL_KEY;
+#define POLL_KEY_RESERVED   (~0ULL)
+
+class SocketPoller
+{
+#if defined(__linux__)
+    int                               pollHandle = -1;
+    int                               stopHandle = -1;
+    int                               wakeHandle = -1;
+#else
+    std::mutex                        lock;
+    std::unordered_map<SOCKET, POLL_KEY> armed;
+    SOCKET                            wakeSocket = INVALID_SOCKET;
+    bool                              stopped = false;
+#endif
+
+public:
+    SocketPoller();
+    ~SocketPoller();
+
+    SocketPoller(_In_ const SocketPoller& Other) = delete;
+    SocketPoller& operator=(_In_ const SocketPoller& Other) = delete;
+
+    // Adds Socket, or re-arms it after Wait() reported it. Closing a socket is
+    // enough to forget it.
+    bool Arm(SOCKET Socket, POLL_KEY Key);
+
+    // Takes Socket out of the set without closing it; it reports nothing more
+    // until it is armed again, except that a Wait() already returning on another
+    // thread may still report it once.
+    VOID Disarm(SOCKET Socket);
+
+    // Blocks until at least one armed socket is readable, TimeoutMs passes (INFINITE
+    // waits indefinitely) or Wake() is called, and stores up to Capacity keys in
+    // Keys and their number in Count, which may be 0. Returns false once Stop()
+    // has been called.
+    bool Wait(POLL_KEY* Keys, ULONG Capacity, ULONG TimeoutMs, ULONG& Count);
+
+    // Ends the current or next Wait() early, e.g. so it picks up a shorter timeout.
+    VOID Wake();
+
+    VOID Stop();
+};
@@ -0,0 +1,37 @@
+#pragma once
+#include <charconv>
+#include <cstdint>
+#include <string_view>
+#include "TextBuffer.h"
+
+// Parses the "h1,h2,h3,h4,p1,p2" host-port argument of PORT (and of a 227 reply)
+// into its six bytes, in wire order. Nothing may follow the last field but the ")"
+// that closes it in a 227 reply.
+constexpr bool ParseHostPort(std::string_view Text, uint8_t(&Fields)[6])
+{
+    const char* p = Text.data();
+    const char* end = Text.data() + Text.size();
+    for (int c = 0; c < 6; ++c)
+    {
+        unsigned value = 0;
+        auto [next, error] = std::from_chars(p, end, value);
+        if (error != std::errc() || value > 0xFF || (c < 5 && (next == end || *next != ',')))
+        {
+            return false;
+        }
+        Fields[c] = static_cast<uint8_t>(value);
+        p = next + (c < 5 ? 1 : 0);
+    }
+    return p == end || (*p == ')' && p + 1 == end);
+}
+
+template <size_t Capacity>
+TextBuffer<Capacity>& AppendHostPort(TextBuffer<Capacity>& Text, const uint8_t(&Fields)[6])
+{
+    return Text.Append(Fields[0]).Append(',')
+        .Append(Fields[1]).Append(',')
+        .Append(Fields[2]).Append(',')
+        .Append(Fields[3]).Append(',')
+        .Append(Fields[4]).Append(',')
+        .Append(Fields[5]);
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "TextBuffer.h"
+
+typedef struct _REPLY
+{
+    uint16_t         Code;
+    std::string_view Wire;
+} REPLY, * PREPLY;
+
+template <size_t N>
+struct REPLY_TEXT
+{
+    char Text[N] = {};
+
+    constexpr REPLY_TEXT(const char(&Literal)[N])
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            this->Text[i] = Literal[i];
+        }
+    }
+};
+
+// "<code> <text>\r\n", laid out at compile time so a static reply is sent straight
+// from read-only data without being formatted or copied.
+template <uint16_t Code, REPLY_TEXT Text>
+inline constexpr auto ReplyWire = []
+{
+    constexpr size_t textLength = sizeof(Text.Text) - 1;
+    std::array<char, 4 + textLength + 2> wire = {};
+    wire[0] = static_cast<char>('0' + Code / 100);
+    wire[1] = static_cast<char>('0' + Code / 10 % 10);
+    wire[2] = static_cast<char>('0' + Code % 10);
+    wire[3] = ' ';
+    for (size_t i = 0; i < textLength; ++i)
+    {
+        wire[4 + i] = Text.Text[i];
+    }
+    wire[4 + textLength] = '\r';
+    wire[5 + textLength] = '\n';
+    return wire;
+}();
+
+template <uint16_t Code, REPLY_TEXT Text>
+constexpr REPLY MakeReply()
+{
+    static_assert(Code >= 100 && Code <= 599, "FTP reply codes are three digits starting with 1-5");
+    return { Code, std::string_view(ReplyWire<Code, Text>.data(), ReplyWire<Code, Text>.size()) };
+}
+
+class Replies
+{
+public:
+    Replies() = delete;
+
+    static constexpr REPLY OpeningDataConnection = MakeReply<150, "Opening data connection.">();
+    static constexpr REPLY PortOk = MakeReply<200, "PORT command successful.">();
+    static constexpr REPLY EpsvAllOk = MakeReply<200, "EPSV ALL command successful.">();
+    static constexpr REPLY TypeAscii = MakeReply<200, "Type set to A.">();
+    static constexpr REPLY TypeImage = MakeReply<200, "Type set to I.">();
+    static constexpr REPLY CaptureStarted = MakeReply<200, "Session capture started.">();
+    static constexpr REPLY TraceEnabled = MakeReply<200, "Transfer tracing enabled.">();
+    static constexpr REPLY TraceDisabled = MakeReply<200, "Transfer tracing disabled.">();
+    static constexpr REPLY Utf8Enabled = MakeReply<200, "UTF8 mode enabled">();
+    static constexpr REPLY SystemStatusEnd = MakeReply<211, "End of status">();
+    static constexpr REPLY FileStatusEnd = MakeReply<213, "End of status">();
+    static constexpr REPLY ServiceReady = MakeReply<220, "FTP Server Ready">();
+    static constexpr REPLY ClosingControl = MakeReply<221, "Quit.">();
+    static constexpr REPLY TransferComplete = MakeReply<226, "Transfer complete.">();
+    static constexpr REPLY LoggedIn = MakeReply<230, "User logged in.">();
+    static constexpr REPLY TooManyConnections = MakeReply<421, "Too many connections.">();
+    static constexpr REPLY IdleTimeout = MakeReply<421, "Idle timeout, closing control connection.">();
+    static constexpr REPLY LoginTimeout = MakeReply<421, "Login timeout, closing control connection.">();
+    static constexpr REPLY ShuttingDown = MakeReply<421, "Server shutting down, closing control connection.">();
+    static constexpr REPLY TransferAborted = MakeReply<426, "Connection closed; transfer aborted.">();
+    static constexpr REPLY LocalError = MakeReply<451, "Requested action aborted. Local error in processing.">();
+    static constexpr REPLY InsufficientStorage = MakeReply<452, "Requested action not taken. Insufficient storage space.">();
+    static constexpr REPLY LineTooLong = MakeReply<500, "Command line too long.">();
+    static constexpr REPLY SyntaxError = MakeReply<501, "Syntax error in parameters or arguments.">();
+    static constexpr REPLY OptsSyntaxError = MakeReply<501, "Opts command with syntax error.">();
+    static constexpr REPLY PassSyntaxError = MakeReply<501, "Pass command with syntax error.">();
+    static constexpr REPLY NotImplemented = MakeReply<502, "Command not implemented.">();
+    static constexpr REPLY ParameterNotImplemented = MakeReply<504, "Command not implemented for that parameter.">();
+    static constexpr REPLY ProtocolNotSupported = MakeReply<522, "Network protocol not supported, use (1).">();
+    static constexpr REPLY LoginIncorrect = MakeReply<530, "Invalid username or password">();
+    static constexpr REPLY NotLoggedIn = MakeReply<530, "Please login with USER and PASS.">();
+    static constexpr REPLY PermissionDenied = MakeReply<550, "Permission denied.">();
+    static constexpr REPLY CannotOpenForWriting = MakeReply<550, "Cannot open file for writing.">();
+    static constexpr REPLY FileNotFound = MakeReply<550, "File not found or access denied.">();
+    static constexpr REPLY FileUnavailable = MakeReply<550, "File or directory unavailable.">();
+};
+
+// Builds a dynamic reply ("227 Entering Passive Mode (...)") in place; Wire()
+// terminates it with CRLF, which always has room reserved. The first line of a
+// multi-line reply takes '-' as its Separator.
+template <size_t Capacity>
+class ReplyBuilder : public TextBuffer<Capacity + 2>
+{
+public:
+    explicit ReplyBuilder(uint16_t Code, char Separator = ' ')
+    {
+        this->Append(Code).Append(Separator);
+    }
+
+    std::string_view Wire()
+    {
+        if (this->length > Capacity)
+        {
+            this->length = Capacity;
+        }
+        this->buffer[this->length++] = '\r';
+        this->buffer[this->length++] = '\n';
+        return this->View();
+    }
+};
@@ -0,0 +1,153 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Logger.h"
+#include "PerThreadRing.h"
+#include "SessionCapture.h"
+
+std::atomic<bool> SessionCapture::enabled{ false };
+
+namespace
+{
+    typedef struct _CAPTURE_ENTRY
+    {
+        CAPTURE_RECORD Record;
+        char           Line[CAPTURE_LINE_LENGTH];
+    } CAPTURE_ENTRY;
+
+    typedef PerThreadRing<CAPTURE_ENTRY, CAPTURE_RING_CAPACITY> CAPTURE_RING;
+
+    struct CAPTURE_STATE
+    {
+        std::mutex                 lock;       // Start and Stop
+        RingRegistry<CAPTURE_RING> rings;
+        RingFlusher                flusher;
+        bool                       running = false;
+        std::ofstream              output;
+        uint64_t                   written = 0;
+        std::atomic<uint32_t>      nextSessionId{ 1 };
+        std::atomic<int64_t>       started{ 0 };      // steady clock, microseconds
+    };
+
+    CAPTURE_STATE& State()
+    {
+        static CAPTURE_STATE state;
+        return state;
+    }
+
+    int64_t SteadyMicroseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Records are written in ring order, so offsets are only ordered per session;
+    // the replayer sorts each session's records itself.
+    void Drain(CAPTURE_STATE& State, std::string& Batch, std::vector<CAPTURE_RING*>& Rings)
+    {
+        State.rings.Collect(Rings);
+
+        Batch.clear();
+        for (CAPTURE_RING* ring : Rings)
+        {
+            ring->Drain([&State, &Batch](const CAPTURE_ENTRY& Entry)
+                {
+                    Batch.append(reinterpret_cast<const char*>(&Entry.Record), sizeof(Entry.Record));
+                    Batch.append(Entry.Line, Entry.Record.LineLength);
+                    ++State.written;
+                });
+        }
+
+        if (!Batch.empty())
+        {
+            State.output.write(Batch.data(), static_cast<std::streamsize>(Batch.size()));
+        }
+    }
+}
+
+bool SessionCapture::Start(const char* Path)
+{
+    CAPTURE_STATE& state = State();
+    std::lock_guard<std::mutex> guard(state.lock);
+    if (state.running)
+    {
+        return true;
+    }
+
+    state.output.open(Path, std::ios::binary | std::ios::trunc);
+    if (!state.output)
+    {
+        return false;
+    }
+
+    CAPTURE_FILE_HEADER header;
+    memcpy(header.Magic, CAPTURE_FILE_MAGIC, sizeof(header.Magic));
+    header.Version = CAPTURE_FILE_VERSION;
+    header.RecordSize = sizeof(CAPTURE_RECORD);
+    header.StartTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    state.output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // Anything a session pushed after the previous capture stopped belongs to no file.
+    state.rings.ForEach([](CAPTURE_RING& Ring) { Ring.Discard(); });
+
+    state.written = 0;
+    state.started.store(SteadyMicroseconds(), std::memory_order_relaxed);
+    state.running = true;
+    state.flusher.Start(std::chrono::milliseconds(CAPTURE_FLUSH_INTERVAL_MS),
+        [&state, batch = std::string(), rings = std::vector<CAPTURE_RING*>()]() mutable { Drain(state, batch, rings); });
+
+    enabled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+uint64_t SessionCapture::Stop()
+{
+    CAPTURE_STATE& state = State();
+    uint64_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> guard(state.lock);
+        if (!state.running)
+        {
+            return 0;
+        }
+        enabled.store(false, std::memory_order_relaxed);
+        state.running = false;
+        state.flusher.Stop();
+        state.output.close();
+        state.rings.ForEach([&dropped](CAPTURE_RING& Ring) { dropped += Ring.NewlyDropped(); });
+    }
+    if (dropped)
+    {
+        LogEvent(LOG_LEVEL::Warning, "capture_dropped").Field("records", dropped);
+    }
+    return state.written;
+}
+
+uint32_t SessionCapture::NextSessionId()
+{
+    return State().nextSessionId.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SessionCapture::Record(uint32_t SessionId, CAPTURE_EVENT Event, COMMAND_ID Command, std::string_view Line, uint64_t LatencyUs, uint64_t TransferBytes)
+{
+    CAPTURE_RING& ring = State().rings.ThreadRing();
+    CAPTURE_ENTRY* entry = ring.Reserve();
+    if (!entry)
+    {
+        return;
+    }
+
+    int64_t offset = SteadyMicroseconds() - State().started.load(std::memory_order_relaxed);
+
+    entry->Record.Offset = offset > 0 ? static_cast<uint64_t>(offset) : 0;
+    entry->Record.TransferBytes = TransferBytes;
+    entry->Record.SessionId = SessionId;
+    entry->Record.LatencyUs = LatencyUs > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(LatencyUs);
+    entry->Record.Event = Event;
+    entry->Record.Command = Command;
+    entry->Record.LineLength = static_cast<uint8_t>(Line.size() < CAPTURE_LINE_LENGTH ? Line.size() : CAPTURE_LINE_LENGTH);
+    memcpy(entry->Line, Line.data(), entry->Record.LineLength);
+    ring.Commit();
+}
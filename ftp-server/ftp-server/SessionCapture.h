@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+#include "Metrics.h"
+
+#define CAPTURE_RING_CAPACITY       1024
+#define CAPTURE_LINE_LENGTH         255
+#define CAPTURE_FLUSH_INTERVAL_MS   1000
+#define CAPTURE_FILE_MAGIC          "FTPCAPTR"
+#define CAPTURE_FILE_VERSION        1
+#define CAPTURE_DEFAULT_FILE        "ftp-server.capture"
+
+typedef enum class _CAPTURE_EVENT : uint8_t
+{
+    Command = 0,
+    SessionClosed,
+
+    MaxCaptureEvent
+} CAPTURE_EVENT, * PCAPTURE_EVENT;
+
+// One record per control-channel command (or session end). On disk each record
+// is followed by LineLength bytes of the command line, without CRLF.
+typedef struct _CAPTURE_RECORD
+{
+    uint64_t      Offset = 0;           // microseconds since the capture started
+    uint64_t      TransferBytes = 0;    // data-connection payload of LIST/RETR/STOR
+    uint32_t      SessionId = 0;
+    uint32_t      LatencyUs = 0;        // server-side handler time
+    CAPTURE_EVENT Event = CAPTURE_EVENT::Command;
+    COMMAND_ID    Command = COMMAND_ID::Unknown;
+    uint8_t       LineLength = 0;
+    uint8_t       Reserved[5] = { 0 };
+} CAPTURE_RECORD, * PCAPTURE_RECORD;
+static_assert(sizeof(CAPTURE_RECORD) == 32, "CAPTURE_RECORD is part of the capture file format");
+
+typedef struct _CAPTURE_FILE_HEADER
+{
+    char     Magic[8] = { 0 };
+    uint32_t Version = 0;
+    uint32_t RecordSize = 0;
+    int64_t  StartTime = 0;             // system clock, microseconds
+} CAPTURE_FILE_HEADER, * PCAPTURE_FILE_HEADER;
+
+// Records every session's control-channel traffic for later replay (ftp-replay).
+// Sessions append to per-thread rings; a background thread writes them out once a
+// second. PASS arguments are never captured. When capture is off a command costs
+// one relaxed load.
+class SessionCapture
+{
+public:
+    SessionCapture() = delete;
+
+    static bool Start(const char* Path = CAPTURE_DEFAULT_FILE);
+    // Flushes and closes the capture; returns the number of records written.
+    static uint64_t Stop();
+
+    static bool IsEnabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    static uint32_t NextSessionId();
+    static void Record(uint32_t SessionId, CAPTURE_EVENT Event, COMMAND_ID Command, std::string_view Line, uint64_t LatencyUs, uint64_t TransferBytes);
+
+private:
+    static std::atomic<bool> enabled;
+};
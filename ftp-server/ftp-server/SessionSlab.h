@@ -0,0 +1,207 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+#include "Platform.h"
+
+// A session's identity outside the lock that guards it: slot index in the low 32
+// bits, the slot's generation in the high 32. Generations start at 1, so 0 is
+// never a live handle, and a handle to a session that has ended stops resolving
+// even after its slot has been reused.
+typedef uint64_t SESSION_HANDLE;
+#define INVALID_SESSION_HANDLE  0ULL
+
+typedef enum class _SESSION_STATE : BYTE
+{
+    Free = 0,
+    Busy = 1,       // a session task or a transfer owns it
+    Parked = 2,     // waiting in the shard's poller for its next command
+
+    MaxSessionState
+} SESSION_STATE, * PSESSION_STATE;
+
+// Fixed-size session slots, allocated a chunk at a time so a session never moves
+// and a slot is reused as soon as its session ends. What scans over every session
+// need (socket, state, when the state last changed) lives in dense arrays beside
+// the slots instead of inside them, so a drain or a census reads a few bytes per
+// session rather than a cache line each.
+//
+// Not thread-safe: FtpServer keeps one per acceptor shard, under the shard's
+// session lock.
+template <typename T>
+class SessionSlab
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr ULONG ChunkSlots = 1024;
+
+    explicit SessionSlab(Clock::time_point Origin = Clock::now()) : origin(Origin)
+    {
+    }
+
+    ~SessionSlab()
+    {
+        for (size_t index = 0; index < this->states.size(); ++index)
+        {
+            if (this->states[index] != SESSION_STATE::Free)
+            {
+                this->Slot(index)->~T();
+            }
+        }
+    }
+
+    SessionSlab(_In_ const SessionSlab& Other) = delete;
+    SessionSlab& operator=(_In_ const SessionSlab& Other) = delete;
+
+    // A value-initialized T in a free slot, Busy from Now.
+    T* Allocate(SOCKET Socket, Clock::time_point Now, SESSION_HANDLE& Handle)
+    {
+        if (this->freeSlots.empty())
+        {
+            this->Grow();
+        }
+        uint32_t index = this->freeSlots.back();
+        this->freeSlots.pop_back();
+
+        T* session = new (this->Slot(index)) T();
+        this->sockets[index] = Socket;
+        this->states[index] = SESSION_STATE::Busy;
+        this->changed[index] = this->Seconds(Now);
+        Handle = (static_cast<uint64_t>(this->generations[index]) << 32) | index;
+        ++this->count;
+        return session;
+    }
+
+    VOID Release(SESSION_HANDLE Handle)
+    {
+        uint32_t index = static_cast<uint32_t>(Handle);
+        this->Slot(index)->~T();
+        this->states[index] = SESSION_STATE::Free;
+        this->sockets[index] = INVALID_SOCKET;
+        if (!++this->generations[index])
+        {
+            this->generations[index] = 1;
+        }
+        this->freeSlots.push_back(index);
+        --this->count;
+    }
+
+    // The session Handle names, or nullptr if it has ended.
+    T* Resolve(SESSION_HANDLE Handle)
+    {
+        uint32_t index = static_cast<uint32_t>(Handle);
+        if (index >= this->states.size() ||
+            this->states[index] == SESSION_STATE::Free ||
+            this->generations[index] != static_cast<uint32_t>(Handle >> 32))
+        {
+            return nullptr;
+        }
+        return this->Slot(index);
+    }
+
+    SESSION_STATE State(SESSION_HANDLE Handle) const
+    {
+        return this->states[static_cast<uint32_t>(Handle)];
+    }
+
+    VOID SetState(SESSION_HANDLE Handle, SESSION_STATE State, Clock::time_point Now)
+    {
+        uint32_t index = static_cast<uint32_t>(Handle);
+        this->states[index] = State;
+        this->changed[index] = this->Seconds(Now);
+    }
+
+    // Visits every live session as Visit(SESSION_HANDLE, T&, SOCKET, seconds in its
+    // current state). Visit must not allocate or release sessions.
+    template <typename F>
+    VOID ForEach(Clock::time_point Now, F&& Visit)
+    {
+        this->Scan(SESSION_STATE::MaxSessionState, Now, Visit);
+    }
+
+    // The same, for the sessions in State.
+    template <typename F>
+    VOID ForEach(SESSION_STATE State, Clock::time_point Now, F&& Visit)
+    {
+        this->Scan(State, Now, Visit);
+    }
+
+    size_t Count() const
+    {
+        return this->count;
+    }
+
+    size_t Capacity() const
+    {
+        return this->states.size();
+    }
+
+    // Bytes held for each slot, whether or not it is in use.
+    static constexpr size_t SlotBytes()
+    {
+        // generation, state change time and free-list entry
+        return sizeof(T) + sizeof(SOCKET) + sizeof(SESSION_STATE) + 3 * sizeof(uint32_t);
+    }
+
+private:
+    typedef struct _SLOT
+    {
+        alignas(T) BYTE Bytes[sizeof(T)];
+    } SLOT;
+
+    // MaxSessionState matches every live session.
+    template <typename F>
+    VOID Scan(SESSION_STATE State, Clock::time_point Now, F& Visit)
+    {
+        uint32_t now = this->Seconds(Now);
+        for (size_t index = 0; index < this->states.size(); ++index)
+        {
+            SESSION_STATE state = this->states[index];
+            if (state == SESSION_STATE::Free || (State != SESSION_STATE::MaxSessionState && state != State))
+            {
+                continue;
+            }
+            SESSION_HANDLE handle = (static_cast<uint64_t>(this->generations[index]) << 32) | index;
+            Visit(handle, *this->Slot(index), this->sockets[index], now - this->changed[index]);
+        }
+    }
+
+    T* Slot(size_t Index)
+    {
+        return std::launder(reinterpret_cast<T*>(this->chunks[Index / ChunkSlots][Index % ChunkSlots].Bytes));
+    }
+
+    uint32_t Seconds(Clock::time_point Time) const
+    {
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(Time - this->origin).count());
+    }
+
+    // Slots are handed out lowest index first, so a lightly loaded shard keeps its
+    // sessions at the front of the arrays.
+    VOID Grow()
+    {
+        size_t first = this->states.size();
+        this->chunks.push_back(std::make_unique<SLOT[]>(ChunkSlots));
+        this->sockets.resize(first + ChunkSlots, INVALID_SOCKET);
+        this->states.resize(first + ChunkSlots, SESSION_STATE::Free);
+        this->generations.resize(first + ChunkSlots, 1);
+        this->changed.resize(first + ChunkSlots, 0);
+        for (size_t index = first + ChunkSlots; index > first; --index)
+        {
+            this->freeSlots.push_back(static_cast<uint32_t>(index - 1));
+        }
+    }
+
+    Clock::time_point                      origin;
+    std::vector<std::unique_ptr<SLOT[]>>   chunks;
+    std::vector<SOCKET>                    sockets;
+    std::vector<SESSION_STATE>             states;
+    std::vector<uint32_t>                  generations;
+    std::vector<uint32_t>                  changed;        // seconds from origin
+    std::vector<uint32_t>                  freeSlots;
+    size_t                                 count = 0;
+};
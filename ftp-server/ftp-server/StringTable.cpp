@@ -0,0 +1,99 @@
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include "StringTable.h"
+
+typedef struct _INTERNED_ENTRY
+{
+    std::string           Text;
+    std::atomic<uint32_t> References{ 1 };
+} INTERNED_ENTRY, * PINTERNED_ENTRY;
+
+namespace
+{
+    // Keys view the entries' own text.
+    std::mutex tableLock;
+    std::unordered_map<std::string_view, std::unique_ptr<INTERNED_ENTRY>> table;
+}
+
+InternedString StringTable::Intern(std::string_view Text)
+{
+    std::lock_guard<std::mutex> guard(tableLock);
+    auto found = table.find(Text);
+    if (found != table.end())
+    {
+        found->second->References.fetch_add(1, std::memory_order_relaxed);
+        return InternedString(found->second.get());
+    }
+
+    std::unique_ptr<INTERNED_ENTRY> entry = std::make_unique<INTERNED_ENTRY>();
+    entry->Text = Text;
+    PINTERNED_ENTRY interned = entry.get();
+    table.emplace(interned->Text, std::move(entry));
+    return InternedString(interned);
+}
+
+size_t StringTable::Count()
+{
+    std::lock_guard<std::mutex> guard(tableLock);
+    return table.size();
+}
+
+// Dropping a reference that is not the last is a compare-exchange. The last one
+// is dropped under the lock, where Intern() cannot hand the entry out again.
+VOID StringTable::Release(PINTERNED_ENTRY Entry)
+{
+    uint32_t references = Entry->References.load(std::memory_order_relaxed);
+    while (references > 1)
+    {
+        if (Entry->References.compare_exchange_weak(references, references - 1, std::memory_order_acq_rel))
+        {
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(tableLock);
+    if (Entry->References.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        table.erase(std::string_view(Entry->Text));
+    }
+}
+
+InternedString::InternedString(const InternedString& Other) : entry(Other.entry)
+{
+    if (this->entry)
+    {
+        this->entry->References.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+InternedString::InternedString(InternedString&& Other) noexcept : entry(std::exchange(Other.entry, nullptr))
+{
+}
+
+InternedString& InternedString::operator=(InternedString Other) noexcept
+{
+    std::swap(this->entry, Other.entry);
+    return *this;
+}
+
+InternedString::~InternedString()
+{
+    if (this->entry)
+    {
+        StringTable::Release(this->entry);
+    }
+}
+
+std::string_view InternedString::View() const
+{
+    return this->entry ? std::string_view(this->entry->Text) : std::string_view();
+}
+
+PCSTR InternedString::CStr() const
+{
+    return this->entry ? this->entry->Text.c_str() : "";
+}
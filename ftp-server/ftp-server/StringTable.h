@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+#include "Platform.h"
+
+// A reference to text held once in the StringTable, however many sessions use it.
+// Eight bytes in place of a fixed-size buffer per session; copying one only bumps a
+// count, and the text goes away with its last reference.
+class InternedString
+{
+public:
+    InternedString() = default;
+    InternedString(_In_ const InternedString& Other);
+    InternedString(InternedString&& Other) noexcept;
+    InternedString& operator=(InternedString Other) noexcept;
+    ~InternedString();
+
+    std::string_view View() const;
+
+    // NUL-terminated; "" when empty.
+    PCSTR CStr() const;
+
+private:
+    friend class StringTable;
+    explicit InternedString(struct _INTERNED_ENTRY* Entry) : entry(Entry) {}
+
+    struct _INTERNED_ENTRY* entry = nullptr;
+};
+
+// Process-wide and thread-safe. Interning takes a lock, so it belongs where a
+// string changes (USER, a new session's root directory), not on every command.
+class StringTable
+{
+public:
+    static InternedString Intern(std::string_view Text);
+
+    // Distinct strings currently held.
+    static size_t Count();
+
+private:
+    friend class InternedString;
+    static VOID Release(struct _INTERNED_ENTRY* Entry);
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Fixed-capacity text formatting on the stack: never allocates, and truncates
+// instead of overflowing. Integers go through std::to_chars.
+template <size_t Capacity>
+class TextBuffer
+{
+public:
+    TextBuffer& Append(std::string_view Text)
+    {
+        size_t count = Text.size() < this->Available() ? Text.size() : this->Available();
+        memcpy(this->buffer + this->length, Text.data(), count);
+        this->length += count;
+        return *this;
+    }
+
+    TextBuffer& Append(char Character)
+    {
+        if (this->Available())
+        {
+            this->buffer[this->length++] = Character;
+        }
+        return *this;
+    }
+
+    template <std::integral Integer>
+        requires (!std::same_as<Integer, char> && !std::same_as<Integer, bool>)
+    TextBuffer& Append(Integer Value, int Width = 0)
+    {
+        char digits[24];
+        std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), Value);
+        for (int padding = Width - static_cast<int>(result.ptr - digits); padding > 0; --padding)
+        {
+            this->Append('0');
+        }
+        return this->Append(std::string_view(digits, static_cast<size_t>(result.ptr - digits)));
+    }
+
+    std::string_view View() const
+    {
+        return std::string_view(this->buffer, this->length);
+    }
+
+    void Clear()
+    {
+        this->length = 0;
+    }
+
+protected:
+    size_t Available() const
+    {
+        return Capacity - this->length;
+    }
+
+    char   buffer[Capacity];
+    size_t length = 0;
+};
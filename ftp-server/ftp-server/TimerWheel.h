@@ -0,0 +1,232 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "Platform.h"
+
+// A timer that lives inside whatever it times, so arming one never allocates.
+// Context is for the owner; the wheel only links the timer into a slot.
+typedef struct _TIMER
+{
+    struct _TIMER* Next = nullptr;
+    struct _TIMER* Prev = nullptr;
+    uint64_t       Deadline = 0ULL;     // in ticks
+    PVOID          Context = nullptr;
+    BYTE           Level = 0;
+    BYTE           Slot = 0;
+    bool           Scheduled = false;
+} TIMER, * PTIMER;
+
+// Hierarchical timing wheel: six levels of 64 slots, each level's slot spanning
+// the whole of the level below. A timer goes in the lowest level that can tell
+// its deadline apart from the current tick and moves down a level each time the
+// wheel reaches its slot, so scheduling and cancelling are O(1) list operations
+// and the next deadline is a bit scan over six occupancy masks. With 100 ms ticks
+// the wheel covers 2^36 ticks, far beyond any session timeout.
+//
+// Not thread-safe: the owner serializes access (FtpServer keeps one per acceptor
+// shard, under the shard's session lock).
+class TimerWheel
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit TimerWheel(std::chrono::milliseconds Tick, Clock::time_point Origin = Clock::now())
+        : tick(std::max<int64_t>(1, Tick.count())), origin(Origin)
+    {
+    }
+
+    TimerWheel(_In_ const TimerWheel& Other) = delete;
+    TimerWheel& operator=(_In_ const TimerWheel& Other) = delete;
+
+    // (Re)arms Timer. A deadline that has already passed fires on the next Expire().
+    VOID Schedule(TIMER& Timer, Clock::time_point Deadline)
+    {
+        if (Timer.Scheduled)
+        {
+            this->Unlink(Timer);
+        }
+        Timer.Deadline = this->ToTick(Deadline, true);
+        this->Insert(Timer);
+    }
+
+    VOID Cancel(TIMER& Timer)
+    {
+        if (Timer.Scheduled)
+        {
+            this->Unlink(Timer);
+        }
+    }
+
+    // Unlinks and reports every timer due at Now. OnExpired(TIMER&) may schedule
+    // or cancel timers, including the one it was handed.
+    template <typename F>
+    size_t Expire(Clock::time_point Now, F&& OnExpired)
+    {
+        uint64_t target = this->ToTick(Now, false);
+        size_t fired = 0;
+        uint64_t when = 0;
+        ULONG level = 0;
+        ULONG slot = 0;
+        while (this->NextExpiration(when, level, slot) && when <= target)
+        {
+            this->elapsed = when;
+            while (PTIMER timer = this->slots[level][slot])
+            {
+                this->Unlink(*timer);
+                if (timer->Deadline <= target)
+                {
+                    ++fired;
+                    OnExpired(*timer);
+                }
+                else
+                {
+                    this->Insert(*timer);
+                }
+            }
+        }
+        this->elapsed = std::max(this->elapsed, target);
+        return fired;
+    }
+
+    // How long a poller can sleep before the wheel needs to run again: 0 if a
+    // timer is due, INFINITE if none are scheduled. Higher levels wake the poller
+    // early to move their timers down, never late.
+    ULONG MillisecondsUntilNext(Clock::time_point Now) const
+    {
+        uint64_t when = 0;
+        ULONG level = 0;
+        ULONG slot = 0;
+        if (!this->NextExpiration(when, level, slot))
+        {
+            return INFINITE;
+        }
+
+        auto due = this->origin + std::chrono::milliseconds(static_cast<int64_t>(when) * this->tick);
+        if (due <= Now)
+        {
+            return 0;
+        }
+        auto wait = std::chrono::ceil<std::chrono::milliseconds>(due - Now).count();
+        return static_cast<ULONG>(std::min<int64_t>(wait, INFINITE - 1));
+    }
+
+    size_t Count() const
+    {
+        return this->count;
+    }
+
+private:
+    static constexpr ULONG SlotBits = 6;
+    static constexpr ULONG Slots = 1UL << SlotBits;
+    static constexpr ULONG Levels = 6;
+    static constexpr uint64_t Span = 1ULL << (SlotBits * Levels);
+
+    uint64_t ToTick(Clock::time_point Time, bool RoundUp) const
+    {
+        int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(Time - this->origin).count();
+        if (ms <= 0)
+        {
+            return 0;
+        }
+        return static_cast<uint64_t>((RoundUp ? ms + this->tick - 1 : ms) / this->tick);
+    }
+
+    VOID Insert(TIMER& Timer)
+    {
+        // Overdue timers go in the current level-0 slot; deadlines past the top
+        // level park in its last slot and are re-filed when it comes round.
+        uint64_t when = std::max(Timer.Deadline, this->elapsed);
+        if (when - this->elapsed >= Span)
+        {
+            when = this->elapsed | (Span - 1);
+        }
+
+        uint64_t significant = (when ^ this->elapsed) | (Slots - 1);
+        ULONG level = static_cast<ULONG>((63 - std::countl_zero(significant)) / SlotBits);
+        if (level >= Levels)
+        {
+            level = Levels - 1;
+        }
+        ULONG slot = static_cast<ULONG>((when >> (level * SlotBits)) & (Slots - 1));
+
+        PTIMER& head = this->slots[level][slot];
+        Timer.Prev = nullptr;
+        Timer.Next = head;
+        if (head)
+        {
+            head->Prev = &Timer;
+        }
+        head = &Timer;
+        Timer.Level = static_cast<BYTE>(level);
+        Timer.Slot = static_cast<BYTE>(slot);
+        Timer.Scheduled = true;
+        this->occupied[level] |= 1ULL << slot;
+        ++this->count;
+    }
+
+    VOID Unlink(TIMER& Timer)
+    {
+        PTIMER& head = this->slots[Timer.Level][Timer.Slot];
+        if (Timer.Prev)
+        {
+            Timer.Prev->Next = Timer.Next;
+        }
+        else
+        {
+            head = Timer.Next;
+        }
+        if (Timer.Next)
+        {
+            Timer.Next->Prev = Timer.Prev;
+        }
+        if (!head)
+        {
+            this->occupied[Timer.Level] &= ~(1ULL << Timer.Slot);
+        }
+        Timer.Next = nullptr;
+        Timer.Prev = nullptr;
+        Timer.Scheduled = false;
+        --this->count;
+    }
+
+    // The start of the first occupied slot at or after the current tick. Every
+    // level-N slot starts after every level-(N-1) slot, so the lowest occupied
+    // level holds the answer.
+    bool NextExpiration(uint64_t& When, ULONG& Level, ULONG& Slot) const
+    {
+        for (ULONG level = 0; level < Levels; ++level)
+        {
+            if (!this->occupied[level])
+            {
+                continue;
+            }
+
+            ULONG shift = level * SlotBits;
+            ULONG current = static_cast<ULONG>((this->elapsed >> shift) & (Slots - 1));
+            ULONG distance = static_cast<ULONG>(std::countr_zero(std::rotr(this->occupied[level], static_cast<int>(current))));
+            ULONG slot = (current + distance) & (Slots - 1);
+
+            uint64_t levelSpan = 1ULL << (shift + SlotBits);
+            uint64_t when = (this->elapsed & ~(levelSpan - 1)) + (static_cast<uint64_t>(slot) << shift);
+            if (slot < current)
+            {
+                when += levelSpan;
+            }
+            When = std::max(when, this->elapsed);
+            Level = level;
+            Slot = slot;
+            return true;
+        }
+        return false;
+    }
+
+    int64_t           tick;             // milliseconds
+    Clock::time_point origin;
+    uint64_t          elapsed = 0ULL;   // ticks the wheel has advanced through
+    size_t            count = 0;
+    uint64_t          occupied[Levels] = { 0 };
+    PTIMER            slots[Levels][Slots] = {};
+};
@@ -0,0 +1,101 @@
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include "PerThreadRing.h"
+#include "Tracing.h"
+
+std::atomic<bool> Tracer::enabled{ false };
+
+namespace
+{
+    // Single writer that overwrites its oldest records, unlike PerThreadRing; Head
+    // counts every record ever written, so the reader can tell which slots were
+    // overwritten while it was copying them.
+    typedef struct _TRACE_RING
+    {
+        explicit _TRACE_RING(uint32_t ThreadIndex) : ThreadId(ThreadIndex)
+        {
+        }
+
+        std::atomic<uint64_t> Head{ 0 };
+        uint32_t              ThreadId;
+        TRACE_RECORD          Records[TRACE_RING_CAPACITY];
+    } TRACE_RING;
+
+    struct TRACE_STATE
+    {
+        RingRegistry<TRACE_RING> rings;
+        std::atomic<uint64_t>    nextTransferId{ 1 };
+    };
+
+    TRACE_STATE& State()
+    {
+        static TRACE_STATE state;
+        return state;
+    }
+}
+
+void Tracer::Enable(bool Enabled)
+{
+    enabled.store(Enabled, std::memory_order_relaxed);
+}
+
+uint64_t Tracer::NextTransferId()
+{
+    return State().nextTransferId.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Tracer::Record(uint64_t TransferId, COMMAND_ID Command, TRACE_PHASE Phase, uint64_t Bytes)
+{
+    TRACE_RING& ring = State().rings.ThreadRing();
+    uint64_t head = ring.Head.load(std::memory_order_relaxed);
+
+    TRACE_RECORD& record = ring.Records[head % TRACE_RING_CAPACITY];
+    record.Timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    record.TransferId = TransferId;
+    record.Bytes = Bytes;
+    record.ThreadId = ring.ThreadId;
+    record.Command = Command;
+    record.Phase = Phase;
+    record.Reserved = 0;
+
+    ring.Head.store(head + 1, std::memory_order_release);
+}
+
+size_t Tracer::Dump(FILE* File)
+{
+    std::vector<TRACE_RECORD> records;
+    State().rings.ForEach([&records](TRACE_RING& Ring)
+        {
+            uint64_t head = Ring.Head.load(std::memory_order_acquire);
+            uint64_t first = head > TRACE_RING_CAPACITY ? head - TRACE_RING_CAPACITY : 0;
+            size_t copied = records.size();
+            for (uint64_t i = first; i < head; ++i)
+            {
+                records.push_back(Ring.Records[i % TRACE_RING_CAPACITY]);
+            }
+
+            // Anything the writer lapped during the copy, or is writing right now, may
+            // be torn; drop it.
+            uint64_t after = Ring.Head.load(std::memory_order_acquire) + 1;
+            uint64_t lapped = after > TRACE_RING_CAPACITY + first ? after - TRACE_RING_CAPACITY - first : 0;
+            if (lapped)
+            {
+                size_t drop = static_cast<size_t>(lapped < head - first ? lapped : head - first);
+                records.erase(records.begin() + static_cast<std::ptrdiff_t>(copied), records.begin() + static_cast<std::ptrdiff_t>(copied + drop));
+            }
+        });
+
+    TRACE_FILE_HEADER header;
+    memcpy(header.Magic, TRACE_FILE_MAGIC, sizeof(header.Magic));
+    header.Version = TRACE_FILE_VERSION;
+    header.RecordSize = sizeof(TRACE_RECORD);
+    header.RecordCount = records.size();
+    if (fwrite(&header, sizeof(header), 1, File) != 1 ||
+        (!records.empty() && fwrite(records.data(), sizeof(TRACE_RECORD), records.size(), File) != records.size()))
+    {
+        return 0;
+    }
+    return records.size();
+}
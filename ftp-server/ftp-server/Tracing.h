@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include "Metrics.h"
+
+#define TRACE_RING_CAPACITY     4096
+#define TRACE_FILE_MAGIC        "FTPTRACE"
+#define TRACE_FILE_VERSION      1
+#define TRACE_DEFAULT_FILE      "ftp-server.trace"
+
+typedef enum class _TRACE_PHASE : uint8_t
+{
+    CommandReceived = 0,
+    DataSocketReady,
+    FirstByte,
+    LastByte,
+    ReplySent,
+
+    MaxTracePhase
+} TRACE_PHASE, * PTRACE_PHASE;
+
+// On-disk and in-memory layout are the same, so a dump is a header followed by a
+// straight copy of the rings.
+typedef struct _TRACE_RECORD
+{
+    uint64_t    Timestamp;      // steady clock, nanoseconds
+    uint64_t    TransferId;
+    uint64_t    Bytes;
+    uint32_t    ThreadId;
+    COMMAND_ID  Command;
+    TRACE_PHASE Phase;
+    uint16_t    Reserved;
+} TRACE_RECORD, * PTRACE_RECORD;
+static_assert(sizeof(TRACE_RECORD) == 32, "TRACE_RECORD is part of the trace file format");
+
+typedef struct _TRACE_FILE_HEADER
+{
+    char     Magic[8] = { 0 };
+    uint32_t Version = 0;
+    uint32_t RecordSize = 0;
+    uint64_t RecordCount = 0;
+} TRACE_FILE_HEADER, * PTRACE_FILE_HEADER;
+
+// Flight recorder for data transfers. Each thread writes into its own ring and
+// overwrites its oldest records; Dump() collects whatever the rings hold. When
+// tracing is disabled a transfer costs one relaxed load.
+class Tracer
+{
+public:
+    Tracer() = delete;
+
+    static void Enable(bool Enabled);
+    static bool IsEnabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t NextTransferId();
+    static void Record(uint64_t TransferId, COMMAND_ID Command, TRACE_PHASE Phase, uint64_t Bytes);
+
+    // Writes every buffered record to File; returns the number of records written.
+    static size_t Dump(FILE* File);
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+// Phase marks for one RETR/STOR/LIST. Constructing it stamps CommandReceived.
+class TransferTrace
+{
+public:
+    TransferTrace() : command(COMMAND_ID::Unknown) {}
+
+    explicit TransferTrace(COMMAND_ID Command) : command(Command)
+    {
+        if (Tracer::IsEnabled())
+        {
+            this->transferId = Tracer::NextTransferId();
+            Tracer::Record(this->transferId, Command, TRACE_PHASE::CommandReceived, 0);
+        }
+    }
+
+    void Mark(TRACE_PHASE Phase, uint64_t Bytes = 0)
+    {
+        if (this->transferId)
+        {
+            Tracer::Record(this->transferId, this->command, Phase, Bytes);
+        }
+    }
+
+private:
+    uint64_t   transferId = 0;
+    COMMAND_ID command;
+};
@@ -0,0 +1,200 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Metrics.h"
+#include "PerThreadRing.h"
+#include "TextBuffer.h"
+#include "TransferLog.h"
+
+namespace
+{
+    typedef PerThreadRing<TRANSFER_RECORD, XFERLOG_RING_CAPACITY> TRANSFER_RING;
+
+    struct TRANSFER_LOG_STATE
+    {
+        std::mutex                            lock;     // Start and Stop
+        RingRegistry<TRANSFER_RING>           rings;
+        RingFlusher                           flusher;
+        bool                                  running = false;
+        std::string                           path;
+        std::ofstream                         output;
+        uint64_t                              written = 0;
+        std::chrono::steady_clock::time_point opened;
+    };
+
+    TRANSFER_LOG_STATE& State()
+    {
+        static TRANSFER_LOG_STATE state;
+        return state;
+    }
+
+    // Unbuffered, so every batch reaches the file as one write.
+    void OpenOutput(TRANSFER_LOG_STATE& State)
+    {
+        State.output.rdbuf()->pubsetbuf(nullptr, 0);
+        State.output.open(State.path, std::ios::binary | std::ios::app);
+        State.output.seekp(0, std::ios::end);
+        std::streamoff size = State.output.tellp();
+        State.written = size > 0 ? static_cast<uint64_t>(size) : 0;
+        State.opened = std::chrono::steady_clock::now();
+    }
+
+    // "Mon Oct 18 12:00:00 2026", the ctime() layout xferlog readers expect (in UTC).
+    void AppendCtime(TextBuffer<XFERLOG_PATH_LENGTH + 128>& Line, int64_t Timestamp)
+    {
+        static constexpr std::string_view weekdays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+        static constexpr std::string_view months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+        using namespace std::chrono;
+        sys_time<microseconds> time{ microseconds(Timestamp) };
+        sys_days day = floor<days>(time);
+        year_month_day date(day);
+        hh_mm_ss<seconds> clock(floor<seconds>(time - day));
+
+        Line.Append(weekdays[weekday(day).c_encoding()]).Append(' ')
+            .Append(months[static_cast<unsigned>(date.month()) - 1]).Append(' ')
+            .Append(static_cast<unsigned>(date.day()) < 10 ? " " : "").Append(static_cast<unsigned>(date.day())).Append(' ')
+            .Append(clock.hours().count(), 2).Append(':')
+            .Append(clock.minutes().count(), 2).Append(':')
+            .Append(clock.seconds().count(), 2).Append(' ')
+            .Append(static_cast<int>(date.year()));
+    }
+
+    // current-time transfer-time remote-host file-size filename transfer-type
+    // special-action-flag direction access-mode username service-name
+    // authentication-method authenticated-user-id completion-status
+    void AppendRecord(std::string& Batch, const TRANSFER_RECORD& Record)
+    {
+        TextBuffer<XFERLOG_PATH_LENGTH + 128> line;
+        AppendCtime(line, Record.Timestamp);
+        line.Append(' ').Append((Record.DurationMs + 999) / 1000).Append(' ')
+            .Append(Record.RemoteAddress[0]).Append('.')
+            .Append(Record.RemoteAddress[1]).Append('.')
+            .Append(Record.RemoteAddress[2]).Append('.')
+            .Append(Record.RemoteAddress[3]).Append(' ')
+            .Append(Record.Bytes).Append(' ');
+        for (uint16_t i = 0; i < Record.FileNameLength; ++i)
+        {
+            char c = Record.FileName[i];
+            line.Append(c == ' ' || static_cast<unsigned char>(c) < 0x20 ? '_' : c);
+        }
+        line.Append(' ').Append(Record.TransferType)
+            .Append(" _ ").Append(static_cast<char>(Record.Direction))
+            .Append(" r ").Append(std::string_view(Record.UserName, Record.UserNameLength))
+            .Append(" ftp 0 * ").Append(Record.Completed ? 'c' : 'i').Append('\n');
+        Batch.append(line.View());
+    }
+
+    void Rotate(TRANSFER_LOG_STATE& State)
+    {
+        State.output.close();
+
+        using namespace std::chrono;
+        sys_seconds now = floor<seconds>(system_clock::now());
+        sys_days day = floor<days>(now);
+        year_month_day date(day);
+        hh_mm_ss<seconds> clock(now - day);
+
+        TextBuffer<XFERLOG_PATH_LENGTH + 32> rotated;
+        rotated.Append(State.path).Append('.')
+            .Append(static_cast<int>(date.year()), 4)
+            .Append(static_cast<unsigned>(date.month()), 2)
+            .Append(static_cast<unsigned>(date.day()), 2).Append('-')
+            .Append(clock.hours().count(), 2)
+            .Append(clock.minutes().count(), 2)
+            .Append(clock.seconds().count(), 2);
+        std::rename(State.path.c_str(), std::string(rotated.View()).c_str());
+
+        OpenOutput(State);
+    }
+
+    // Batch and Rings are the flusher's own and keep their capacity between drains.
+    void Drain(TRANSFER_LOG_STATE& State, std::string& Batch, std::vector<TRANSFER_RING*>& Rings)
+    {
+        State.rings.Collect(Rings);
+
+        Batch.clear();
+        for (TRANSFER_RING* ring : Rings)
+        {
+            ring->Drain([&Batch](const TRANSFER_RECORD& Record) { AppendRecord(Batch, Record); });
+        }
+
+        if (Batch.empty())
+        {
+            return;
+        }
+
+        if (State.written >= XFERLOG_ROTATE_BYTES ||
+            std::chrono::steady_clock::now() - State.opened >= std::chrono::seconds(XFERLOG_ROTATE_SECONDS))
+        {
+            Rotate(State);
+        }
+
+        State.output.write(Batch.data(), static_cast<std::streamsize>(Batch.size()));
+        State.written += Batch.size();
+    }
+}
+
+void TRANSFER_RECORD::SetFileName(std::string_view Name)
+{
+    this->FileNameLength = static_cast<uint16_t>(Name.size() < sizeof(this->FileName) ? Name.size() : sizeof(this->FileName));
+    memcpy(this->FileName, Name.data(), this->FileNameLength);
+}
+
+void TRANSFER_RECORD::SetUserName(std::string_view Name)
+{
+    this->UserNameLength = static_cast<uint8_t>(Name.size() < sizeof(this->UserName) ? Name.size() : sizeof(this->UserName));
+    memcpy(this->UserName, Name.data(), this->UserNameLength);
+}
+
+void TransferLog::Start(const char* Path)
+{
+    TRANSFER_LOG_STATE& state = State();
+    std::lock_guard<std::mutex> guard(state.lock);
+    if (state.running)
+    {
+        return;
+    }
+
+    state.path = Path;
+    OpenOutput(state);
+    state.running = true;
+    state.flusher.Start(std::chrono::milliseconds(XFERLOG_FLUSH_INTERVAL_MS),
+        [&state, batch = std::string(), rings = std::vector<TRANSFER_RING*>()]() mutable { Drain(state, batch, rings); });
+}
+
+void TransferLog::Stop()
+{
+    TRANSFER_LOG_STATE& state = State();
+    std::lock_guard<std::mutex> guard(state.lock);
+    if (!state.running)
+    {
+        return;
+    }
+    state.running = false;
+    state.flusher.Stop();
+    state.output.close();
+}
+
+void TransferLog::Write(const TRANSFER_RECORD& Record)
+{
+    TRANSFER_RING& ring = State().rings.ThreadRing();
+    TRANSFER_RECORD* slot = ring.Reserve();
+    if (!slot)
+    {
+        Metrics::TransferRecordDropped();
+        return;
+    }
+
+    *slot = Record;
+    ring.Commit();
+}
+
+uint64_t TransferLog::Dropped()
+{
+    return State().rings.Dropped();
+}
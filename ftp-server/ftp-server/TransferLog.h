@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+#define XFERLOG_DEFAULT_FILE        "xferlog"
+#define XFERLOG_RING_CAPACITY       256
+#define XFERLOG_PATH_LENGTH         260
+#define XFERLOG_USER_LENGTH         32
+#define XFERLOG_FLUSH_INTERVAL_MS   1000
+#define XFERLOG_ROTATE_BYTES        (64ULL * 1024 * 1024)
+#define XFERLOG_ROTATE_SECONDS      (24 * 60 * 60)
+
+typedef enum class _TRANSFER_DIRECTION : char
+{
+    Outgoing = 'o',
+    Incoming = 'i',
+} TRANSFER_DIRECTION, * PTRANSFER_DIRECTION;
+
+typedef struct _TRANSFER_RECORD
+{
+    int64_t            Timestamp = 0;       // system clock, microseconds
+    uint64_t           DurationMs = 0;
+    uint64_t           Bytes = 0;
+    uint8_t            RemoteAddress[4] = { 0 };
+    TRANSFER_DIRECTION Direction = TRANSFER_DIRECTION::Outgoing;
+    char               TransferType = 'a';
+    bool               Completed = false;
+    uint16_t           FileNameLength = 0;
+    uint8_t            UserNameLength = 0;
+    char               FileName[XFERLOG_PATH_LENGTH] = { 0 };
+    char               UserName[XFERLOG_USER_LENGTH] = { 0 };
+
+    void SetFileName(std::string_view Name);
+    void SetUserName(std::string_view Name);
+} TRANSFER_RECORD, * PTRANSFER_RECORD;
+
+// wu-ftpd compatible xferlog. Transfer handlers push fixed-size records into a
+// per-thread ring (lock-free; dropped when full, and counted in Metrics); a
+// background thread formats them and appends each batch with a single write.
+// Rotation (by size or age) happens on that thread too, so it never stalls a
+// transfer.
+class TransferLog
+{
+public:
+    TransferLog() = delete;
+
+    static void Start(const char* Path = XFERLOG_DEFAULT_FILE);
+    static void Stop();
+
+    static void Write(const TRANSFER_RECORD& Record);
+    static uint64_t Dropped();
+};
@@ -0,0 +1,135 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "Platform.h"
+
+#define SCHEDULER_QUANTUM       (64 * 1024)     // bytes a flow may move per turn at weight 1
+#define SCHEDULER_MAX_WEIGHT    64
+
+// A transfer's standing with the scheduler. Deficit is what it may still move in
+// its current turn, negative when its last chunk overshot; Round is the round it
+// last joined.
+typedef struct _SCHEDULED_FLOW
+{
+    ULONG    Weight = 1;
+    int64_t  Deficit = 0LL;
+    uint64_t Round = 0ULL;
+} SCHEDULED_FLOW, * PSCHEDULED_FLOW;
+
+// Deficit round-robin over the transfers that have data to move. The flow at the
+// front is credited a quantum per unit of its user's weight, moves up to its credit
+// and, if it has more, goes back in line carrying whatever it overshot. A flow that
+// drops out (finished, or paused by the shaper) keeps no credit, so a big transfer
+// cannot bank turns, and a small one is never more than one round of quanta away
+// from its first byte however large the transfers ahead of it.
+//
+// Several workers take turns at once, so a flow coming back from its turn waits for
+// the next round instead of joining the back of the current one. Otherwise a flow
+// with short turns would come round again while the long turns were still running,
+// and weights would buy less than their share.
+//
+// Not thread-safe: FtpServer holds its bulkLock around it.
+template <typename T>
+class TransferScheduler
+{
+public:
+    explicit TransferScheduler(int64_t Quantum = SCHEDULER_QUANTUM) : quantum(Quantum)
+    {
+    }
+
+    TransferScheduler(_In_ const TransferScheduler& Other) = delete;
+    TransferScheduler& operator=(_In_ const TransferScheduler& Other) = delete;
+
+    // Weights are per user and 1 unless set; 0 sets a user back to 1. A change
+    // applies from the user's flows' next turn.
+    VOID SetWeight(std::string_view User, ULONG Weight)
+    {
+        auto weight = this->weights.find(User);
+        if (!Weight || Weight == 1)
+        {
+            if (weight != this->weights.end())
+            {
+                this->weights.erase(weight);
+            }
+            return;
+        }
+
+        Weight = std::min<ULONG>(Weight, SCHEDULER_MAX_WEIGHT);
+        if (weight == this->weights.end())
+        {
+            this->weights.emplace(std::string(User), Weight);
+        }
+        else
+        {
+            weight->second = Weight;
+        }
+    }
+
+    ULONG Weight(std::string_view User) const
+    {
+        auto weight = this->weights.find(User);
+        return weight == this->weights.end() ? 1 : weight->second;
+    }
+
+    // Item, with its flow Flow, joins the line. Returning is for a flow coming back
+    // from a turn with more to move, which goes in the round after the one it had
+    // its turn in; anything else starts without credit in the current round.
+    VOID Push(T Item, SCHEDULED_FLOW& Flow, std::string_view User, bool Returning)
+    {
+        Flow.Weight = this->Weight(User);
+        if (!Returning)
+        {
+            Flow.Deficit = std::min<int64_t>(Flow.Deficit, 0);
+        }
+        if (Returning && Flow.Round == this->round)
+        {
+            Flow.Round = this->round + 1;
+            this->next.emplace_back(Item, &Flow);
+        }
+        else
+        {
+            Flow.Round = this->round;
+            this->current.emplace_back(Item, &Flow);
+        }
+    }
+
+    // The item whose turn it is, already credited for the turn; false if the line
+    // is empty.
+    bool Pop(T& Item)
+    {
+        if (this->current.empty())
+        {
+            if (this->next.empty())
+            {
+                return false;
+            }
+            this->current.swap(this->next);
+            ++this->round;
+        }
+        auto [item, flow] = this->current.front();
+        this->current.pop_front();
+        flow->Deficit += this->quantum * static_cast<int64_t>(flow->Weight);
+        Item = item;
+        return true;
+    }
+
+    size_t Size() const
+    {
+        return this->current.size() + this->next.size();
+    }
+
+private:
+    typedef std::deque<std::pair<T, PSCHEDULED_FLOW>> LINE;
+
+    int64_t                                     quantum;
+    uint64_t                                    round = 0ULL;
+    LINE                                        current;
+    LINE                                        next;
+    std::map<std::string, ULONG, std::less<>>   weights;
+};
@@ -0,0 +1,272 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "BS_thread_pool_light.hpp"
+
+// A work-stealing executor with the interface of BS::thread_pool_light (push_task,
+// wait_for_tasks, get_thread_count), so InstrumentedPool can sit on either.
+//
+// Every worker owns a deque. Tasks pushed from a worker go to the back of its own
+// deque and it pops from the back, so follow-up work stays on the core that made
+// it; tasks pushed from outside are dealt round-robin. An idle worker steals from
+// the front of other deques, starting at a random victim. Pushers only ever touch
+// one deque's lock, and the shared sleep lock only when a worker is parked. The
+// deques are rings that only ever grow, so once one has held its high-water mark
+// of tasks, pushing and popping never allocate (std::deque allocates a block
+// every few dozen pushes).
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(BS::concurrency_t ThreadCount = 0)
+    {
+        this->threadCount = ThreadCount ? ThreadCount : std::max(1U, std::thread::hardware_concurrency());
+        this->queues = std::make_unique<WORKER_QUEUE[]>(this->threadCount);
+        this->threads = std::make_unique<std::thread[]>(this->threadCount);
+        for (BS::concurrency_t index = 0; index < this->threadCount; ++index)
+        {
+            this->threads[index] = std::thread(&WorkStealingPool::Worker, this, index);
+        }
+    }
+
+    ~WorkStealingPool()
+    {
+        this->wait_for_tasks();
+        {
+            std::lock_guard<std::mutex> guard(this->sleepLock);
+            this->stopping = true;
+        }
+        this->wake.notify_all();
+        for (BS::concurrency_t index = 0; index < this->threadCount; ++index)
+        {
+            this->threads[index].join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool& Other) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool& Other) = delete;
+
+    [[nodiscard]] BS::concurrency_t get_thread_count() const
+    {
+        return this->threadCount;
+    }
+
+    template <typename F, typename... A>
+    void push_task(F&& Task, A&&... Arguments)
+    {
+        size_t target = currentPool == this
+            ? currentIndex
+            : this->nextQueue.fetch_add(1, std::memory_order_relaxed) % this->threadCount;
+
+        this->unfinished.fetch_add(1);
+        {
+            WORKER_QUEUE& queue = this->queues[target];
+            std::lock_guard<std::mutex> guard(queue.Lock);
+            // std::bind would add to the task's size, and a task without arguments
+            // that fits std::function's inline storage should not be moved to the heap.
+            if constexpr (sizeof...(A) == 0)
+            {
+                queue.Tasks.push_back(std::forward<F>(Task));
+            }
+            else
+            {
+                queue.Tasks.push_back(std::bind(std::forward<F>(Task), std::forward<A>(Arguments)...));
+            }
+        }
+
+        // Pairs with the sleeper's increment of `sleepers` before it re-checks
+        // `queued`: one of the two sides always sees the other.
+        this->queued.fetch_add(1);
+        if (this->sleepers.load())
+        {
+            std::lock_guard<std::mutex> guard(this->sleepLock);
+            this->wake.notify_one();
+        }
+    }
+
+    void wait_for_tasks()
+    {
+        std::unique_lock<std::mutex> lock(this->sleepLock);
+        this->done.wait(lock, [this] { return this->unfinished.load() == 0; });
+    }
+
+private:
+    class TaskRing
+    {
+    public:
+        TaskRing() : slots(std::make_unique<std::function<void()>[]>(InitialCapacity)), capacity(InitialCapacity)
+        {
+        }
+
+        bool empty() const
+        {
+            return this->head == this->tail;
+        }
+
+        void push_back(std::function<void()>&& Task)
+        {
+            if (this->tail - this->head == this->capacity)
+            {
+                this->Grow();
+            }
+            this->slots[this->tail++ & (this->capacity - 1)] = std::move(Task);
+        }
+
+        void pop_back(std::function<void()>& Task)
+        {
+            this->Take(--this->tail, Task);
+        }
+
+        void pop_front(std::function<void()>& Task)
+        {
+            this->Take(this->head++, Task);
+        }
+
+    private:
+        static constexpr size_t InitialCapacity = 64;
+
+        // Leaves the slot empty, so whatever the task captured goes with it.
+        void Take(size_t Position, std::function<void()>& Task)
+        {
+            std::function<void()>& slot = this->slots[Position & (this->capacity - 1)];
+            Task = std::move(slot);
+            slot = nullptr;
+        }
+
+        void Grow()
+        {
+            std::unique_ptr<std::function<void()>[]> grown = std::make_unique<std::function<void()>[]>(this->capacity * 2);
+            for (size_t position = this->head; position != this->tail; ++position)
+            {
+                grown[position - this->head] = std::move(this->slots[position & (this->capacity - 1)]);
+            }
+            this->slots = std::move(grown);
+            this->capacity *= 2;
+            this->tail -= this->head;
+            this->head = 0;
+        }
+
+        std::unique_ptr<std::function<void()>[]> slots;
+        size_t                                   capacity;     // a power of two
+        size_t                                   head = 0;     // positions grow without wrapping
+        size_t                                   tail = 0;
+    };
+
+    typedef struct alignas(64) _WORKER_QUEUE
+    {
+        std::mutex Lock;
+        TaskRing   Tasks;
+    } WORKER_QUEUE;
+
+    bool PopLocal(size_t Index, std::function<void()>& Task)
+    {
+        WORKER_QUEUE& queue = this->queues[Index];
+        std::lock_guard<std::mutex> guard(queue.Lock);
+        if (queue.Tasks.empty())
+        {
+            return false;
+        }
+        queue.Tasks.pop_back(Task);
+        return true;
+    }
+
+    bool Steal(size_t Index, uint64_t& Random, std::function<void()>& Task)
+    {
+        // xorshift64: cheap, and distinct per worker so thieves spread out.
+        Random ^= Random << 13;
+        Random ^= Random >> 7;
+        Random ^= Random << 17;
+
+        size_t start = static_cast<size_t>(Random % this->threadCount);
+        for (size_t offset = 0; offset < this->threadCount; ++offset)
+        {
+            size_t victim = (start + offset) % this->threadCount;
+            if (victim == Index)
+            {
+                continue;
+            }
+
+            WORKER_QUEUE& queue = this->queues[victim];
+            std::unique_lock<std::mutex> guard(queue.Lock, std::try_to_lock);
+            if (!guard.owns_lock() || queue.Tasks.empty())
+            {
+                continue;
+            }
+            queue.Tasks.pop_front(Task);
+            return true;
+        }
+        return false;
+    }
+
+    void Worker(size_t Index)
+    {
+        currentPool = this;
+        currentIndex = Index;
+        uint64_t random = 0x9E3779B97F4A7C15ULL * (Index + 1);
+
+        std::function<void()> task;
+        uint32_t idle = 0;
+        while (true)
+        {
+            if (this->PopLocal(Index, task) || this->Steal(Index, random, task))
+            {
+                idle = 0;
+                this->queued.fetch_sub(1);
+                task();
+                task = nullptr;
+                if (this->unfinished.fetch_sub(1) == 1)
+                {
+                    std::lock_guard<std::mutex> guard(this->sleepLock);
+                    this->done.notify_all();
+                }
+                continue;
+            }
+
+            // Parking costs a futex round trip on both sides, so an idle worker
+            // yields a few times first in case the next push is about to land.
+            if (idle++ < IdleYields)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            idle = 0;
+
+            // A steal can miss a task behind a contended lock; `queued` is the
+            // authority on whether there is anything left to run.
+            std::unique_lock<std::mutex> lock(this->sleepLock);
+            this->sleepers.fetch_add(1);
+            this->wake.wait(lock, [this] { return this->stopping || this->queued.load() > 0; });
+            this->sleepers.fetch_sub(1);
+            if (this->stopping && this->queued.load() == 0)
+            {
+                return;
+            }
+        }
+    }
+
+    static constexpr uint32_t IdleYields = 16;
+
+    static inline thread_local const WorkStealingPool* currentPool = nullptr;
+    static inline thread_local size_t currentIndex = 0;
+
+    BS::concurrency_t               threadCount = 0;
+    std::unique_ptr<WORKER_QUEUE[]> queues;
+    std::unique_ptr<std::thread[]>  threads;
+
+    alignas(64) std::atomic<size_t>   nextQueue{ 0 };
+    alignas(64) std::atomic<int64_t>  queued{ 0 };
+    alignas(64) std::atomic<int64_t>  unfinished{ 0 };
+    std::atomic<uint32_t>             sleepers{ 0 };
+
+    std::mutex                        sleepLock;
+    std::condition_variable           wake;
+    std::condition_variable           done;
+    bool                              stopping = false;
+};
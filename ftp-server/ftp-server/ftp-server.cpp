@@ -1,12 +1,127 @@
+#include <cstdlib>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include "FtpServer.h"
-int main()
+
+// ftp-server [port] [--shards N] [--pin]
+//            [--max-sessions N] [--max-per-address N] [--queue-deadline-ms N]
+//            [--idle-timeout S] [--login-timeout S] [--stall-timeout S]
+//            [--drain-seconds S] [--handoff PATH] [--takeover PATH]
+//            [--rate-global B] [--rate-user B] [--rate-session B] [--weight USER=N]...
+//
+// Rates are in bytes per second and can be changed later with SITE RATE. --weight
+// gives USER N turns with the transfer scheduler to everyone else's one, and can
+// be changed later with SITE WEIGHT.
+// SIGINT or SIGTERM drains the server and exits; a second one cuts the drain short.
+// A server started with --takeover PATH takes the listeners and idle sessions of
+// the one running with --handoff PATH, which then drains and exits.
+int main(int argc, char* argv[])
 {
+	LISTENER_OPTIONS options;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string_view argument = argv[i];
+		if (argument == "--shards" && i + 1 < argc)
+		{
+			options.Shards = static_cast<ULONG>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--pin")
+		{
+			options.PinShards = true;
+		}
+		else if (argument == "--max-sessions" && i + 1 < argc)
+		{
+			options.Admission.MaxSessions = static_cast<ULONG>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--max-per-address" && i + 1 < argc)
+		{
+			options.Admission.MaxSessionsPerAddress = static_cast<ULONG>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--queue-deadline-ms" && i + 1 < argc)
+		{
+			options.Admission.QueueDeadlineMs = static_cast<ULONG>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--idle-timeout" && i + 1 < argc)
+		{
+			options.Timeouts.IdleSeconds = static_cast<ULONG>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--login-timeout" && i + 1 < argc)
+		{
+			options.Timeouts.LoginSeconds = static_cast<ULONG>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--stall-timeout" && i + 1 < argc)
+		{
+			options.Timeouts.DataStallSeconds = static_cast<ULONG>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--drain-seconds" && i + 1 < argc)
+		{
+			options.DrainSeconds = static_cast<ULONG>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--rate-global" && i + 1 < argc)
+		{
+			options.Rates.Global = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (argument == "--rate-user" && i + 1 < argc)
+		{
+			options.Rates.User = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (argument == "--rate-session" && i + 1 < argc)
+		{
+			options.Rates.Session = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (argument == "--weight" && i + 1 < argc)
+		{
+			std::string_view weight = argv[++i];
+			size_t separator = weight.rfind('=');
+			if (separator != std::string_view::npos)
+			{
+				options.Weights.emplace_back(weight.substr(0, separator), static_cast<ULONG>(std::strtoul(weight.data() + separator + 1, nullptr, 10)));
+			}
+		}
+		else if (argument == "--handoff" && i + 1 < argc)
+		{
+			options.HandoffPath = argv[++i];
+		}
+		else if (argument == "--takeover" && i + 1 < argc)
+		{
+			options.TakeoverPath = argv[++i];
+		}
+		else
+		{
+			options.Port = argv[i];
+		}
+	}
+
+	// Before any thread starts, so the signals are only ever taken by the waiter. A
+	// signal that arrives once Start() has returned finds no server to stop.
+	Platform::BlockStopSignals();
+	static std::mutex serverLock;
+	static FtpServer* runningServer = nullptr;
+	std::thread([]
+		{
+			while (true)
+			{
+				Platform::WaitForStopSignal();
+				std::lock_guard<std::mutex> guard(serverLock);
+				if (runningServer)
+				{
+					runningServer->RequestStop();
+				}
+			}
+		}).detach();
+
 	try
 	{
 		FtpServer ftpServer;
-		ftpServer.Start();
+		{
+			std::lock_guard<std::mutex> guard(serverLock);
+			runningServer = &ftpServer;
+		}
+		ftpServer.Start(options);
 
+		std::lock_guard<std::mutex> guard(serverLock);
+		runningServer = nullptr;
 	}
 	catch (const std::exception& exception)
 	{
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include "AllocationCounter.h"
+#include "Test.h"
+#include "TestServer.h"
+
+// Commands served by a real session, counted against this binary's global
+// operator new. The client side (a raw socket, stack buffers, EXPECT_* that only
+// allocate to report a failure) makes no allocations of its own, and nothing else
+// runs in the process, so every count is the server's. Memory that libc takes for
+// itself, such as opendir's buffer, is not operator new and does not show up.
+namespace
+{
+    typedef struct _COMMAND_CASE
+    {
+        std::string_view Line;
+        std::string_view Reply;     // expected prefix
+    } COMMAND_CASE;
+
+    // Commands that ProcessCommand turns away before a handler runs: not logged in,
+    // missing arguments and unknown verbs.
+    constexpr COMMAND_CASE Rejected[] =
+    {
+        { "LIST", "530 " },
+        { "retr missing.bin", "530 " },
+        { "PASS " HARDCODED_PASSWORD, "530 " },
+        { "USER", "501 " },
+        { "XYZ", "502 " },
+        { "A-VERY-LONG-UNKNOWN-VERB argument", "502 " },
+    };
+
+    // Control-connection commands, the ones that fail included. SITE RATE and SITE
+    // WEIGHT are configuration changes that may well allocate, so are left out.
+    constexpr COMMAND_CASE Commands[] =
+    {
+        { "USER " HARDCODED_USER, "331 " },
+        { "PASS " HARDCODED_PASSWORD, "230 " },
+        { "TYPE I", "200 " },
+        { "type a", "200 " },
+        { "OPTS UTF8 ON", "200 " },
+        { "STAT", "211-" },
+        { "STAT .", "213-" },
+        { "STAT missing-directory", "550 " },
+        { "LIST missing-directory", "550 " },
+        { "nlst ../outside", "501 " },
+        { "RETR missing.bin", "550 " },
+        { "STOR", "501 " },
+        { "PASV", "227 " },
+        { "EPSV", "229 " },
+        { "SITE STATS", "211-" },
+        { "SITE BOGUS", "504 " },
+        { "NOOP", "502 " },
+        { "A-VERY-LONG-UNKNOWN-VERB argument", "502 " },
+    };
+
+    // Each batch runs every command this many times.
+    constexpr size_t BatchRounds = 16;
+
+    // The first commands on a session thread register its logger ring and metrics
+    // shard, and the logger's flusher grows its batch buffer until it holds the
+    // largest flush it has seen. Batches run until one makes no allocations at all.
+    constexpr size_t MaxBatches = 32;
+
+    bool SendLine(SOCKET Control, std::string_view Line)
+    {
+        CHAR buffer[DEFAULT_BUFLEN];
+        if (Line.size() + 2 > sizeof(buffer))
+        {
+            return false;
+        }
+        memcpy(buffer, Line.data(), Line.size());
+        memcpy(buffer + Line.size(), "\r\n", 2);
+        return send(Control, buffer, static_cast<int>(Line.size() + 2), 0) == static_cast<int>(Line.size() + 2);
+    }
+
+    // Reads one reply, multi-line ones included, into Buffer. Returns it, or an
+    // empty view if the connection broke or the reply does not fit.
+    std::string_view ReceiveReply(SOCKET Control, CHAR* Buffer, size_t Capacity)
+    {
+        size_t length = 0;
+        size_t lineStart = 0;
+        while (length < Capacity)
+        {
+            int received = recv(Control, Buffer + length, static_cast<int>(Capacity - length), 0);
+            if (received <= 0)
+            {
+                return std::string_view();
+            }
+            length += static_cast<size_t>(received);
+
+            std::string_view text(Buffer, length);
+            for (size_t lineEnd = text.find("\r\n", lineStart); lineEnd != std::string_view::npos; lineEnd = text.find("\r\n", lineStart))
+            {
+                bool last = text.size() < 4 || text[3] != '-' ||
+                    (lineEnd - lineStart >= 4 && text.compare(lineStart, 3, text, 0, 3) == 0 && text[lineStart + 3] == ' ');
+                lineStart = lineEnd + 2;
+                if (last)
+                {
+                    return text.substr(0, lineStart);
+                }
+            }
+        }
+        return std::string_view();
+    }
+
+    // Runs Cases in batches until one makes no allocations, then expects that batch
+    // to have been it.
+    template <size_t Count>
+    void ExpectNoAllocations(SOCKET Control, const COMMAND_CASE (&Cases)[Count])
+    {
+        static CHAR reply[64 * 1024];
+        uint64_t perCommand[Count] = {};
+        uint64_t allocations = UINT64_MAX;
+        size_t batches = 0;
+        while (allocations && batches < MaxBatches)
+        {
+            ++batches;
+            std::fill(std::begin(perCommand), std::end(perCommand), 0ULL);
+            uint64_t batchStart = AllocationCounter::Allocations();
+            for (size_t round = 0; round < BatchRounds; ++round)
+            {
+                for (size_t i = 0; i < Count; ++i)
+                {
+                    uint64_t start = AllocationCounter::Allocations();
+                    ASSERT_TRUE(SendLine(Control, Cases[i].Line));
+                    ASSERT_PREFIX(ReceiveReply(Control, reply, sizeof(reply)), Cases[i].Reply);
+                    perCommand[i] += AllocationCounter::Allocations() - start;
+                }
+            }
+            allocations = AllocationCounter::Allocations() - batchStart;
+        }
+
+        // Counts are only roughly attributable to a command, as the logger's flusher
+        // and the poller run alongside, but they point at where to look.
+        if (!EXPECT_EQ(allocations, 0ULL))
+        {
+            for (size_t i = 0; i < Count; ++i)
+            {
+                if (perCommand[i])
+                {
+                    TestRegistry::Fail(__FILE__, __LINE__, std::string(Cases[i].Line) + ": " + std::to_string(perCommand[i]) +
+                        " allocations in " + std::to_string(BatchRounds) + " runs");
+                }
+            }
+        }
+    }
+
+    SOCKET ConnectSession(const TestServer& Server)
+    {
+        CHAR greeting[DEFAULT_BUFLEN];
+        SOCKET control = Server.Connect();
+        if (control != INVALID_SOCKET && !ReceiveReply(control, greeting, sizeof(greeting)).starts_with("220 "))
+        {
+            Platform::CloseSocket(control);
+            return INVALID_SOCKET;
+        }
+        return control;
+    }
+}
+
+TEST(Allocation, RejectedCommandsDoNotAllocate)
+{
+    TestServer server;
+    ASSERT_TRUE(server.IsReady());
+    SOCKET control = ConnectSession(server);
+    ASSERT_TRUE(control != INVALID_SOCKET);
+
+    ExpectNoAllocations(control, Rejected);
+    Platform::CloseSocket(control);
+}
+
+TEST(Allocation, CommandsDoNotAllocate)
+{
+    TestServer server;
+    ASSERT_TRUE(server.IsReady());
+    SOCKET control = ConnectSession(server);
+    ASSERT_TRUE(control != INVALID_SOCKET);
+
+    ExpectNoAllocations(control, Commands);
+    Platform::CloseSocket(control);
+}
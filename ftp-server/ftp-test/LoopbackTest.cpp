@@ -0,0 +1,264 @@
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include "FtpClient.hpp"
+#include "Test.h"
+#include "TestServer.h"
+
+// The server and FtpClient talking over loopback, one server per test. Files are
+// made in and served from the working directory, which CTest points at a scratch
+// directory of the suite's own.
+namespace
+{
+    // An FtpClient whose console output is kept for the test to look at.
+    struct CLIENT_SESSION
+    {
+        std::istringstream Input;
+        std::ostringstream Output;
+        std::ostringstream Error;
+        FtpClient          Client{ Input, Output, Error };
+    };
+
+    bool WriteLocalFile(const char* Path, const std::string& Content)
+    {
+        std::ofstream file(Path, std::ios::binary | std::ios::trunc);
+        return static_cast<bool>(file.write(Content.data(), static_cast<std::streamsize>(Content.size())));
+    }
+
+    std::string ReadLocalFile(const char* Path)
+    {
+        std::ifstream file(Path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    // Large enough to take several turns with the transfer scheduler.
+    std::string Payload()
+    {
+        std::string payload(300 * 1024, '\0');
+        uint32_t state = 0x2545F491U;
+        for (char& byte : payload)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            byte = static_cast<char>(state);
+        }
+        return payload;
+    }
+
+    bool LogIn(CLIENT_SESSION& Session, const TestServer& Server)
+    {
+        return Session.Client.Connect("127.0.0.1", Server.Port()) &&
+            Session.Client.SendUser(HARDCODED_USER) &&
+            Session.Client.SendPassword(HARDCODED_PASSWORD);
+    }
+
+    // Reads from a raw control connection into Replies until Text has arrived or
+    // the server closes it. False if it closed first.
+    bool ReceiveUntil(SOCKET Control, std::string& Replies, std::string_view Text)
+    {
+        CHAR buffer[DEFAULT_BUFLEN];
+        while (Text.empty() || !Replies.contains(Text))
+        {
+            int received = recv(Control, buffer, sizeof(buffer), 0);
+            if (received <= 0)
+            {
+                return false;
+            }
+            Replies.append(buffer, static_cast<size_t>(received));
+        }
+        return true;
+    }
+
+#if defined(__linux__)
+    size_t OpenDescriptors()
+    {
+        std::error_code error;
+        auto entries = std::filesystem::directory_iterator("/proc/self/fd", error);
+        return static_cast<size_t>(std::distance(entries, std::filesystem::directory_iterator()));
+    }
+#endif
+}
+
+TEST(Loopback, Login)
+{
+    TestServer server;
+    ASSERT_TRUE(server.IsReady());
+
+    CLIENT_SESSION session;
+    ASSERT_TRUE(session.Client.Connect("127.0.0.1", server.Port()));
+    EXPECT_PREFIX(session.Output.str(), "220 ");
+
+    EXPECT_PREFIX(session.Client.Quote("PASS " HARDCODED_PASSWORD), "530 ");
+    EXPECT_PREFIX(session.Client.Quote("USER " HARDCODED_USER), "331 ");
+    EXPECT_PREFIX(session.Client.Quote("PASS wrong"), "530 ");
+    EXPECT_PREFIX(session.Client.Quote("USER " HARDCODED_USER), "331 ");
+    EXPECT_PREFIX(session.Client.Quote("PASS " HARDCODED_PASSWORD), "230 ");
+    EXPECT_PREFIX(session.Client.Quote("QUIT"), "221 ");
+}
+
+TEST(Loopback, PassiveModes)
+{
+    TestServer server;
+    ASSERT_TRUE(server.IsReady());
+    CLIENT_SESSION session;
+    ASSERT_TRUE(LogIn(session, server));
+
+    EXPECT_PREFIX(session.Client.Quote("PASV"), "227 Entering Passive Mode (127,0,0,1,");
+    EXPECT_PREFIX(session.Client.Quote("EPSV"), "229 Entering Extended Passive Mode (|||");
+    EXPECT_PREFIX(session.Client.Quote("EPSV 1"), "229 Entering Extended Passive Mode (|||");
+    EXPECT_PREFIX(session.Client.Quote("EPSV ALL"), "200 ");
+    EXPECT_PREFIX(session.Client.Quote("EPSV 2"), "522 ");
+
+    // The data connection really is at the port the reply names.
+    EXPECT_TRUE(session.Client.EnterPassiveMode());
+    session.Client.ClosePassiveMode();
+    session.Client.SetExtendedPassive(true);
+    EXPECT_TRUE(session.Client.EnterPassiveMode());
+    session.Client.ClosePassiveMode();
+    session.Client.Disconnect(true);
+}
+
+TEST(Loopback, List)
+{
+    ASSERT_TRUE(WriteLocalFile("listed.txt", "listed\n"));
+    TestServer server;
+    ASSERT_TRUE(server.IsReady());
+    CLIENT_SESSION session;
+    ASSERT_TRUE(LogIn(session, server));
+
+    for (bool extended : { false, true })
+    {
+        session.Output.str(std::string());
+        session.Client.SetExtendedPassive(extended);
+        EXPECT_TRUE(session.Client.ListFiles());
+        EXPECT_TRUE(session.Output.str().contains("listed.txt"));
+    }
+    session.Client.Disconnect(true);
+}
+
+TEST(Loopback, RetrStor)
+{
+    const std::string payload = Payload();
+    ASSERT_TRUE(WriteLocalFile("payload.bin", payload));
+    TestServer server;
+    ASSERT_TRUE(server.IsReady());
+    CLIENT_SESSION session;
+    ASSERT_TRUE(LogIn(session, server));
+    ASSERT_TRUE(session.Client.SetTransferMode(true));
+
+    for (bool extended : { false, true })
+    {
+        session.Client.SetExtendedPassive(extended);
+        EXPECT_TRUE(session.Client.DownloadFile("payload.bin", "downloaded.bin"));
+        EXPECT_TRUE(ReadLocalFile("downloaded.bin") == payload);
+        EXPECT_TRUE(session.Client.UploadFile("payload.bin", "uploaded.bin"));
+        EXPECT_TRUE(ReadLocalFile("uploaded.bin") == payload);
+    }
+    session.Client.Disconnect(true);
+}
+
+#if !defined(_WIN32)
+// A directory opens like a file here but fails the first read, which stands in for
+// a disk error partway through a download.
+TEST(Loopback, RetrReadFailure)
+{
+    std::filesystem::create_directory("unreadable");
+    {
+        TestServer server;
+        ASSERT_TRUE(server.IsReady());
+        CLIENT_SESSION session;
+        ASSERT_TRUE(LogIn(session, server));
+
+        EXPECT_TRUE(!session.Client.DownloadFile("unreadable", "downloaded.bin"));
+        EXPECT_TRUE(session.Error.str().contains("Server response: 451 "));
+        session.Client.Disconnect(true);
+    }
+
+    // The server has stopped, so its xferlog is flushed. It names the file by its
+    // absolute path.
+    std::string path = (std::filesystem::current_path() / "unreadable").string();
+    std::string xferlog = ReadLocalFile("xferlog");
+    EXPECT_TRUE(xferlog.ends_with(" " + path + " a _ o r " HARDCODED_USER " ftp 0 * i\n"));
+}
+#endif
+
+// The server stops while a download waits for its data connection: the client is
+// cut off after its 150, and the file the server opened is closed all the same.
+TEST(Loopback, DrainBetweenRetrAndTransfer)
+{
+    ASSERT_TRUE(WriteLocalFile("payload.bin", Payload()));
+#if defined(__linux__)
+    size_t descriptors = OpenDescriptors();
+#endif
+    std::string replies;
+    SOCKET control = INVALID_SOCKET;
+    {
+        TestServer server;
+        ASSERT_TRUE(server.IsReady());
+        control = server.Connect();
+        ASSERT_TRUE(control != INVALID_SOCKET);
+
+        const std::string_view commands = "USER " HARDCODED_USER "\r\nPASS " HARDCODED_PASSWORD "\r\nPASV\r\nRETR payload.bin\r\n";
+        EXPECT_EQ(send(control, commands.data(), static_cast<int>(commands.size()), 0), static_cast<int>(commands.size()));
+        EXPECT_TRUE(ReceiveUntil(control, replies, "\r\n150 "));
+    }
+
+    EXPECT_TRUE(!ReceiveUntil(control, replies, std::string_view()));
+    Platform::CloseSocket(control);
+    EXPECT_TRUE(!replies.contains("\r\n226 "));
+#if defined(__linux__)
+    EXPECT_EQ(OpenDescriptors(), descriptors);
+#endif
+}
+
+TEST(Loopback, Stat)
+{
+    ASSERT_TRUE(WriteLocalFile("listed.txt", "listed\n"));
+    TestServer server;
+    ASSERT_TRUE(server.IsReady());
+    CLIENT_SESSION session;
+    ASSERT_TRUE(LogIn(session, server));
+
+    std::string reply = session.Client.Quote("STAT");
+    EXPECT_PREFIX(reply, "211-FTP server status:\r\n");
+    EXPECT_TRUE(reply.contains(" Logged in as " HARDCODED_USER "\r\n"));
+    EXPECT_TRUE(reply.ends_with("\r\n211 End of status\r\n"));
+
+    reply = session.Client.Quote("STAT .");
+    EXPECT_PREFIX(reply, "213-Status of .:\r\n");
+    EXPECT_TRUE(reply.contains("listed.txt"));
+    EXPECT_TRUE(reply.ends_with("\r\n213 End of status\r\n"));
+    session.Client.Disconnect(true);
+}
+
+TEST(Loopback, ErrorReplies)
+{
+    TestServer server;
+    ASSERT_TRUE(server.IsReady());
+    CLIENT_SESSION session;
+    ASSERT_TRUE(session.Client.Connect("127.0.0.1", server.Port()));
+
+    EXPECT_PREFIX(session.Client.Quote("LIST"), "530 ");
+    EXPECT_PREFIX(session.Client.Quote("USER"), "501 ");
+    EXPECT_PREFIX(session.Client.Quote("XYZ"), "502 ");
+    ASSERT_TRUE(session.Client.SendUser(HARDCODED_USER));
+    ASSERT_TRUE(session.Client.SendPassword(HARDCODED_PASSWORD));
+
+    EXPECT_PREFIX(session.Client.Quote("RETR missing.bin"), "550 ");
+    EXPECT_PREFIX(session.Client.Quote("RETR"), "501 ");
+    EXPECT_PREFIX(session.Client.Quote("STOR"), "501 ");
+    EXPECT_PREFIX(session.Client.Quote("TYPE X"), "501 ");
+    EXPECT_PREFIX(session.Client.Quote("PORT 127,0,0,1,4,1garbage"), "501 ");
+    EXPECT_PREFIX(session.Client.Quote("PORT 127,0,0,1,4,1,2"), "501 ");
+    EXPECT_PREFIX(session.Client.Quote("STAT missing-directory"), "550 ");
+    EXPECT_PREFIX(session.Client.Quote("STAT ../outside"), "501 ");
+    EXPECT_PREFIX(session.Client.Quote("SITE BOGUS"), "504 ");
+    EXPECT_PREFIX(session.Client.Quote("OPTS BOGUS"), "501 ");
+    EXPECT_PREFIX(session.Client.Quote("NOOP"), "502 ");
+    session.Client.Disconnect(true);
+}
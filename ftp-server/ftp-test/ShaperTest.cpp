@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "BandwidthShaper.h"
+#include "Test.h"
+
+// How exactly the shaper holds rates from 1 MB/s to 1 GB/s. Time is simulated: a
+// flow moves its credit the moment it has it, and a flow told to wait sleeps until
+// WakeAt rounded up to the server's 100 ms timer tick, the way a paused transfer
+// waits in its shard's timer wheel. Bytes are counted over 10 s after a 1 s warm-up,
+// so the buckets' initial burst is left out.
+namespace
+{
+    typedef BandwidthShaper::Clock Clock;
+
+    constexpr auto Tick = std::chrono::milliseconds(100);
+    constexpr auto Warmup = std::chrono::seconds(1);
+    constexpr auto Measured = std::chrono::seconds(10);
+
+    constexpr uint64_t MBps = 1000ULL * 1000ULL;
+    constexpr uint64_t GBps = 1000ULL * MBps;
+
+    constexpr uint64_t Rates[] = { MBps, 10 * MBps, 100 * MBps, GBps };
+
+    // How far the measured rate may be from the one that should bind. The shaper
+    // holds every rate here to well under a tenth of that.
+    constexpr double MaxErrorPercent = 1.0;
+
+    typedef struct _SIMULATED_FLOW
+    {
+        SHAPED_FLOW       Flow;
+        ULONG             User = 0;
+        Clock::time_point Next;
+    } SIMULATED_FLOW;
+
+    // Bytes each user moved in the measured window.
+    std::vector<uint64_t> Simulate(const SHAPING_RATES& Rates, ULONG Users, ULONG FlowsPerUser)
+    {
+        BandwidthShaper shaper;
+        shaper.SetRates(Rates);
+
+        auto start = Clock::now();
+        auto measureFrom = start + Warmup;
+        auto end = measureFrom + Measured;
+        std::vector<SIMULATED_FLOW> flows(Users * FlowsPerUser);
+        for (size_t i = 0; i < flows.size(); ++i)
+        {
+            flows[i].User = static_cast<ULONG>(i % Users);
+            flows[i].Next = start;
+            shaper.Attach(flows[i].Flow, "user" + std::to_string(flows[i].User));
+        }
+
+        std::vector<uint64_t> bytes(Users, 0);
+        while (true)
+        {
+            SIMULATED_FLOW& flow = *std::min_element(flows.begin(), flows.end(), [](const SIMULATED_FLOW& Left, const SIMULATED_FLOW& Right) { return Left.Next < Right.Next; });
+            auto now = flow.Next;
+            if (now >= end)
+            {
+                break;
+            }
+
+            Clock::time_point wakeAt;
+            while (shaper.Replenish(flow.Flow, now, wakeAt))
+            {
+                if (now >= measureFrom)
+                {
+                    bytes[flow.User] += static_cast<uint64_t>(flow.Flow.Grant);
+                }
+                BandwidthShaper::Spend(flow.Flow, static_cast<size_t>(flow.Flow.Grant));
+            }
+            auto ticks = (wakeAt - start + Tick - Clock::duration(1)) / Tick;
+            flow.Next = start + ticks * Tick;
+        }
+        return bytes;
+    }
+
+    // Checks the aggregate against Expected, and that no user went over UserRate.
+    void ExpectRate(const std::vector<uint64_t>& Bytes, uint64_t Expected, uint64_t UserRate)
+    {
+        double seconds = std::chrono::duration<double>(Measured).count();
+        uint64_t total = 0;
+        for (uint64_t userBytes : Bytes)
+        {
+            total += userBytes;
+            if (UserRate)
+            {
+                EXPECT_LE(static_cast<double>(userBytes) / seconds, static_cast<double>(UserRate) * (1.0 + MaxErrorPercent / 100.0));
+            }
+        }
+        double errorPercent = (static_cast<double>(total) / seconds - static_cast<double>(Expected)) / static_cast<double>(Expected) * 100.0;
+        EXPECT_LE(std::abs(errorPercent), MaxErrorPercent);
+    }
+}
+
+// One transfer held to its session rate.
+TEST(Shaper, SessionRate)
+{
+    for (uint64_t rate : Rates)
+    {
+        ExpectRate(Simulate({ .Session = rate }, 1, 1), rate, 0);
+    }
+}
+
+// Two users with four transfers each, every user held to the rate and nothing
+// else: the aggregate is twice the user rate.
+TEST(Shaper, UserRate)
+{
+    for (uint64_t rate : Rates)
+    {
+        ExpectRate(Simulate({ .User = rate }, 2, 4), 2 * rate, rate);
+    }
+}
+
+// All three levels: four transfers could take half the uplink each, a user's
+// transfers could take half of it together, and three users share the global
+// rate, which binds.
+TEST(Shaper, Hierarchy)
+{
+    for (uint64_t rate : Rates)
+    {
+        ExpectRate(Simulate({ .Global = rate, .User = rate / 2, .Session = rate / 2 }, 3, 4), rate, rate / 2);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <sstream>
+#include <string>
+#include <string_view>
+
+// A small harness in the same spirit as ftp-bench's: tests are free functions
+// declared with TEST(Suite, Name). EXPECT_* record a failure and carry on; ASSERT_*
+// also return from the test. `ftp-test Suite` runs one suite, which is how CTest
+// runs each in a process (and a scratch directory) of its own.
+class TestRegistry
+{
+public:
+    typedef void (*TEST_ROUTINE)();
+
+    static int Register(const char* Suite, const char* Name, TEST_ROUTINE Routine);
+    static void Fail(const char* File, int Line, const std::string& Message);
+
+    // Runs every test in Suite (all of them if it is empty); returns the number that
+    // failed, or -1 if none matched.
+    static int RunAll(const std::string& Suite);
+};
+
+template <typename Actual, typename Expected, typename Compare>
+bool ExpectCompare(const Actual& Left, const Expected& Right, Compare Compared, const char* Operator, const char* Text, const char* File, int Line)
+{
+    if (Compared(Left, Right))
+    {
+        return true;
+    }
+
+    std::ostringstream message;
+    message << Text << ": " << Left << " " << Operator << " " << Right << " does not hold";
+    TestRegistry::Fail(File, Line, message.str());
+    return false;
+}
+
+inline bool ExpectPrefix(std::string_view Text, std::string_view Prefix, const char* Expression, const char* File, int Line)
+{
+    if (Text.starts_with(Prefix))
+    {
+        return true;
+    }
+
+    std::ostringstream message;
+    message << Expression << ": \"" << Text << "\" does not start with \"" << Prefix << "\"";
+    TestRegistry::Fail(File, Line, message.str());
+    return false;
+}
+
+#define TEST(Suite, Name) \
+    static void Suite##_##Name(); \
+    static const int Suite##_##Name##_registration = TestRegistry::Register(#Suite, #Name, Suite##_##Name); \
+    static void Suite##_##Name()
+
+#define EXPECT_TRUE(Condition) \
+    ((Condition) ? true : (TestRegistry::Fail(__FILE__, __LINE__, #Condition), false))
+#define EXPECT_EQ(Left, Right) \
+    ExpectCompare((Left), (Right), [](const auto& a, const auto& b) { return a == b; }, "==", #Left, __FILE__, __LINE__)
+#define EXPECT_LE(Left, Right) \
+    ExpectCompare((Left), (Right), [](const auto& a, const auto& b) { return a <= b; }, "<=", #Left, __FILE__, __LINE__)
+#define EXPECT_PREFIX(Text, Prefix) \
+    ExpectPrefix((Text), (Prefix), #Text, __FILE__, __LINE__)
+
+#define ASSERT_TRUE(Condition) do { if (!EXPECT_TRUE(Condition)) return; } while (0)
+#define ASSERT_EQ(Left, Right) do { if (!EXPECT_EQ(Left, Right)) return; } while (0)
+#define ASSERT_PREFIX(Text, Prefix) do { if (!EXPECT_PREFIX(Text, Prefix)) return; } while (0)
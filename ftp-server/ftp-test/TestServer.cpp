@@ -0,0 +1,86 @@
+#include <chrono>
+#include "TestServer.h"
+
+#define TEST_SERVER_START_MS    5000
+#define TEST_SERVER_RETRY_MS    10
+
+namespace
+{
+    // Asks the stack for a free port. Another process could take it before the
+    // server binds it, which only shows up as a test that fails to start.
+    std::string FreePort()
+    {
+        SOCKET probe = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (probe == INVALID_SOCKET)
+        {
+            return std::string();
+        }
+
+        SOCKADDR_IN address = { .sin_family = AF_INET, .sin_port = 0, .sin_addr = {} };
+        socklen_t addressSize = sizeof(address);
+        std::string port;
+        if (bind(probe, reinterpret_cast<PSOCKADDR>(&address), sizeof(address)) != SOCKET_ERROR &&
+            getsockname(probe, reinterpret_cast<PSOCKADDR>(&address), &addressSize) != SOCKET_ERROR)
+        {
+            port = std::to_string(ntohs(address.sin_port));
+        }
+        Platform::CloseSocket(probe);
+        return port;
+    }
+}
+
+TestServer::TestServer(LISTENER_OPTIONS Options) : port(FreePort())
+{
+    if (this->port.empty())
+    {
+        return;
+    }
+
+    Options.Port = this->port.c_str();
+    Options.DrainSeconds = 1;
+    this->thread = std::thread([this, Options] { this->server.Start(Options); });
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TEST_SERVER_START_MS);
+    while (!this->ready && std::chrono::steady_clock::now() < deadline)
+    {
+        SOCKET probe = this->Connect();
+        if (probe == INVALID_SOCKET)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(TEST_SERVER_RETRY_MS));
+            continue;
+        }
+
+        // Wait for the greeting, so the server has finished with the probe before
+        // a test starts to measure anything.
+        CHAR greeting[DEFAULT_BUFLEN];
+        this->ready = recv(probe, greeting, sizeof(greeting), 0) > 0;
+        Platform::CloseSocket(probe);
+    }
+}
+
+TestServer::~TestServer()
+{
+    if (this->thread.joinable())
+    {
+        this->server.RequestStop();
+        this->thread.join();
+    }
+}
+
+SOCKET TestServer::Connect() const
+{
+    SOCKET control = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (control == INVALID_SOCKET)
+    {
+        return INVALID_SOCKET;
+    }
+
+    SOCKADDR_IN address = { .sin_family = AF_INET, .sin_port = htons(static_cast<USHORT>(std::stoul(this->port))), .sin_addr = {} };
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    if (connect(control, reinterpret_cast<PSOCKADDR>(&address), sizeof(address)) == SOCKET_ERROR)
+    {
+        Platform::CloseSocket(control);
+        return INVALID_SOCKET;
+    }
+    return control;
+}
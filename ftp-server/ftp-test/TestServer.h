@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <thread>
+#include "FtpServer.h"
+
+// An FtpServer running on a thread of its own, listening on a free port and serving
+// the current directory, for as long as the object lives.
+class TestServer
+{
+public:
+    explicit TestServer(LISTENER_OPTIONS Options = LISTENER_OPTIONS());
+    ~TestServer();
+
+    TestServer(const TestServer& Other) = delete;
+    TestServer& operator=(const TestServer& Other) = delete;
+
+    // False if the server did not start accepting connections.
+    bool IsReady() const
+    {
+        return this->ready;
+    }
+
+    const std::string& Port() const
+    {
+        return this->port;
+    }
+
+    // A blocking control connection to the server, or INVALID_SOCKET.
+    SOCKET Connect() const;
+
+private:
+    std::string port;
+    bool        ready = false;
+    FtpServer   server;
+    std::thread thread;
+};
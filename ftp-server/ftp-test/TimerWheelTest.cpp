@@ -0,0 +1,91 @@
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include "Test.h"
+#include "TimerWheel.h"
+
+// The idle timers of 100k parked sessions, driven the way a shard's poller drives
+// them: every 100 ms tick expires what is due, re-arms it (the session sent another
+// command) and works out how long to sleep. Time is simulated, so ten minutes of it
+// take a few milliseconds, and the assertion is on the wheel's own cost per tick.
+namespace
+{
+    constexpr auto Tick = std::chrono::milliseconds(100);
+    constexpr auto IdleTimeout = std::chrono::seconds(300);
+    constexpr uint64_t Sessions = 100000;
+    constexpr uint64_t Ticks = 6000;
+
+    // Share of one core the wheel may take at this tick rate. A release build needs
+    // a few thousandths of a percent.
+    constexpr double MaxCpuPercent = 0.1;
+
+    typedef struct _IDLE_SESSION
+    {
+        TIMER                         Timer;
+        TimerWheel::Clock::time_point Deadline;
+        uint32_t                      Fired = 0;
+        uint32_t                      Early = 0;
+        uint32_t                      Late = 0;
+    } IDLE_SESSION;
+}
+
+TEST(TimerWheel, IdleTimersAtScale)
+{
+    auto start = TimerWheel::Clock::now();
+    TimerWheel wheel(Tick, start);
+    std::unique_ptr<IDLE_SESSION[]> sessions = std::make_unique<IDLE_SESSION[]>(Sessions);
+
+    // Deadlines spread evenly over the first timeout, as they are once a server has
+    // been up for a while.
+    auto spread = std::chrono::duration_cast<std::chrono::milliseconds>(IdleTimeout).count();
+    for (uint64_t i = 0; i < Sessions; ++i)
+    {
+        IDLE_SESSION& session = sessions[i];
+        session.Timer.Context = &session;
+        session.Deadline = start + std::chrono::milliseconds(static_cast<int64_t>(i * spread / Sessions) + 1);
+        wheel.Schedule(session.Timer, session.Deadline);
+    }
+    ASSERT_EQ(wheel.Count(), static_cast<size_t>(Sessions));
+
+    auto now = start;
+    uint64_t fired = 0;
+    uint64_t sleepTotal = 0;
+    auto measured = std::chrono::steady_clock::now();
+    for (uint64_t tick = 0; tick < Ticks; ++tick)
+    {
+        now += Tick;
+        fired += wheel.Expire(now, [&wheel, now](TIMER& Timer)
+            {
+                IDLE_SESSION& session = *static_cast<IDLE_SESSION*>(Timer.Context);
+                ++session.Fired;
+                session.Early += now < session.Deadline;
+                session.Late += now - session.Deadline >= Tick;
+                session.Deadline = now + IdleTimeout;
+                wheel.Schedule(Timer, session.Deadline);
+            });
+        sleepTotal += wheel.MillisecondsUntilNext(now);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - measured).count();
+
+    // Ten minutes is two timeouts: every timer fires twice, within the tick its
+    // deadline falls in, and is armed again.
+    uint64_t early = 0;
+    uint64_t late = 0;
+    uint64_t missed = 0;
+    for (uint64_t i = 0; i < Sessions; ++i)
+    {
+        early += sessions[i].Early;
+        late += sessions[i].Late;
+        missed += sessions[i].Fired != 2;
+    }
+    EXPECT_EQ(fired, 2 * Sessions);
+    EXPECT_EQ(early, 0ULL);
+    EXPECT_EQ(late, 0ULL);
+    EXPECT_EQ(missed, 0ULL);
+    EXPECT_EQ(wheel.Count(), static_cast<size_t>(Sessions));
+    EXPECT_LE(sleepTotal, Ticks * static_cast<uint64_t>(Tick.count()));
+
+    double perTick = static_cast<double>(elapsed) / static_cast<double>(Ticks);
+    double cpuPercent = perTick / static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(Tick).count()) * 100.0;
+    EXPECT_LE(cpuPercent, MaxCpuPercent);
+}
@@ -0,0 +1,75 @@
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include "Test.h"
+
+namespace
+{
+    struct REGISTERED_TEST
+    {
+        const char*                Suite;
+        const char*                Name;
+        TestRegistry::TEST_ROUTINE Routine;
+    };
+
+    std::vector<REGISTERED_TEST>& Tests()
+    {
+        static std::vector<REGISTERED_TEST> tests;
+        return tests;
+    }
+
+    int failures = 0;
+}
+
+int TestRegistry::Register(const char* Suite, const char* Name, TEST_ROUTINE Routine)
+{
+    Tests().push_back({ Suite, Name, Routine });
+    return static_cast<int>(Tests().size());
+}
+
+void TestRegistry::Fail(const char* File, int Line, const std::string& Message)
+{
+    std::printf("%s:%d: %s\n", File, Line, Message.c_str());
+    std::fflush(stdout);
+    ++failures;
+}
+
+int TestRegistry::RunAll(const std::string& Suite)
+{
+    int ran = 0;
+    int failed = 0;
+    for (const REGISTERED_TEST& test : Tests())
+    {
+        if (!Suite.empty() && Suite != test.Suite)
+        {
+            continue;
+        }
+
+        std::printf("[ RUN      ] %s.%s\n", test.Suite, test.Name);
+        std::fflush(stdout);
+        int before = failures;
+        test.Routine();
+        bool passed = failures == before;
+        std::printf("[ %8s ] %s.%s\n", passed ? "OK" : "FAILED", test.Suite, test.Name);
+        std::fflush(stdout);
+        failed += !passed;
+        ++ran;
+    }
+
+    return ran ? failed : -1;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string suite = argc > 1 ? argv[1] : "";
+
+    int failed = TestRegistry::RunAll(suite);
+    if (failed < 0)
+    {
+        std::cout << "No test suite '" << suite << "'" << std::endl;
+        return 1;
+    }
+
+    std::cout << failed << " test(s) failed" << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Tracing.h"
+
+// Converts a trace dumped with SITE TRACE DUMP into Chrome trace JSON
+// (chrome://tracing, Perfetto). Every transfer becomes one span on its worker
+// thread, with a child span for each phase.
+namespace
+{
+    constexpr const char* PhaseSpans[] =
+    {
+        "data_connection",  // CommandReceived -> DataSocketReady
+        "first_byte",       // DataSocketReady -> FirstByte
+        "transfer",         // FirstByte -> LastByte
+        "reply",            // LastByte -> ReplySent
+    };
+    static_assert(std::size(PhaseSpans) == static_cast<size_t>(TRACE_PHASE::MaxTracePhase) - 1, "one span between each pair of phases");
+
+    bool ReadTrace(const char* Path, std::vector<TRACE_RECORD>& Records)
+    {
+        std::ifstream file(Path, std::ios::binary);
+        if (!file)
+        {
+            std::cerr << "Cannot open " << Path << std::endl;
+            return false;
+        }
+
+        TRACE_FILE_HEADER header;
+        bool valid = file.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+            !std::memcmp(header.Magic, TRACE_FILE_MAGIC, sizeof(header.Magic)) &&
+            header.Version == TRACE_FILE_VERSION &&
+            header.RecordSize == sizeof(TRACE_RECORD);
+        if (valid)
+        {
+            Records.resize(static_cast<size_t>(header.RecordCount));
+            valid = static_cast<bool>(file.read(reinterpret_cast<char*>(Records.data()), static_cast<std::streamsize>(Records.size() * sizeof(TRACE_RECORD))));
+        }
+
+        if (!valid)
+        {
+            std::cerr << Path << " is not a version " << TRACE_FILE_VERSION << " transfer trace" << std::endl;
+        }
+        return valid;
+    }
+
+    void WriteSpan(std::ostream& Out, bool& First, const char* Name, const std::string& Category, uint32_t Thread, uint64_t Start, uint64_t End, uint64_t Origin, uint64_t TransferId, uint64_t Bytes)
+    {
+        char event[512];
+        std::snprintf(event, sizeof(event), "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"transfer\":%llu,\"bytes\":%llu}}",
+            First ? "" : ",",
+            Name,
+            Category.c_str(),
+            Thread,
+            static_cast<double>(Start - Origin) / 1000.0,
+            static_cast<double>(End - Start) / 1000.0,
+            static_cast<unsigned long long>(TransferId),
+            static_cast<unsigned long long>(Bytes));
+        Out << event;
+        First = false;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const char* input = argc > 1 ? argv[1] : TRACE_DEFAULT_FILE;
+    const char* output = argc > 2 ? argv[2] : nullptr;
+
+    std::vector<TRACE_RECORD> records;
+    if (!ReadTrace(input, records))
+    {
+        return 1;
+    }
+
+    std::sort(records.begin(), records.end(), [](const TRACE_RECORD& a, const TRACE_RECORD& b)
+        {
+            return a.TransferId != b.TransferId ? a.TransferId < b.TransferId : a.Phase < b.Phase;
+        });
+
+    uint64_t origin = UINT64_MAX;
+    for (const TRACE_RECORD& record : records)
+    {
+        origin = std::min(origin, record.Timestamp);
+    }
+
+    std::ofstream file;
+    if (output)
+    {
+        file.open(output);
+        if (!file)
+        {
+            std::cerr << "Cannot open " << output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = output ? file : std::cout;
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    size_t transfers = 0;
+    for (size_t begin = 0; begin < records.size();)
+    {
+        size_t end = begin;
+        while (end < records.size() && records[end].TransferId == records[begin].TransferId)
+        {
+            ++end;
+        }
+
+        // A ring may have overwritten the start of a transfer; only complete ones are shown.
+        const TRACE_RECORD& head = records[begin];
+        if (head.Phase == TRACE_PHASE::CommandReceived && end - begin > 1)
+        {
+            const TRACE_RECORD& tail = records[end - 1];
+            std::string command(CommandName(head.Command));
+            WriteSpan(out, first, command.c_str(), "transfer", head.ThreadId, head.Timestamp, tail.Timestamp, origin, head.TransferId, tail.Bytes);
+            for (size_t i = begin + 1; i < end; ++i)
+            {
+                const TRACE_RECORD& from = records[i - 1];
+                const TRACE_RECORD& to = records[i];
+                WriteSpan(out, first, PhaseSpans[static_cast<size_t>(to.Phase) - 1], command, to.ThreadId, from.Timestamp, to.Timestamp, origin, to.TransferId, to.Bytes);
+            }
+            ++transfers;
+        }
+        begin = end;
+    }
+    out << "\n]}\n";
+
+    std::cerr << "Exported " << transfers << " transfers from " << records.size() << " records" << std::endl;
+    return 0;
+}
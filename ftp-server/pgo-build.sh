@@ -0,0 +1,89 @@
+#!/usr/bin/env bash
+# Profile-guided build of ftp-server with GCC or Clang.
+#
+#   ./pgo-build.sh [build-dir] [seconds-per-run]
+#
+# 1. builds a plain Release tree (baseline) and an instrumented ftp-server,
+# 2. trains the instrumented server with `ftp-load --scenario training` over loopback,
+# 3. rebuilds ftp-server in the same tree with the collected profile,
+# 4. runs the same scenario against the baseline and PGO servers and compares
+#    commands per second.
+#
+# FTP_PGO_PORT picks the listening port (default 2121). The metrics endpoint
+# is fixed, so only one server runs at a time.
+set -euo pipefail
+
+SOURCE_DIR=$(cd "$(dirname "$0")" && pwd)
+BUILD_DIR=$(mkdir -p "${1:-$SOURCE_DIR/build-pgo}" && cd "${1:-$SOURCE_DIR/build-pgo}" && pwd)
+RUN_SECONDS=${2:-10}
+PORT=${FTP_PGO_PORT:-2121}
+PROFILE_DIR=$BUILD_DIR/profile
+JOBS=$(nproc 2>/dev/null || echo 4)
+
+LOAD=$BUILD_DIR/baseline/ftp-load
+SERVER_PID=
+
+stop_server() {
+    if [[ -n $SERVER_PID ]]; then
+        kill -TERM "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+        SERVER_PID=
+    fi
+}
+trap stop_server EXIT
+
+# Starts $1 in a fresh root directory and waits until it accepts connections.
+start_server() {
+    local root=$BUILD_DIR/root-$2
+    rm -rf "$root" && mkdir -p "$root"
+    (cd "$root" && exec "$1" "$PORT" > server.log 2>&1) &
+    SERVER_PID=$!
+    for _ in $(seq 100); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$PORT") 2>/dev/null; then
+            return
+        fi
+        sleep 0.1
+    done
+    echo "ftp-server did not start, see $root/server.log" >&2
+    exit 1
+}
+
+# Runs the training scenario against $1 and prints its commands per second.
+measure() {
+    start_server "$1" "$2"
+    "$LOAD" --port "$PORT" --scenario training --seconds "$RUN_SECONDS" > "$BUILD_DIR/load-$2.txt"
+    stop_server
+    sed -n 's/.*commands_per_second=\([0-9.]*\).*/\1/p' "$BUILD_DIR/load-$2.txt"
+}
+
+echo "== baseline build"
+cmake -S "$SOURCE_DIR" -B "$BUILD_DIR/baseline" -DCMAKE_BUILD_TYPE=Release -DFTP_PGO=OFF > /dev/null
+cmake --build "$BUILD_DIR/baseline" -j"$JOBS"
+
+echo "== instrumented build"
+rm -rf "$PROFILE_DIR"
+cmake -S "$SOURCE_DIR" -B "$BUILD_DIR/pgo" -DCMAKE_BUILD_TYPE=Release -DFTP_PGO=GENERATE -DFTP_PGO_PROFILE_DIR="$PROFILE_DIR" > /dev/null
+cmake --build "$BUILD_DIR/pgo" --target ftp-server -j"$JOBS"
+
+echo "== training"
+measure "$BUILD_DIR/pgo/ftp-server" training > /dev/null
+cat "$BUILD_DIR/load-training.txt"
+if compgen -G "$PROFILE_DIR/*.profraw" > /dev/null; then
+    llvm-profdata merge -output="$PROFILE_DIR/default.profdata" "$PROFILE_DIR"/*.profraw
+elif ! find "$PROFILE_DIR" -name '*.gcda' | grep -q .; then
+    echo "no profile was written to $PROFILE_DIR" >&2
+    exit 1
+fi
+
+echo "== optimized build"
+cmake -S "$SOURCE_DIR" -B "$BUILD_DIR/pgo" -DFTP_PGO=USE > /dev/null
+cmake --build "$BUILD_DIR/pgo" --target ftp-server -j"$JOBS"
+
+echo "== comparison (${RUN_SECONDS}s of --scenario training each)"
+BASELINE=$(measure "$BUILD_DIR/baseline/ftp-server" baseline)
+OPTIMIZED=$(measure "$BUILD_DIR/pgo/ftp-server" optimized)
+awk -v base="$BASELINE" -v pgo="$OPTIMIZED" 'BEGIN {
+    printf "baseline  commands_per_second=%.1f\n", base
+    printf "pgo       commands_per_second=%.1f\n", pgo
+    printf "speedup   %+.1f%%\n", (pgo / base - 1) * 100
+}'